@@ -584,6 +584,12 @@ gboolean b_core_client_write_metadata(BCoreClient *self, const gchar *uri, const
  *
  * @brief Query for metadata based on a uri pattern
  *
+ * A uri without '*' is looked up as is.  In a pattern, '*' matches any run of characters, including '/',
+ * every other character matches itself, and the pattern must match the whole uri.  For example, a device
+ * uri followed by "/ep/" and a '*' finds everything on the device's endpoints.  A pattern that also contains
+ * one of . [ ] ^ $ \ is treated as a POSIX basic regular expression in which each '*' stands for ".*", and
+ * it too must match the whole uri.
+ *
  * Returns: (element-type utf8) (transfer full): GList* - a list of metadata with the given uri, or NULL if not found.
  */
 GList *b_core_client_get_metadata_by_uri(BCoreClient *self, gchar *uriPattern);
@@ -608,6 +614,9 @@ gchar *b_core_client_read_metadata(BCoreClient *self, const gchar *uri, GError *
  *
  * @brief Get a list of resources that match the URI.
  *
+ * A uri without '*' is looked up as is, otherwise the pattern syntax is the same as for
+ * b_core_client_get_metadata_by_uri().
+ *
  * Returns: (element-type BCoreResource) (transfer full): GList* - a list of resources that match the URI
  * pattern.
  */
@@ -42,6 +42,14 @@ typedef enum
     CACHING_POLICY_ALWAYS, // Always cache this attribute and never call the device driver to retrieve the value
 } ResourceCachingPolicy;
 
+typedef enum
+{
+    PERSISTENCE_POLICY_ALWAYS,      // Write every change to storage (RESOURCE_MODE_LAZY_SAVE_NEXT still applies)
+    PERSISTENCE_POLICY_COALESCE,    // Write changes at most once per persistIntervalSecs
+    PERSISTENCE_POLICY_MEMORY_ONLY, // Changes never cause a write, they are stored only along with other changes
+    PERSISTENCE_POLICY_ON_SHUTDOWN, // Keep changes in memory until the device is next saved or the database is closed
+} ResourcePersistencePolicy;
+
 typedef struct
 {
     char *id;
@@ -54,6 +62,8 @@ typedef struct
     ResourceCachingPolicy cachingPolicy;
     uint64_t dateOfLastSyncMillis; // GMT epoch based time when this resource was last read from or written to the
                                    // device.  0 for never.
+    ResourcePersistencePolicy persistencePolicy;
+    uint32_t persistIntervalSecs; // for PERSISTENCE_POLICY_COALESCE
 
 } icDeviceResource;
 
@@ -67,6 +77,35 @@ inline void resourceDestroy__auto(icDeviceResource **resource)
 
 void resourcePrint(icDeviceResource *resource, const char *prefix);
 
+/**
+ * Declare how changes to a resource are written to storage.  Drivers set this when creating the
+ * resource to override its default, it is not changed by saving the resource afterwards.
+ *
+ * @param resource the resource, may be NULL
+ * @param policy the persistence policy
+ * @param intervalSecs for PERSISTENCE_POLICY_COALESCE, the longest a change may wait to be written
+ */
+void resourceSetPersistencePolicy(icDeviceResource *resource, ResourcePersistencePolicy policy, uint32_t intervalSecs);
+
+/**
+ * Give a resource the persistence policy its kind of data has unless a driver declares another one.
+ * High frequency telemetry (link rssi/lqi, power readings and dateLastContacted) does not get a write
+ * of its own.  New resources get their default when created, and stored resources without a policy
+ * get it when loaded, so devices paired before the policy existed are covered too.
+ *
+ * @param resource the resource, may be NULL
+ */
+void resourceApplyDefaultPersistencePolicy(icDeviceResource *resource);
+
+/**
+ * Check whether a resource still has the persistence policy resourceApplyDefaultPersistencePolicy
+ * would give it.  Such policies are not stored, so a later change of default applies to them.
+ *
+ * @param resource the resource
+ * @return true if the policy and interval are the defaults for the resource
+ */
+bool resourceHasDefaultPersistencePolicy(const icDeviceResource *resource);
+
 /**
  * Clone a device resource object
  *
@@ -183,6 +183,17 @@ icDevice *deviceServiceGetDevice(const char *uuid);
  */
 bool deviceServiceIsDeviceKnown(const char *uuid);
 
+/*
+ * Retrieve the device class of a device without retrieving the whole device.
+ *
+ * Caller is responsible for freeing the non-NULL result.
+ *
+ * @param uuid - the device's universally unique identifier
+ *
+ * @returns the device class or NULL if the device is not found
+ */
+char *deviceServiceGetDeviceClass(const char *uuid);
+
 /*
  * Check if the provided device uuid is denylisted by CPE property.
  *
@@ -352,6 +363,72 @@ bool deviceServiceChangeResourceMode(const char *uri, uint8_t newMode);
  */
 bool deviceServiceGetSystemProperty(const char *name, char **value);
 
+/*
+ * Retrieve a device service system property as a boolean. Values are cached and parsed only when
+ * they change, so this is cheap enough for hot paths.
+ *
+ * @param name - the name of the property to retrieve
+ * @param defaultValue - returned when the property is not set
+ *
+ * @returns the property value
+ */
+bool deviceServiceGetSystemPropertyBool(const char *name, bool defaultValue);
+
+/*
+ * Retrieve a device service system property as an integer. Values are cached and parsed only when
+ * they change, so this is cheap enough for hot paths.
+ *
+ * @param name - the name of the property to retrieve
+ * @param defaultValue - returned when the property is not set or is not an integer
+ *
+ * @returns the property value
+ */
+int32_t deviceServiceGetSystemPropertyInt(const char *name, int32_t defaultValue);
+
+/*
+ * Retrieve a device service system property from the cache. Caller frees the result.
+ *
+ * @param name - the name of the property to retrieve
+ * @param defaultValue - copied when the property is not set
+ *
+ * @returns the property value, or NULL if it is not set and there is no default
+ */
+char *deviceServiceGetSystemPropertyString(const char *name, const char *defaultValue);
+
+/*
+ * Called when a watched system property changes.
+ *
+ * @param name - the name of the property
+ * @param value - the new value, or NULL if the property was removed
+ * @param ctx - the context given to deviceServiceSubscribeSystemProperty
+ */
+typedef void (*deviceServiceSystemPropertyChangedCallback)(const char *name, const char *value, void *ctx);
+
+/*
+ * Watch a device service system property for changes. The callback is invoked without any device
+ * service locks held.
+ *
+ * @param name - the name of the property to watch
+ * @param callback - invoked when the value changes
+ * @param ctx - passed to the callback
+ *
+ * @returns true on success
+ */
+bool deviceServiceSubscribeSystemProperty(const char *name,
+                                          deviceServiceSystemPropertyChangedCallback callback,
+                                          void *ctx);
+
+/*
+ * Stop watching a device service system property.
+ *
+ * @param name - the name given to deviceServiceSubscribeSystemProperty
+ * @param callback - the callback given to deviceServiceSubscribeSystemProperty
+ * @param ctx - the context given to deviceServiceSubscribeSystemProperty
+ */
+void deviceServiceUnsubscribeSystemProperty(const char *name,
+                                            deviceServiceSystemPropertyChangedCallback callback,
+                                            void *ctx);
+
 /*
  * Retrieve all device service system properties. Caller frees value output.
  *
@@ -412,6 +489,9 @@ char *deviceServiceDumpZigbeeConfig(void);
 
 /*
  * Query for metadata based on a uri pattern, currently only supported matching is with wildcards, e.g. *
+ * A wildcard matches any run of characters, including '/', and the pattern must match the whole uri.
+ * A pattern that also contains one of . [ ] ^ $ \ is a POSIX basic regular expression instead, with
+ * each * standing for .*, and may match any part of a uri.
  *
  * @param uriPattern the uri pattern to search with
  * @return the list of matching metadata
@@ -420,6 +500,9 @@ icLinkedList *deviceServiceGetMetadataByUriPattern(char *uriPattern);
 
 /*
  * Query for resources based on a uri pattern, currently only supported matching is with wildcards, e.g. *
+ * A wildcard matches any run of characters, including '/', and the pattern must match the whole uri.
+ * A pattern that also contains one of . [ ] ^ $ \ is a POSIX basic regular expression instead, with
+ * each * standing for .*, and may match any part of a uri.
  *
  * @param uriPattern the uri pattern to search with
  * @return the list of matching resources
@@ -110,6 +110,45 @@ void updateResource(const char *deviceUuid,
                     const char *newValue,
                     cJSON *metadata);
 
+typedef struct ResourceUpdateBatch ResourceUpdateBatch;
+
+/*
+ * Start a batch of resource updates.  Drivers that update several resources for one report should stage
+ * them in a batch instead of calling updateResource for each: the batch is applied to the database in one
+ * transaction, each device is persisted at most once, and resource-updated events are only sent once
+ * every change is in place.
+ *
+ * @returns a new batch, which must be passed to resourceUpdateBatchCommit
+ */
+ResourceUpdateBatch *resourceUpdateBatchBegin(void);
+
+/*
+ * Stage a resource update in a batch.  Nothing is applied until the batch is committed.  Staging the same
+ * resource more than once keeps only the last value.
+ *
+ * @param batch      - the batch
+ * @param deviceUuid - the universally unique identifier for the device
+ * @param endpointId - the id of the endpoint owning the resource, or NULL for a
+ *                     device-level (root device) resource
+ * @param resourceId - the unique id of the resource to update
+ * @param newValue   - the new resource value
+ * @param metadata   - optional metadata to attach to the resource-updated event,
+ *                     or NULL for none.  A copy is kept.
+ */
+void resourceUpdateBatchStage(ResourceUpdateBatch *batch,
+                              const char *deviceUuid,
+                              const char *endpointId,
+                              const char *resourceId,
+                              const char *newValue,
+                              cJSON *metadata);
+
+/*
+ * Apply every update staged in a batch with the same semantics as updateResource, then destroy the batch.
+ *
+ * @param batch - the batch
+ */
+void resourceUpdateBatchCommit(ResourceUpdateBatch *batch);
+
 void setMetadata(const char *deviceUuid, const char *endpointId, const char *name, const char *value);
 char *getMetadata(const char *deviceUuid, const char *endpointId, const char *name);
 bool deviceServiceRemoveMetadata(const char *deviceUuid, const char *endpointId, const char *name);
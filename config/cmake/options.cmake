@@ -145,6 +145,9 @@ bcore_option(NAME BCORE_GENERATE_DEFAULT_LABELS
 bcore_option(NAME BCORE_MATTER_USE_RANDOM_PORT
            DEFINITION BARTON_CONFIG_MATTER_USE_RANDOM_PORT
            DESCRIPTION "Use a random oerational communication port for Matter. If not set, 5540 will be used.")
+bcore_option(NAME BCORE_DEVICE_DB_COMPACT_RECORDS
+           DEFINITION BARTON_CONFIG_DEVICE_DB_COMPACT_RECORDS
+           DESCRIPTION "Store device database records in the compact binary encoding instead of pretty printed JSON")
 bcore_option(NAME BCORE_BUILD_REFERENCE
            DEFINITION BARTON_CONFIG_BUILD_REFERENCE
            DESCRIPTION "Build the reference application"
@@ -120,6 +120,10 @@ namespace barton
         bool optional = false;
         std::vector<std::string> prerequisites; // Alias names for prerequisite checks
 
+        // When changes are written to storage: "always" (default), "coalesce", "memoryOnly" or "onShutdown"
+        std::string persistencePolicy;
+        uint32_t persistIntervalSecs = 0; // For "coalesce"
+
         std::optional<SbmdHandler> seed;
         std::optional<SbmdHandler> read;
         std::optional<SbmdHandler> write;
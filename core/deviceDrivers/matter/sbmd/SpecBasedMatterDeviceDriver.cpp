@@ -195,6 +195,35 @@ namespace
         std::optional<ParsedResult> &result;
     };
 
+    /*
+     * Convert a resource's declared persistence policy.
+     *
+     * policy - the policy name from the spec, empty for the default.
+     *
+     * Returns std::nullopt if the name is not known.
+     */
+    std::optional<ResourcePersistencePolicy> ConvertPersistencePolicy(const std::string &policy)
+    {
+        if (policy.empty() || policy == "always")
+        {
+            return PERSISTENCE_POLICY_ALWAYS;
+        }
+        else if (policy == "coalesce")
+        {
+            return PERSISTENCE_POLICY_COALESCE;
+        }
+        else if (policy == "memoryOnly")
+        {
+            return PERSISTENCE_POLICY_MEMORY_ONLY;
+        }
+        else if (policy == "onShutdown")
+        {
+            return PERSISTENCE_POLICY_ON_SHUTDOWN;
+        }
+
+        return std::nullopt;
+    }
+
 } // namespace
 
 SpecBasedMatterDeviceDriverMetrics SpecBasedMatterDeviceDriver::metrics;
@@ -649,6 +678,19 @@ bool SpecBasedMatterDeviceDriver::DoRegisterDriverResources(icDevice *device)
 
             uint8_t resourceMode = *modeResult;
 
+            auto persistencePolicy = ConvertPersistencePolicy(resource.persistencePolicy);
+
+            if (!persistencePolicy.has_value())
+            {
+                icError("Invalid persistence policy '%s' for resource '%s' on endpoint '%s'",
+                        resource.persistencePolicy.c_str(),
+                        resource.id.c_str(),
+                        endpoint.id.c_str());
+                result = false;
+
+                continue;
+            }
+
             if (resource.execute.has_value())
             {
                 resourceMode |= RESOURCE_MODE_EXECUTABLE;
@@ -683,9 +725,10 @@ bool SpecBasedMatterDeviceDriver::DoRegisterDriverResources(icDevice *device)
                 }
             }
 
-            result &= createEndpointResource(
-                          ep, resource.id.c_str(), initialValue, resource.type.c_str(), resourceMode, cachingPolicy) !=
-                      nullptr;
+            auto *icResource = createEndpointResource(
+                ep, resource.id.c_str(), initialValue, resource.type.c_str(), resourceMode, cachingPolicy);
+            resourceSetPersistencePolicy(icResource, *persistencePolicy, resource.persistIntervalSecs);
+            result &= icResource != nullptr;
         }
     }
 
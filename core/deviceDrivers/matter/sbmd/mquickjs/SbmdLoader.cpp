@@ -775,6 +775,15 @@ namespace barton
                         resource.prerequisites = GetStringArray(ctx, prereqVal.Get());
                     }
 
+                    // Persistence policy
+                    SafeJSValue persistenceVal(ctx, JS_GetPropertyStr(ctx, resVal.Get(), "persistence"));
+
+                    if (!JS_IsUndefined(persistenceVal.Get()) && !JS_IsNull(persistenceVal.Get()))
+                    {
+                        resource.persistencePolicy = GetStringProp(ctx, persistenceVal.Get(), "policy");
+                        resource.persistIntervalSecs = GetUint32Prop(ctx, persistenceVal.Get(), "intervalSecs", 0);
+                    }
+
                     // Resource handlers
                     SafeJSValue seedVal(ctx, JS_GetPropertyStr(ctx, resVal.Get(), "seed"));
 
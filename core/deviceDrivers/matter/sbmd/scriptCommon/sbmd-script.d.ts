@@ -162,6 +162,15 @@ interface SbmdResource {
     /** If true, silently skip when prerequisites are not met. Default false. */
     optional?: boolean;
 
+    /**
+     * When value changes are written to the device DB. Default "always". Use "coalesce" (with
+     * intervalSecs), "memoryOnly" or "onShutdown" for high frequency telemetry.
+     */
+    persistence?: {
+        policy: "always" | "coalesce" | "memoryOnly" | "onShutdown";
+        intervalSecs?: number;
+    };
+
     /** Initialization handler (runs on discovery and each startup). */
     seed?: SbmdResourceHandler | SbmdHandlerFunction;
 
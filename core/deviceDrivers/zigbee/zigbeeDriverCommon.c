@@ -3769,13 +3769,17 @@ static void updateNeRssiAndLqi(void *ctx, uint64_t eui64, int8_t rssi, uint8_t l
 
     char *deviceUuid = zigbeeSubsystemEui64ToId(eui64);
 
+    ResourceUpdateBatch *batch = resourceUpdateBatchBegin();
+
     char rssiStr[5]; //-127 + \0
     snprintf(rssiStr, 5, "%d", rssi);
-    updateResource(deviceUuid, 0, COMMON_DEVICE_RESOURCE_NERSSI, rssiStr, NULL);
+    resourceUpdateBatchStage(batch, deviceUuid, NULL, COMMON_DEVICE_RESOURCE_NERSSI, rssiStr, NULL);
 
     char lqiStr[4]; // 255 + \0
     snprintf(lqiStr, 4, "%u", lqi);
-    updateResource(deviceUuid, 0, COMMON_DEVICE_RESOURCE_NELQI, lqiStr, NULL);
+    resourceUpdateBatchStage(batch, deviceUuid, NULL, COMMON_DEVICE_RESOURCE_NELQI, lqiStr, NULL);
+
+    resourceUpdateBatchCommit(batch);
 
     updateLinkQuality(commonDriver, deviceUuid);
 
@@ -3788,13 +3792,17 @@ static void handleRssiLqiUpdated(void *ctx, uint64_t eui64, uint8_t endpointId,
 
     char *deviceUuid = zigbeeSubsystemEui64ToId(eui64);
 
+    ResourceUpdateBatch *batch = resourceUpdateBatchBegin();
+
     char rssiStr[5]; //-127 + \0
     snprintf(rssiStr, 5, "%d", rssi);
-    updateResource(deviceUuid, 0, COMMON_DEVICE_RESOURCE_FERSSI, rssiStr, NULL);
+    resourceUpdateBatchStage(batch, deviceUuid, NULL, COMMON_DEVICE_RESOURCE_FERSSI, rssiStr, NULL);
 
     char lqiStr[4]; // 255 + \0
     snprintf(lqiStr, 4, "%u", lqi);
-    updateResource(deviceUuid, 0, COMMON_DEVICE_RESOURCE_FELQI, lqiStr, NULL);
+    resourceUpdateBatchStage(batch, deviceUuid, NULL, COMMON_DEVICE_RESOURCE_FELQI, lqiStr, NULL);
+
+    resourceUpdateBatchCommit(batch);
 
     updateLinkQuality(commonDriver, deviceUuid);
 
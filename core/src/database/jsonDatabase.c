@@ -25,37 +25,66 @@
  * Created by Micah Koch on 5/4/18.
  */
 
+#include <errno.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "deviceServicePrivate.h"
+#include "deviceStorageCommit.h"
 #include "event/deviceEventProducer.h"
 #include "jsonDatabase.h"
+#include "jsonDatabaseCompactRecord.h"
+#include "jsonDatabaseIndex.h"
+#include "jsonDatabaseJournal.h"
+#include "jsonDatabaseMetadataTable.h"
+#include "jsonDatabaseRecord.h"
+#include "jsonDatabaseSnapshot.h"
+#include "jsonDatabaseSyncTable.h"
+#include "jsonDatabaseUriTrie.h"
 #include <cjson/cJSON.h>
 #include <device/icDeviceEndpoint.h>
 #include <device/icDeviceMetadata.h>
 #include <device/icDeviceResource.h>
+#include <icConcurrent/delayedTask.h>
 #include <icConcurrent/threadUtils.h>
+#include <icConcurrent/timedWait.h>
 #include <icConfig/storage.h>
 #include <icLog/logging.h>
 #include <icTime/timeUtils.h>
 #include <icTypes/icStringHashMap.h>
+#include <icUtil/fileUtils.h>
 #include <icUtil/stringUtils.h>
+#include <inttypes.h>
 #include <jsonHelper/jsonHelper.h>
 #include <regex.h>
+#include <stdio.h>
 
 #define LOG_TAG               "jsonDeviceDatabase"
 #define STORAGE_NAMESPACE     "devicedb"
 #define SYSTEM_PROPERTIES_KEY "systemProperties"
+// Key suffix of a device's metadata record, stored next to the device as <uuid>.metadata
+#define METADATA_RECORD_SUFFIX ".metadata"
+
+// Bulk archive: a header line with the system properties, then one device per line
+#define ARCHIVE_VERSION_KEY           "archiveVersion"
+#define ARCHIVE_VERSION               1
+#define ARCHIVE_SYSTEM_PROPERTIES_KEY "systemProperties"
+#define ARCHIVE_FILE_NAME             STORAGE_NAMESPACE ".archive"
 
 // We keep per device files, and keep an in memory cache of all devices
 // This structure keeps track of which devices might be dirty and require
 // flushing to disk
 typedef struct
 {
-    icDevice *device;
+    char *uuid;       // key in the devices map
+    icDevice *device; // NULL while evicted
+    char *evicted;    // compact serialized device while evicted
+    uint64_t lastAccessMillis;
+    uint64_t deferredUntilMillis; // when a change deferred by persistence policy is due, 0 for none
     bool dirty;
+    bool unverified; // loaded from the cold start snapshot and not yet checked against storage
 } DeviceCacheEntry;
 
 // For our URI hashmap, we need to know what sort of object is pointed to
@@ -108,18 +137,144 @@ static icHashMap *devices = NULL;
 // Map of "resources" by their uri, this includes devices, endpoints, resources, and metadata
 // It only owns the Locator value that is stored in the map.
 static icHashMap *resourcesByUri = NULL;
+// The same locators arranged by URI segment, for wildcard queries.  Kept in step with resourcesByUri
+// by putUriLocator/deleteUriLocator and owns nothing but its own nodes.
+static JsonDatabaseUriTrie *uriTrie = NULL;
+// Secondary indexes of DeviceCacheEntry by device uuid, maintained alongside resourcesByUri by the
+// add/remove URI entry functions.  Only device level metadata is indexed by metadata id.
+static JsonDatabaseIndex *devicesByClass = NULL;
+static JsonDatabaseIndex *devicesByDriver = NULL;
+static JsonDatabaseIndex *devicesByEndpointProfile = NULL;
+static JsonDatabaseIndex *devicesByMetadataId = NULL;
 // Map of system properties, simple name value pairs
 static icStringHashMap *systemProperties = NULL;
-// Lock when we want to read or write our in memory cache.  The locking strategy of this class is
-// static (private) functions assume the lock is held.   All public functions should lock before
-// calling functions which manipulate global data structures
-static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+// Whether every device record in storage has been sealed with a checksum, as recorded by the
+// JSON_DATABASE_RECORDS_SEALED_KEY system property.  Once set, a record without a checksum can only
+// be a torn or truncated write.  Protected by writeMtx, and does not change while initializing.
+static bool deviceRecordsSealed = false;
+// The locking strategy of this class uses two locks:
+//
+// writeMtx serializes every operation that mutates the cache or writes to storage.  Holding it
+// guarantees nobody else will change the cache, so the holder may walk and serialize cached
+// devices without any other lock.
+//
+// cacheLock guards the in memory structures for readers.  Lookups only take it for reading.
+// Mutators take it for writing only while they are actually changing the maps/devices, and must
+// already hold writeMtx. Serialization and storage I/O are done while holding writeMtx only, so
+// lookups never wait on disk writes.
+//
+// Static (private) functions ending in NoLock assume the caller holds writeMtx and the write side
+// of cacheLock.  All public functions should lock before calling functions which manipulate
+// global data structures
+static pthread_mutex_t writeMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t cacheLock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Write-behind state.  When writeBehindIntervalMillis is non-zero, device changes are only marked
+// dirty and a flusher thread writes them out.  These values and dirtyDeviceCount are protected by
+// writeMtx.
+static uint32_t writeBehindIntervalMillis = 0;
+static uint16_t writeBehindMaxDirtyDevices = 0;
+static uint32_t dirtyDeviceCount = 0;
+static uint64_t oldestDirtyMillis = 0;
+
+// Flusher thread state, protected by flusherMtx.  flusherMtx may be taken while holding writeMtx,
+// but never the other way around.  writeBehindControlMtx serializes starting/stopping the flusher.
+static pthread_mutex_t writeBehindControlMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t flusherMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusherCond = PTHREAD_COND_INITIALIZER;
+static pthread_t flusherThread;
+static bool flusherRunning = false;
+static bool flushRequested = false;
+static uint32_t flusherIntervalMillis = 0;
+
+// Optional resource update journal, protected by writeMtx.  Records are only ever newer than the
+// device snapshots in storage; any snapshot write outside of compaction compacts the journal first.
+static JsonDatabaseJournal *journal = NULL;
+static uint32_t journalMaxRecords = 0;
+
+// Optional table of resource last sync times, protected by writeMtx.  With it, a sync that doesn't
+// change a resource's value only updates the cache and the table, which is checkpointed on its own
+// at most every syncCheckpointIntervalMillis instead of rewriting the device.
+static JsonDatabaseSyncTable *syncTable = NULL;
+static uint32_t syncCheckpointIntervalMillis = 0;
+static uint32_t syncCheckpointTask = 0;
+
+// Resource changes deferred by their persistence policy, protected by writeMtx.  A device with a
+// deferred change is not dirty, so only its deadline, jsonDatabaseFlush or a persisting cleanup
+// writes it (along with any other change to it).  A deadline of UINT64_MAX waits for one of the latter.
+// Only the most recently scheduled deferred write task is tracked, earlier ones find nothing to do.
+static uint32_t deferredDeviceCount = 0;
+static StorageCommitTask deferredWriteTask;
+
+// Metadata saved since a device was last written in full, protected by metadataMtx, which is taken
+// last and never held while calling out.  Each device in the table has a metadata record in storage that
+// is newer than the metadata in its device record, so saving metadata writes only that record.  The
+// entry and record go when the device is next written.  metadataRecordsLoaded, protected by writeMtx,
+// is false while the metadata records in storage may not all be in the table yet, i.e. until the
+// cold start snapshot has been reconciled.
+static pthread_mutex_t metadataMtx = PTHREAD_MUTEX_INITIALIZER;
+static JsonDatabaseMetadataTable *metadataTable = NULL;
+static bool metadataRecordsLoaded = false;
+
+// Number of threads reading and parsing device files during initialization, protected by writeMtx
+static uint8_t loadWorkerCount = 1;
+
+// Whether device records are written to storage as compact binary records rather than pretty printed
+// JSON, protected by writeMtx.  System properties are written as unformatted JSON then.  Loading accepts
+// either encoding.
+#ifdef BARTON_CONFIG_DEVICE_DB_COMPACT_RECORDS
+static bool compactStorageFormat = true;
+#else
+static bool compactStorageFormat = false;
+#endif
+
+// Bounded cache: when maxResidentDevices is non-zero, the least recently used clean devices beyond
+// that many are evicted to their compact serialized form and rehydrated when next looked up.  Evicted
+// devices keep their cache entry and index memberships but have no URI entries.  The limit and the
+// evicted count change under writeMtx and the write side of cacheLock, and are read atomically by the
+// lookup fast paths.  Statistics are updated atomically.
+static uint32_t maxResidentDevices = 0;
+static uint32_t evictedDeviceCount = 0;
+static uint64_t cacheHits = 0;
+static uint64_t cacheRehydrations = 0;
+static uint64_t cacheEvictions = 0;
+static uint64_t rehydrateMillisTotal = 0;
+static uint64_t rehydrateMillisMax = 0;
+
+// Optional cold start snapshot.  snapshotPath and snapshotIntervalMillis are configuration that
+// survives cleanup; everything else is protected by writeMtx.  Devices loaded from the snapshot start
+// out evicted and unverified, with their compact record in the mapped snapshot (coldSnapshot).  They
+// are reloaded from storage when first made resident or by the reconciler thread, whichever comes
+// first, and the snapshot is unmapped once none are left.  snapshotStale is set whenever storage
+// changes, and the snapshot is only rewritten while it is set.
+static char *snapshotPath = NULL;
+static uint32_t snapshotIntervalMillis = 0;
+static JsonDatabaseSnapshot *coldSnapshot = NULL;
+static uint32_t unverifiedDeviceCount = 0;
+static bool snapshotStale = false;
+static uint32_t snapshotTask = 0;
+static pthread_t reconcilerThread;
+static bool reconcilerStarted = false;
+static bool reconcilerStopRequested = false;
+
+// Who to tell about system property changes, protected by listenerMtx.  The listener is called
+// without holding any of our locks, so it may use the database.
+static pthread_mutex_t listenerMtx = PTHREAD_MUTEX_INITIALIZER;
+static jsonDatabaseSystemPropertyListener systemPropertyListener = NULL;
+static void *systemPropertyListenerCtx = NULL;
 
 static bool jsonDatabaseGetSystemPropertyNoLock(const char *key, char **value);
+static bool putSystemPropertyNoLock(const char *key, const char *value);
 static bool jsonDatabaseGetAllSystemPropertiesNoLock(icStringHashMap *map);
 static bool jsonDatabaseSetSystemPropertyNoLock(const char *key, const char *value);
 static bool loadDeviceIntoCache(icDevice *newDevice);
+static bool removeDeviceNoLock(const char *uuid);
 static void removeDeviceURIEntries(const icDevice *device);
+static void markDeviceDirtyNoLock(DeviceCacheEntry *entry);
+static icDevice *decodeEvictedDevice(const DeviceCacheEntry *entry);
+static icDevice *loadStoredDevice(const char *uuid);
+static void removeEvictedIndexEntries(const DeviceCacheEntry *entry);
+static void freeDevicesItem(void *key, void *value);
 
 static bool isMetadataAccessible(const char *uri);
 static bool isEndpointEnabled(icDeviceEndpoint *endpoint);
@@ -141,12 +296,29 @@ static void replaceEndpointResources(EndpointLocator *dst, icDeviceEndpoint *src
 static DeviceCacheEntry *createCacheEntry(icDevice *device)
 {
     DeviceCacheEntry *entry = (DeviceCacheEntry *) calloc(1, sizeof(DeviceCacheEntry));
+    entry->uuid = strdup(device->uuid);
     entry->device = device;
+    entry->lastAccessMillis = getMonotonicMillis();
     entry->dirty = false;
 
     return entry;
 }
 
+/**
+ * Let go of an entry's compact record.  The records of unverified entries belong to the cold start
+ * snapshot.
+ *
+ * @param entry the cache entry
+ */
+static void releaseEvictedRecord(DeviceCacheEntry *entry)
+{
+    if (!jsonDatabaseSnapshotContains(coldSnapshot, entry->evicted))
+    {
+        free(entry->evicted);
+    }
+    entry->evicted = NULL;
+}
+
 /**
  * Destroy a cache entry, includes removing any resources in our URI and destroying the
  * device itself
@@ -155,11 +327,23 @@ static DeviceCacheEntry *createCacheEntry(icDevice *device)
  */
 static void destroyCacheEntry(DeviceCacheEntry *entry)
 {
+    if (entry->unverified)
+    {
+        unverifiedDeviceCount--;
+    }
+    if (entry->device == NULL && entry->evicted != NULL)
+    {
+        evictedDeviceCount--;
+        // An evicted device has no URI entries, but is still in the indexes unless they are gone already
+        removeEvictedIndexEntries(entry);
+    }
     // Cleanup the resources map first
     removeDeviceURIEntries(entry->device);
     // Now clean up the device
     deviceDestroy(entry->device);
     // Now cleanup the cache entry itself
+    releaseEvictedRecord(entry);
+    free(entry->uuid);
     free(entry);
 }
 
@@ -197,6 +381,72 @@ static void destroyLocator(void *key, void *value)
     free(value);
 }
 
+/**
+ * Create any secondary indexes that don't exist yet
+ */
+static void createIndexes(void)
+{
+    if (devicesByClass == NULL)
+    {
+        devicesByClass = jsonDatabaseIndexCreate();
+        devicesByDriver = jsonDatabaseIndexCreate();
+        devicesByEndpointProfile = jsonDatabaseIndexCreate();
+        devicesByMetadataId = jsonDatabaseIndexCreate();
+    }
+}
+
+/**
+ * Destroy the secondary indexes
+ */
+static void destroyIndexes(void)
+{
+    jsonDatabaseIndexDestroy(devicesByClass);
+    devicesByClass = NULL;
+    jsonDatabaseIndexDestroy(devicesByDriver);
+    devicesByDriver = NULL;
+    jsonDatabaseIndexDestroy(devicesByEndpointProfile);
+    devicesByEndpointProfile = NULL;
+    jsonDatabaseIndexDestroy(devicesByMetadataId);
+    devicesByMetadataId = NULL;
+}
+
+/**
+ * Add a locator to resourcesByUri and uriTrie
+ *
+ * @param uri the URI of the item, must remain valid for as long as the entry exists
+ * @param locator the locator, owned by resourcesByUri on success
+ * @return true on success, false if the URI already has an entry
+ */
+static bool putUriLocator(char *uri, Locator *locator)
+{
+    if (!hashMapPut(resourcesByUri, uri, strlen(uri) + 1, locator))
+    {
+        return false;
+    }
+
+    if (!jsonDatabaseUriTriePut(uriTrie, uri, locator))
+    {
+        hashMapDelete(resourcesByUri, uri, strlen(uri) + 1, standardDoNotFreeHashMapFunc);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Remove a locator from resourcesByUri and uriTrie
+ *
+ * @param uri the URI of the item
+ * @param freeFunc how resourcesByUri should free the locator
+ * @return true if there was an entry to remove
+ */
+static bool deleteUriLocator(const char *uri, hashMapFreeFunc freeFunc)
+{
+    jsonDatabaseUriTrieRemove(uriTrie, uri);
+
+    return hashMapDelete(resourcesByUri, (void *) uri, strlen(uri) + 1, freeFunc);
+}
+
 /**
  * Remove the URI entry for some metadata
  *
@@ -207,7 +457,11 @@ static void removeMetadataURIEntry(const icDeviceMetadata *deviceMetadata)
     if (deviceMetadata != NULL)
     {
         // The map only owns the locator, so free that
-        hashMapDelete(resourcesByUri, deviceMetadata->uri, strlen(deviceMetadata->uri) + 1, destroyLocator);
+        deleteUriLocator(deviceMetadata->uri, destroyLocator);
+        if (deviceMetadata->endpointId == NULL)
+        {
+            jsonDatabaseIndexRemove(devicesByMetadataId, deviceMetadata->id, deviceMetadata->deviceUuid);
+        }
     }
 }
 
@@ -221,7 +475,7 @@ static void removeDeviceResourceURIEntry(const icDeviceResource *deviceResource)
     if (deviceResource != NULL && deviceResource->uri != NULL)
     {
         // The map only owns the locator, so free that
-        hashMapDelete(resourcesByUri, deviceResource->uri, strlen(deviceResource->uri) + 1, destroyLocator);
+        deleteUriLocator(deviceResource->uri, destroyLocator);
     }
 }
 
@@ -235,7 +489,7 @@ static void removeEndpointURIEntries(const icDeviceEndpoint *endpoint)
     if (endpoint != NULL && endpoint->uri != NULL)
     {
         // The map only owns the locator, so free that
-        hashMapDelete(resourcesByUri, endpoint->uri, strlen(endpoint->uri) + 1, destroyLocator);
+        deleteUriLocator(endpoint->uri, destroyLocator);
         // Remove all resource URI entries
         icLinkedListIterator *iter = linkedListIteratorCreate(endpoint->resources);
         while (linkedListIteratorHasNext(iter))
@@ -265,13 +519,17 @@ static void removeDeviceURIEntries(const icDevice *device)
     if (device != NULL && device->uri != NULL)
     {
         // The map only owns the locator, so free that
-        hashMapDelete(resourcesByUri, device->uri, strlen(device->uri) + 1, destroyLocator);
+        deleteUriLocator(device->uri, destroyLocator);
+        jsonDatabaseIndexRemove(devicesByClass, device->deviceClass, device->uuid);
+        jsonDatabaseIndexRemove(devicesByDriver, device->managingDeviceDriver, device->uuid);
         // Remove all endpoint URI entries
         icLinkedListIterator *iter = linkedListIteratorCreate(device->endpoints);
         while (linkedListIteratorHasNext(iter))
         {
             icDeviceEndpoint *endpoint = (icDeviceEndpoint *) linkedListIteratorGetNext(iter);
             removeEndpointURIEntries(endpoint);
+            // Endpoints only go away with their device, so other endpoints can't still need this
+            jsonDatabaseIndexRemove(devicesByEndpointProfile, endpoint->profile, device->uuid);
         }
         linkedListIteratorDestroy(iter);
 
@@ -317,12 +575,17 @@ static bool addDeviceMetadataURIEntry(DeviceCacheEntry *deviceCacheEntry,
         locator->locator.metadataLocator.deviceCacheEntry = deviceCacheEntry;
         locator->locator.metadataLocator.endpoint = endpoint;
         locator->locator.metadataLocator.metadata = deviceMetadata;
-        if (hashMapPut(resourcesByUri, deviceMetadata->uri, strlen(deviceMetadata->uri) + 1, locator) == false)
+        if (putUriLocator(deviceMetadata->uri, locator) == false)
         {
             icLogError(LOG_TAG, "Failed to add metadata locator with uri %s", deviceMetadata->uri);
             free(locator);
             retval = false;
         }
+        else if (endpoint == NULL)
+        {
+            jsonDatabaseIndexAdd(
+                devicesByMetadataId, deviceMetadata->id, deviceCacheEntry->device->uuid, deviceCacheEntry);
+        }
     }
     else
     {
@@ -355,7 +618,7 @@ static bool addDeviceResourceURIEntry(DeviceCacheEntry *deviceCacheEntry,
         locator->locator.resourceLocator.deviceCacheEntry = deviceCacheEntry;
         locator->locator.resourceLocator.endpoint = endpoint;
         locator->locator.resourceLocator.resource = deviceResource;
-        if (!hashMapPut(resourcesByUri, deviceResource->uri, strlen(deviceResource->uri) + 1, locator))
+        if (!putUriLocator(deviceResource->uri, locator))
         {
             icLogError(LOG_TAG, "Failed to add resource locator with uri %s", deviceResource->uri);
             free(locator);
@@ -390,8 +653,11 @@ static bool addEndpointURIEntries(DeviceCacheEntry *deviceCacheEntry, icDeviceEn
         locator->locatorType = LOCATOR_TYPE_ENDPOINT;
         locator->locator.endpointLocator.deviceCacheEntry = deviceCacheEntry;
         locator->locator.endpointLocator.endpoint = endpoint;
-        if (hashMapPut(resourcesByUri, endpoint->uri, strlen(endpoint->uri) + 1, locator))
+        if (putUriLocator(endpoint->uri, locator))
         {
+            jsonDatabaseIndexAdd(
+                devicesByEndpointProfile, endpoint->profile, deviceCacheEntry->device->uuid, deviceCacheEntry);
+
             icLinkedListIterator *endpointResourcesIter = linkedListIteratorCreate(endpoint->resources);
             while (linkedListIteratorHasNext(endpointResourcesIter))
             {
@@ -454,9 +720,12 @@ static bool addDeviceURIEntries(DeviceCacheEntry *deviceCacheEntry)
         Locator *locator = (Locator *) calloc(1, sizeof(Locator));
         locator->locatorType = LOCATOR_TYPE_DEVICE;
         locator->locator.deviceCacheEntry = deviceCacheEntry;
-        if (hashMapPut(
-                resourcesByUri, deviceCacheEntry->device->uri, strlen(deviceCacheEntry->device->uri) + 1, locator))
+        if (putUriLocator(deviceCacheEntry->device->uri, locator))
         {
+            icDevice *device = deviceCacheEntry->device;
+            jsonDatabaseIndexAdd(devicesByClass, device->deviceClass, device->uuid, deviceCacheEntry);
+            jsonDatabaseIndexAdd(devicesByDriver, device->managingDeviceDriver, device->uuid, deviceCacheEntry);
+
             icLinkedListIterator *iter = linkedListIteratorCreate(deviceCacheEntry->device->endpoints);
             while (linkedListIteratorHasNext(iter))
             {
@@ -526,385 +795,3350 @@ static bool addDeviceURIEntries(DeviceCacheEntry *deviceCacheEntry)
 }
 
 /**
- * If systemProperty having any node with name CurrentBlacklistMd5 and currentBlacklistUrl,
- * This function will replace them with CurrentDenylistMd5 and currentDenylistUrl and
- * updating schemaVersion.
- * @return true if successful, false otherwise
+ * Add an evicted device's cache entry back to the secondary indexes.  Evicted devices keep their
+ * index memberships so index queries still find them.
+ *
+ * @param deviceCacheEntry the device cache entry, with the device still attached
  */
-static bool migrateSysPropFile()
+static void addDeviceIndexEntries(DeviceCacheEntry *deviceCacheEntry)
 {
-    bool retval = false;
-    char *propertyValue = stringHashMapGet(systemProperties, JSON_DATABASE_SCHEMA_VERSION_KEY);
-    if (stringCompare(propertyValue, JSON_DATABASE_CURRENT_SCHEMA_VERSION, false) != 0)
+    icDevice *device = deviceCacheEntry->device;
+
+    jsonDatabaseIndexAdd(devicesByClass, device->deviceClass, device->uuid, deviceCacheEntry);
+    jsonDatabaseIndexAdd(devicesByDriver, device->managingDeviceDriver, device->uuid, deviceCacheEntry);
+
+    icLinkedListIterator *iter = linkedListIteratorCreate(device->endpoints);
+    while (linkedListIteratorHasNext(iter))
     {
-        char *blackListMd5value = NULL;
-        char *blackListUrlvalue = NULL;
-        if (jsonDatabaseGetSystemPropertyNoLock("currentBlacklistMd5", &blackListMd5value) == true)
-        {
-            stringHashMapPutCopy(systemProperties, CURRENT_DENYLIST_MD5, blackListMd5value);
-            stringHashMapDelete(systemProperties, "currentBlacklistMd5", NULL);
-        }
-        if (jsonDatabaseGetSystemPropertyNoLock("currentBlacklistUrl", &blackListUrlvalue) == true)
-        {
-            stringHashMapPutCopy(systemProperties, CURRENT_DENYLIST_URL, blackListUrlvalue);
-            stringHashMapDelete(systemProperties, "currentBlacklistUrl", NULL);
-        }
-        jsonDatabaseSetSystemPropertyNoLock(JSON_DATABASE_SCHEMA_VERSION_KEY, JSON_DATABASE_CURRENT_SCHEMA_VERSION);
-        retval = true;
+        icDeviceEndpoint *endpoint = (icDeviceEndpoint *) linkedListIteratorGetNext(iter);
+        jsonDatabaseIndexAdd(devicesByEndpointProfile, endpoint->profile, device->uuid, deviceCacheEntry);
     }
-    return retval;
+    linkedListIteratorDestroy(iter);
+
+    icLinkedListIterator *metadataIter = linkedListIteratorCreate(device->metadata);
+    while (linkedListIteratorHasNext(metadataIter))
+    {
+        icDeviceMetadata *metadata = (icDeviceMetadata *) linkedListIteratorGetNext(metadataIter);
+        jsonDatabaseIndexAdd(devicesByMetadataId, metadata->id, device->uuid, deviceCacheEntry);
+    }
+    linkedListIteratorDestroy(metadataIter);
 }
+
 /**
- * Load system properties from storage
- * @return true if successful, false otherwise
+ * @param uuid the device
+ * @return the storage key of the device's metadata record, caller must free
  */
-static bool loadSystemProperties()
+static char *getMetadataRecordKey(const char *uuid)
 {
-    bool retval = false;
-    if (systemProperties == NULL)
-    {
-        systemProperties = stringHashMapCreate();
-    }
+    return stringBuilder("%s" METADATA_RECORD_SUFFIX, uuid);
+}
 
-    scoped_cJSON *body = NULL;
-    if ((body = storageLoadJSON(STORAGE_NAMESPACE, SYSTEM_PROPERTIES_KEY)) != NULL)
-    {
-        int count = cJSON_GetArraySize(body);
-        for (int i = 0; i < count; ++i)
-        {
-            cJSON *item = cJSON_GetArrayItem(body, i);
-            if (item->type == cJSON_String && item->valuestring != NULL)
-            {
-                stringHashMapPut(systemProperties, strdup(item->string), strdup(item->valuestring));
-            }
-            else
-            {
-                // We will still say we are successful, but log the error. Really not sure how this
-                // would ever happen
-                icLogWarn(LOG_TAG, "Skipping unreadable system property %s", item->string);
-            }
-        }
-        migrateSysPropFile();
-        retval = true;
-    }
-    else
+/**
+ * @param key a storage key
+ * @return true if the key is of a metadata record
+ */
+static bool isMetadataRecordKey(const char *key)
+{
+    size_t keyLen = strlen(key);
+    size_t suffixLen = strlen(METADATA_RECORD_SUFFIX);
+
+    return keyLen > suffixLen && strcmp(key + keyLen - suffixLen, METADATA_RECORD_SUFFIX) == 0;
+}
+
+/**
+ * @param key a storage key
+ * @return the device uuid if the key is of a metadata record, otherwise NULL.  Caller must free.
+ */
+static char *getMetadataRecordUuid(const char *key)
+{
+    if (!isMetadataRecordKey(key))
     {
-        icLogError(LOG_TAG, "Failed to parse system properties");
+        return NULL;
     }
 
-    return retval;
+    return strndup(key, strlen(key) - strlen(METADATA_RECORD_SUFFIX));
 }
 
-struct LoaderContext
+/**
+ * @param uuid the device
+ * @return true if the device has an entry in the metadata table.  Caller must not hold metadataMtx.
+ */
+static bool hasMetadataEntry(const char *uuid)
 {
-    bool permissive;
-};
+    LOCK_SCOPE(metadataMtx);
+    return jsonDatabaseMetadataTableContains(metadataTable, uuid);
+}
 
 /**
- * Load a device from storage into our in-memory cache
- * @param jsonData a valid JSON document to load
- * @return whether the device was loaded into the cache successfully.
+ * Read a device's metadata record from storage into the metadata table, if it has one.  Caller must
+ * not hold metadataMtx.
+ *
+ * @param uuid the device
+ * @return true if the device has a metadata record
  */
-static bool loadDevice(const char *jsonData, void *ctx)
+static bool loadMetadataRecord(const char *uuid)
 {
-    icDevice *device = NULL;
-    bool permissive = false;
+    scoped_generic char *key = getMetadataRecordKey(uuid);
+    scoped_generic char *record = NULL;
 
-    struct LoaderContext *loaderContext = ctx;
-    if (loaderContext != NULL)
+    // The last write may still be waiting for a group commit
+    deviceStorageCommitSettle(STORAGE_NAMESPACE, key);
+    if (!storageLoad(STORAGE_NAMESPACE, key, &record))
     {
-        permissive = loaderContext->permissive;
+        return false;
     }
 
-    cJSON *json = cJSON_Parse(jsonData);
-    if (json != NULL)
+    // The device's own record has older metadata, but that beats none
+    if (jsonDatabaseRecordVerify(record) == JSON_DATABASE_RECORD_CORRUPT)
     {
-        icSerDesContext *context = serDesCreateContext();
-        serDesSetContextValue(context, "namespace", STORAGE_NAMESPACE);
-
-        device = deviceFromJSON(json, context, permissive);
-
-        if (!loadDeviceIntoCache(device))
-        {
-            // If loadDeviceIntoCache fails it cleans up the device as well, so return NULL to the caller
-            device = NULL;
-        }
-        // Cleanup
-        cJSON_Delete(json);
-        serDesDestroyContext(context);
+        icLogWarn(LOG_TAG, "%s: metadata record of device %s failed checksum verification", __FUNCTION__, uuid);
+        return false;
     }
 
-    return device != NULL;
+    LOCK_SCOPE(metadataMtx);
+    return jsonDatabaseMetadataTablePutRecord(metadataTable, uuid, record);
 }
 
 /**
- * Load all devices from storage into our in memory cache
+ * Write a device's entry in the metadata table to storage as its metadata record.  Assumes caller owns
+ * writeMtx.
  *
- * @return true if success, false otherwise
+ * @param uuid the device
+ * @return true if the record was written
  */
-static bool loadDevices()
+static bool saveMetadataRecordNoLock(const char *uuid)
 {
-    bool retval = true;
-    if (devices == NULL)
+    scoped_generic char *body = NULL;
     {
-        devices = hashMapCreate();
+        LOCK_SCOPE(metadataMtx);
+        body = jsonDatabaseMetadataTableEncode(metadataTable, uuid);
     }
-    if (resourcesByUri == NULL)
+    if (body == NULL)
     {
-        resourcesByUri = hashMapCreate();
+        return false;
     }
 
-    icLinkedList *keys = storageGetKeys(STORAGE_NAMESPACE);
-    icLinkedListIterator *iter = linkedListIteratorCreate(keys);
-
-    const StorageCallbacks strictDeviceCallback = {.parse = loadDevice, .parserCtx = NULL};
-
-    struct LoaderContext permissiveCtx = {.permissive = true};
-
-    const StorageCallbacks permissiveDeviceCallback = {.parse = loadDevice, .parserCtx = &permissiveCtx};
-
-    while (linkedListIteratorHasNext(iter))
+    scoped_generic char *key = getMetadataRecordKey(uuid);
+    scoped_generic char *toWrite = jsonDatabaseRecordSeal(body);
+    if (!deviceStorageCommitSave(STORAGE_NAMESPACE, key, toWrite))
     {
-        char *key = (char *) linkedListIteratorGetNext(iter);
-        if (key != NULL && strcmp(key, SYSTEM_PROPERTIES_KEY) != 0)
-        {
-            if (storageParse(STORAGE_NAMESPACE, key, &strictDeviceCallback) == false)
-            {
-                // Notify someone that a device couldn't load. It might recover, but it should always be checked out.
-                sendDeviceDatabaseFailureEvent(B_CORE_DEVICE_DATABASE_FAILURE_TYPE_DEVICE_LOAD_FAILURE, key);
-
-                if (storageParseBad(STORAGE_NAMESPACE, key, &permissiveDeviceCallback) == true)
-                {
-                    icLogInfo(LOG_TAG, "Successfully recovered device %s", key);
-                }
-            }
-        }
+        icLogError(LOG_TAG, "Failed to write metadata of device %s", uuid);
+        return false;
     }
 
-    linkedListIteratorDestroy(iter);
-    linkedListDestroy(keys, NULL);
-
-    return retval;
+    snapshotStale = true;
+    return true;
 }
 
 /**
- * Flush system properties to storage
- * @return true if success, false otherwise
+ * Drop a device's metadata record, if it has one, once the device record has the same metadata or
+ * the device is gone.  Assumes caller owns writeMtx.
+ *
+ * @param uuid the device
  */
-static bool saveSystemProperties()
+static void dropMetadataRecordNoLock(const char *uuid)
 {
-    bool didSave = true;
-    cJSON *body = stringHashMapToJson(systemProperties);
-    char *toWrite = cJSON_Print(body);
-    if (!storageSave(STORAGE_NAMESPACE, SYSTEM_PROPERTIES_KEY, toWrite))
+    bool hadRecord = hasMetadataEntry(uuid);
+    if (hadRecord)
     {
-        didSave = false;
-        icLogError(LOG_TAG, "Failed to write system properties");
+        LOCK_SCOPE(metadataMtx);
+        jsonDatabaseMetadataTableRemoveDevice(metadataTable, uuid);
     }
-    // Cleanup
-    free(toWrite);
-    cJSON_Delete(body);
 
-    return didSave;
+    scoped_generic char *key = hadRecord ? getMetadataRecordKey(uuid) : NULL;
+    if (key != NULL && !deviceStorageCommitDelete(STORAGE_NAMESPACE, key))
+    {
+        icLogWarn(LOG_TAG, "%s: unable to remove metadata record of device %s", __FUNCTION__, uuid);
+    }
 }
 
 /**
- * Flush a device to storage
+ * Bring a device up to its entry in the metadata table, if it has one.  Caller must not hold
+ * metadataMtx.
  *
- * @param device the device to write
- * @return true if success, false otherwise
+ * @param device the device
  */
-static bool saveDevice(icDevice *device)
+static void applyMetadataTable(icDevice *device)
 {
-    icSerDesContext *context = serDesCreateContext();
-    bool didSave = true;
-
-    serDesSetContextValue(context, "namespace", STORAGE_NAMESPACE);
-
-    cJSON *body = deviceToJSON(device, context);
-    char *toWrite = cJSON_Print(body);
-
-    if (!storageSave(STORAGE_NAMESPACE, device->uuid, toWrite))
-    {
-        didSave = false;
-        icLogError(LOG_TAG, "Failed to write device %s", device->uuid);
-    }
-    // Cleanup
-    free(toWrite);
-    cJSON_Delete(body);
-    serDesDestroyContext(context);
-
-    return didSave;
+    LOCK_SCOPE(metadataMtx);
+    jsonDatabaseMetadataTableApply(metadataTable, device);
 }
 
 /**
- * Open or create our jsonDatabase.  Assumes caller owns the mutex
+ * Decode the compact form of an evicted device.
  *
- * @return true on success (either opening existing or creating new)
+ * @param entry the evicted cache entry
+ * @return a new device, or NULL on failure.  Caller must destroy.
  */
-static bool jsonDatabaseInitializeNoLock()
+static icDevice *decodeEvictedDevice(const DeviceCacheEntry *entry)
 {
-    bool retval = false;
-    if (loadSystemProperties())
+    icDevice *device = NULL;
+
+    cJSON *json = cJSON_Parse(entry->evicted);
+    if (json != NULL)
+    {
+        icSerDesContext *context = serDesCreateContext();
+        serDesSetContextValue(context, "namespace", STORAGE_NAMESPACE);
+        device = deviceFromJSON(json, context, false);
+        serDesDestroyContext(context);
+        cJSON_Delete(json);
+    }
+
+    if (device == NULL)
     {
-        // Load devices
-        retval = loadDevices();
+        icLogError(LOG_TAG, "%s: unable to decode evicted device %s", __FUNCTION__, entry->uuid);
     }
     else
     {
-        // Intialize empty database
-        devices = hashMapCreate();
-        resourcesByUri = hashMapCreate();
-        jsonDatabaseSetSystemPropertyNoLock(JSON_DATABASE_SCHEMA_VERSION_KEY, JSON_DATABASE_CURRENT_SCHEMA_VERSION);
-        retval = true;
+        // Metadata may have been saved since the device was evicted
+        applyMetadataTable(device);
     }
-    return retval;
+
+    return device;
 }
 
 /**
- * Open or create our jsonDatabase.
+ * Get a cached device for reading, decoding it if it is evicted.  The device is not made resident,
+ * so scans over many devices do not churn the cache.  Assumes caller holds cacheLock.
  *
- * @return true on success (either opening existing or creating new)
+ * @param entry the cache entry
+ * @param decoded set to the decoded device when one had to be created, which the caller must destroy
+ * @return the device, or NULL if an evicted device could not be decoded
  */
-bool jsonDatabaseInitialize()
+static icDevice *borrowCachedDevice(const DeviceCacheEntry *entry, icDevice **decoded)
 {
-    bool retval = false;
-    // Take the lock to initialize things
-    pthread_mutex_lock(&mtx);
-    retval = jsonDatabaseInitializeNoLock();
-    pthread_mutex_unlock(&mtx);
+    *decoded = NULL;
+    if (entry->device != NULL)
+    {
+        return entry->device;
+    }
 
-    return retval;
+    *decoded = decodeEvictedDevice(entry);
+    return *decoded;
 }
 
 /**
- * HashMap free function for devices map
- * @param key the key
+ * Find the cache entry of a device by its uuid or any uri within it, including evicted devices.
+ * Assumes caller holds cacheLock.
+ *
+ * @param uuidOrUri a device uuid, or a device, endpoint, resource or metadata uri
+ * @return the cache entry or NULL if not found
+ */
+static DeviceCacheEntry *getDeviceCacheEntryByUuidOrUriNoLock(const char *uuidOrUri)
+{
+    // Every uri starts with the device's uuid as its first segment
+    const char *uuid = uuidOrUri[0] == '/' ? uuidOrUri + 1 : uuidOrUri;
+    size_t uuidLen = strcspn(uuid, "/");
+    if (uuidLen == 0 || uuidLen >= UINT16_MAX)
+    {
+        return NULL;
+    }
+
+    scoped_generic char *key = strndup(uuid, uuidLen);
+    return (DeviceCacheEntry *) hashMapGet(devices, key, (uint16_t) (uuidLen + 1));
+}
+
+/**
+ * Decode the device owning a uuid or uri if it is evicted.  Evicted devices have no locators, and a
+ * device can be evicted again after ensureDeviceResident, so uri lookups fall back to this when they
+ * find no locator.  Assumes caller holds cacheLock.
+ *
+ * @param uuidOrUri a device uuid, or a device, endpoint, resource or metadata uri
+ * @return the decoded device, or NULL if the owner is not found or is resident.  Caller must destroy.
+ */
+static icDevice *decodeEvictedOwnerNoLock(const char *uuidOrUri)
+{
+    DeviceCacheEntry *entry = NULL;
+    if (evictedDeviceCount > 0 && devices != NULL)
+    {
+        entry = getDeviceCacheEntryByUuidOrUriNoLock(uuidOrUri);
+    }
+
+    return entry != NULL && entry->device == NULL ? decodeEvictedDevice(entry) : NULL;
+}
+
+/**
+ * Find the resource or metadata with a uri in a list
+ *
+ * @param list a resource or metadata list
+ * @param locatorType LOCATOR_TYPE_RESOURCE or LOCATOR_TYPE_METADATA, the kind of items in list
+ * @param uri the uri to find
+ * @return the item or NULL if not found
+ */
+static void *findListItemByUri(icLinkedList *list, LocatorType locatorType, const char *uri)
+{
+    void *found = NULL;
+    icLinkedListIterator *iter = linkedListIteratorCreate(list);
+    while (found == NULL && linkedListIteratorHasNext(iter))
+    {
+        void *item = linkedListIteratorGetNext(iter);
+        const char *itemUri = locatorType == LOCATOR_TYPE_RESOURCE ? ((icDeviceResource *) item)->uri
+                                                                   : ((icDeviceMetadata *) item)->uri;
+        if (stringCompare(itemUri, uri, false) == 0)
+        {
+            found = item;
+        }
+    }
+    linkedListIteratorDestroy(iter);
+
+    return found;
+}
+
+/**
+ * Find the item with a uri in a device that has no locators, such as a decoded evicted device
+ *
+ * @param device the device
+ * @param locatorType the kind of item to find
+ * @param uri the uri to find
+ * @return the device, endpoint, resource or metadata, or NULL if the device has no such item
+ */
+static void *findDeviceItemByUri(icDevice *device, LocatorType locatorType, const char *uri)
+{
+    if (locatorType == LOCATOR_TYPE_DEVICE)
+    {
+        return stringCompare(device->uri, uri, false) == 0 ? device : NULL;
+    }
+
+    void *found = NULL;
+    if (locatorType != LOCATOR_TYPE_ENDPOINT)
+    {
+        icLinkedList *list = locatorType == LOCATOR_TYPE_RESOURCE ? device->resources : device->metadata;
+        found = findListItemByUri(list, locatorType, uri);
+    }
+
+    icLinkedListIterator *iter = linkedListIteratorCreate(device->endpoints);
+    while (found == NULL && linkedListIteratorHasNext(iter))
+    {
+        icDeviceEndpoint *endpoint = (icDeviceEndpoint *) linkedListIteratorGetNext(iter);
+        if (locatorType == LOCATOR_TYPE_ENDPOINT)
+        {
+            found = stringCompare(endpoint->uri, uri, false) == 0 ? endpoint : NULL;
+        }
+        else
+        {
+            icLinkedList *list = locatorType == LOCATOR_TYPE_RESOURCE ? endpoint->resources : endpoint->metadata;
+            found = findListItemByUri(list, locatorType, uri);
+        }
+    }
+    linkedListIteratorDestroy(iter);
+
+    return found;
+}
+
+/**
+ * Check whether a device that has no locators is, or holds the endpoint, resource or metadata with,
+ * a uri
+ *
+ * @param device the device
+ * @param uri the uri to find
+ * @return true if the device owns the uri
+ */
+static bool deviceOwnsUri(icDevice *device, const char *uri)
+{
+    bool owned = false;
+    for (LocatorType type = LOCATOR_TYPE_DEVICE; !owned && type <= LOCATOR_TYPE_METADATA; type++)
+    {
+        owned = findDeviceItemByUri(device, type, uri) != NULL;
+    }
+
+    return owned;
+}
+
+/**
+ * Find the endpoint that is, or holds the resource or metadata with, a uri in a device that has no
+ * locators
+ *
+ * @param device the device
+ * @param uri the uri to find
+ * @return the endpoint, or NULL if the uri is not on an endpoint of the device
+ */
+static icDeviceEndpoint *findEndpointOwningUri(icDevice *device, const char *uri)
+{
+    icDeviceEndpoint *found = NULL;
+    icLinkedListIterator *iter = linkedListIteratorCreate(device->endpoints);
+    while (found == NULL && linkedListIteratorHasNext(iter))
+    {
+        icDeviceEndpoint *endpoint = (icDeviceEndpoint *) linkedListIteratorGetNext(iter);
+        if (stringCompare(endpoint->uri, uri, false) == 0 ||
+            findListItemByUri(endpoint->resources, LOCATOR_TYPE_RESOURCE, uri) != NULL ||
+            findListItemByUri(endpoint->metadata, LOCATOR_TYPE_METADATA, uri) != NULL)
+        {
+            found = endpoint;
+        }
+    }
+    linkedListIteratorDestroy(iter);
+
+    return found;
+}
+
+/**
+ * Evict a resident, clean device to its compact serialized form.  Assumes caller owns writeMtx and
+ * the write side of cacheLock.
+ *
+ * @param entry the cache entry
+ * @return true if the device was evicted
+ */
+static bool evictEntryNoLock(DeviceCacheEntry *entry)
+{
+    if (entry->device == NULL || entry->dirty || entry->deferredUntilMillis != 0)
+    {
+        return false;
+    }
+
+    icSerDesContext *context = serDesCreateContext();
+    serDesSetContextValue(context, "namespace", STORAGE_NAMESPACE);
+    cJSON *json = deviceToJSON(entry->device, context);
+    entry->evicted = json != NULL ? cJSON_PrintUnformatted(json) : NULL;
+    cJSON_Delete(json);
+    serDesDestroyContext(context);
+
+    if (entry->evicted == NULL)
+    {
+        icLogWarn(LOG_TAG, "%s: unable to serialize device %s", __FUNCTION__, entry->uuid);
+        return false;
+    }
+
+    // Locators point into the device, so they go with it.  Index entries only point at the cache
+    // entry, which stays.
+    removeDeviceURIEntries(entry->device);
+    addDeviceIndexEntries(entry);
+    deviceDestroy(entry->device);
+    entry->device = NULL;
+
+    evictedDeviceCount++;
+    __atomic_add_fetch(&cacheEvictions, 1, __ATOMIC_RELAXED);
+
+    return true;
+}
+
+/**
+ * Bring resources up to the last sync times recorded in the sync table.  Assumes caller owns writeMtx
+ * and the write side of cacheLock.
+ *
+ * @param resources the resources to update
+ */
+static void applySyncTimesToResourcesNoLock(icLinkedList *resources)
+{
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(resources);
+    while (linkedListIteratorHasNext(iter))
+    {
+        icDeviceResource *resource = linkedListIteratorGetNext(iter);
+        uint64_t millis;
+        if (jsonDatabaseSyncTableGet(syncTable, resource->uri, &millis) && millis > resource->dateOfLastSyncMillis)
+        {
+            resource->dateOfLastSyncMillis = millis;
+        }
+    }
+}
+
+/**
+ * Bring a device loaded from storage up to the last sync times recorded in the sync table, if there
+ * is one.  Assumes caller owns writeMtx and the write side of cacheLock.
+ *
+ * @param device the device
+ */
+static void applySyncTimesNoLock(icDevice *device)
+{
+    if (syncTable == NULL || jsonDatabaseSyncTableGetCount(syncTable) == 0)
+    {
+        return;
+    }
+
+    applySyncTimesToResourcesNoLock(device->resources);
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(device->endpoints);
+    while (linkedListIteratorHasNext(iter))
+    {
+        icDeviceEndpoint *endpoint = linkedListIteratorGetNext(iter);
+        applySyncTimesToResourcesNoLock(endpoint->resources);
+    }
+}
+
+static void applySyncTimeVisitor(const char *uri, uint64_t dateOfLastSyncMillis, void *ctx)
+{
+    (void) ctx;
+
+    // Evicted devices are brought up to date as they are rehydrated
+    Locator *locator = (Locator *) hashMapGet(resourcesByUri, (void *) uri, strlen(uri) + 1);
+    if (locator != NULL && locator->locatorType == LOCATOR_TYPE_RESOURCE)
+    {
+        icDeviceResource *resource = locator->locator.resourceLocator.resource;
+        if (dateOfLastSyncMillis > resource->dateOfLastSyncMillis)
+        {
+            resource->dateOfLastSyncMillis = dateOfLastSyncMillis;
+        }
+    }
+}
+
+/**
+ * Bring every resident resource up to the last sync time recorded in the sync table, if there is one.
+ * Assumes caller owns writeMtx and the write side of cacheLock.
+ */
+static void applySyncTableNoLock(void)
+{
+    if (resourcesByUri != NULL)
+    {
+        jsonDatabaseSyncTableVisit(syncTable, applySyncTimeVisitor, NULL);
+    }
+}
+
+/**
+ * Remove an evicted device from the secondary indexes without decoding it.  Assumes caller owns
+ * writeMtx and the write side of cacheLock.
+ *
+ * @param entry the cache entry
+ */
+static void removeEvictedIndexEntries(const DeviceCacheEntry *entry)
+{
+    jsonDatabaseIndexRemoveId(devicesByClass, entry->uuid);
+    jsonDatabaseIndexRemoveId(devicesByDriver, entry->uuid);
+    jsonDatabaseIndexRemoveId(devicesByEndpointProfile, entry->uuid);
+    jsonDatabaseIndexRemoveId(devicesByMetadataId, entry->uuid);
+}
+
+/**
+ * Put a device into an evicted cache entry, making it resident.  Assumes caller owns writeMtx and the
+ * write side of cacheLock.
+ *
+ * @param entry the evicted cache entry
+ * @param device the device, which need not match the entry's record.  Ownership is taken.
+ * @return true if the device is resident
+ */
+static bool installEvictedDeviceNoLock(DeviceCacheEntry *entry, icDevice *device)
+{
+    // The device brings its own index entries
+    removeEvictedIndexEntries(entry);
+
+    entry->device = device;
+    if (!addDeviceURIEntries(entry))
+    {
+        // That took the index entries with it, so put them back and stay evicted
+        addDeviceIndexEntries(entry);
+        deviceDestroy(entry->device);
+        entry->device = NULL;
+        return false;
+    }
+
+    releaseEvictedRecord(entry);
+    evictedDeviceCount--;
+    if (entry->unverified)
+    {
+        entry->unverified = false;
+        unverifiedDeviceCount--;
+    }
+
+    // The sync table is only applied to resident devices when it is enabled
+    applySyncTimesNoLock(entry->device);
+
+    return true;
+}
+
+/**
+ * Make an evicted device resident again.  Devices from the cold start snapshot are reloaded from
+ * storage.  Assumes caller owns writeMtx and the write side of cacheLock.
+ *
+ * @param entry the cache entry
+ * @return true if the device is resident
+ */
+static bool rehydrateEntryNoLock(DeviceCacheEntry *entry)
+{
+    __atomic_store_n(&entry->lastAccessMillis, getMonotonicMillis(), __ATOMIC_RELAXED);
+    if (entry->device != NULL)
+    {
+        return true;
+    }
+
+    uint64_t startMillis = getMonotonicMillis();
+
+    icDevice *device = NULL;
+    if (entry->unverified)
+    {
+        // The snapshot may be stale, storage has the truth
+        device = loadStoredDevice(entry->uuid);
+        if (device == NULL)
+        {
+            icLogWarn(
+                LOG_TAG, "%s: unable to load device %s from storage, using its snapshot", __FUNCTION__, entry->uuid);
+        }
+    }
+    if (device == NULL)
+    {
+        device = decodeEvictedDevice(entry);
+    }
+
+    if (device == NULL || !installEvictedDeviceNoLock(entry, device))
+    {
+        return false;
+    }
+
+    uint64_t elapsedMillis = getMonotonicMillis() - startMillis;
+    __atomic_add_fetch(&cacheRehydrations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&rehydrateMillisTotal, elapsedMillis, __ATOMIC_RELAXED);
+    if (elapsedMillis > __atomic_load_n(&rehydrateMillisMax, __ATOMIC_RELAXED))
+    {
+        // Only writers get here, so there is no competing store
+        __atomic_store_n(&rehydrateMillisMax, elapsedMillis, __ATOMIC_RELAXED);
+    }
+
+    return true;
+}
+
+/**
+ * Make the device owning a uuid or uri resident, if it is evicted.  This never evicts, so locators
+ * found afterwards under the same locks stay valid.  Assumes caller owns writeMtx and the write side
+ * of cacheLock.
+ *
+ * @param uuidOrUri a device uuid, or a device, endpoint, resource or metadata uri
+ */
+static void rehydrateDeviceNoLock(const char *uuidOrUri)
+{
+    if (evictedDeviceCount > 0 && uuidOrUri != NULL)
+    {
+        DeviceCacheEntry *entry = getDeviceCacheEntryByUuidOrUriNoLock(uuidOrUri);
+        if (entry != NULL)
+        {
+            rehydrateEntryNoLock(entry);
+        }
+    }
+}
+
+static int compareLastAccess(const void *a, const void *b)
+{
+    uint64_t left = (*(DeviceCacheEntry *const *) a)->lastAccessMillis;
+    uint64_t right = (*(DeviceCacheEntry *const *) b)->lastAccessMillis;
+
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+/**
+ * Evict the least recently used clean devices while more than maxResidentDevices are resident.
+ * Eviction goes down to 90% of the limit so that a run of misses doesn't evict on every lookup.
+ * Assumes caller owns writeMtx and the write side of cacheLock.
+ *
+ * @param keep an entry that must stay resident (may be NULL)
+ */
+static void enforceCacheLimitNoLock(const DeviceCacheEntry *keep)
+{
+    uint32_t limit = maxResidentDevices;
+    uint32_t resident = devices != NULL ? hashMapCount(devices) - evictedDeviceCount : 0;
+    if (limit == 0 || resident <= limit)
+    {
+        return;
+    }
+
+    DeviceCacheEntry **candidates = calloc(resident, sizeof(DeviceCacheEntry *));
+    uint32_t candidateCount = 0;
+    icHashMapIterator *iter = hashMapIteratorCreate(devices);
+    while (hashMapIteratorHasNext(iter) && candidateCount < resident)
+    {
+        void *key;
+        uint16_t keyLen;
+        DeviceCacheEntry *entry;
+        hashMapIteratorGetNext(iter, &key, &keyLen, (void **) &entry);
+        if (entry != keep && entry->device != NULL && !entry->dirty && entry->deferredUntilMillis == 0)
+        {
+            candidates[candidateCount++] = entry;
+        }
+    }
+    hashMapIteratorDestroy(iter);
+
+    qsort(candidates, candidateCount, sizeof(DeviceCacheEntry *), compareLastAccess);
+
+    uint32_t target = limit - limit / 10;
+    for (uint32_t i = 0; i < candidateCount && resident > target; i++)
+    {
+        if (evictEntryNoLock(candidates[i]))
+        {
+            resident--;
+        }
+    }
+    free(candidates);
+
+    if (resident > limit)
+    {
+        // Everything else is dirty or deferred, it becomes eligible once flushed
+        icLogDebug(LOG_TAG,
+                   "%s: %" PRIu32 " devices resident, over the limit of %" PRIu32,
+                   __FUNCTION__,
+                   resident,
+                   limit);
+    }
+}
+
+/**
+ * Make sure the device owning a uuid or uri is resident before looking it up.  This is a no-op
+ * unless the cache is bounded.  Caller must not hold any lock.
+ *
+ * A device can in principle be evicted again between this and the caller's lookup, so lookups must
+ * still cope with evicted entries.
+ *
+ * @param uuidOrUri a device uuid, or a device, endpoint, resource or metadata uri
+ */
+static void ensureDeviceResident(const char *uuidOrUri)
+{
+    // Without a limit only devices from the cold start snapshot can be evicted
+    if (uuidOrUri == NULL || (__atomic_load_n(&maxResidentDevices, __ATOMIC_RELAXED) == 0 &&
+                              __atomic_load_n(&evictedDeviceCount, __ATOMIC_RELAXED) == 0))
+    {
+        return;
+    }
+
+    {
+        READ_LOCK_SCOPE(cacheLock);
+        DeviceCacheEntry *entry = devices != NULL ? getDeviceCacheEntryByUuidOrUriNoLock(uuidOrUri) : NULL;
+        if (entry == NULL)
+        {
+            return;
+        }
+        if (entry->device != NULL)
+        {
+            __atomic_store_n(&entry->lastAccessMillis, getMonotonicMillis(), __ATOMIC_RELAXED);
+            __atomic_add_fetch(&cacheHits, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    LOCK_SCOPE(writeMtx);
+    WRITE_LOCK_SCOPE(cacheLock);
+    DeviceCacheEntry *entry = devices != NULL ? getDeviceCacheEntryByUuidOrUriNoLock(uuidOrUri) : NULL;
+    if (entry != NULL && rehydrateEntryNoLock(entry))
+    {
+        enforceCacheLimitNoLock(entry);
+    }
+}
+
+typedef bool (*UriFilter)(const char *uri, void *ctx);
+
+/**
+ * Append clones of the resources or metadata in a list whose uris pass a filter
+ *
+ * @param items the list to append to
+ * @param list a resource or metadata list
+ * @param locatorType LOCATOR_TYPE_RESOURCE or LOCATOR_TYPE_METADATA, the kind of items in list
+ * @param filter the uri filter
+ * @param ctx context for the filter
+ */
+static void appendFilteredItemClones(icLinkedList *items,
+                                     icLinkedList *list,
+                                     LocatorType locatorType,
+                                     UriFilter filter,
+                                     void *ctx)
+{
+    icLinkedListIterator *iter = linkedListIteratorCreate(list);
+    while (linkedListIteratorHasNext(iter))
+    {
+        void *item = linkedListIteratorGetNext(iter);
+        if (locatorType == LOCATOR_TYPE_RESOURCE)
+        {
+            icDeviceResource *resource = item;
+            if (resource->uri != NULL && filter(resource->uri, ctx))
+            {
+                linkedListAppend(items, resourceClone(resource));
+            }
+        }
+        else
+        {
+            icDeviceMetadata *metadata = item;
+            if (metadata->uri != NULL && filter(metadata->uri, ctx))
+            {
+                linkedListAppend(items, metadataClone(metadata));
+            }
+        }
+    }
+    linkedListIteratorDestroy(iter);
+}
+
+/**
+ * Append clones of the resources or metadata of an evicted device whose uris pass a filter
+ *
+ * @param items the list to append to
+ * @param entry the cache entry, ignored unless it is evicted
+ * @param locatorType LOCATOR_TYPE_RESOURCE or LOCATOR_TYPE_METADATA
+ * @param filter the uri filter
+ * @param ctx context for the filter
+ */
+static void appendEvictedEntryItemClones(icLinkedList *items,
+                                         const DeviceCacheEntry *entry,
+                                         LocatorType locatorType,
+                                         UriFilter filter,
+                                         void *ctx)
+{
+    icDevice *device = entry->device == NULL ? decodeEvictedDevice(entry) : NULL;
+    if (device == NULL)
+    {
+        return;
+    }
+
+    appendFilteredItemClones(items,
+                             locatorType == LOCATOR_TYPE_RESOURCE ? device->resources : device->metadata,
+                             locatorType,
+                             filter,
+                             ctx);
+    icLinkedListIterator *iter = linkedListIteratorCreate(device->endpoints);
+    while (linkedListIteratorHasNext(iter))
+    {
+        icDeviceEndpoint *endpoint = (icDeviceEndpoint *) linkedListIteratorGetNext(iter);
+        appendFilteredItemClones(items,
+                                 locatorType == LOCATOR_TYPE_RESOURCE ? endpoint->resources : endpoint->metadata,
+                                 locatorType,
+                                 filter,
+                                 ctx);
+    }
+    linkedListIteratorDestroy(iter);
+    deviceDestroy(device);
+}
+
+/**
+ * Append clones of the resources or metadata of evicted devices whose uris pass a filter.  Evicted
+ * devices have no locators, so uri queries use this to see them without making them resident.
+ * Assumes caller holds cacheLock.
+ *
+ * @param items the list to append to
+ * @param locatorType LOCATOR_TYPE_RESOURCE or LOCATOR_TYPE_METADATA
+ * @param uuid only consider this device (may be NULL for all)
+ * @param filter the uri filter
+ * @param ctx context for the filter
+ */
+static void appendEvictedItemClones(icLinkedList *items,
+                                    LocatorType locatorType,
+                                    const char *uuid,
+                                    UriFilter filter,
+                                    void *ctx)
+{
+    if (evictedDeviceCount == 0 || (locatorType != LOCATOR_TYPE_RESOURCE && locatorType != LOCATOR_TYPE_METADATA))
+    {
+        return;
+    }
+
+    if (uuid != NULL)
+    {
+        DeviceCacheEntry *entry = hashMapGet(devices, (void *) uuid, strlen(uuid) + 1);
+        if (entry != NULL)
+        {
+            appendEvictedEntryItemClones(items, entry, locatorType, filter, ctx);
+        }
+        return;
+    }
+
+    icHashMapIterator *iter = hashMapIteratorCreate(devices);
+    while (hashMapIteratorHasNext(iter))
+    {
+        void *key;
+        uint16_t keyLen;
+        DeviceCacheEntry *entry;
+        hashMapIteratorGetNext(iter, &key, &keyLen, (void **) &entry);
+        appendEvictedEntryItemClones(items, entry, locatorType, filter, ctx);
+    }
+    hashMapIteratorDestroy(iter);
+}
+
+/**
+ * If systemProperty having any node with name CurrentBlacklistMd5 and currentBlacklistUrl,
+ * This function will replace them with CurrentDenylistMd5 and currentDenylistUrl and
+ * updating schemaVersion.
+ * @return true if successful, false otherwise
+ */
+static bool migrateSysPropFile()
+{
+    bool retval = false;
+    char *propertyValue = stringHashMapGet(systemProperties, JSON_DATABASE_SCHEMA_VERSION_KEY);
+    if (stringCompare(propertyValue, JSON_DATABASE_CURRENT_SCHEMA_VERSION, false) != 0)
+    {
+        char *blackListMd5value = NULL;
+        char *blackListUrlvalue = NULL;
+        if (jsonDatabaseGetSystemPropertyNoLock("currentBlacklistMd5", &blackListMd5value) == true)
+        {
+            stringHashMapPutCopy(systemProperties, CURRENT_DENYLIST_MD5, blackListMd5value);
+            stringHashMapDelete(systemProperties, "currentBlacklistMd5", NULL);
+        }
+        if (jsonDatabaseGetSystemPropertyNoLock("currentBlacklistUrl", &blackListUrlvalue) == true)
+        {
+            stringHashMapPutCopy(systemProperties, CURRENT_DENYLIST_URL, blackListUrlvalue);
+            stringHashMapDelete(systemProperties, "currentBlacklistUrl", NULL);
+        }
+        jsonDatabaseSetSystemPropertyNoLock(JSON_DATABASE_SCHEMA_VERSION_KEY, JSON_DATABASE_CURRENT_SCHEMA_VERSION);
+        retval = true;
+    }
+    return retval;
+}
+/**
+ * Load system properties from storage
+ * @return true if successful, false otherwise
+ */
+static bool loadSystemProperties()
+{
+    bool retval = false;
+    if (systemProperties == NULL)
+    {
+        systemProperties = stringHashMapCreate();
+    }
+
+    scoped_cJSON *body = NULL;
+    if ((body = storageLoadJSON(STORAGE_NAMESPACE, SYSTEM_PROPERTIES_KEY)) != NULL)
+    {
+        int count = cJSON_GetArraySize(body);
+        for (int i = 0; i < count; ++i)
+        {
+            cJSON *item = cJSON_GetArrayItem(body, i);
+            if (item->type == cJSON_String && item->valuestring != NULL)
+            {
+                stringHashMapPut(systemProperties, strdup(item->string), strdup(item->valuestring));
+            }
+            else
+            {
+                // We will still say we are successful, but log the error. Really not sure how this
+                // would ever happen
+                icLogWarn(LOG_TAG, "Skipping unreadable system property %s", item->string);
+            }
+        }
+        migrateSysPropFile();
+        retval = true;
+    }
+    else
+    {
+        icLogError(LOG_TAG, "Failed to parse system properties");
+    }
+
+    return retval;
+}
+
+struct LoaderContext
+{
+    bool permissive;
+};
+
+/**
+ * A device parsed from storage but not yet in the cache
+ */
+typedef struct
+{
+    icDevice *device;
+    bool foreignEncoding; // not in the configured storage encoding
+    bool unsealed;        // from before records were sealed, needs a checksum
+} ParsedDevice;
+
+/**
+ * Work shared by the device load workers.  Only `next` changes once the workers start.
+ */
+typedef struct
+{
+    pthread_mutex_t mtx;
+    size_t next;
+    size_t keyCount;
+    char **keys;
+    ParsedDevice *parsed;
+} DeviceLoadWork;
+
+/**
+ * Check a device record's checksum before spending any time parsing it.  Until every record has been
+ * sealed, records written before checksums were introduced have none and are accepted so they can be
+ * sealed.  After that a record without a checksum has lost its trailer, so it is treated as damaged.
+ * Reads deviceRecordsSealed, which does not change while the database is initializing.
+ *
+ * @param jsonData the record read from storage
+ * @param unsealed set to whether the record is an accepted record without a checksum
+ * @return false if the record is damaged
+ */
+static bool deviceRecordIsIntact(const char *jsonData, bool *unsealed)
+{
+    *unsealed = false;
+
+    switch (jsonDatabaseRecordVerify(jsonData))
+    {
+        case JSON_DATABASE_RECORD_CORRUPT:
+            icLogWarn(LOG_TAG, "%s: device record failed checksum verification", __FUNCTION__);
+            return false;
+
+        case JSON_DATABASE_RECORD_UNSEALED:
+            if (deviceRecordsSealed)
+            {
+                icLogWarn(LOG_TAG, "%s: device record has no checksum, it was likely cut short", __FUNCTION__);
+                return false;
+            }
+            *unsealed = true;
+            return true;
+
+        default:
+            return true;
+    }
+}
+
+/**
+ * Decode a device record from storage, in either encoding.  Reads compactStorageFormat, which does
+ * not change while the database is initializing.
+ *
+ * @param record the record read from storage
+ * @param permissive whether to leave out invalid endpoints, resources and metadata rather than failing
+ * @param foreignEncoding set to whether the record is not in the configured encoding
+ * @return the device, or NULL if it can't be decoded.  Caller must destroy.
+ */
+static icDevice *decodeStoredDevice(const char *record, bool permissive, bool *foreignEncoding)
+{
+    icDevice *device = NULL;
+    bool compact = jsonDatabaseCompactRecordIsCompact(record);
+
+    *foreignEncoding = compact != compactStorageFormat;
+
+    if (compact)
+    {
+        device = jsonDatabaseCompactRecordDecode(record, STORAGE_NAMESPACE, permissive);
+    }
+    else
+    {
+        cJSON *json = cJSON_Parse(record);
+        if (json != NULL)
+        {
+            icSerDesContext *context = serDesCreateContext();
+            serDesSetContextValue(context, "namespace", STORAGE_NAMESPACE);
+
+            device = deviceFromJSON(json, context, permissive);
+
+            // Cleanup
+            cJSON_Delete(json);
+            serDesDestroyContext(context);
+        }
+    }
+
+    return device;
+}
+
+/**
+ * Parse a device from storage without touching the cache, so it is safe to call from any thread.
+ *
+ * @param jsonData the record read from storage
+ * @param ctx the ParsedDevice to fill in
+ * @return whether the device was parsed successfully
+ */
+static bool parseDevice(const char *jsonData, void *ctx)
+{
+    ParsedDevice *parsed = ctx;
+
+    if (!deviceRecordIsIntact(jsonData, &parsed->unsealed))
+    {
+        return false;
+    }
+
+    parsed->device = decodeStoredDevice(jsonData, false, &parsed->foreignEncoding);
+
+    return parsed->device != NULL;
+}
+
+/**
+ * Load a device from storage without touching the cache, along with its metadata record.  Assumes
+ * caller owns writeMtx, so storage matches what was last written.
+ *
+ * @param uuid the device
+ * @return the device, or NULL if it is not in storage or can't be parsed.  Caller must destroy.
+ */
+static icDevice *loadStoredDevice(const char *uuid)
+{
+    ParsedDevice parsed = {0};
+    const StorageCallbacks callback = {.parse = parseDevice, .parserCtx = &parsed};
+
+    // The last write may still be waiting for a group commit
+    deviceStorageCommitSettle(STORAGE_NAMESPACE, uuid);
+    storageParse(STORAGE_NAMESPACE, uuid, &callback);
+
+    if (parsed.device != NULL)
+    {
+        // Until the reconciler has read them all, look for the device's metadata record ourselves
+        if (!metadataRecordsLoaded)
+        {
+            loadMetadataRecord(uuid);
+        }
+        applyMetadataTable(parsed.device);
+    }
+
+    return parsed.device;
+}
+
+/**
+ * Merge a parsed device into our in-memory cache.  Assumes caller owns writeMtx and the write side
+ * of cacheLock.
+ *
+ * @param parsed the device to merge, ownership of the device is taken
+ * @return whether the device was loaded into the cache successfully.
+ */
+static bool cacheParsedDevice(ParsedDevice *parsed)
+{
+    icDevice *device = parsed->device;
+    parsed->device = NULL;
+
+    applyMetadataTable(device);
+    if (!loadDeviceIntoCache(device))
+    {
+        // If loadDeviceIntoCache fails it cleans up the device as well
+        return false;
+    }
+
+    if (parsed->foreignEncoding || parsed->unsealed)
+    {
+        // Record from before the storage encoding was changed or before records were sealed, rewrite
+        // it after loading
+        DeviceCacheEntry *entry =
+            (DeviceCacheEntry *) hashMapGet(devices, (void *) device->uuid, strlen(device->uuid) + 1);
+        if (entry != NULL)
+        {
+            markDeviceDirtyNoLock(entry);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Load a device from storage into our in-memory cache
+ * @param jsonData a valid JSON document to load
+ * @return whether the device was loaded into the cache successfully.
+ */
+static bool loadDevice(const char *jsonData, void *ctx)
+{
+    icDevice *device = NULL;
+    bool permissive = false;
+
+    struct LoaderContext *loaderContext = ctx;
+    if (loaderContext != NULL)
+    {
+        permissive = loaderContext->permissive;
+    }
+
+    ParsedDevice parsed = {0};
+
+    // Permissive loading is the last resort, take whatever can be salvaged
+    if (!deviceRecordIsIntact(jsonData, &parsed.unsealed) && !permissive)
+    {
+        return false;
+    }
+
+    parsed.device = decodeStoredDevice(jsonData, permissive, &parsed.foreignEncoding);
+    device = parsed.device;
+
+    if (device != NULL && !cacheParsedDevice(&parsed))
+    {
+        // The device has been cleaned up, so return NULL to the caller
+        device = NULL;
+    }
+
+    return device != NULL;
+}
+
+/**
+ * Device load worker: read and parse device files until there are none left.
+ *
+ * @param arg the DeviceLoadWork
+ */
+static void *deviceLoadWorkerThreadProc(void *arg)
+{
+    DeviceLoadWork *work = arg;
+
+    while (true)
+    {
+        pthread_mutex_lock(&work->mtx);
+        size_t i = work->next++;
+        pthread_mutex_unlock(&work->mtx);
+
+        if (i >= work->keyCount)
+        {
+            break;
+        }
+
+        const StorageCallbacks callback = {.parse = parseDevice, .parserCtx = &work->parsed[i]};
+        storageParse(STORAGE_NAMESPACE, work->keys[i], &callback);
+    }
+
+    return NULL;
+}
+
+/**
+ * Read and parse the given device files, fanned out across up to loadWorkerCount threads.  Nothing is
+ * put into the cache here.
+ *
+ * @param keys the device storage keys
+ * @param keyCount the number of keys
+ * @return the parsed devices, in key order.  Devices that failed to parse are NULL.  Caller must free.
+ */
+static ParsedDevice *parseDevices(char **keys, size_t keyCount)
+{
+    DeviceLoadWork work = {.mtx = PTHREAD_MUTEX_INITIALIZER,
+                           .next = 0,
+                           .keyCount = keyCount,
+                           .keys = keys,
+                           .parsed = calloc(keyCount, sizeof(ParsedDevice))};
+
+    size_t workerCount = loadWorkerCount < keyCount ? loadWorkerCount : keyCount;
+    pthread_t workers[UINT8_MAX];
+    size_t started = 0;
+
+    // This thread is a worker too
+    for (; started + 1 < workerCount; started++)
+    {
+        if (!createThread(&workers[started], deviceLoadWorkerThreadProc, &work, "jsonDbLoad"))
+        {
+            break;
+        }
+    }
+
+    deviceLoadWorkerThreadProc(&work);
+
+    for (size_t i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&work.mtx);
+
+    return work.parsed;
+}
+
+/**
+ * Create the device cache maps and indexes, if they don't exist yet
+ */
+static void createCacheMaps(void)
+{
+    if (devices == NULL)
+    {
+        devices = hashMapCreate();
+    }
+    if (resourcesByUri == NULL)
+    {
+        resourcesByUri = hashMapCreate();
+    }
+    if (uriTrie == NULL)
+    {
+        uriTrie = jsonDatabaseUriTrieCreate();
+    }
+    createIndexes();
+
+    LOCK_SCOPE(metadataMtx);
+    if (metadataTable == NULL)
+    {
+        metadataTable = jsonDatabaseMetadataTableCreate();
+    }
+}
+
+/**
+ * Load all devices from storage into our in memory cache.  Device files are read and parsed in parallel
+ * when more than one load worker is configured; merging into the cache is always done on this thread
+ * and in key order.  Assumes caller owns writeMtx and the write side of cacheLock.
+ *
+ * @return true if success, false otherwise
+ */
+static bool loadDevices()
+{
+    bool retval = true;
+    createCacheMaps();
+
+    uint64_t startMillis = getMonotonicMillis();
+
+    icLinkedList *keys = storageGetKeys(STORAGE_NAMESPACE);
+    icLinkedListIterator *iter = linkedListIteratorCreate(keys);
+
+    size_t keyCount = 0;
+    char **deviceKeys = calloc(linkedListCount(keys) + 1, sizeof(char *));
+
+    while (linkedListIteratorHasNext(iter))
+    {
+        char *key = (char *) linkedListIteratorGetNext(iter);
+        scoped_generic char *metadataUuid = key != NULL ? getMetadataRecordUuid(key) : NULL;
+        if (metadataUuid != NULL)
+        {
+            // Metadata records are applied to their devices as those are cached
+            loadMetadataRecord(metadataUuid);
+        }
+        else if (key != NULL && strcmp(key, SYSTEM_PROPERTIES_KEY) != 0)
+        {
+            deviceKeys[keyCount++] = key;
+        }
+    }
+    linkedListIteratorDestroy(iter);
+    metadataRecordsLoaded = true;
+
+    ParsedDevice *parsed = NULL;
+    if (loadWorkerCount > 1 && keyCount > 1)
+    {
+        parsed = parseDevices(deviceKeys, keyCount);
+    }
+
+    uint64_t parsedMillis = getMonotonicMillis();
+
+    const StorageCallbacks strictDeviceCallback = {.parse = loadDevice, .parserCtx = NULL};
+
+    struct LoaderContext permissiveCtx = {.permissive = true};
+
+    const StorageCallbacks permissiveDeviceCallback = {.parse = loadDevice, .parserCtx = &permissiveCtx};
+
+    uint32_t loaded = 0;
+    for (size_t i = 0; i < keyCount; i++)
+    {
+        char *key = deviceKeys[i];
+        bool didLoad = false;
+
+        if (parsed == NULL)
+        {
+            didLoad = storageParse(STORAGE_NAMESPACE, key, &strictDeviceCallback);
+        }
+        else if (parsed[i].device != NULL)
+        {
+            didLoad = cacheParsedDevice(&parsed[i]);
+            if (!didLoad)
+            {
+                // The worker's storageParse only falls back to the backup file when parsing fails.  Retry like
+                // the serial path does, so a merge failure reaches the backup file too.
+                didLoad = storageParse(STORAGE_NAMESPACE, key, &strictDeviceCallback);
+            }
+        }
+
+        if (didLoad == false)
+        {
+            // Notify someone that a device couldn't load. It might recover, but it should always be checked out.
+            sendDeviceDatabaseFailureEvent(B_CORE_DEVICE_DATABASE_FAILURE_TYPE_DEVICE_LOAD_FAILURE, key);
+
+            if (storageParseBad(STORAGE_NAMESPACE, key, &permissiveDeviceCallback) == true)
+            {
+                icLogInfo(LOG_TAG, "Successfully recovered device %s", key);
+                didLoad = true;
+            }
+        }
+
+        if (didLoad)
+        {
+            loaded++;
+        }
+    }
+
+    if (parsed != NULL)
+    {
+        icLogDebug(LOG_TAG,
+                   "%s: read %zu devices in %" PRIu64 "ms with %" PRIu8 " workers",
+                   __FUNCTION__,
+                   keyCount,
+                   parsedMillis - startMillis,
+                   loadWorkerCount);
+    }
+
+    icLogInfo(LOG_TAG,
+              "%s: loaded %" PRIu32 " of %zu devices in %" PRIu64 "ms",
+              __FUNCTION__,
+              loaded,
+              keyCount,
+              getMonotonicMillis() - startMillis);
+
+    free(parsed);
+    free(deviceKeys);
+    linkedListDestroy(keys, NULL);
+
+    return retval;
+}
+
+static void *snapshotReconcilerThreadProc(void *arg);
+
+/**
+ * Put a device from the cold start snapshot into the cache as an evicted, unverified entry.  Assumes
+ * caller owns writeMtx and the write side of cacheLock.
+ *
+ * @param snapshotDevice the device
+ * @param ctx a uint32_t counting the devices put into the cache
+ */
+static void cacheSnapshotDevice(const JsonDatabaseSnapshotDevice *snapshotDevice, void *ctx)
+{
+    uint32_t *cached = ctx;
+
+    DeviceCacheEntry *entry = calloc(1, sizeof(DeviceCacheEntry));
+    entry->uuid = strdup(snapshotDevice->uuid);
+    // The record stays in the snapshot.  A last access of 0 makes these the first to evict.
+    entry->evicted = (char *) snapshotDevice->record;
+    entry->unverified = true;
+
+    if (!hashMapPut(devices, entry->uuid, (uint16_t) (strlen(entry->uuid) + 1), entry))
+    {
+        icLogWarn(LOG_TAG, "%s: ignoring duplicate device %s", __FUNCTION__, entry->uuid);
+        free(entry->uuid);
+        free(entry);
+        return;
+    }
+
+    jsonDatabaseIndexAdd(devicesByClass, snapshotDevice->deviceClass, entry->uuid, entry);
+    jsonDatabaseIndexAdd(devicesByDriver, snapshotDevice->managingDeviceDriver, entry->uuid, entry);
+
+    const char *profile = snapshotDevice->endpointProfiles;
+    for (uint32_t i = 0; i < snapshotDevice->endpointProfileCount; i++, profile += strlen(profile) + 1)
+    {
+        jsonDatabaseIndexAdd(devicesByEndpointProfile, profile, entry->uuid, entry);
+    }
+
+    const char *metadataId = snapshotDevice->metadataIds;
+    for (uint32_t i = 0; i < snapshotDevice->metadataIdCount; i++, metadataId += strlen(metadataId) + 1)
+    {
+        jsonDatabaseIndexAdd(devicesByMetadataId, metadataId, entry->uuid, entry);
+    }
+
+    evictedDeviceCount++;
+    unverifiedDeviceCount++;
+    (*cached)++;
+}
+
+/**
+ * Load devices from the cold start snapshot instead of storage, if there is a usable snapshot.  Nothing
+ * is parsed: the devices are cached evicted, and the reconciler thread checks them against storage
+ * afterwards.  Assumes caller owns writeMtx and the write side of cacheLock.
+ *
+ * @return true if the devices were loaded from the snapshot
+ */
+static bool loadSnapshotNoLock(void)
+{
+    if (snapshotPath == NULL)
+    {
+        return false;
+    }
+
+    uint64_t startMillis = getMonotonicMillis();
+
+    coldSnapshot = jsonDatabaseSnapshotOpen(snapshotPath);
+    if (coldSnapshot == NULL)
+    {
+        return false;
+    }
+
+    createCacheMaps();
+
+    uint32_t cached = 0;
+    jsonDatabaseSnapshotVisit(coldSnapshot, cacheSnapshotDevice, &cached);
+
+    reconcilerStopRequested = false;
+    reconcilerStarted = createThread(&reconcilerThread, snapshotReconcilerThreadProc, NULL, "jsonDbReconcile");
+    if (!reconcilerStarted)
+    {
+        icLogWarn(
+            LOG_TAG, "%s: unable to start the reconciler, devices will be checked as they are used", __FUNCTION__);
+    }
+
+    icLogInfo(LOG_TAG,
+              "%s: loaded %" PRIu32 " devices from snapshot %s in %" PRIu64 "ms",
+              __FUNCTION__,
+              cached,
+              snapshotPath,
+              getMonotonicMillis() - startMillis);
+
+    return true;
+}
+
+/**
+ * Render a JSON record for storage in the configured encoding.  Assumes caller owns writeMtx.
+ *
+ * @param body the JSON record
+ * @return the encoded record, caller must free
+ */
+static char *printStorageJSON(const cJSON *body)
+{
+    return compactStorageFormat ? cJSON_PrintUnformatted(body) : cJSON_Print(body);
+}
+
+/**
+ * Flush system properties to storage
+ * @return true if success, false otherwise
+ */
+static bool saveSystemProperties()
+{
+    bool didSave = true;
+    cJSON *body = stringHashMapToJson(systemProperties);
+    char *toWrite = printStorageJSON(body);
+    if (!deviceStorageCommitSave(STORAGE_NAMESPACE, SYSTEM_PROPERTIES_KEY, toWrite))
+    {
+        didSave = false;
+        icLogError(LOG_TAG, "Failed to write system properties");
+    }
+    // Cleanup
+    free(toWrite);
+    cJSON_Delete(body);
+
+    return didSave;
+}
+
+/**
+ * Flush a device to storage as a checksummed record in the configured encoding
+ *
+ * @param device the device to write
+ * @return true if success, false otherwise
+ */
+static bool saveDevice(icDevice *device)
+{
+    icSerDesContext *context = serDesCreateContext();
+    bool didSave = true;
+
+    serDesSetContextValue(context, "namespace", STORAGE_NAMESPACE);
+
+    cJSON *body = NULL;
+    scoped_generic char *encoded = NULL;
+    if (compactStorageFormat)
+    {
+        encoded = jsonDatabaseCompactRecordEncode(device, STORAGE_NAMESPACE);
+    }
+    else
+    {
+        body = deviceToJSON(device, context);
+        encoded = printStorageJSON(body);
+    }
+    char *toWrite = jsonDatabaseRecordSeal(encoded);
+
+    if (!deviceStorageCommitSave(STORAGE_NAMESPACE, device->uuid, toWrite))
+    {
+        didSave = false;
+        icLogError(LOG_TAG, "Failed to write device %s", device->uuid);
+    }
+    else
+    {
+        snapshotStale = true;
+        if (hasMetadataEntry(device->uuid))
+        {
+            // The device record has the latest metadata now.  It must be in storage before the metadata
+            // record goes, or a crash in between could lose the metadata.
+            deviceStorageCommitSettle(STORAGE_NAMESPACE, device->uuid);
+            dropMetadataRecordNoLock(device->uuid);
+        }
+    }
+    // Cleanup
+    free(toWrite);
+    cJSON_Delete(body);
+    serDesDestroyContext(context);
+
+    return didSave;
+}
+
+/**
+ * Mark a device as needing to be written to storage.  Assumes caller owns writeMtx.
+ *
+ * @param entry the cache entry of the changed device
+ */
+static void markDeviceDirtyNoLock(DeviceCacheEntry *entry)
+{
+    if (!entry->dirty)
+    {
+        entry->dirty = true;
+        if (dirtyDeviceCount++ == 0)
+        {
+            oldestDirtyMillis = getMonotonicMillis();
+        }
+    }
+}
+
+/**
+ * Mark a device as matching what is in storage.  Assumes caller owns writeMtx.
+ *
+ * @param entry the cache entry of the device
+ */
+static void markDeviceCleanNoLock(DeviceCacheEntry *entry)
+{
+    if (entry->dirty)
+    {
+        entry->dirty = false;
+        dirtyDeviceCount--;
+    }
+
+    // Whatever was deferred is in storage now too
+    if (entry->deferredUntilMillis != 0)
+    {
+        entry->deferredUntilMillis = 0;
+        deferredDeviceCount--;
+    }
+}
+
+/**
+ * Wake the write-behind flusher so it writes out dirty devices now instead of at its next interval.
+ */
+static void requestFlush(void)
+{
+    pthread_mutex_lock(&flusherMtx);
+    flushRequested = true;
+    pthread_cond_signal(&flusherCond);
+    pthread_mutex_unlock(&flusherMtx);
+}
+
+/**
+ * Write every dirty device to storage.  Assumes caller owns writeMtx; the cache lock is not required
+ * since no other writer can run.
+ *
+ * @return true if all dirty devices were written, false otherwise
+ */
+static bool writeDirtyDevicesNoLock(void)
+{
+    bool didFlush = true;
+
+    if (devices == NULL || dirtyDeviceCount == 0)
+    {
+        return true;
+    }
+
+    uint64_t startMillis = getMonotonicMillis();
+    uint64_t waitedMillis = startMillis - oldestDirtyMillis;
+    uint32_t written = 0;
+
+    icHashMapIterator *iter = hashMapIteratorCreate(devices);
+    while (hashMapIteratorHasNext(iter))
+    {
+        char *deviceUuid;
+        uint16_t keyLen;
+        DeviceCacheEntry *deviceCacheEntry;
+        hashMapIteratorGetNext(iter, (void **) &deviceUuid, &keyLen, (void **) &deviceCacheEntry);
+
+        if (deviceCacheEntry->dirty)
+        {
+            if (saveDevice(deviceCacheEntry->device))
+            {
+                markDeviceCleanNoLock(deviceCacheEntry);
+                written++;
+            }
+            else
+            {
+                icLogError(LOG_TAG, "%s: device save for %s failed!", __FUNCTION__, deviceCacheEntry->device->uuid);
+                didFlush = false;
+            }
+        }
+    }
+    hashMapIteratorDestroy(iter);
+
+    if (dirtyDeviceCount > 0)
+    {
+        // Whatever failed will be retried on the next flush
+        oldestDirtyMillis = startMillis;
+    }
+
+    icLogDebug(LOG_TAG,
+               "%s: wrote %" PRIu32 " devices in %" PRIu64 "ms, oldest change waited %" PRIu64 "ms",
+               __FUNCTION__,
+               written,
+               getMonotonicMillis() - startMillis,
+               waitedMillis);
+
+    return didFlush;
+}
+
+/**
+ * Write every dirty device to storage and, once they are all written, compact the journal since the
+ * snapshots now include everything it recorded.  Assumes caller owns writeMtx.
+ *
+ * @return true if all dirty devices were written, false otherwise
+ */
+static bool flushDirtyDevicesNoLock(void)
+{
+    bool didFlush = writeDirtyDevicesNoLock();
+
+    // The records can only go once the snapshots are in storage, not just queued for a group commit
+    if (didFlush && jsonDatabaseJournalGetRecordCount(journal) > 0 && deviceStorageCommitFlush(STORAGE_NAMESPACE))
+    {
+        uint32_t records = jsonDatabaseJournalGetRecordCount(journal);
+        if (jsonDatabaseJournalTruncate(journal))
+        {
+            icLogDebug(LOG_TAG, "%s: compacted %" PRIu32 " journal records", __FUNCTION__, records);
+        }
+    }
+
+    return didFlush;
+}
+
+/**
+ * Journal records are replayed over the device snapshots, so a snapshot must never be newer than a
+ * record.  Call before writing or deleting a snapshot outside of a flush.  Assumes caller owns writeMtx.
+ */
+static void settleJournalNoLock(void)
+{
+    if (jsonDatabaseJournalGetRecordCount(journal) > 0)
+    {
+        flushDirtyDevicesNoLock();
+    }
+}
+
+/**
+ * Account for journal records just appended for a device, compacting the journal once it is full.
+ * Assumes caller owns writeMtx.
+ *
+ * @param entry the cache entry of the device the records belong to
+ */
+static void journaledDeviceNoLock(DeviceCacheEntry *entry)
+{
+    // The snapshot is stale until the next compaction
+    markDeviceDirtyNoLock(entry);
+
+    if (journalMaxRecords > 0 && jsonDatabaseJournalGetRecordCount(journal) >= journalMaxRecords)
+    {
+        flushDirtyDevicesNoLock();
+    }
+}
+
+/**
+ * Record a resource update in the journal instead of rewriting its device.  Assumes caller owns writeMtx.
+ *
+ * @param entry the cache entry of the device owning the resource
+ * @param resource the updated (cached) resource
+ * @return true if the update was journaled, false if the caller must save the device instead
+ */
+static bool journalResourceNoLock(DeviceCacheEntry *entry, const icDeviceResource *resource)
+{
+    // Sensitive values are only ever stored protected, which the journal doesn't do
+    if (journal == NULL || (resource->mode & RESOURCE_MODE_SENSITIVE) != 0)
+    {
+        return false;
+    }
+
+    if (!jsonDatabaseJournalAppend(journal, resource))
+    {
+        return false;
+    }
+
+    journaledDeviceNoLock(entry);
+
+    return true;
+}
+
+/**
+ * Record several updates to one device's resources in the journal, with a single sync, instead of
+ * rewriting the device.  Assumes caller owns writeMtx.
+ *
+ * @param entry the cache entry of the device owning the resources
+ * @param resources the updated (cached) icDeviceResources
+ * @return true if every update was journaled, false if the caller must save the device instead
+ */
+static bool journalResourcesNoLock(DeviceCacheEntry *entry, icLinkedList *resources)
+{
+    if (journal == NULL)
+    {
+        return false;
+    }
+
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(resources);
+    while (linkedListIteratorHasNext(iter))
+    {
+        const icDeviceResource *resource = linkedListIteratorGetNext(iter);
+        // Sensitive values are only ever stored protected, which the journal doesn't do
+        if ((resource->mode & RESOURCE_MODE_SENSITIVE) != 0)
+        {
+            return false;
+        }
+    }
+
+    if (!jsonDatabaseJournalAppendAll(journal, resources))
+    {
+        return false;
+    }
+
+    journaledDeviceNoLock(entry);
+
+    return true;
+}
+
+/**
+ * Apply a replayed journal record to the cache.  Assumes caller owns writeMtx and the write side of cacheLock.
+ */
+static void replayJournalRecord(const icDeviceResource *record, void *ctx)
+{
+    (void) ctx;
+
+    rehydrateDeviceNoLock(record->uri);
+    Locator *locator = (Locator *) hashMapGet(resourcesByUri, record->uri, strlen(record->uri) + 1);
+    if (locator == NULL || locator->locatorType != LOCATOR_TYPE_RESOURCE)
+    {
+        // The resource (or its device) has gone away since this was recorded
+        icLogDebug(LOG_TAG, "%s: ignoring journal record for unknown resource %s", __FUNCTION__, record->uri);
+        return;
+    }
+
+    icDeviceResource *dbResource = locator->locator.resourceLocator.resource;
+    free(dbResource->value);
+    dbResource->value = record->value != NULL ? strdup(record->value) : NULL;
+    dbResource->cachingPolicy = record->cachingPolicy;
+    dbResource->mode = record->mode;
+    dbResource->dateOfLastSyncMillis = record->dateOfLastSyncMillis;
+
+    markDeviceDirtyNoLock(locator->locator.resourceLocator.deviceCacheEntry);
+}
+
+/**
+ * Apply any journal records on top of the freshly loaded snapshots.  Assumes caller owns writeMtx
+ * and the write side of cacheLock.
+ *
+ * @return the number of records applied
+ */
+static uint32_t replayJournalNoLock(void)
+{
+    uint32_t replayed = 0;
+
+    if (journal != NULL && resourcesByUri != NULL)
+    {
+        replayed = jsonDatabaseJournalReplay(journal, replayJournalRecord, NULL);
+        if (replayed > 0)
+        {
+            icLogInfo(LOG_TAG, "Replayed %" PRIu32 " journal records", replayed);
+        }
+    }
+
+    return replayed;
+}
+
+/**
+ * Persist a changed device.  With write-behind enabled the device is only marked dirty and is left
+ * for the flusher thread, otherwise it is written to storage right away.  Assumes caller owns writeMtx.
+ *
+ * @param entry the cache entry of the changed device
+ * @return true if the device was written or queued for writing, false otherwise
+ */
+static bool commitDeviceNoLock(DeviceCacheEntry *entry)
+{
+    bool didCommit = true;
+
+    markDeviceDirtyNoLock(entry);
+
+    if (writeBehindIntervalMillis > 0)
+    {
+        if (writeBehindMaxDirtyDevices > 0 && dirtyDeviceCount >= writeBehindMaxDirtyDevices)
+        {
+            requestFlush();
+        }
+    }
+    else
+    {
+        settleJournalNoLock();
+        didCommit = saveDevice(entry->device);
+        if (didCommit)
+        {
+            markDeviceCleanNoLock(entry);
+        }
+    }
+
+    return didCommit;
+}
+
+static void deferredWriteTaskFunc(void *arg);
+
+/**
+ * Apply a resource's persistence policy to a change of it.  Assumes caller owns writeMtx.
+ *
+ * @param entry the cache entry of the device owning the resource
+ * @param resource the changed (cached) resource
+ * @return true if the policy took care of the change, false if the caller must persist it as usual
+ */
+static bool deferResourceWriteNoLock(DeviceCacheEntry *entry, const icDeviceResource *resource)
+{
+    uint64_t deadlineMillis;
+
+    switch (resource->persistencePolicy)
+    {
+        case PERSISTENCE_POLICY_MEMORY_ONLY:
+            return true;
+
+        case PERSISTENCE_POLICY_ON_SHUTDOWN:
+            deadlineMillis = UINT64_MAX;
+            break;
+
+        case PERSISTENCE_POLICY_COALESCE:
+            deadlineMillis = getMonotonicMillis() + (uint64_t) resource->persistIntervalSecs * 1000;
+            break;
+
+        case PERSISTENCE_POLICY_ALWAYS:
+        default:
+            return false;
+    }
+
+    if (entry->deferredUntilMillis == 0)
+    {
+        deferredDeviceCount++;
+        entry->deferredUntilMillis = deadlineMillis;
+    }
+    else if (deadlineMillis < entry->deferredUntilMillis)
+    {
+        entry->deferredUntilMillis = deadlineMillis;
+    }
+
+    if (deadlineMillis != UINT64_MAX)
+    {
+        deviceStorageCommitScheduleTaskNoLock(&deferredWriteTask, entry->deferredUntilMillis, deferredWriteTaskFunc);
+    }
+
+    return true;
+}
+
+/**
+ * Commit devices whose deferred changes are due and schedule the next check.  Assumes caller owns writeMtx.
+ *
+ * @param promoteAll commit every device with a deferred change, due or not
+ */
+static void commitDeferredDevicesNoLock(bool promoteAll)
+{
+    if (devices == NULL || deferredDeviceCount == 0)
+    {
+        return;
+    }
+
+    uint64_t now = getMonotonicMillis();
+    uint64_t nextDeadlineMillis = UINT64_MAX;
+
+    icHashMapIterator *iter = hashMapIteratorCreate(devices);
+    while (hashMapIteratorHasNext(iter))
+    {
+        void *key;
+        uint16_t keyLen;
+        DeviceCacheEntry *entry;
+        hashMapIteratorGetNext(iter, &key, &keyLen, (void **) &entry);
+
+        if (entry->deferredUntilMillis == 0)
+        {
+            continue;
+        }
+
+        if (promoteAll || entry->deferredUntilMillis <= now)
+        {
+            // Committing marks it clean, which also ends the deferral
+            commitDeviceNoLock(entry);
+        }
+        else if (entry->deferredUntilMillis < nextDeadlineMillis)
+        {
+            nextDeadlineMillis = entry->deferredUntilMillis;
+        }
+    }
+    hashMapIteratorDestroy(iter);
+
+    if (nextDeadlineMillis != UINT64_MAX)
+    {
+        deviceStorageCommitScheduleTaskNoLock(&deferredWriteTask, nextDeadlineMillis, deferredWriteTaskFunc);
+    }
+}
+
+static void deferredWriteTaskFunc(void *arg)
+{
+    (void) arg;
+
+    pthread_mutex_lock(&writeMtx);
+    deferredWriteTask.handle = 0;
+    commitDeferredDevicesNoLock(false);
+    pthread_mutex_unlock(&writeMtx);
+}
+
+/**
+ * Write out the sync table if it changed since the last checkpoint.  Assumes caller owns writeMtx.
+ */
+static void checkpointSyncTableNoLock(void)
+{
+    if (syncTable != NULL && jsonDatabaseSyncTableIsDirty(syncTable) && !jsonDatabaseSyncTableCheckpoint(syncTable))
+    {
+        icLogWarn(LOG_TAG, "%s: failed to checkpoint resource sync times", __FUNCTION__);
+    }
+}
+
+static void syncCheckpointTaskFunc(void *arg)
+{
+    (void) arg;
+
+    pthread_mutex_lock(&writeMtx);
+    syncCheckpointTask = 0;
+    checkpointSyncTableNoLock();
+    pthread_mutex_unlock(&writeMtx);
+}
+
+/**
+ * Record a resource's last sync time in the sync table instead of rewriting its device.  Assumes
+ * caller owns writeMtx.
+ *
+ * @param resource the synced (cached) resource
+ * @return true if the sync table took care of it, false if the caller must persist it as usual
+ */
+static bool recordSyncTimeNoLock(const icDeviceResource *resource)
+{
+    // Resources that are never persisted don't get a sync time persisted either
+    if (syncTable == NULL || resource->persistencePolicy == PERSISTENCE_POLICY_MEMORY_ONLY)
+    {
+        return false;
+    }
+
+    jsonDatabaseSyncTablePut(syncTable, resource->uri, resource->dateOfLastSyncMillis);
+
+    // Without an interval it is only checkpointed when the database is flushed
+    if (syncCheckpointTask == 0 && syncCheckpointIntervalMillis > 0)
+    {
+        syncCheckpointTask =
+            scheduleDelayTask(syncCheckpointIntervalMillis, DELAY_MILLIS, syncCheckpointTaskFunc, NULL);
+    }
+
+    return true;
+}
+
+static void *writeBehindFlusherThreadProc(void *arg)
+{
+    (void) arg;
+
+    icLogDebug(LOG_TAG, "%s: starting up", __FUNCTION__);
+
+    pthread_mutex_lock(&flusherMtx);
+    while (flusherRunning)
+    {
+        if (!flushRequested)
+        {
+            incrementalCondTimedWaitMillis(&flusherCond, &flusherMtx, flusherIntervalMillis);
+        }
+        flushRequested = false;
+
+        if (!flusherRunning)
+        {
+            break;
+        }
+
+        // Never take writeMtx while holding flusherMtx, writers signal us while holding writeMtx
+        pthread_mutex_unlock(&flusherMtx);
+
+        pthread_mutex_lock(&writeMtx);
+        flushDirtyDevicesNoLock();
+        pthread_mutex_unlock(&writeMtx);
+
+        pthread_mutex_lock(&flusherMtx);
+    }
+    pthread_mutex_unlock(&flusherMtx);
+
+    icLogDebug(LOG_TAG, "%s: exiting", __FUNCTION__);
+
+    return NULL;
+}
+
+/**
+ * Stop the write-behind flusher thread if it is running.  Assumes caller owns writeBehindControlMtx
+ * and does not own writeMtx.  Anything still dirty is left for the caller to deal with.
+ */
+static void stopWriteBehindFlusher(void)
+{
+    pthread_mutex_lock(&flusherMtx);
+    bool wasRunning = flusherRunning;
+    flusherRunning = false;
+    pthread_cond_broadcast(&flusherCond);
+    pthread_mutex_unlock(&flusherMtx);
+
+    if (wasRunning)
+    {
+        pthread_join(flusherThread, NULL);
+    }
+}
+
+/**
+ * Check a stored device against the cache: a device from the cold start snapshot is replaced by its
+ * stored version, and a device added since the snapshot was written is loaded.  Assumes caller owns
+ * writeMtx.
+ *
+ * @param uuid the device's storage key
+ */
+static void reconcileStoredDeviceNoLock(const char *uuid)
+{
+    if (devices == NULL)
+    {
+        return;
+    }
+
+    DeviceCacheEntry *entry = hashMapGet(devices, (void *) uuid, (uint16_t) (strlen(uuid) + 1));
+    if (entry != NULL && !entry->unverified)
+    {
+        return;
+    }
+
+    // Storage is read without cacheLock, so lookups carry on meanwhile
+    icDevice *device = loadStoredDevice(uuid);
+    if (device == NULL)
+    {
+        icLogWarn(LOG_TAG, "%s: unable to load device %s from storage", __FUNCTION__, uuid);
+        return;
+    }
+
+    WRITE_LOCK_SCOPE(cacheLock);
+    if (entry == NULL)
+    {
+        // If this fails it cleans up the device as well
+        loadDeviceIntoCache(device);
+    }
+    else
+    {
+        installEvictedDeviceNoLock(entry, device);
+    }
+    enforceCacheLimitNoLock(NULL);
+}
+
+/**
+ * Drop devices from the cold start snapshot that are not in storage anymore.  Assumes caller owns
+ * writeMtx.
+ *
+ * @param stored the storage keys
+ * @return the number of devices dropped
+ */
+static uint32_t dropUnstoredDevicesNoLock(icHashMap *stored)
+{
+    uint32_t dropped = 0;
+
+    if (devices == NULL || unverifiedDeviceCount == 0)
+    {
+        return 0;
+    }
+
+    WRITE_LOCK_SCOPE(cacheLock);
+    scoped_icHashMapIterator *iter = hashMapIteratorCreate(devices);
+    while (hashMapIteratorHasNext(iter))
+    {
+        void *key;
+        uint16_t keyLen;
+        DeviceCacheEntry *entry;
+        hashMapIteratorGetNext(iter, &key, &keyLen, (void **) &entry);
+        if (entry->unverified && !hashMapContains(stored, entry->uuid, keyLen))
+        {
+            hashMapIteratorDeleteCurrent(iter, freeDevicesItem);
+            dropped++;
+        }
+    }
+
+    return dropped;
+}
+
+/**
+ * Reconciler thread: replace the devices loaded from the cold start snapshot with their stored
+ * versions, one at a time so writers get their turn, then let go of the snapshot.
+ *
+ * @param arg unused
+ */
+static void *snapshotReconcilerThreadProc(void *arg)
+{
+    (void) arg;
+
+    uint64_t startMillis = getMonotonicMillis();
+    bool stopped = false;
+
+    // Devices added since the snapshot may not have reached storage yet
+    deviceStorageCommitFlush(STORAGE_NAMESPACE);
+    icLinkedList *keys = storageGetKeys(STORAGE_NAMESPACE);
+    icHashMap *stored = hashMapCreate();
+
+    // Metadata records first, so the devices reloaded below get their metadata from the table
+    icLinkedListIterator *iter = linkedListIteratorCreate(keys);
+    while (!stopped && linkedListIteratorHasNext(iter))
+    {
+        char *key = (char *) linkedListIteratorGetNext(iter);
+        scoped_generic char *metadataUuid = key != NULL ? getMetadataRecordUuid(key) : NULL;
+        if (metadataUuid == NULL)
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&writeMtx);
+        stopped = reconcilerStopRequested;
+        // An entry made meanwhile is at least as new as the record
+        if (!stopped && !hasMetadataEntry(metadataUuid))
+        {
+            loadMetadataRecord(metadataUuid);
+        }
+        pthread_mutex_unlock(&writeMtx);
+    }
+    linkedListIteratorDestroy(iter);
+
+    pthread_mutex_lock(&writeMtx);
+    if (!stopped)
+    {
+        metadataRecordsLoaded = true;
+    }
+    pthread_mutex_unlock(&writeMtx);
+
+    iter = linkedListIteratorCreate(keys);
+    while (!stopped && linkedListIteratorHasNext(iter))
+    {
+        char *key = (char *) linkedListIteratorGetNext(iter);
+        if (key == NULL || strcmp(key, SYSTEM_PROPERTIES_KEY) == 0 || isMetadataRecordKey(key))
+        {
+            continue;
+        }
+        hashMapPut(stored, key, (uint16_t) (strlen(key) + 1), key);
+
+        pthread_mutex_lock(&writeMtx);
+        stopped = reconcilerStopRequested;
+        if (!stopped)
+        {
+            reconcileStoredDeviceNoLock(key);
+        }
+        pthread_mutex_unlock(&writeMtx);
+    }
+    linkedListIteratorDestroy(iter);
+
+    pthread_mutex_lock(&writeMtx);
+    if (!stopped && !reconcilerStopRequested)
+    {
+        uint32_t dropped = dropUnstoredDevicesNoLock(stored);
+
+        // Nothing refers to the snapshot anymore unless a device could not be loaded from storage
+        if (unverifiedDeviceCount == 0 && coldSnapshot != NULL)
+        {
+            pthread_rwlock_wrlock(&cacheLock);
+            jsonDatabaseSnapshotClose(coldSnapshot);
+            coldSnapshot = NULL;
+            pthread_rwlock_unlock(&cacheLock);
+        }
+
+        icLogInfo(LOG_TAG,
+                  "%s: reconciled snapshot with storage in %" PRIu64 "ms, dropped %" PRIu32 " devices, %" PRIu32
+                  " unverified",
+                  __FUNCTION__,
+                  getMonotonicMillis() - startMillis,
+                  dropped,
+                  unverifiedDeviceCount);
+    }
+    pthread_mutex_unlock(&writeMtx);
+
+    hashMapDestroy(stored, standardDoNotFreeHashMapFunc);
+    linkedListDestroy(keys, NULL);
+
+    return NULL;
+}
+
+/**
+ * Stop the reconciler thread if it is running.  Assumes caller does not own writeMtx.  Devices not yet
+ * reconciled stay unverified.
+ */
+static void stopSnapshotReconciler(void)
+{
+    pthread_mutex_lock(&writeMtx);
+    bool wasStarted = reconcilerStarted;
+    reconcilerStarted = false;
+    reconcilerStopRequested = true;
+    pthread_mutex_unlock(&writeMtx);
+
+    if (wasStarted)
+    {
+        pthread_join(reconcilerThread, NULL);
+    }
+}
+
+/**
+ * Serialize a cached device as it currently stands, in the compact form the cold start snapshot and
+ * archives hold.  An evicted record is only reused as is when nothing recorded since the eviction could
+ * be missing from it; otherwise the device is decoded with the metadata and sync times recorded since,
+ * and a device from the cold start snapshot is loaded from storage, whose record may be newer.  Assumes
+ * caller owns writeMtx.
+ *
+ * @param entry the cache entry
+ * @param context the serialization context
+ * @param device when not NULL, set to the device the record was made from, which is always provided
+ * @param decoded set to a device that had to be created, which the caller must destroy
+ * @return the record, or NULL on failure.  Caller must free.
+ */
+static char *serializeCurrentDeviceNoLock(const DeviceCacheEntry *entry,
+                                          icSerDesContext *context,
+                                          const icDevice **device,
+                                          icDevice **decoded)
+{
+    *decoded = NULL;
+    const icDevice *current = entry->device;
+
+    if (current == NULL)
+    {
+        bool recordCurrent = !entry->unverified && !hasMetadataEntry(entry->uuid) &&
+                             (syncTable == NULL || jsonDatabaseSyncTableGetCount(syncTable) == 0);
+        if (recordCurrent && device == NULL)
+        {
+            return strdup(entry->evicted);
+        }
+
+        *decoded = entry->unverified ? loadStoredDevice(entry->uuid) : NULL;
+        if (*decoded == NULL)
+        {
+            *decoded = decodeEvictedDevice(entry);
+        }
+        if (*decoded == NULL)
+        {
+            return NULL;
+        }
+
+        applySyncTimesNoLock(*decoded);
+        current = *decoded;
+
+        if (recordCurrent)
+        {
+            *device = current;
+            return strdup(entry->evicted);
+        }
+    }
+
+    if (device != NULL)
+    {
+        *device = current;
+    }
+
+    cJSON *json = deviceToJSON(current, context);
+    char *retval = json != NULL ? cJSON_PrintUnformatted(json) : NULL;
+    cJSON_Delete(json);
+
+    return retval;
+}
+
+/**
+ * Write the whole cache to the cold start snapshot if storage changed since it was last written.
+ * Assumes caller owns writeMtx; the cache lock is not required since no other writer can run.
+ */
+static void writeSnapshotNoLock(void)
+{
+    // Until reconciled, the cache holds nothing newer than the snapshot in use
+    if (snapshotPath == NULL || devices == NULL || !snapshotStale || coldSnapshot != NULL)
+    {
+        return;
+    }
+
+    uint64_t startMillis = getMonotonicMillis();
+
+    JsonDatabaseSnapshotWriter *writer = jsonDatabaseSnapshotWriterCreate(snapshotPath);
+    bool ok = writer != NULL;
+
+    icSerDesContext *context = serDesCreateContext();
+    serDesSetContextValue(context, "namespace", STORAGE_NAMESPACE);
+
+    icHashMapIterator *iter = hashMapIteratorCreate(devices);
+    while (ok && hashMapIteratorHasNext(iter))
+    {
+        void *key;
+        uint16_t keyLen;
+        DeviceCacheEntry *entry;
+        hashMapIteratorGetNext(iter, &key, &keyLen, (void **) &entry);
+
+        // Evicted devices are decoded either way, their index keys need the device
+        const icDevice *device = NULL;
+        icDevice *decoded = NULL;
+        char *record = serializeCurrentDeviceNoLock(entry, context, &device, &decoded);
+        ok = record != NULL && jsonDatabaseSnapshotWriterAdd(writer, device, record);
+
+        free(record);
+        deviceDestroy(decoded);
+    }
+    hashMapIteratorDestroy(iter);
+    serDesDestroyContext(context);
+
+    if (!ok)
+    {
+        jsonDatabaseSnapshotWriterAbort(writer);
+        icLogWarn(LOG_TAG, "%s: unable to write snapshot %s", __FUNCTION__, snapshotPath);
+    }
+    else if (jsonDatabaseSnapshotWriterCommit(writer))
+    {
+        snapshotStale = false;
+        icLogDebug(LOG_TAG,
+                   "%s: wrote snapshot of %" PRIu16 " devices in %" PRIu64 "ms",
+                   __FUNCTION__,
+                   hashMapCount(devices),
+                   getMonotonicMillis() - startMillis);
+    }
+}
+
+/**
+ * Forget the cold start snapshot after storage was replaced underneath the cache, so a restart
+ * can't serve devices from before.  Assumes caller owns writeMtx.
+ */
+static void invalidateSnapshotNoLock(void)
+{
+    if (snapshotPath != NULL)
+    {
+        unlink(snapshotPath);
+        snapshotStale = true;
+    }
+}
+
+static void scheduleSnapshotNoLock(void);
+
+static void snapshotTaskFunc(void *arg)
+{
+    (void) arg;
+
+    pthread_mutex_lock(&writeMtx);
+    snapshotTask = 0;
+    writeSnapshotNoLock();
+    scheduleSnapshotNoLock();
+    pthread_mutex_unlock(&writeMtx);
+}
+
+/**
+ * Schedule the next periodic snapshot, if enabled and not scheduled already.  Assumes caller owns
+ * writeMtx.
+ */
+static void scheduleSnapshotNoLock(void)
+{
+    if (snapshotTask == 0 && snapshotPath != NULL && snapshotIntervalMillis > 0 && devices != NULL)
+    {
+        snapshotTask = scheduleDelayTask(snapshotIntervalMillis, DELAY_MILLIS, snapshotTaskFunc, NULL);
+    }
+}
+
+/**
+ * Open or create our jsonDatabase.  Assumes caller owns the mutex
+ *
+ * @param useSnapshot whether devices may be loaded from the cold start snapshot
+ * @return true on success (either opening existing or creating new)
+ */
+static bool jsonDatabaseInitializeNoLock(bool useSnapshot)
+{
+    bool retval = false;
+
+    // Read back what a previous session left waiting for a group commit
+    deviceStorageCommitFlush(STORAGE_NAMESPACE);
+
+    if (loadSystemProperties())
+    {
+        const char *sealed = stringHashMapGet(systemProperties, JSON_DATABASE_RECORDS_SEALED_KEY);
+        deviceRecordsSealed = stringCompare(sealed, "true", false) == 0;
+
+        // Load devices.  The snapshot skips the records, so it can't be used until they are all sealed.
+        retval = (useSnapshot && deviceRecordsSealed && loadSnapshotNoLock()) || loadDevices();
+
+        if (dirtyDeviceCount > 0)
+        {
+            // Loading flagged records that are not in the configured encoding or not sealed yet.  Only
+            // the snapshots are rewritten here, their content is unchanged so any journal records are
+            // still newer.
+            uint32_t migrated = dirtyDeviceCount;
+            saveSystemProperties();
+            if (writeDirtyDevicesNoLock())
+            {
+                icLogInfo(LOG_TAG, "%s: rewrote %" PRIu32 " device records", __FUNCTION__, migrated);
+            }
+        }
+
+        if (!deviceRecordsSealed && dirtyDeviceCount == 0)
+        {
+            // Every record has a checksum now.  Make sure the rewrites are in storage before saying so,
+            // from here on a record without one is damaged.
+            deviceStorageCommitFlush(STORAGE_NAMESPACE);
+            deviceRecordsSealed = true;
+            jsonDatabaseSetSystemPropertyNoLock(JSON_DATABASE_RECORDS_SEALED_KEY, "true");
+        }
+    }
+    else
+    {
+        // Intialize empty database, its records are sealed from the start
+        createCacheMaps();
+        metadataRecordsLoaded = true;
+        deviceRecordsSealed = true;
+        stringHashMapPutCopy(systemProperties, JSON_DATABASE_RECORDS_SEALED_KEY, "true");
+        jsonDatabaseSetSystemPropertyNoLock(JSON_DATABASE_SCHEMA_VERSION_KEY, JSON_DATABASE_CURRENT_SCHEMA_VERSION);
+        retval = true;
+    }
+    return retval;
+}
+
+/**
+ * Tell the system property listener, if any, about a change.  Caller must not hold writeMtx or
+ * cacheLock.
+ *
+ * @param key the property that changed, or NULL if any of them may have
+ */
+static void notifySystemPropertyChanged(const char *key)
+{
+    pthread_mutex_lock(&listenerMtx);
+    jsonDatabaseSystemPropertyListener listener = systemPropertyListener;
+    void *ctx = systemPropertyListenerCtx;
+    pthread_mutex_unlock(&listenerMtx);
+
+    // Not under listenerMtx, so the listener may in turn change properties
+    if (listener != NULL)
+    {
+        listener(key, ctx);
+    }
+}
+
+/**
+ * Open or create our jsonDatabase.
+ *
+ * @return true on success (either opening existing or creating new)
+ */
+bool jsonDatabaseInitialize()
+{
+    bool retval = false;
+    // Take the locks to initialize things
+    pthread_mutex_lock(&writeMtx);
+    pthread_rwlock_wrlock(&cacheLock);
+    retval = jsonDatabaseInitializeNoLock(true);
+    pthread_rwlock_unlock(&cacheLock);
+    // Storage may have changed since the snapshot was written, if there even is one
+    snapshotStale = true;
+    scheduleSnapshotNoLock();
+    pthread_mutex_unlock(&writeMtx);
+
+    notifySystemPropertyChanged(NULL);
+
+    return retval;
+}
+
+/**
+ * HashMap free function for devices map
+ * @param key the key
  * @param value the value
  */
-static void freeDevicesItem(void *key, void *value)
+static void freeDevicesItem(void *key, void *value)
+{
+    // The key is the uuid stored within the cache entry, so no need to free
+    (void) key;
+    destroyCacheEntry((DeviceCacheEntry *) value);
+}
+
+/**
+ * Flush system properties and any dirty devices to storage.  Assumes caller owns writeMtx; the
+ * cache lock is not required since no other writer can run.
+ */
+static void persistAllNoLock(void)
+{
+    // Flush system properties to disk
+    saveSystemProperties();
+
+    // Flush devices to disk, including changes their persistence policy held back
+    commitDeferredDevicesNoLock(true);
+    flushDirtyDevicesNoLock();
+    checkpointSyncTableNoLock();
+    deviceStorageCommitFlush(STORAGE_NAMESPACE);
+}
+
+/**
+ * Close the jsonDatabase and release any related resources.  Assumes caller owns writeMtx and
+ * the write side of cacheLock.
+ */
+static void jsonDatabaseCleanupNoLock(void)
+{
+    // Cleanup
+    stringHashMapDestroy(systemProperties, NULL);
+    systemProperties = NULL;
+    // Indexes first, so evicted devices need not be decoded just to leave them
+    destroyIndexes();
+    hashMapDestroy(devices, freeDevicesItem);
+    devices = NULL;
+    // Only after the devices, unverified ones have their records in it
+    jsonDatabaseSnapshotClose(coldSnapshot);
+    coldSnapshot = NULL;
+    // Should be nothing left, but to clean up the map itself
+    hashMapDestroy(resourcesByUri, NULL);
+    resourcesByUri = NULL;
+    jsonDatabaseUriTrieDestroy(uriTrie);
+    uriTrie = NULL;
+    pthread_mutex_lock(&metadataMtx);
+    jsonDatabaseMetadataTableDestroy(metadataTable);
+    metadataTable = NULL;
+    pthread_mutex_unlock(&metadataMtx);
+    metadataRecordsLoaded = false;
+    deviceRecordsSealed = false;
+    // Anything still dirty or deferred is gone with the cache
+    dirtyDeviceCount = 0;
+    deferredDeviceCount = 0;
+}
+
+/**
+ * Close the jsonDatabase and release any related resources.
+ *
+ * @param persist Whether or not to persist everything while shutting down
+ */
+void jsonDatabaseCleanup(bool persist)
+{
+    pthread_mutex_lock(&writeBehindControlMtx);
+    stopWriteBehindFlusher();
+    pthread_mutex_unlock(&writeBehindControlMtx);
+
+    stopSnapshotReconciler();
+
+    pthread_mutex_lock(&writeMtx);
+    // Write-behind must be re-enabled after the next initialize
+    writeBehindIntervalMillis = 0;
+    writeBehindMaxDirtyDevices = 0;
+    if (persist)
+    {
+        // Write out while readers are still allowed in
+        persistAllNoLock();
+        writeSnapshotNoLock();
+    }
+    jsonDatabaseJournalClose(journal);
+    journal = NULL;
+    journalMaxRecords = 0;
+    // Like the journal, the sync table must be re-enabled after the next initialize
+    jsonDatabaseSyncTableClose(syncTable);
+    syncTable = NULL;
+    syncCheckpointIntervalMillis = 0;
+    pthread_rwlock_wrlock(&cacheLock);
+    jsonDatabaseCleanupNoLock();
+    pthread_rwlock_unlock(&cacheLock);
+    uint32_t task = deferredWriteTask.handle;
+    deferredWriteTask.handle = 0;
+    uint32_t checkpointTask = syncCheckpointTask;
+    syncCheckpointTask = 0;
+    uint32_t snapshotWriteTask = snapshotTask;
+    snapshotTask = 0;
+    pthread_mutex_unlock(&writeMtx);
+
+    // Not under writeMtx, the tasks take it.  If one already started it will find nothing to do.
+    if (task != 0)
+    {
+        cancelDelayTask(task);
+    }
+    if (checkpointTask != 0)
+    {
+        cancelDelayTask(checkpointTask);
+    }
+    if (snapshotWriteTask != 0)
+    {
+        cancelDelayTask(snapshotWriteTask);
+    }
+
+    notifySystemPropertyChanged(NULL);
+}
+
+/**
+ * Reload the database from storage without flushing the current contents.  Basically
+ * the equivalent of calling jsonDatabaseCleanup(false), and then jsonDatabaseInitialize(),
+ * but this method is atomic under a lock to prevent races
+ *
+ * @return true on success
+ */
+bool jsonDatabaseReload()
+{
+    bool retval = false;
+    pthread_mutex_lock(&writeMtx);
+    pthread_rwlock_wrlock(&cacheLock);
+    // Cleanup without pushing contents out to stoarge
+    jsonDatabaseCleanupNoLock();
+    // Storage changed underneath us, so the snapshot has too
+    invalidateSnapshotNoLock();
+    // Re-initialize based on what's in storage
+    retval = jsonDatabaseInitializeNoLock(false);
+    if (retval)
+    {
+        replayJournalNoLock();
+        applySyncTableNoLock();
+        // Replay may have rehydrated devices
+        enforceCacheLimitNoLock(NULL);
+    }
+    pthread_rwlock_unlock(&cacheLock);
+    pthread_mutex_unlock(&writeMtx);
+
+    notifySystemPropertyChanged(NULL);
+
+    return retval;
+}
+
+/**
+ * Restore a database from a previous backup.  Assumes caller owns writeMtx and the write side of cacheLock.
+ *
+ * @param tempRestoreDir The configuration directory to restore from.
+ * @return True on success.
+ */
+static bool jsonDatabaseRestoreNoLock(const char *tempRestoreDir)
 {
-    // The key is the device uuid stored within the actual device, so no need to free
-    (void) key;
-    destroyCacheEntry((DeviceCacheEntry *) value);
+    bool retval = false;
+
+    jsonDatabaseCleanupNoLock();
+
+    // Whatever was journaled belongs to the configuration being replaced
+    if (journal != NULL)
+    {
+        jsonDatabaseJournalTruncate(journal);
+    }
+    if (syncTable != NULL)
+    {
+        jsonDatabaseSyncTableClear(syncTable);
+        jsonDatabaseSyncTableCheckpoint(syncTable);
+    }
+
+    // Writes still waiting for a group commit belong to the configuration being replaced
+    deviceStorageCommitDiscard(STORAGE_NAMESPACE);
+
+    // Restore the configuration. The current namespace will
+    // be deleted automatically.
+    StorageRestoreErrorCode restoreError = storageRestoreNamespace(STORAGE_NAMESPACE, tempRestoreDir);
+
+    switch (restoreError)
+    {
+
+        case STORAGE_RESTORE_ERROR_NONE:
+            /* Nothing to restore is OK, e.g., from legacy */
+        case STORAGE_RESTORE_ERROR_NEW_DIR_MISSING:
+            retval = true;
+            break;
+
+        case STORAGE_RESTORE_ERROR_OLD_CONFIG_DELETE:
+        case STORAGE_RESTORE_ERROR_FAILED_COPY:
+        default:
+            break;
+    }
+
+    if (!retval)
+    {
+        icLogError(LOG_TAG,
+                   "JSON database storage restore failed: [%d]: %s",
+                   restoreError,
+                   storageRestoreErrorDescribe(restoreError));
+        return false;
+    }
+
+    retval = jsonDatabaseInitializeNoLock(false);
+
+    if (!retval)
+    {
+        icLogError(LOG_TAG, "JSON database did not initialize!");
+    }
+
+    return retval;
+}
+
+/**
+ * Write one archive line.
+ *
+ * @param out the archive
+ * @param json the record
+ * @return true on success
+ */
+static bool writeArchiveLine(FILE *out, const cJSON *json)
+{
+    scoped_generic char *line = cJSON_PrintUnformatted(json);
+
+    return line != NULL && fputs(line, out) >= 0 && fputc('\n', out) != EOF;
+}
+
+/**
+ * Replace the system properties with those of an archive.  Assumes caller owns writeMtx.
+ *
+ * @param archived the archived system properties
+ * @param force save them even if nothing changed
+ * @return true on success
+ */
+static bool importSystemPropertiesNoLock(const cJSON *archived, bool force)
+{
+    bool changed = force;
+
+    pthread_rwlock_wrlock(&cacheLock);
+
+    // Drop what the archive doesn't have
+    icLinkedList *stale = linkedListCreate();
+    icStringHashMapIterator *iter = stringHashMapIteratorCreate(systemProperties);
+    while (stringHashMapIteratorHasNext(iter))
+    {
+        char *key;
+        char *value;
+        stringHashMapIteratorGetNext(iter, &key, &value);
+        // Whether our records are sealed is not the archive's to say
+        if (cJSON_GetObjectItemCaseSensitive(archived, key) == NULL &&
+            strcmp(key, JSON_DATABASE_RECORDS_SEALED_KEY) != 0)
+        {
+            linkedListAppend(stale, strdup(key));
+        }
+    }
+    stringHashMapIteratorDestroy(iter);
+
+    icLinkedListIterator *staleIter = linkedListIteratorCreate(stale);
+    while (linkedListIteratorHasNext(staleIter))
+    {
+        stringHashMapDelete(systemProperties, linkedListIteratorGetNext(staleIter), NULL);
+        changed = true;
+    }
+    linkedListIteratorDestroy(staleIter);
+    linkedListDestroy(stale, NULL);
+
+    const cJSON *item = NULL;
+    cJSON_ArrayForEach(item, archived)
+    {
+        if (cJSON_IsString(item) && item->valuestring != NULL &&
+            strcmp(item->string, JSON_DATABASE_RECORDS_SEALED_KEY) != 0)
+        {
+            const char *current = stringHashMapGet(systemProperties, item->string);
+            if (current == NULL || strcmp(current, item->valuestring) != 0)
+            {
+                putSystemPropertyNoLock(item->string, item->valuestring);
+                changed = true;
+            }
+        }
+    }
+
+    pthread_rwlock_unlock(&cacheLock);
+
+    return changed == false || saveSystemProperties();
+}
+
+/**
+ * Load devices from an archive, replacing the current contents of the database.  Assumes caller owns writeMtx
+ * but not cacheLock; the cache is only locked while each device is swapped in.
+ *
+ * @param path the archive
+ * @param incremental when true, devices that are identical to the archived ones are left untouched
+ * @return true if every archived device was imported
+ */
+static bool importArchiveNoLock(const char *path, bool incremental)
+{
+    FILE *in = fopen(path, "r");
+    if (in == NULL)
+    {
+        icLogError(LOG_TAG, "%s: unable to open %s: %s", __FUNCTION__, path, strerror(errno));
+        return false;
+    }
+
+    uint64_t startMillis = getMonotonicMillis();
+    char *line = NULL;
+    size_t lineSize = 0;
+
+    // The header carries the format version and the system properties
+    cJSON *header = getline(&line, &lineSize, in) > 0 ? cJSON_Parse(line) : NULL;
+    cJSON *archivedProperties = cJSON_GetObjectItemCaseSensitive(header, ARCHIVE_SYSTEM_PROPERTIES_KEY);
+    int version = 0;
+
+    if (header == NULL || getCJSONInt(header, ARCHIVE_VERSION_KEY, &version) == false ||
+        version != ARCHIVE_VERSION || cJSON_IsObject(archivedProperties) == false)
+    {
+        icLogError(LOG_TAG, "%s: %s is not a device database archive", __FUNCTION__, path);
+        cJSON_Delete(header);
+        free(line);
+        fclose(in);
+        return false;
+    }
+
+    // Any journaled changes belong to the snapshots that are about to be replaced
+    settleJournalNoLock();
+
+    icSerDesContext *context = serDesCreateContext();
+    serDesSetContextValue(context, "namespace", STORAGE_NAMESPACE);
+
+    // uuids of the archived devices
+    icHashMap *archived = hashMapCreate();
+    uint32_t imported = 0;
+    uint32_t unchanged = 0;
+    uint32_t failed = 0;
+    uint32_t removed = 0;
+
+    while (getline(&line, &lineSize, in) > 0)
+    {
+        scoped_cJSON *json = cJSON_Parse(line);
+        icDevice *device = json != NULL ? deviceFromJSON(json, context, false) : NULL;
+        if (device == NULL)
+        {
+            icLogWarn(LOG_TAG, "%s: skipping unreadable device", __FUNCTION__);
+            failed++;
+            continue;
+        }
+
+        scoped_generic char *uuid = strdup(device->uuid);
+        uint16_t uuidLen = (uint16_t) (strlen(uuid) + 1);
+        if (!hashMapContains(archived, uuid, uuidLen))
+        {
+            hashMapPut(archived, strdup(uuid), uuidLen, NULL);
+        }
+
+        DeviceCacheEntry *existing = hashMapGet(devices, uuid, uuidLen);
+        if (incremental && existing != NULL)
+        {
+            scoped_cJSON *current = existing->device != NULL ? deviceToJSON(existing->device, context)
+                                                             : cJSON_Parse(existing->evicted);
+            if (cJSON_Compare(current, json, true))
+            {
+                deviceDestroy(device);
+                unchanged++;
+                continue;
+            }
+        }
+
+        pthread_rwlock_wrlock(&cacheLock);
+        if (existing != NULL)
+        {
+            markDeviceCleanNoLock(existing);
+            hashMapDelete(devices, uuid, uuidLen, freeDevicesItem);
+        }
+        // Takes the device, even on failure
+        bool didLoad = loadDeviceIntoCache(device);
+        pthread_rwlock_unlock(&cacheLock);
+
+        DeviceCacheEntry *entry = didLoad ? hashMapGet(devices, uuid, uuidLen) : NULL;
+        if (entry != NULL && commitDeviceNoLock(entry))
+        {
+            imported++;
+        }
+        else
+        {
+            icLogWarn(LOG_TAG, "%s: failed to import device %s", __FUNCTION__, uuid);
+            failed++;
+        }
+    }
+
+    bool readFailed = ferror(in) != 0;
+    free(line);
+    fclose(in);
+    serDesDestroyContext(context);
+
+    if (readFailed)
+    {
+        // Don't take a short read as a reason to delete devices
+        icLogError(LOG_TAG, "%s: failed reading %s", __FUNCTION__, path);
+        failed++;
+    }
+    else
+    {
+        // Devices that are not in the archive are gone
+        icLinkedList *stale = linkedListCreate();
+        icHashMapIterator *iter = hashMapIteratorCreate(devices);
+        while (hashMapIteratorHasNext(iter))
+        {
+            void *key;
+            uint16_t keyLen;
+            void *value;
+            hashMapIteratorGetNext(iter, &key, &keyLen, &value);
+            if (!hashMapContains(archived, key, keyLen))
+            {
+                linkedListAppend(stale, strdup((const char *) key));
+            }
+        }
+        hashMapIteratorDestroy(iter);
+
+        icLinkedListIterator *staleIter = linkedListIteratorCreate(stale);
+        while (linkedListIteratorHasNext(staleIter))
+        {
+            if (removeDeviceNoLock(linkedListIteratorGetNext(staleIter)))
+            {
+                removed++;
+            }
+        }
+        linkedListIteratorDestroy(staleIter);
+        linkedListDestroy(stale, NULL);
+    }
+
+    if (!importSystemPropertiesNoLock(archivedProperties, !incremental))
+    {
+        failed++;
+    }
+
+    hashMapDestroy(archived, standardDoNotFreeHashMapValuesFunc);
+    cJSON_Delete(header);
+
+    icLogInfo(LOG_TAG,
+              "%s: imported %" PRIu32 " devices (%" PRIu32 " unchanged, %" PRIu32 " removed, %" PRIu32
+              " failed) in %" PRIu64 "ms",
+              __FUNCTION__,
+              imported,
+              unchanged,
+              removed,
+              failed,
+              getMonotonicMillis() - startMillis);
+
+    return failed == 0;
+}
+
+bool jsonDatabaseImportArchive(const char *path, bool incremental)
+{
+    if (path == NULL)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&writeMtx);
+    bool retval = importArchiveNoLock(path, incremental);
+    pthread_mutex_unlock(&writeMtx);
+
+    notifySystemPropertyChanged(NULL);
+
+    return retval;
+}
+
+bool jsonDatabaseExportArchive(const char *path)
+{
+    if (path == NULL)
+    {
+        return false;
+    }
+
+    uint64_t startMillis = getMonotonicMillis();
+    scoped_generic char *tempPath = stringBuilder("%s.tmp", path);
+
+    // Only writers change the cache, so holding writeMtx gives a consistent view
+    LOCK_SCOPE(writeMtx);
+
+    FILE *out = fopen(tempPath, "w");
+    if (out == NULL)
+    {
+        icLogError(LOG_TAG, "%s: unable to create %s: %s", __FUNCTION__, tempPath, strerror(errno));
+        return false;
+    }
+
+    cJSON *header = cJSON_CreateObject();
+    cJSON_AddNumberToObject(header, ARCHIVE_VERSION_KEY, ARCHIVE_VERSION);
+    cJSON_AddItemToObject(header, ARCHIVE_SYSTEM_PROPERTIES_KEY, stringHashMapToJson(systemProperties));
+    bool didWrite = writeArchiveLine(out, header);
+    cJSON_Delete(header);
+
+    icSerDesContext *context = serDesCreateContext();
+    serDesSetContextValue(context, "namespace", STORAGE_NAMESPACE);
+
+    uint32_t count = 0;
+    icHashMapIterator *iter = hashMapIteratorCreate(devices);
+    while (didWrite && hashMapIteratorHasNext(iter))
+    {
+        void *key;
+        uint16_t keyLen;
+        void *value;
+        hashMapIteratorGetNext(iter, &key, &keyLen, &value);
+
+        // One device at a time, the whole archive is never in memory
+        icDevice *decoded = NULL;
+        scoped_generic char *record = serializeCurrentDeviceNoLock(value, context, NULL, &decoded);
+        didWrite = record != NULL && fputs(record, out) >= 0 && fputc('\n', out) != EOF;
+        deviceDestroy(decoded);
+        count++;
+    }
+    hashMapIteratorDestroy(iter);
+    serDesDestroyContext(context);
+
+    didWrite = didWrite && fflush(out) == 0 && fsync(fileno(out)) == 0;
+    didWrite = fclose(out) == 0 && didWrite;
+
+    // Never leave a partial archive where a complete one is expected
+    if (didWrite && rename(tempPath, path) == 0)
+    {
+        icLogInfo(LOG_TAG,
+                  "%s: exported %" PRIu32 " devices to %s in %" PRIu64 "ms",
+                  __FUNCTION__,
+                  count,
+                  path,
+                  getMonotonicMillis() - startMillis);
+        return true;
+    }
+
+    icLogError(LOG_TAG, "%s: failed to write %s", __FUNCTION__, path);
+    unlink(tempPath);
+
+    return false;
+}
+
+bool jsonDatabaseRestore(const char *tempRestoreDir)
+{
+    bool retval = false;
+
+    pthread_mutex_lock(&writeMtx);
+
+    // Whatever is restored replaces what the snapshot holds
+    invalidateSnapshotNoLock();
+
+    // A bulk archive only rewrites what differs from what we have
+    scoped_generic char *archivePath = stringBuilder("%s/%s", tempRestoreDir, ARCHIVE_FILE_NAME);
+    if (doesFileExist(archivePath))
+    {
+        icLogInfo(LOG_TAG, "Restoring device database from %s", archivePath);
+        retval = importArchiveNoLock(archivePath, true);
+    }
+    else
+    {
+        pthread_rwlock_wrlock(&cacheLock);
+        retval = jsonDatabaseRestoreNoLock(tempRestoreDir);
+        pthread_rwlock_unlock(&cacheLock);
+    }
+
+    pthread_mutex_unlock(&writeMtx);
+
+    notifySystemPropertyChanged(NULL);
+
+    return retval;
+}
+
+void jsonDatabaseSetWriteBehind(uint32_t flushIntervalMillis, uint16_t maxDirtyDevices)
+{
+    LOCK_SCOPE(writeBehindControlMtx);
+
+    stopWriteBehindFlusher();
+
+    pthread_mutex_lock(&writeMtx);
+    bool wasEnabled = writeBehindIntervalMillis > 0;
+    writeBehindIntervalMillis = flushIntervalMillis;
+    writeBehindMaxDirtyDevices = maxDirtyDevices;
+    if (wasEnabled && flushIntervalMillis == 0)
+    {
+        // Going back to writing through, don't leave queued changes behind
+        flushDirtyDevicesNoLock();
+    }
+    pthread_mutex_unlock(&writeMtx);
+
+    if (flushIntervalMillis > 0)
+    {
+        pthread_mutex_lock(&flusherMtx);
+        flusherIntervalMillis = flushIntervalMillis;
+        flusherRunning = true;
+        flushRequested = false;
+        initTimedWaitCond(&flusherCond);
+        createThread(&flusherThread, writeBehindFlusherThreadProc, NULL, "jsonDbFlush");
+        pthread_mutex_unlock(&flusherMtx);
+
+        icLogInfo(LOG_TAG,
+                  "Device write-behind enabled: interval %" PRIu32 "ms, max dirty devices %" PRIu16,
+                  flushIntervalMillis,
+                  maxDirtyDevices);
+    }
+    else if (wasEnabled)
+    {
+        icLogInfo(LOG_TAG, "Device write-behind disabled");
+    }
+}
+
+bool jsonDatabaseFlush(void)
+{
+    LOCK_SCOPE(writeMtx);
+    commitDeferredDevicesNoLock(true);
+    checkpointSyncTableNoLock();
+    bool didFlush = flushDirtyDevicesNoLock();
+    if (!deviceStorageCommitFlush(STORAGE_NAMESPACE) || !didFlush)
+    {
+        icLogError(LOG_TAG, "%s: failed to write every pending device change", __FUNCTION__);
+        return false;
+    }
+
+    return true;
+}
+
+bool jsonDatabaseFlushDevice(const char *uuid)
+{
+    if (uuid == NULL)
+    {
+        return false;
+    }
+
+    LOCK_SCOPE(writeMtx);
+
+    // Only writers change the cache, so writeMtx alone gives a consistent view of it
+    DeviceCacheEntry *entry = devices != NULL ? hashMapGet(devices, (void *) uuid, strlen(uuid) + 1) : NULL;
+    if (entry == NULL)
+    {
+        icLogWarn(LOG_TAG, "%s: device %s not found", __FUNCTION__, uuid);
+        return false;
+    }
+
+    bool didFlush = true;
+    if (entry->dirty || entry->deferredUntilMillis != 0)
+    {
+        // Journal records are replayed over the device record, so they must not be older than it.  This
+        // may write the device along with the other dirty ones.
+        settleJournalNoLock();
+    }
+
+    // Dirty and deferred devices are never evicted
+    if (entry->dirty || entry->deferredUntilMillis != 0)
+    {
+        didFlush = saveDevice(entry->device);
+        if (didFlush)
+        {
+            markDeviceCleanNoLock(entry);
+        }
+    }
+
+    // Either record may still be waiting for a group commit
+    scoped_generic char *metadataKey = getMetadataRecordKey(uuid);
+    bool didSettle = deviceStorageCommitSettle(STORAGE_NAMESPACE, uuid);
+    didSettle = deviceStorageCommitSettle(STORAGE_NAMESPACE, metadataKey) && didSettle;
+
+    if (!didFlush || !didSettle)
+    {
+        icLogError(LOG_TAG, "%s: failed to write device %s", __FUNCTION__, uuid);
+        return false;
+    }
+
+    return true;
 }
 
-/**
- * Close the jsonDatabase and release any related resources.  Assumes caller owns the mutex
- *
- * @param persist Whether or not to persist everything while shutting down
- */
-static void jsonDatabaseCleanupNoLock(bool persist)
+bool jsonDatabaseSetJournal(const char *path, uint32_t maxRecords)
 {
-    if (persist)
+    bool retval = true;
+
+    LOCK_SCOPE(writeMtx);
+
+    if (journal != NULL)
     {
-        // Flush system properties to disk
-        saveSystemProperties();
+        // Fold the current journal into the snapshots before letting go of it
+        flushDirtyDevicesNoLock();
+        jsonDatabaseJournalClose(journal);
+        journal = NULL;
     }
-    // Cleanup
-    stringHashMapDestroy(systemProperties, NULL);
-    systemProperties = NULL;
-    // Flush devices to disk
-    icHashMapIterator *iter = hashMapIteratorCreate(devices);
-    while (hashMapIteratorHasNext(iter))
-    {
-        char *deviceUuid;
-        uint16_t keyLen;
-        DeviceCacheEntry *deviceCacheEntry;
-        hashMapIteratorGetNext(iter, (void **) &deviceUuid, &keyLen, (void **) &deviceCacheEntry);
 
-        if (persist)
+    journalMaxRecords = maxRecords;
+
+    if (path != NULL)
+    {
+        journal = jsonDatabaseJournalOpen(path);
+        if (journal != NULL)
         {
-            if (deviceCacheEntry->dirty)
+            // Recover anything recorded but not yet compacted, e.g. before a crash
+            pthread_rwlock_wrlock(&cacheLock);
+            uint32_t replayed = replayJournalNoLock();
+            pthread_rwlock_unlock(&cacheLock);
+
+            if (replayed > 0)
             {
-                if (!saveDevice(deviceCacheEntry->device))
-                {
-                    icLogError(LOG_TAG, "%s: device save for %s failed!", deviceCacheEntry->device->uri, __FUNCTION__);
-                }
+                flushDirtyDevicesNoLock();
             }
+
+            icLogInfo(
+                LOG_TAG, "Resource journal enabled at %s, compacting every %" PRIu32 " records", path, maxRecords);
+        }
+        else
+        {
+            icLogError(LOG_TAG, "Failed to open resource journal %s, resources will be saved with their device", path);
+            retval = false;
         }
     }
-    hashMapIteratorDestroy(iter);
-    hashMapDestroy(devices, freeDevicesItem);
-    devices = NULL;
-    // Should be nothing left, but to clean up the map itself
-    hashMapDestroy(resourcesByUri, NULL);
-    resourcesByUri = NULL;
+
+    return retval;
 }
 
-/**
- * Close the jsonDatabase and release any related resources.
- *
- * @param persist Whether or not to persist everything while shutting down
- */
-void jsonDatabaseCleanup(bool persist)
+void jsonDatabaseSetSnapshot(const char *path, uint32_t intervalMillis)
 {
-    pthread_mutex_lock(&mtx);
-    jsonDatabaseCleanupNoLock(persist);
-    pthread_mutex_unlock(&mtx);
+    pthread_mutex_lock(&writeMtx);
+
+    free(snapshotPath);
+    snapshotPath = path != NULL ? strdup(path) : NULL;
+    snapshotIntervalMillis = intervalMillis;
+    snapshotStale = true;
+
+    uint32_t task = snapshotTask;
+    snapshotTask = 0;
+    scheduleSnapshotNoLock();
+
+    pthread_mutex_unlock(&writeMtx);
+
+    // Not under writeMtx, the task takes it
+    if (task != 0)
+    {
+        cancelDelayTask(task);
+    }
 }
 
-/**
- * Reload the database from storage without flushing the current contents.  Basically
- * the equivalent of calling jsonDatabaseCleanup(false), and then jsonDatabaseInitialize(),
- * but this method is atomic under a lock to prevent races
- *
- * @return true on success
- */
-bool jsonDatabaseReload()
+bool jsonDatabaseSetSyncTable(const char *path, uint32_t checkpointIntervalMillis)
 {
-    bool retval = false;
-    pthread_mutex_lock(&mtx);
-    // Cleanup without pushing contents out to stoarge
-    jsonDatabaseCleanupNoLock(false);
-    // Re-initialize based on what's in storage
-    retval = jsonDatabaseInitializeNoLock();
-    pthread_mutex_unlock(&mtx);
+    bool retval = true;
+
+    pthread_mutex_lock(&writeMtx);
+
+    if (syncTable != NULL)
+    {
+        checkpointSyncTableNoLock();
+        jsonDatabaseSyncTableClose(syncTable);
+        syncTable = NULL;
+    }
+
+    syncCheckpointIntervalMillis = checkpointIntervalMillis;
+
+    if (path != NULL)
+    {
+        syncTable = jsonDatabaseSyncTableOpen(path);
+        if (syncTable != NULL)
+        {
+            // The snapshots may be older than the sync times checkpointed since they were written
+            pthread_rwlock_wrlock(&cacheLock);
+            applySyncTableNoLock();
+            pthread_rwlock_unlock(&cacheLock);
+
+            icLogInfo(LOG_TAG,
+                      "Resource sync table enabled at %s with %" PRIu32 " entries, checkpointing every %" PRIu32 "ms",
+                      path,
+                      jsonDatabaseSyncTableGetCount(syncTable),
+                      checkpointIntervalMillis);
+        }
+        else
+        {
+            icLogError(
+                LOG_TAG, "Failed to open resource sync table %s, sync times will be saved with their device", path);
+            retval = false;
+        }
+    }
+
+    uint32_t task = syncCheckpointTask;
+    syncCheckpointTask = 0;
+    pthread_mutex_unlock(&writeMtx);
+
+    // Not under writeMtx, the task takes it
+    if (task != 0)
+    {
+        cancelDelayTask(task);
+    }
 
     return retval;
 }
 
-bool jsonDatabaseRestore(const char *tempRestoreDir)
+void jsonDatabaseSetCompactFormat(bool compact)
 {
-    bool retval = false;
-
-    LOCK_SCOPE(mtx);
+    LOCK_SCOPE(writeMtx);
+    compactStorageFormat = compact;
+}
 
-    jsonDatabaseCleanupNoLock(false);
+void jsonDatabaseSetLoadWorkers(uint8_t workers)
+{
+    LOCK_SCOPE(writeMtx);
+    loadWorkerCount = workers > 0 ? workers : 1;
+}
 
-    // Restore the configuration. The current namespace will
-    // be deleted automatically.
-    StorageRestoreErrorCode restoreError = storageRestoreNamespace(STORAGE_NAMESPACE, tempRestoreDir);
+void jsonDatabaseSetCacheLimit(uint32_t maxDevices)
+{
+    LOCK_SCOPE(writeMtx);
+    WRITE_LOCK_SCOPE(cacheLock);
 
-    switch (restoreError)
+    if (maxDevices == 0 && evictedDeviceCount > 0)
     {
+        // Nothing needs to stay evicted without a limit
+        icHashMapIterator *iter = hashMapIteratorCreate(devices);
+        while (hashMapIteratorHasNext(iter))
+        {
+            void *key;
+            uint16_t keyLen;
+            DeviceCacheEntry *entry;
+            hashMapIteratorGetNext(iter, &key, &keyLen, (void **) &entry);
+            rehydrateEntryNoLock(entry);
+        }
+        hashMapIteratorDestroy(iter);
+    }
 
-        case STORAGE_RESTORE_ERROR_NONE:
-            /* Nothing to restore is OK, e.g., from legacy */
-        case STORAGE_RESTORE_ERROR_NEW_DIR_MISSING:
-            retval = true;
-            break;
+    __atomic_store_n(&maxResidentDevices, maxDevices, __ATOMIC_RELAXED);
+    enforceCacheLimitNoLock(NULL);
 
-        case STORAGE_RESTORE_ERROR_OLD_CONFIG_DELETE:
-        case STORAGE_RESTORE_ERROR_FAILED_COPY:
-        default:
-            break;
+    icLogInfo(LOG_TAG,
+              "%s: max resident devices %" PRIu32 ", %" PRIu32 " evicted",
+              __FUNCTION__,
+              maxDevices,
+              evictedDeviceCount);
+}
+
+void jsonDatabaseSetSystemPropertyListener(jsonDatabaseSystemPropertyListener listener, void *ctx)
+{
+    LOCK_SCOPE(listenerMtx);
+    systemPropertyListener = listener;
+    systemPropertyListenerCtx = ctx;
+}
+
+void jsonDatabaseGetCacheStats(JsonDatabaseCacheStats *stats)
+{
+    if (stats == NULL)
+    {
+        return;
     }
 
-    if (!retval)
+    READ_LOCK_SCOPE(cacheLock);
+    stats->maxResidentDevices = maxResidentDevices;
+    stats->evictedDevices = evictedDeviceCount;
+    stats->unverifiedDevices = unverifiedDeviceCount;
+    stats->residentDevices = devices != NULL ? hashMapCount(devices) - evictedDeviceCount : 0;
+    stats->hits = __atomic_load_n(&cacheHits, __ATOMIC_RELAXED);
+    stats->rehydrations = __atomic_load_n(&cacheRehydrations, __ATOMIC_RELAXED);
+    stats->evictions = __atomic_load_n(&cacheEvictions, __ATOMIC_RELAXED);
+    stats->rehydrateMillisTotal = __atomic_load_n(&rehydrateMillisTotal, __ATOMIC_RELAXED);
+    stats->rehydrateMillisMax = __atomic_load_n(&rehydrateMillisMax, __ATOMIC_RELAXED);
+}
+
+char *jsonDatabaseExportDeviceJSON(const char *uuid)
+{
+    char *retval = NULL;
+
+    if (uuid == NULL)
     {
-        icLogError(LOG_TAG,
-                   "JSON database storage restore failed: [%d]: %s",
-                   restoreError,
-                   storageRestoreErrorDescribe(restoreError));
-        return false;
+        return NULL;
     }
 
-    retval = jsonDatabaseInitializeNoLock();
+    // Only writers change the cache, so holding writeMtx gives a consistent view
+    LOCK_SCOPE(writeMtx);
 
-    if (!retval)
+    DeviceCacheEntry *entry =
+        devices != NULL ? (DeviceCacheEntry *) hashMapGet(devices, (void *) uuid, strlen(uuid) + 1) : NULL;
+    if (entry != NULL)
     {
-        icLogError(LOG_TAG, "JSON database did not initialize!");
+        // Same serialization as saveDevice, so sensitive values stay protected
+        icSerDesContext *context = serDesCreateContext();
+        serDesSetContextValue(context, "namespace", STORAGE_NAMESPACE);
+
+        icDevice *decoded = NULL;
+        scoped_generic char *record = serializeCurrentDeviceNoLock(entry, context, NULL, &decoded);
+        scoped_cJSON *body = record != NULL ? cJSON_Parse(record) : NULL;
+        retval = body != NULL ? cJSON_Print(body) : NULL;
+
+        deviceDestroy(decoded);
+        serDesDestroyContext(context);
     }
 
     return retval;
@@ -922,17 +4156,17 @@ bool jsonDatabaseRestore(const char *tempRestoreDir)
  */
 bool jsonDatabaseGetSystemProperty(const char *key, char **value)
 {
-    pthread_mutex_lock(&mtx);
+    pthread_rwlock_rdlock(&cacheLock);
     bool didGet = jsonDatabaseGetSystemPropertyNoLock(key, value);
-    pthread_mutex_unlock(&mtx);
+    pthread_rwlock_unlock(&cacheLock);
     return didGet;
 }
 
 bool jsonDatabaseGetAllSystemProperties(icStringHashMap *map)
 {
-    pthread_mutex_lock(&mtx);
+    pthread_rwlock_rdlock(&cacheLock);
     bool didGet = jsonDatabaseGetAllSystemPropertiesNoLock(map);
-    pthread_mutex_unlock(&mtx);
+    pthread_rwlock_unlock(&cacheLock);
     return didGet;
 }
 
@@ -980,26 +4214,43 @@ static bool jsonDatabaseGetAllSystemPropertiesNoLock(icStringHashMap *map)
 }
 
 /**
- * Private method to set a property, assumes caller holds the lock
+ * Private method to put a property into the in memory map without persisting it, assumes caller
+ * holds writeMtx and the write side of cacheLock
  *
  * @param key the key
  * @param value the value
  * @return true on success
  */
-static bool jsonDatabaseSetSystemPropertyNoLock(const char *key, const char *value)
+static bool putSystemPropertyNoLock(const char *key, const char *value)
 {
-    bool retval = false;
+    bool retval = true;
 
     // Clear out an existing value, if one exists
     stringHashMapDelete(systemProperties, key, NULL);
     // Put it in the map
-    if (stringHashMapPutCopy(systemProperties, key, value))
+    if (!stringHashMapPutCopy(systemProperties, key, value))
     {
-        retval = saveSystemProperties();
+        icLogWarn(LOG_TAG, "%s: Failed to write property %s", __func__, key);
+        retval = false;
     }
-    else
+
+    return retval;
+}
+
+/**
+ * Private method to set a property, assumes caller holds writeMtx and the write side of cacheLock
+ *
+ * @param key the key
+ * @param value the value
+ * @return true on success
+ */
+static bool jsonDatabaseSetSystemPropertyNoLock(const char *key, const char *value)
+{
+    bool retval = false;
+
+    if (putSystemPropertyNoLock(key, value))
     {
-        icLogWarn(LOG_TAG, "%s: Failed to write property %s", __func__, key);
+        retval = saveSystemProperties();
     }
 
     return retval;
@@ -1015,9 +4266,26 @@ static bool jsonDatabaseSetSystemPropertyNoLock(const char *key, const char *val
  */
 bool jsonDatabaseSetSystemProperty(const char *key, const char *value)
 {
-    pthread_mutex_lock(&mtx);
-    bool retval = jsonDatabaseSetSystemPropertyNoLock(key, value);
-    pthread_mutex_unlock(&mtx);
+    bool retval = false;
+
+    pthread_mutex_lock(&writeMtx);
+
+    pthread_rwlock_wrlock(&cacheLock);
+    bool didPut = putSystemPropertyNoLock(key, value);
+    pthread_rwlock_unlock(&cacheLock);
+
+    if (didPut)
+    {
+        // Readers may proceed while we write out
+        retval = saveSystemProperties();
+    }
+
+    pthread_mutex_unlock(&writeMtx);
+
+    if (didPut)
+    {
+        notifySystemPropertyChanged(key);
+    }
 
     return retval;
 }
@@ -1042,11 +4310,12 @@ static bool loadDeviceIntoCache(icDevice *newDevice)
     DeviceCacheEntry *cacheEntry = createCacheEntry(newDevice);
 
     // Put it in the id lookup map and the uri lookup map
-    if (hashMapPut(devices, newDevice->uuid, strlen(newDevice->uuid) + 1, cacheEntry))
+    if (hashMapPut(devices, cacheEntry->uuid, strlen(cacheEntry->uuid) + 1, cacheEntry))
     {
         if (addDeviceURIEntries(cacheEntry))
         {
             retval = true;
+            enforceCacheLimitNoLock(cacheEntry);
         }
         else
         {
@@ -1079,15 +4348,23 @@ bool jsonDatabaseAddDevice(icDevice *device)
     if (device != NULL && device->uuid != NULL)
     {
         icDevice *newDevice = deviceClone(device);
-        pthread_mutex_lock(&mtx);
-        if (loadDeviceIntoCache(newDevice))
+        pthread_mutex_lock(&writeMtx);
+
+        pthread_rwlock_wrlock(&cacheLock);
+        bool didLoad = loadDeviceIntoCache(newDevice);
+        pthread_rwlock_unlock(&cacheLock);
+
+        if (didLoad)
         {
+            settleJournalNoLock();
             if (!saveDevice(newDevice))
             {
                 // TODO is this the right way to handle this?
                 icLogError(LOG_TAG, "Failed to persist device, removing device");
                 // Clean up
+                pthread_rwlock_wrlock(&cacheLock);
                 hashMapDelete(devices, newDevice->uuid, strlen(newDevice->uuid) + 1, freeDevicesItem);
+                pthread_rwlock_unlock(&cacheLock);
             }
             else
             {
@@ -1095,7 +4372,7 @@ bool jsonDatabaseAddDevice(icDevice *device)
             }
         }
         // If loading the device into the cache fails it will clean up the device
-        pthread_mutex_unlock(&mtx);
+        pthread_mutex_unlock(&writeMtx);
     }
     else
     {
@@ -1112,15 +4389,23 @@ bool jsonDatabaseAddEndpoint(icDeviceEndpoint *endpoint)
     {
         icDeviceEndpoint *newEndpoint = endpointClone(endpoint);
 
-        pthread_mutex_lock(&mtx);
+        pthread_mutex_lock(&writeMtx);
+        pthread_rwlock_wrlock(&cacheLock);
+        rehydrateDeviceNoLock(endpoint->deviceUuid);
         DeviceCacheEntry *deviceCacheEntry =
             (DeviceCacheEntry *) hashMapGet(devices, (void *) endpoint->deviceUuid, strlen(endpoint->deviceUuid) + 1);
         if (deviceCacheEntry != NULL)
         {
-            if (addEndpointURIEntries(deviceCacheEntry, newEndpoint) == true)
+            bool didAdd = addEndpointURIEntries(deviceCacheEntry, newEndpoint);
+            if (didAdd == true)
             {
                 linkedListAppend(deviceCacheEntry->device->endpoints, newEndpoint);
+            }
+            pthread_rwlock_unlock(&cacheLock);
 
+            if (didAdd == true)
+            {
+                settleJournalNoLock();
                 if (saveDevice(deviceCacheEntry->device) == true)
                 {
                     retval = true;
@@ -1143,11 +4428,12 @@ bool jsonDatabaseAddEndpoint(icDeviceEndpoint *endpoint)
         }
         else
         {
+            pthread_rwlock_unlock(&cacheLock);
             endpointDestroy(newEndpoint);
             icLogError(LOG_TAG, "Failed to locate device entry for device %s", endpoint->deviceUuid);
         }
 
-        pthread_mutex_unlock(&mtx);
+        pthread_mutex_unlock(&writeMtx);
     }
     else
     {
@@ -1168,7 +4454,7 @@ bool jsonDatabaseAddEndpoint(icDeviceEndpoint *endpoint)
  */
 icLinkedList *jsonDatabaseGetDevices()
 {
-    pthread_mutex_lock(&mtx);
+    pthread_rwlock_rdlock(&cacheLock);
     icLinkedList *devicesCopy = linkedListCreate();
     icHashMapIterator *iter = hashMapIteratorCreate(devices);
     while (hashMapIteratorHasNext(iter))
@@ -1177,14 +4463,36 @@ icLinkedList *jsonDatabaseGetDevices()
         uint16_t keyLen;
         DeviceCacheEntry *deviceCacheEntry;
         hashMapIteratorGetNext(iter, (void **) &key, &keyLen, (void **) &deviceCacheEntry);
-        linkedListAppend(devicesCopy, deviceClone(deviceCacheEntry->device));
+        if (deviceCacheEntry->device != NULL)
+        {
+            linkedListAppend(devicesCopy, deviceClone(deviceCacheEntry->device));
+        }
+        else
+        {
+            // Evicted, the decoded copy is already ours
+            icDevice *decoded = decodeEvictedDevice(deviceCacheEntry);
+            if (decoded != NULL)
+            {
+                linkedListAppend(devicesCopy, decoded);
+            }
+        }
     }
     hashMapIteratorDestroy(iter);
-    pthread_mutex_unlock(&mtx);
+    pthread_rwlock_unlock(&cacheLock);
 
     return devicesCopy;
 }
 
+static void appendDeviceClone(void *value, void *ctx)
+{
+    DeviceCacheEntry *entry = value;
+    icDevice *device = entry->device != NULL ? deviceClone(entry->device) : decodeEvictedDevice(entry);
+    if (device != NULL)
+    {
+        linkedListAppend((icLinkedList *) ctx, device);
+    }
+}
+
 /**
  * Retrieve all devices that have an endpoint with the given profile
  *
@@ -1199,29 +4507,8 @@ icLinkedList *jsonDatabaseGetDevicesByEndpointProfile(const char *profileId)
     icLinkedList *foundDevices = linkedListCreate();
     if (profileId != NULL)
     {
-        pthread_mutex_lock(&mtx);
-        icHashMapIterator *iter = hashMapIteratorCreate(devices);
-        while (hashMapIteratorHasNext(iter))
-        {
-            char *key;
-            uint16_t keyLen;
-            DeviceCacheEntry *deviceCacheEntry;
-            hashMapIteratorGetNext(iter, (void **) &key, &keyLen, (void **) &deviceCacheEntry);
-            icLinkedListIterator *deviceEndpointsIter = linkedListIteratorCreate(deviceCacheEntry->device->endpoints);
-            while (linkedListIteratorHasNext(deviceEndpointsIter))
-            {
-                icDeviceEndpoint *endpoint = (icDeviceEndpoint *) linkedListIteratorGetNext(deviceEndpointsIter);
-                if (endpoint->profile != NULL && strcmp(endpoint->profile, profileId) == 0)
-                {
-                    linkedListAppend(foundDevices, deviceClone(deviceCacheEntry->device));
-                    // Break out of endpoints and move on to the next device
-                    break;
-                }
-            }
-            linkedListIteratorDestroy(deviceEndpointsIter);
-        }
-        hashMapIteratorDestroy(iter);
-        pthread_mutex_unlock(&mtx);
+        READ_LOCK_SCOPE(cacheLock);
+        jsonDatabaseIndexVisit(devicesByEndpointProfile, profileId, appendDeviceClone, foundDevices);
     }
 
     return foundDevices;
@@ -1241,25 +4528,10 @@ icLinkedList *jsonDatabaseGetDevicesByDeviceClass(const char *deviceClass)
     icLinkedList *foundDevices = linkedListCreate();
     if (deviceClass != NULL)
     {
-        pthread_mutex_lock(&mtx);
-        icHashMapIterator *iter = hashMapIteratorCreate(devices);
-        while (hashMapIteratorHasNext(iter))
-        {
-            char *key;
-            uint16_t keyLen;
-            DeviceCacheEntry *deviceCacheEntry;
-            hashMapIteratorGetNext(iter, (void **) &key, &keyLen, (void **) &deviceCacheEntry);
-            if (deviceCacheEntry->device->deviceClass != NULL &&
-                strcmp(deviceClass, deviceCacheEntry->device->deviceClass) == 0)
-            {
-                linkedListAppend(foundDevices, deviceClone(deviceCacheEntry->device));
-            }
-        }
-        hashMapIteratorDestroy(iter);
-        pthread_mutex_unlock(&mtx);
+        READ_LOCK_SCOPE(cacheLock);
+        jsonDatabaseIndexVisit(devicesByClass, deviceClass, appendDeviceClone, foundDevices);
     }
 
-
     return foundDevices;
 }
 
@@ -1277,25 +4549,98 @@ icLinkedList *jsonDatabaseGetDevicesByDeviceDriver(const char *deviceDriverName)
     icLinkedList *foundDevices = linkedListCreate();
     if (deviceDriverName != NULL)
     {
-        pthread_mutex_lock(&mtx);
-        icHashMapIterator *iter = hashMapIteratorCreate(devices);
-        while (hashMapIteratorHasNext(iter))
+        READ_LOCK_SCOPE(cacheLock);
+        jsonDatabaseIndexVisit(devicesByDriver, deviceDriverName, appendDeviceClone, foundDevices);
+    }
+
+    return foundDevices;
+}
+
+struct MetadataMatchContext
+{
+    icLinkedList *devices;
+    const char *metadataId;
+    const char *value;
+};
+
+static void appendDeviceCloneIfMetadataMatches(void *value, void *ctx)
+{
+    DeviceCacheEntry *entry = value;
+    struct MetadataMatchContext *context = ctx;
+
+    icDevice *decoded;
+    icDevice *device = borrowCachedDevice(entry, &decoded);
+    if (device == NULL)
+    {
+        return;
+    }
+
+    icLinkedListIterator *iter = linkedListIteratorCreate(device->metadata);
+    while (linkedListIteratorHasNext(iter))
+    {
+        icDeviceMetadata *metadata = (icDeviceMetadata *) linkedListIteratorGetNext(iter);
+        if (metadata->id != NULL && strcmp(metadata->id, context->metadataId) == 0)
+        {
+            if (metadata->value != NULL &&
+                (context->value == NULL || strcasecmp(metadata->value, context->value) == 0))
+            {
+                linkedListAppend(context->devices, decoded != NULL ? decoded : deviceClone(device));
+                decoded = NULL;
+            }
+            break;
+        }
+    }
+    linkedListIteratorDestroy(iter);
+    deviceDestroy(decoded);
+}
+
+icLinkedList *jsonDatabaseGetDevicesByMetadata(const char *metadataId, const char *value)
+{
+    struct MetadataMatchContext context = {.devices = linkedListCreate(), .metadataId = metadataId, .value = value};
+    if (metadataId != NULL)
+    {
+        READ_LOCK_SCOPE(cacheLock);
+        jsonDatabaseIndexVisit(devicesByMetadataId, metadataId, appendDeviceCloneIfMetadataMatches, &context);
+    }
+
+    return context.devices;
+}
+
+/**
+ * Find the cache entry of the device that owns a uri.  Assumes caller holds cacheLock.
+ *
+ * @param uri the uri of the device, or one of its endpoints, resources or metadata
+ * @return the cache entry or NULL if not found
+ */
+static DeviceCacheEntry *getDeviceCacheEntryByUriNoLock(const char *uri)
+{
+    DeviceCacheEntry *entry = NULL;
+    Locator *locator = (Locator *) hashMapGet(resourcesByUri, (void *) uri, strlen(uri) + 1);
+    if (locator != NULL)
+    {
+        if (locator->locatorType == LOCATOR_TYPE_DEVICE)
+        {
+            entry = locator->locator.deviceCacheEntry;
+        }
+        else if (locator->locatorType == LOCATOR_TYPE_ENDPOINT)
+        {
+            entry = locator->locator.endpointLocator.deviceCacheEntry;
+        }
+        else if (locator->locatorType == LOCATOR_TYPE_RESOURCE)
+        {
+            entry = locator->locator.resourceLocator.deviceCacheEntry;
+        }
+        else if (locator->locatorType == LOCATOR_TYPE_METADATA)
+        {
+            entry = locator->locator.metadataLocator.deviceCacheEntry;
+        }
+        else
         {
-            char *key;
-            uint16_t keyLen;
-            DeviceCacheEntry *deviceCacheEntry;
-            hashMapIteratorGetNext(iter, (void **) &key, &keyLen, (void **) &deviceCacheEntry);
-            if (deviceCacheEntry->device->managingDeviceDriver != NULL &&
-                strcmp(deviceDriverName, deviceCacheEntry->device->managingDeviceDriver) == 0)
-            {
-                linkedListAppend(foundDevices, deviceClone(deviceCacheEntry->device));
-            }
+            icLogWarn(LOG_TAG, "%s: Unknown locator type found %d", __FUNCTION__, locator->locatorType);
         }
-        hashMapIteratorDestroy(iter);
-        pthread_mutex_unlock(&mtx);
     }
 
-    return foundDevices;
+    return entry;
 }
 
 /**
@@ -1311,13 +4656,16 @@ icDevice *jsonDatabaseGetDeviceById(const char *uuid)
     icDevice *device = NULL;
     if (uuid != NULL)
     {
-        pthread_mutex_lock(&mtx);
+        ensureDeviceResident(uuid);
+        pthread_rwlock_rdlock(&cacheLock);
         DeviceCacheEntry *deviceCacheEntry = (DeviceCacheEntry *) hashMapGet(devices, (void *) uuid, strlen(uuid) + 1);
         if (deviceCacheEntry != NULL)
         {
-            device = deviceClone(deviceCacheEntry->device);
+            icDevice *decoded;
+            icDevice *cached = borrowCachedDevice(deviceCacheEntry, &decoded);
+            device = decoded != NULL ? decoded : deviceClone(cached);
         }
-        pthread_mutex_unlock(&mtx);
+        pthread_rwlock_unlock(&cacheLock);
     }
 
     return device;
@@ -1337,37 +4685,133 @@ icDevice *jsonDatabaseGetDeviceByUri(const char *uri)
     icDevice *foundDevice = NULL;
     if (uri != NULL)
     {
-        pthread_mutex_lock(&mtx);
-        Locator *locator = (Locator *) hashMapGet(resourcesByUri, (void *) uri, strlen(uri) + 1);
-        if (locator != NULL)
+        ensureDeviceResident(uri);
+        pthread_rwlock_rdlock(&cacheLock);
+        DeviceCacheEntry *entry = getDeviceCacheEntryByUriNoLock(uri);
+        if (entry != NULL)
         {
-            if (locator->locatorType == LOCATOR_TYPE_DEVICE)
-            {
-                foundDevice = deviceClone(locator->locator.deviceCacheEntry->device);
-            }
-            else if (locator->locatorType == LOCATOR_TYPE_ENDPOINT)
-            {
-                foundDevice = deviceClone(locator->locator.endpointLocator.deviceCacheEntry->device);
-            }
-            else if (locator->locatorType == LOCATOR_TYPE_RESOURCE)
-            {
-                foundDevice = deviceClone(locator->locator.resourceLocator.deviceCacheEntry->device);
-            }
-            else if (locator->locatorType == LOCATOR_TYPE_METADATA)
+            foundDevice = deviceClone(entry->device);
+        }
+        else
+        {
+            // The device may have been evicted again since ensureDeviceResident
+            icDevice *decoded = decodeEvictedOwnerNoLock(uri);
+            if (decoded != NULL && deviceOwnsUri(decoded, uri))
             {
-                foundDevice = deviceClone(locator->locator.metadataLocator.deviceCacheEntry->device);
+                foundDevice = decoded;
             }
             else
             {
-                icLogWarn(LOG_TAG, "%s: Unknown locator type found %d", __FUNCTION__, locator->locatorType);
+                deviceDestroy(decoded);
             }
         }
-        pthread_mutex_unlock(&mtx);
+        pthread_rwlock_unlock(&cacheLock);
     }
 
     return foundDevice;
 }
 
+/**
+ * Run a visitor against a cached device without cloning it
+ *
+ * @param uuid the uuid of the device
+ * @param visitor the callback, run under the read lock
+ * @param ctx context for the callback
+ * @return true if the device was found and visited
+ */
+bool jsonDatabaseVisitDeviceById(const char *uuid, jsonDatabaseDeviceVisitor visitor, void *ctx)
+{
+    bool found = false;
+    if (uuid != NULL && visitor != NULL)
+    {
+        ensureDeviceResident(uuid);
+        READ_LOCK_SCOPE(cacheLock);
+        DeviceCacheEntry *entry = (DeviceCacheEntry *) hashMapGet(devices, (void *) uuid, strlen(uuid) + 1);
+        icDevice *decoded = NULL;
+        icDevice *device = entry != NULL ? borrowCachedDevice(entry, &decoded) : NULL;
+        if (device != NULL)
+        {
+            visitor(device, ctx);
+            deviceDestroy(decoded);
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+/**
+ * Run a visitor against the cached device that owns a uri without cloning it
+ *
+ * @param uri the uri of the device, or one of its endpoints, resources or metadata
+ * @param visitor the callback, run under the read lock
+ * @param ctx context for the callback
+ * @return true if the device was found and visited
+ */
+bool jsonDatabaseVisitDeviceByUri(const char *uri, jsonDatabaseDeviceVisitor visitor, void *ctx)
+{
+    bool found = false;
+    if (uri != NULL && visitor != NULL)
+    {
+        ensureDeviceResident(uri);
+        READ_LOCK_SCOPE(cacheLock);
+        DeviceCacheEntry *entry = getDeviceCacheEntryByUriNoLock(uri);
+        if (entry != NULL)
+        {
+            visitor(entry->device, ctx);
+            found = true;
+        }
+        else
+        {
+            // The device may have been evicted again since ensureDeviceResident
+            scoped_icDevice *decoded = decodeEvictedOwnerNoLock(uri);
+            if (decoded != NULL && deviceOwnsUri(decoded, uri))
+            {
+                visitor(decoded, ctx);
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
+
+static void copyDeviceClass(const icDevice *device, void *ctx)
+{
+    *(char **) ctx = device->deviceClass != NULL ? strdup(device->deviceClass) : NULL;
+}
+
+static void copyManagingDeviceDriver(const icDevice *device, void *ctx)
+{
+    *(char **) ctx = device->managingDeviceDriver != NULL ? strdup(device->managingDeviceDriver) : NULL;
+}
+
+/**
+ * Get the device class of a device without cloning the device
+ *
+ * @param uuid the uuid of the device
+ * @return the device class or NULL if the device is not found.  Caller frees.
+ */
+char *jsonDatabaseGetDeviceClassById(const char *uuid)
+{
+    char *deviceClass = NULL;
+    jsonDatabaseVisitDeviceById(uuid, copyDeviceClass, &deviceClass);
+    return deviceClass;
+}
+
+/**
+ * Get the name of the driver managing the device that owns a uri without cloning the device
+ *
+ * @param uri the uri of the device, or one of its endpoints, resources or metadata
+ * @return the driver name or NULL if the device is not found.  Caller frees.
+ */
+char *jsonDatabaseGetDeviceDriverByUri(const char *uri)
+{
+    char *driverName = NULL;
+    jsonDatabaseVisitDeviceByUri(uri, copyManagingDeviceDriver, &driverName);
+    return driverName;
+}
+
 /**
  * Check if the provided device uuid is known to our database.
  *
@@ -1379,9 +4823,47 @@ bool jsonDatabaseIsDeviceKnown(const char *uuid)
     bool retval = false;
     if (uuid != NULL)
     {
-        pthread_mutex_lock(&mtx);
+        pthread_rwlock_rdlock(&cacheLock);
         retval = hashMapContains(devices, (void *) uuid, strlen(uuid) + 1);
-        pthread_mutex_unlock(&mtx);
+        pthread_rwlock_unlock(&cacheLock);
+    }
+
+    return retval;
+}
+
+/**
+ * Remove a device from storage and from the cache.  Assumes caller owns writeMtx.
+ *
+ * @param uuid the device uuid
+ * @return true if the device was removed, false otherwise
+ */
+static bool removeDeviceNoLock(const char *uuid)
+{
+    bool retval = false;
+
+    // Only writers change the devices map, so holding writeMtx is enough for this lookup
+    DeviceCacheEntry *cacheEntry = hashMapGet(devices, (void *) uuid, strlen(uuid) + 1);
+    if (cacheEntry != NULL)
+    {
+        // Don't leave records behind that could be replayed onto a future device with this uuid
+        settleJournalNoLock();
+        if (deviceStorageCommitDelete(STORAGE_NAMESPACE, uuid))
+        {
+            snapshotStale = true;
+            // Nothing left to write for this device
+            markDeviceCleanNoLock(cacheEntry);
+            jsonDatabaseSyncTableRemoveDevice(syncTable, uuid);
+            dropMetadataRecordNoLock(uuid);
+            // Clean out of id map, which will free all resources
+            pthread_rwlock_wrlock(&cacheLock);
+            hashMapDelete(devices, (void *) uuid, strlen(uuid) + 1, (hashMapFreeFunc) freeDevicesItem);
+            pthread_rwlock_unlock(&cacheLock);
+            retval = true;
+        }
+        else
+        {
+            icLogError(LOG_TAG, "Failed to remove storage for device %s", uuid);
+        }
     }
 
     return retval;
@@ -1398,28 +4880,46 @@ bool jsonDatabaseRemoveDeviceById(const char *uuid)
     bool retval = false;
     if (uuid != NULL)
     {
-        pthread_mutex_lock(&mtx);
-        DeviceCacheEntry *cacheEntry = hashMapGet(devices, (void *) uuid, strlen(uuid) + 1);
-        if (cacheEntry != NULL)
-        {
-            if (storageDelete(STORAGE_NAMESPACE, uuid))
-            {
-                // Clean out of id map, which will free all resources
-                hashMapDelete(devices, (void *) uuid, strlen(uuid) + 1, (hashMapFreeFunc) freeDevicesItem);
-                retval = true;
-            }
-            else
-            {
-                icLogError(LOG_TAG, "Failed to remove storage for device %s", uuid);
-            }
-        }
-        pthread_mutex_unlock(&mtx);
+        pthread_mutex_lock(&writeMtx);
+        retval = removeDeviceNoLock(uuid);
+        pthread_mutex_unlock(&writeMtx);
     }
 
     return retval;
 }
 
 // Endpoints
+struct ProfileMatchContext
+{
+    icLinkedList *endpoints;
+    const char *profileId;
+};
+
+static void appendEndpointClonesWithProfile(void *value, void *ctx)
+{
+    DeviceCacheEntry *entry = value;
+    struct ProfileMatchContext *context = ctx;
+
+    icDevice *decoded;
+    icDevice *device = borrowCachedDevice(entry, &decoded);
+    if (device == NULL)
+    {
+        return;
+    }
+
+    icLinkedListIterator *iter = linkedListIteratorCreate(device->endpoints);
+    while (linkedListIteratorHasNext(iter))
+    {
+        icDeviceEndpoint *endpoint = (icDeviceEndpoint *) linkedListIteratorGetNext(iter);
+        if (endpoint->profile != NULL && strcmp(endpoint->profile, context->profileId) == 0)
+        {
+            linkedListAppend(context->endpoints, endpointClone(endpoint));
+        }
+    }
+    linkedListIteratorDestroy(iter);
+    deviceDestroy(decoded);
+}
+
 /**
  * Retrieve all endpoints  with the given device profile
  *
@@ -1431,33 +4931,14 @@ bool jsonDatabaseRemoveDeviceById(const char *uuid)
  */
 icLinkedList *jsonDatabaseGetEndpointsByProfile(const char *profileId)
 {
-    icLinkedList *endpoints = linkedListCreate();
+    struct ProfileMatchContext context = {.endpoints = linkedListCreate(), .profileId = profileId};
     if (profileId != NULL)
     {
-        pthread_mutex_lock(&mtx);
-        icHashMapIterator *iter = hashMapIteratorCreate(devices);
-        while (hashMapIteratorHasNext(iter))
-        {
-            char *key;
-            uint16_t keyLen;
-            DeviceCacheEntry *deviceCacheEntry;
-            hashMapIteratorGetNext(iter, (void **) &key, &keyLen, (void **) &deviceCacheEntry);
-            icLinkedListIterator *endpointsIter = linkedListIteratorCreate(deviceCacheEntry->device->endpoints);
-            while (linkedListIteratorHasNext(endpointsIter))
-            {
-                icDeviceEndpoint *endpoint = (icDeviceEndpoint *) linkedListIteratorGetNext(endpointsIter);
-                if (endpoint->profile != NULL && strcmp(endpoint->profile, profileId) == 0)
-                {
-                    linkedListAppend(endpoints, endpointClone(endpoint));
-                }
-            }
-            linkedListIteratorDestroy(endpointsIter);
-        }
-        hashMapIteratorDestroy(iter);
-        pthread_mutex_unlock(&mtx);
+        READ_LOCK_SCOPE(cacheLock);
+        jsonDatabaseIndexVisit(devicesByEndpointProfile, profileId, appendEndpointClonesWithProfile, &context);
     }
 
-    return endpoints;
+    return context.endpoints;
 }
 
 /**
@@ -1474,11 +4955,14 @@ icDeviceEndpoint *jsonDatabaseGetEndpointById(const char *deviceUuid, const char
     icDeviceEndpoint *foundEndpoint = NULL;
     if (endpointId != NULL)
     {
-        pthread_mutex_lock(&mtx);
+        ensureDeviceResident(deviceUuid);
+        pthread_rwlock_rdlock(&cacheLock);
         DeviceCacheEntry *deviceCacheEntry = hashMapGet(devices, (void *) deviceUuid, strlen(deviceUuid) + 1);
-        if (deviceCacheEntry != NULL)
+        icDevice *decoded = NULL;
+        icDevice *device = deviceCacheEntry != NULL ? borrowCachedDevice(deviceCacheEntry, &decoded) : NULL;
+        if (device != NULL)
         {
-            icLinkedListIterator *endpointsIter = linkedListIteratorCreate(deviceCacheEntry->device->endpoints);
+            icLinkedListIterator *endpointsIter = linkedListIteratorCreate(device->endpoints);
             while (linkedListIteratorHasNext(endpointsIter))
             {
                 icDeviceEndpoint *endpoint = (icDeviceEndpoint *) linkedListIteratorGetNext(endpointsIter);
@@ -1489,8 +4973,9 @@ icDeviceEndpoint *jsonDatabaseGetEndpointById(const char *deviceUuid, const char
                 }
             }
             linkedListIteratorDestroy(endpointsIter);
+            deviceDestroy(decoded);
         }
-        pthread_mutex_unlock(&mtx);
+        pthread_rwlock_unlock(&cacheLock);
     }
 
     return foundEndpoint;
@@ -1509,7 +4994,8 @@ icDeviceEndpoint *jsonDatabaseGetEndpointByUri(const char *uri)
     icDeviceEndpoint *endpoint = NULL;
     if (uri != NULL)
     {
-        pthread_mutex_lock(&mtx);
+        ensureDeviceResident(uri);
+        pthread_rwlock_rdlock(&cacheLock);
         Locator *locator = (Locator *) hashMapGet(resourcesByUri, (void *) uri, strlen(uri) + 1);
         if (locator != NULL)
         {
@@ -1537,7 +5023,13 @@ icDeviceEndpoint *jsonDatabaseGetEndpointByUri(const char *uri)
                           uri);
             }
         }
-        pthread_mutex_unlock(&mtx);
+        else
+        {
+            // The device may have been evicted again since ensureDeviceResident
+            scoped_icDevice *decoded = decodeEvictedOwnerNoLock(uri);
+            endpoint = decoded != NULL ? endpointClone(findEndpointOwningUri(decoded, uri)) : NULL;
+        }
+        pthread_rwlock_unlock(&cacheLock);
     }
 
     return endpoint;
@@ -1555,7 +5047,11 @@ bool jsonDatabaseSaveEndpoint(icDeviceEndpoint *endpoint)
 
     if (endpoint != NULL && endpoint->uri != NULL)
     {
-        pthread_mutex_lock(&mtx);
+        pthread_mutex_lock(&writeMtx);
+        DeviceCacheEntry *entry = NULL;
+
+        pthread_rwlock_wrlock(&cacheLock);
+        rehydrateDeviceNoLock(endpoint->uri);
         // Take out the bits we can update and update our internal cache
         Locator *locator = (Locator *) hashMapGet(resourcesByUri, endpoint->uri, strlen(endpoint->uri) + 1);
         if (locator != NULL)
@@ -1566,7 +5062,7 @@ bool jsonDatabaseSaveEndpoint(icDeviceEndpoint *endpoint)
                 // Update everything that makes sense(only enabled flag right now)
                 dbEndpoint->enabled = endpoint->enabled;
 
-                DeviceCacheEntry *entry = locator->locator.endpointLocator.deviceCacheEntry;
+                entry = locator->locator.endpointLocator.deviceCacheEntry;
 
                 // Replace resources when changing profile versions
                 // TODO: This business logic shouldn't be here. It is purely defensive; a more general purpose
@@ -1577,17 +5073,16 @@ bool jsonDatabaseSaveEndpoint(icDeviceEndpoint *endpoint)
                     replaceEndpointResources(&locator->locator.endpointLocator, endpoint);
                     dbEndpoint->profileVersion = endpoint->profileVersion;
                 }
-
-                // Write out
-                entry->dirty = true;
-                retval = saveDevice(entry->device);
-                if (retval)
-                {
-                    entry->dirty = false;
-                }
             }
         }
-        pthread_mutex_unlock(&mtx);
+        pthread_rwlock_unlock(&cacheLock);
+
+        if (entry != NULL)
+        {
+            // Write out
+            retval = commitDeviceNoLock(entry);
+        }
+        pthread_mutex_unlock(&writeMtx);
     }
 
     return retval;
@@ -1608,18 +5103,81 @@ icDeviceResource *jsonDatabaseGetResourceByUri(const char *uri)
     icDeviceResource *resource = NULL;
     if (uri != NULL)
     {
-        pthread_mutex_lock(&mtx);
+        ensureDeviceResident(uri);
+        pthread_rwlock_rdlock(&cacheLock);
         Locator *locator = (Locator *) hashMapGet(resourcesByUri, (void *) uri, strlen(uri) + 1);
         if (locator != NULL && locator->locatorType == LOCATOR_TYPE_RESOURCE)
         {
             resource = resourceClone(locator->locator.resourceLocator.resource);
         }
-        pthread_mutex_unlock(&mtx);
+        else if (locator == NULL)
+        {
+            // The device may have been evicted again since ensureDeviceResident
+            scoped_icDevice *decoded = decodeEvictedOwnerNoLock(uri);
+            icDeviceResource *found = decoded != NULL ? findDeviceItemByUri(decoded, LOCATOR_TYPE_RESOURCE, uri) : NULL;
+            resource = resourceClone(found);
+        }
+        pthread_rwlock_unlock(&cacheLock);
     }
 
     return resource;
 }
 
+/**
+ * Run a visitor against a cached resource without cloning it
+ *
+ * @param uri the uri of the resource
+ * @param visitor the callback, run under the read lock
+ * @param ctx context for the callback
+ * @return true if the resource was found and visited
+ */
+bool jsonDatabaseVisitResourceByUri(const char *uri, jsonDatabaseResourceVisitor visitor, void *ctx)
+{
+    bool found = false;
+    if (uri != NULL && visitor != NULL)
+    {
+        ensureDeviceResident(uri);
+        READ_LOCK_SCOPE(cacheLock);
+        Locator *locator = (Locator *) hashMapGet(resourcesByUri, (void *) uri, strlen(uri) + 1);
+        icDeviceResource *resource = NULL;
+        scoped_icDevice *decoded = NULL;
+        if (locator != NULL && locator->locatorType == LOCATOR_TYPE_RESOURCE)
+        {
+            resource = locator->locator.resourceLocator.resource;
+        }
+        else if (locator == NULL)
+        {
+            // The device may have been evicted again since ensureDeviceResident
+            decoded = decodeEvictedOwnerNoLock(uri);
+            resource = decoded != NULL ? findDeviceItemByUri(decoded, LOCATOR_TYPE_RESOURCE, uri) : NULL;
+        }
+
+        if (resource != NULL)
+        {
+            visitor(resource, ctx);
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+/**
+ * Copy the updatable parts of a resource into its cached copy.  Assumes caller owns the cacheLock for write.
+ *
+ * @param dbResource the cached resource
+ * @param resource the resource with the new values
+ */
+static void updateCachedResource(icDeviceResource *dbResource, const icDeviceResource *resource)
+{
+    // Update everything that makes sense
+    free(dbResource->value);
+    dbResource->value = resource->value != NULL ? strdup(resource->value) : NULL;
+    dbResource->cachingPolicy = resource->cachingPolicy;
+    dbResource->mode = resource->mode;
+    dbResource->dateOfLastSyncMillis = resource->dateOfLastSyncMillis;
+}
+
 /**
  * Update a resource in the database.  The following properties can be updated:
  * value
@@ -1627,81 +5185,248 @@ icDeviceResource *jsonDatabaseGetResourceByUri(const char *uri)
  * mode
  * dateOfLastSyncMillis
  *
- * @param endpoint the resource to update
- * @return true if success, false otherwise
+ * When the change is written to storage follows the persistence policy the resource was created with.
+ *
+ * @param endpoint the resource to update
+ * @return true if success, false otherwise
+ */
+bool jsonDatabaseSaveResource(icDeviceResource *resource)
+{
+    bool retval = false;
+    if (resource != NULL && resource->uri != NULL)
+    {
+        pthread_mutex_lock(&writeMtx);
+        DeviceCacheEntry *entry = NULL;
+        icDeviceResource *dbResource = NULL;
+
+        pthread_rwlock_wrlock(&cacheLock);
+        rehydrateDeviceNoLock(resource->uri);
+        // Take out the bits we can update and update our internal cache
+        Locator *locator = (Locator *) hashMapGet(resourcesByUri, resource->uri, strlen(resource->uri) + 1);
+        if (locator != NULL && locator->locatorType == LOCATOR_TYPE_RESOURCE)
+        {
+            dbResource = locator->locator.resourceLocator.resource;
+            updateCachedResource(dbResource, resource);
+            entry = locator->locator.resourceLocator.deviceCacheEntry;
+        }
+        pthread_rwlock_unlock(&cacheLock);
+
+        if (entry != NULL)
+        {
+            if (deferResourceWriteNoLock(entry, dbResource))
+            {
+                // Its persistence policy decides when this reaches storage
+                retval = true;
+            }
+            // If this is a lazy save resource, dont flush to storage yet
+            else if ((resource->mode & RESOURCE_MODE_LAZY_SAVE_NEXT) == 0)
+            {
+                // Write out, preferring a small journal record over rewriting the device
+                retval = journalResourceNoLock(entry, dbResource) || commitDeviceNoLock(entry);
+            }
+            else
+            {
+                // a lazy save is successful
+                markDeviceDirtyNoLock(entry);
+                retval = true;
+            }
+        }
+        pthread_mutex_unlock(&writeMtx);
+    }
+
+    return retval;
+}
+
+/**
+ * Update the dateOfLastSyncMillis of a resource.  Note that this is a lazy save and does not write to storage
+ * immediately.
+ *
+ * @param resource the resource to update
+ * @return true if success, false otherwise
+ */
+bool jsonDatabaseUpdateDateOfLastSyncMillis(icDeviceResource *resource)
+{
+    bool retval = false;
+    if (resource != NULL && resource->uri != NULL)
+    {
+        pthread_mutex_lock(&writeMtx);
+        pthread_rwlock_wrlock(&cacheLock);
+        rehydrateDeviceNoLock(resource->uri);
+        // Take out the bits we can update and update our internal cache
+        Locator *locator = (Locator *) hashMapGet(resourcesByUri, resource->uri, strlen(resource->uri) + 1);
+        if (locator != NULL && locator->locatorType == LOCATOR_TYPE_RESOURCE)
+        {
+            icDeviceResource *dbResource = locator->locator.resourceLocator.resource;
+            // Update the dateOfLastSyncMillis to 'now'
+            dbResource->dateOfLastSyncMillis = getCurrentUnixTimeMillis();
+            // Write out, unless the sync table or its persistence policy takes care of it
+            DeviceCacheEntry *entry = locator->locator.resourceLocator.deviceCacheEntry;
+            if (!recordSyncTimeNoLock(dbResource) && !deferResourceWriteNoLock(entry, dbResource))
+            {
+                markDeviceDirtyNoLock(entry);
+            }
+
+            // This is a lazy save resource so dont flush to storage yet
+            retval = true;
+        }
+        pthread_rwlock_unlock(&cacheLock);
+        pthread_mutex_unlock(&writeMtx);
+    }
+
+    return retval;
+}
+
+// A device with resources changed by jsonDatabaseSaveResources that must be persisted
+typedef struct
+{
+    DeviceCacheEntry *entry;
+    // The changed (cached) resources, journaled together unless that fails
+    icLinkedList *resources;
+} PendingResourceSave;
+
+static void pendingResourceSaveFreeFunc(void *key, void *value)
+{
+    (void) key;
+    PendingResourceSave *pending = value;
+
+    linkedListDestroy(pending->resources, standardDoNotFreeFunc);
+    free(pending);
+}
+
+/**
+ * Find the cache locator of a resource.  Assumes caller owns the cacheLock.
+ *
+ * @param resource the resource
+ * @return the locator, or NULL if the resource is not in the database
+ */
+static Locator *getResourceLocator(const icDeviceResource *resource)
+{
+    Locator *locator = NULL;
+
+    if (resource != NULL && resource->uri != NULL)
+    {
+        rehydrateDeviceNoLock(resource->uri);
+        locator = (Locator *) hashMapGet(resourcesByUri, resource->uri, strlen(resource->uri) + 1);
+        if (locator != NULL && locator->locatorType != LOCATOR_TYPE_RESOURCE)
+        {
+            locator = NULL;
+        }
+    }
+
+    return locator;
+}
+
+/**
+ * Update many resources at once.  All of the changes are made in the cache together, so readers see
+ * either none or all of them, and each affected device is persisted at most once no matter how many
+ * of its resources changed.
+ *
+ * @param resources the resources to update, as with jsonDatabaseSaveResource.  May be NULL.
+ * @param syncedResources resources whose values did not change but are now in sync, as with
+ *                        jsonDatabaseUpdateDateOfLastSyncMillis.  May be NULL.
+ * @return true if every resource was found and saved, false otherwise
  */
-bool jsonDatabaseSaveResource(icDeviceResource *resource)
+bool jsonDatabaseSaveResources(icLinkedList *resources, icLinkedList *syncedResources)
 {
-    bool retval = false;
-    if (resource != NULL && resource->uri != NULL)
+    bool retval = true;
+
+    pthread_mutex_lock(&writeMtx);
+
+    // device uuid -> PendingResourceSave
+    icHashMap *pendingSaves = hashMapCreate();
+
+    pthread_rwlock_wrlock(&cacheLock);
+
+    if (resources != NULL)
     {
-        pthread_mutex_lock(&mtx);
-        // Take out the bits we can update and update our internal cache
-        Locator *locator = (Locator *) hashMapGet(resourcesByUri, resource->uri, strlen(resource->uri) + 1);
-        if (locator != NULL && locator->locatorType == LOCATOR_TYPE_RESOURCE)
+        scoped_icLinkedListIterator *iter = linkedListIteratorCreate(resources);
+        while (linkedListIteratorHasNext(iter))
         {
+            icDeviceResource *resource = linkedListIteratorGetNext(iter);
+            Locator *locator = getResourceLocator(resource);
+            if (locator == NULL)
+            {
+                icLogWarn(LOG_TAG, "%s: resource %s not found", __FUNCTION__, stringCoalesce(resource->uri));
+                retval = false;
+                continue;
+            }
+
             icDeviceResource *dbResource = locator->locator.resourceLocator.resource;
-            // Update everything that makes sense
-            free(dbResource->value);
-            dbResource->value = resource->value != NULL ? strdup(resource->value) : NULL;
-            dbResource->cachingPolicy = resource->cachingPolicy;
-            dbResource->mode = resource->mode;
-            dbResource->dateOfLastSyncMillis = resource->dateOfLastSyncMillis;
-            // Write out
             DeviceCacheEntry *entry = locator->locator.resourceLocator.deviceCacheEntry;
-            entry->dirty = true;
+            updateCachedResource(dbResource, resource);
+
+            // Its persistence policy decides when this reaches storage
+            if (deferResourceWriteNoLock(entry, dbResource))
+            {
+                continue;
+            }
 
             // If this is a lazy save resource, dont flush to storage yet
-            if ((resource->mode & RESOURCE_MODE_LAZY_SAVE_NEXT) == 0)
+            if ((resource->mode & RESOURCE_MODE_LAZY_SAVE_NEXT) != 0)
             {
-                retval = saveDevice(entry->device);
-                if (retval)
-                {
-                    entry->dirty = false;
-                }
+                markDeviceDirtyNoLock(entry);
+                continue;
             }
-            else
+
+            const char *uuid = entry->device->uuid;
+            PendingResourceSave *pending = hashMapGet(pendingSaves, (void *) uuid, strlen(uuid) + 1);
+            if (pending == NULL)
             {
-                // a lazy save is successful
-                retval = true;
+                pending = calloc(1, sizeof(PendingResourceSave));
+                pending->entry = entry;
+                pending->resources = linkedListCreate();
+                hashMapPut(pendingSaves, (void *) uuid, strlen(uuid) + 1, pending);
             }
+            linkedListAppend(pending->resources, dbResource);
         }
-        pthread_mutex_unlock(&mtx);
     }
 
-    return retval;
-}
-
-/**
- * Update the dateOfLastSyncMillis of a resource.  Note that this is a lazy save and does not write to storage
- * immediately.
- *
- * @param resource the resource to update
- * @return true if success, false otherwise
- */
-bool jsonDatabaseUpdateDateOfLastSyncMillis(icDeviceResource *resource)
-{
-    bool retval = false;
-    if (resource != NULL && resource->uri != NULL)
+    if (syncedResources != NULL)
     {
-        pthread_mutex_lock(&mtx);
-        // Take out the bits we can update and update our internal cache
-        Locator *locator = (Locator *) hashMapGet(resourcesByUri, resource->uri, strlen(resource->uri) + 1);
-        if (locator != NULL && locator->locatorType == LOCATOR_TYPE_RESOURCE)
+        uint64_t now = getCurrentUnixTimeMillis();
+
+        scoped_icLinkedListIterator *iter = linkedListIteratorCreate(syncedResources);
+        while (linkedListIteratorHasNext(iter))
         {
+            Locator *locator = getResourceLocator(linkedListIteratorGetNext(iter));
+            if (locator == NULL)
+            {
+                retval = false;
+                continue;
+            }
+
+            // This is a lazy save so dont flush to storage yet
             icDeviceResource *dbResource = locator->locator.resourceLocator.resource;
-            // Update the dateOfLastSyncMillis to 'now'
-            dbResource->dateOfLastSyncMillis = getCurrentUnixTimeMillis();
-            // Write out
             DeviceCacheEntry *entry = locator->locator.resourceLocator.deviceCacheEntry;
-            entry->dirty = true;
-
-            // This is a lazy save resource so dont flush to storage yet
-            retval = true;
+            dbResource->dateOfLastSyncMillis = now;
+            if (!recordSyncTimeNoLock(dbResource) && !deferResourceWriteNoLock(entry, dbResource))
+            {
+                markDeviceDirtyNoLock(entry);
+            }
         }
-        pthread_mutex_unlock(&mtx);
     }
 
+    pthread_rwlock_unlock(&cacheLock);
+
+    icHashMapIterator *pendingIter = hashMapIteratorCreate(pendingSaves);
+    while (hashMapIteratorHasNext(pendingIter))
+    {
+        void *key;
+        uint16_t keyLen;
+        void *value;
+        hashMapIteratorGetNext(pendingIter, &key, &keyLen, &value);
+        PendingResourceSave *pending = (PendingResourceSave *) value;
+
+        // One journal record per change, the whole device is only written if they can't be journaled
+        bool saved = journalResourcesNoLock(pending->entry, pending->resources) || commitDeviceNoLock(pending->entry);
+        retval = retval && saved;
+    }
+    hashMapIteratorDestroy(pendingIter);
+
+    hashMapDestroy(pendingSaves, pendingResourceSaveFreeFunc);
+
+    pthread_mutex_unlock(&writeMtx);
+
     return retval;
 }
 
@@ -1729,6 +5454,117 @@ static void replaceEndpointResources(EndpointLocator *dst, icDeviceEndpoint *src
 }
 
 // Metadata
+/**
+ * Record a resident device's current metadata in the metadata table.  Assumes caller owns writeMtx
+ * and the write side of cacheLock.
+ *
+ * @param device the device
+ */
+static void putMetadataEntryNoLock(const icDevice *device)
+{
+    LOCK_SCOPE(metadataMtx);
+    jsonDatabaseMetadataTablePutDevice(metadataTable, device);
+}
+
+/**
+ * Look up a metadata of an evicted device in the metadata table, so the device need not be rehydrated.
+ * Caller must not hold any lock.
+ *
+ * @param uri the metadata uri
+ * @param metadata set to a clone of the metadata, or NULL if the device doesn't have it
+ * @return true if the device is evicted and has an entry in the metadata table
+ */
+static bool getEvictedMetadata(const char *uri, icDeviceMetadata **metadata)
+{
+    *metadata = NULL;
+    if (__atomic_load_n(&evictedDeviceCount, __ATOMIC_RELAXED) == 0)
+    {
+        return false;
+    }
+
+    READ_LOCK_SCOPE(cacheLock);
+    DeviceCacheEntry *entry = devices != NULL ? getDeviceCacheEntryByUuidOrUriNoLock(uri) : NULL;
+    if (entry == NULL || entry->device != NULL)
+    {
+        return false;
+    }
+
+    LOCK_SCOPE(metadataMtx);
+    if (!jsonDatabaseMetadataTableContains(metadataTable, entry->uuid))
+    {
+        return false;
+    }
+
+    const icDeviceMetadata *found = jsonDatabaseMetadataTableGet(metadataTable, uri);
+    if (found != NULL)
+    {
+        *metadata = metadataClone(found);
+    }
+
+    return true;
+}
+
+/**
+ * Save or remove a metadata of an evicted device in the metadata table, without making the device
+ * resident.  Assumes caller owns writeMtx and the write side of cacheLock.
+ *
+ * @param uri the metadata uri
+ * @param metadata the metadata to save, or NULL to remove it
+ * @param changed set to the cache entry of the device if its metadata changed, otherwise NULL
+ * @return true if the device is evicted and was handled here
+ */
+static bool changeEvictedMetadataNoLock(const char *uri, const icDeviceMetadata *metadata, DeviceCacheEntry **changed)
+{
+    *changed = NULL;
+
+    DeviceCacheEntry *entry = evictedDeviceCount > 0 ? getDeviceCacheEntryByUuidOrUriNoLock(uri) : NULL;
+    if (entry == NULL || entry->device != NULL)
+    {
+        return false;
+    }
+
+    if (!hasMetadataEntry(entry->uuid))
+    {
+        // The snapshot record of an unverified device may be older than its metadata in storage
+        icDevice *device = entry->unverified ? NULL : decodeEvictedDevice(entry);
+        if (device == NULL)
+        {
+            return false;
+        }
+        putMetadataEntryNoLock(device);
+        deviceDestroy(device);
+    }
+
+    LOCK_SCOPE(metadataMtx);
+    const icDeviceMetadata *current = jsonDatabaseMetadataTableGet(metadataTable, uri);
+    if (metadata != NULL)
+    {
+        if (jsonDatabaseMetadataTableSet(metadataTable, metadata))
+        {
+            if (current == NULL && metadata->endpointId == NULL)
+            {
+                jsonDatabaseIndexAdd(devicesByMetadataId, metadata->id, entry->uuid, entry);
+            }
+            *changed = entry;
+        }
+    }
+    else if (current != NULL)
+    {
+        if (current->endpointId == NULL)
+        {
+            jsonDatabaseIndexRemove(devicesByMetadataId, current->id, entry->uuid);
+        }
+        jsonDatabaseMetadataTableRemove(metadataTable, uri);
+        *changed = entry;
+    }
+    else
+    {
+        icLogWarn(LOG_TAG, "%s: metadata with uri %s is not found", __func__, uri);
+    }
+
+    return true;
+}
+
 /**
  * Retrieve a metadata by its uri
  *
@@ -1740,15 +5576,23 @@ static void replaceEndpointResources(EndpointLocator *dst, icDeviceEndpoint *src
 icDeviceMetadata *jsonDatabaseGetMetadataByUri(const char *uri)
 {
     icDeviceMetadata *metadata = NULL;
-    if (uri != NULL)
+    if (uri != NULL && !getEvictedMetadata(uri, &metadata))
     {
-        pthread_mutex_lock(&mtx);
+        ensureDeviceResident(uri);
+        pthread_rwlock_rdlock(&cacheLock);
         Locator *locator = (Locator *) hashMapGet(resourcesByUri, (void *) uri, strlen(uri) + 1);
         if (locator != NULL && locator->locatorType == LOCATOR_TYPE_METADATA)
         {
             metadata = metadataClone(locator->locator.metadataLocator.metadata);
         }
-        pthread_mutex_unlock(&mtx);
+        else if (locator == NULL)
+        {
+            // The device may have been evicted again since ensureDeviceResident
+            scoped_icDevice *decoded = decodeEvictedOwnerNoLock(uri);
+            icDeviceMetadata *found = decoded != NULL ? findDeviceItemByUri(decoded, LOCATOR_TYPE_METADATA, uri) : NULL;
+            metadata = metadataClone(found);
+        }
+        pthread_rwlock_unlock(&cacheLock);
     }
 
     return metadata;
@@ -1765,10 +5609,18 @@ bool jsonDatabaseSaveMetadata(icDeviceMetadata *metadata)
     bool retval = false;
     if (metadata != NULL && metadata->uri != NULL)
     {
-        pthread_mutex_lock(&mtx);
+        pthread_mutex_lock(&writeMtx);
         DeviceCacheEntry *entry = NULL;
+
+        pthread_rwlock_wrlock(&cacheLock);
+        bool evicted = changeEvictedMetadataNoLock(metadata->uri, metadata, &entry);
+        if (!evicted)
+        {
+            rehydrateDeviceNoLock(metadata->uri);
+        }
         // Copy over the pieces we can update in our internal cache
-        Locator *locator = (Locator *) hashMapGet(resourcesByUri, metadata->uri, strlen(metadata->uri) + 1);
+        Locator *locator =
+            evicted ? NULL : (Locator *) hashMapGet(resourcesByUri, metadata->uri, strlen(metadata->uri) + 1);
         if (locator != NULL)
         {
             if (locator->locatorType == LOCATOR_TYPE_METADATA)
@@ -1776,11 +5628,11 @@ bool jsonDatabaseSaveMetadata(icDeviceMetadata *metadata)
                 icDeviceMetadata *dbMetadata = locator->locator.metadataLocator.metadata;
                 free(dbMetadata->value);
                 dbMetadata->value = strdup(metadata->value);
-                // Mark the device dirty and save
+                // Save the device's metadata
                 entry = locator->locator.metadataLocator.deviceCacheEntry;
             }
         }
-        else
+        else if (!evicted)
         {
             // Create new metadata
             entry = hashMapGet(devices, metadata->deviceUuid, strlen(metadata->deviceUuid) + 1);
@@ -1818,23 +5670,58 @@ bool jsonDatabaseSaveMetadata(icDeviceMetadata *metadata)
             }
         }
 
-        // Flush the change if we did something
+        if (entry != NULL && entry->device != NULL)
+        {
+            putMetadataEntryNoLock(entry->device);
+        }
+
+        pthread_rwlock_unlock(&cacheLock);
+
+        // Only the metadata is written, the device record catches up whenever it is next written
         if (entry != NULL)
         {
-            entry->dirty = true;
-            retval = saveDevice(entry->device);
-            if (retval)
-            {
-                entry->dirty = false;
-            }
+            retval = saveMetadataRecordNoLock(entry->uuid);
         }
 
-        pthread_mutex_unlock(&mtx);
+        pthread_mutex_unlock(&writeMtx);
     }
 
     return retval;
 }
 
+/**
+ * Append a clone of the item a locator points at
+ * @param items the list to append to
+ * @param locator the locator
+ */
+static void appendLocatorItemClone(icLinkedList *items, const Locator *locator)
+{
+    switch (locator->locatorType)
+    {
+
+        case LOCATOR_TYPE_DEVICE:
+            linkedListAppend(items, deviceClone(locator->locator.deviceCacheEntry->device));
+            break;
+        case LOCATOR_TYPE_ENDPOINT:
+            linkedListAppend(items, endpointClone(locator->locator.endpointLocator.endpoint));
+            break;
+        case LOCATOR_TYPE_RESOURCE:
+            linkedListAppend(items, resourceClone(locator->locator.resourceLocator.resource));
+            break;
+        case LOCATOR_TYPE_METADATA:
+            linkedListAppend(items, metadataClone(locator->locator.metadataLocator.metadata));
+            break;
+        default:
+            icLogError(LOG_TAG, "Unknown locator type value %d", (int) locator->locatorType);
+            break;
+    }
+}
+
+static bool uriMatchesRegex(const char *uri, void *ctx)
+{
+    return regexec((const regex_t *) ctx, uri, 0, NULL, 0) == 0;
+}
+
 /**
  * Get a list of items based on a uri regex of the specified type
  * @param uriRegex the regex to match
@@ -1852,7 +5739,7 @@ static icLinkedList *getItemsByUriRegex(const char *uriRegex, LocatorType locato
 
         if (ret == 0)
         {
-            pthread_mutex_lock(&mtx);
+            pthread_rwlock_rdlock(&cacheLock);
             icHashMapIterator *iter = hashMapIteratorCreate(resourcesByUri);
             while (hashMapIteratorHasNext(iter))
             {
@@ -1865,30 +5752,13 @@ static icLinkedList *getItemsByUriRegex(const char *uriRegex, LocatorType locato
                     ret = regexec(&regex, key, 0, NULL, 0);
                     if (ret == 0)
                     {
-                        switch (locatorType)
-                        {
-
-                            case LOCATOR_TYPE_DEVICE:
-                                linkedListAppend(items, deviceClone(value->locator.deviceCacheEntry->device));
-                                break;
-                            case LOCATOR_TYPE_ENDPOINT:
-                                linkedListAppend(items, endpointClone(value->locator.endpointLocator.endpoint));
-                                break;
-                            case LOCATOR_TYPE_RESOURCE:
-                                linkedListAppend(items, resourceClone(value->locator.resourceLocator.resource));
-                                break;
-                            case LOCATOR_TYPE_METADATA:
-                                linkedListAppend(items, metadataClone(value->locator.metadataLocator.metadata));
-                                break;
-                            default:
-                                icLogError(LOG_TAG, "Unknown locator type value %d", (int) locatorType);
-                                break;
-                        }
+                        appendLocatorItemClone(items, value);
                     }
                 }
             }
             hashMapIteratorDestroy(iter);
-            pthread_mutex_unlock(&mtx);
+            appendEvictedItemClones(items, locatorType, NULL, uriMatchesRegex, &regex);
+            pthread_rwlock_unlock(&cacheLock);
 
             // Cleanup
             regfree(&regex);
@@ -1923,6 +5793,123 @@ icLinkedList *jsonDatabaseGetMetadataByUriRegex(const char *uriRegex)
     return getItemsByUriRegex(uriRegex, LOCATOR_TYPE_METADATA);
 }
 
+struct PatternMatchContext
+{
+    icLinkedList *items;
+    LocatorType locatorType;
+};
+
+static void appendMatchingItemClone(const char *uri, void *value, void *ctx)
+{
+    (void) uri;
+    struct PatternMatchContext *context = ctx;
+    const Locator *locator = value;
+
+    if (locator->locatorType == context->locatorType)
+    {
+        appendLocatorItemClone(context->items, locator);
+    }
+}
+
+static bool uriMatchesPattern(const char *uri, void *ctx)
+{
+    return jsonDatabaseUriPatternMatches((const char *) ctx, uri);
+}
+
+/**
+ * Get the device uuid a uri pattern is limited to
+ *
+ * @param uriPattern the pattern
+ * @return the uuid, or NULL if the pattern could match uris of any device.  Caller must free.
+ */
+static char *getUriPatternDeviceUuid(const char *uriPattern)
+{
+    if (uriPattern[0] != '/')
+    {
+        return NULL;
+    }
+
+    size_t len = strcspn(uriPattern + 1, "/");
+    if (len == 0 || memchr(uriPattern + 1, '*', len) != NULL)
+    {
+        return NULL;
+    }
+
+    return strndup(uriPattern + 1, len);
+}
+
+/**
+ * Get a list of items based on a uri wildcard pattern of the specified type
+ * @param uriPattern the pattern to match
+ * @param locatorType the type of items to get(devices, endpoints, resources, metadata)
+ * @return the list of items
+ */
+static icLinkedList *getItemsByUriPattern(const char *uriPattern, LocatorType locatorType)
+{
+    struct PatternMatchContext context = {.items = linkedListCreate(), .locatorType = locatorType};
+
+    if (uriPattern != NULL)
+    {
+        // A pattern within one device is a lookup of that device, anything wider only decodes
+        // evicted devices
+        scoped_generic char *uuid = getUriPatternDeviceUuid(uriPattern);
+        ensureDeviceResident(uuid);
+
+        READ_LOCK_SCOPE(cacheLock);
+        jsonDatabaseUriTrieMatch(uriTrie, uriPattern, appendMatchingItemClone, &context);
+        appendEvictedItemClones(context.items, locatorType, uuid, uriMatchesPattern, (void *) uriPattern);
+    }
+
+    return context.items;
+}
+
+icLinkedList *jsonDatabaseGetResourcesByUriPattern(const char *uriPattern)
+{
+    return getItemsByUriPattern(uriPattern, LOCATOR_TYPE_RESOURCE);
+}
+
+icLinkedList *jsonDatabaseGetMetadataByUriPattern(const char *uriPattern)
+{
+    return getItemsByUriPattern(uriPattern, LOCATOR_TYPE_METADATA);
+}
+
+/**
+ * Build the regex that matches the same URIs as a wildcard pattern
+ *
+ * @param uriPattern the pattern
+ * @return the regex.  Caller must free.
+ */
+char *jsonDatabaseCreateUriPatternRegex(const char *uriPattern)
+{
+    // Figure out how big the regex will be
+    int wildcardChars = 0;
+    int i = 0;
+    for (; uriPattern[i]; ++i)
+    {
+        if (uriPattern[i] == '*')
+        {
+            ++wildcardChars;
+        }
+    }
+
+    // Build the regex, essentially just replacing * with .* and anchoring it to the whole URI like a pattern
+    char *regexUri = (char *) malloc(i + wildcardChars + 3);
+    int j = 0;
+    regexUri[j++] = '^';
+    for (i = 0; uriPattern[i]; ++i)
+    {
+        if (uriPattern[i] == '*')
+        {
+            regexUri[j++] = '.';
+        }
+        regexUri[j++] = uriPattern[i];
+    }
+    regexUri[j++] = '$';
+    regexUri[j] = '\0';
+
+    return regexUri;
+}
+
 static bool searchResourceListByResource(void *searchVal, void *item)
 {
     return searchVal == item;
@@ -1939,7 +5926,14 @@ bool jsonDatabaseAddResource(const char *ownerUri, icDeviceResource *resource)
     bool retval = false;
     if (ownerUri != NULL && resource != NULL && resource->id != NULL && resource->uri != NULL)
     {
-        pthread_mutex_lock(&mtx);
+        pthread_mutex_lock(&writeMtx);
+        if (evictedDeviceCount > 0)
+        {
+            pthread_rwlock_wrlock(&cacheLock);
+            rehydrateDeviceNoLock(ownerUri);
+            pthread_rwlock_unlock(&cacheLock);
+        }
+        // Only writers change the URI map, so holding writeMtx is enough for this lookup
         Locator *locator = (Locator *) hashMapGet(resourcesByUri, (void *) ownerUri, strlen(ownerUri) + 1);
         if (locator != NULL)
         {
@@ -1963,34 +5957,42 @@ bool jsonDatabaseAddResource(const char *ownerUri, icDeviceResource *resource)
             if (resourceList != NULL && deviceCacheEntry != NULL)
             {
                 icDeviceResource *newResource = resourceClone(resource);
-                if (linkedListAppend(resourceList, newResource) == true)
+
+                pthread_rwlock_wrlock(&cacheLock);
+                bool didAppend = linkedListAppend(resourceList, newResource);
+                bool didAdd = didAppend && addDeviceResourceURIEntry(deviceCacheEntry, endpoint, newResource);
+                pthread_rwlock_unlock(&cacheLock);
+
+                if (didAdd == true)
                 {
-                    if (addDeviceResourceURIEntry(deviceCacheEntry, endpoint, newResource) == true)
+                    // Flush to storage
+                    settleJournalNoLock();
+                    if (saveDevice(deviceCacheEntry->device) == true)
                     {
-                        // Flush to storage
-                        if (saveDevice(deviceCacheEntry->device) == true)
-                        {
-                            retval = true;
-                        }
-                        else
-                        {
-                            // Cleanup
-                            removeDeviceResourceURIEntry(newResource);
-                        }
+                        retval = true;
                     }
-
-                    if (retval == false)
+                    else
                     {
-                        // Clean up, remove resource from list
-                        linkedListDelete(resourceList,
-                                         newResource,
-                                         searchResourceListByResource,
-                                         (linkedListItemFreeFunc) resourceDestroy);
+                        // Cleanup
+                        pthread_rwlock_wrlock(&cacheLock);
+                        removeDeviceResourceURIEntry(newResource);
+                        pthread_rwlock_unlock(&cacheLock);
                     }
                 }
+
+                if (didAppend == true && retval == false)
+                {
+                    // Clean up, remove resource from list
+                    pthread_rwlock_wrlock(&cacheLock);
+                    linkedListDelete(resourceList,
+                                     newResource,
+                                     searchResourceListByResource,
+                                     (linkedListItemFreeFunc) resourceDestroy);
+                    pthread_rwlock_unlock(&cacheLock);
+                }
             }
         }
-        pthread_mutex_unlock(&mtx);
+        pthread_mutex_unlock(&writeMtx);
     }
 
     return retval;
@@ -2013,7 +6015,8 @@ bool jsonDatabaseIsUriAccessible(const char *uri)
         return false;
     }
 
-    pthread_mutex_lock(&mtx);
+    ensureDeviceResident(uri);
+    pthread_rwlock_rdlock(&cacheLock);
     Locator *locator = (Locator *) hashMapGet(resourcesByUri, (void *) uri, strlen(uri) + 1);
     if (locator != NULL)
     {
@@ -2060,15 +6063,31 @@ bool jsonDatabaseIsUriAccessible(const char *uri)
     }
     else
     {
-        // It can be a new metadata
-        //
-        pthread_mutex_unlock(&mtx);
+        // The device may have been evicted again since ensureDeviceResident
+        scoped_icDevice *decoded = decodeEvictedOwnerNoLock(uri);
+        icDeviceEndpoint *endpoint = decoded != NULL ? findEndpointOwningUri(decoded, uri) : NULL;
+        if (endpoint != NULL)
+        {
+            accessible = isEndpointEnabled(endpoint);
+        }
+        else if (decoded != NULL && deviceOwnsUri(decoded, uri))
+        {
+            // it is on device
+            //
+            accessible = true;
+        }
+        else
+        {
+            // It can be a new metadata
+            //
+            pthread_rwlock_unlock(&cacheLock);
 
-        accessible = isMetadataAccessible(uri);
+            accessible = isMetadataAccessible(uri);
 
-        pthread_mutex_lock(&mtx);
+            pthread_rwlock_rdlock(&cacheLock);
+        }
     }
-    pthread_mutex_unlock(&mtx);
+    pthread_rwlock_unlock(&cacheLock);
 
     return accessible;
 }
@@ -2196,18 +6215,36 @@ bool jsonDatabaseRemoveMetadataByUri(const char *uri)
 
     if (uri != NULL)
     {
-        LOCK_SCOPE(mtx);
+        LOCK_SCOPE(writeMtx);
         scoped_generic char *metadataUri = strdup(uri);
+        DeviceCacheEntry *entry = NULL;
+        bool evicted = false;
+
+        if (evictedDeviceCount > 0)
+        {
+            pthread_rwlock_wrlock(&cacheLock);
+            evicted = changeEvictedMetadataNoLock(metadataUri, NULL, &entry);
+            if (!evicted)
+            {
+                rehydrateDeviceNoLock(metadataUri);
+            }
+            pthread_rwlock_unlock(&cacheLock);
+        }
 
         // get the locator to required metadata from our URI hashmap
-        Locator *locator = (Locator *) hashMapGet(resourcesByUri, (void *) metadataUri, strlen(metadataUri) + 1);
-        if (locator != NULL && locator->locatorType == LOCATOR_TYPE_METADATA)
+        Locator *locator =
+            evicted ? NULL : (Locator *) hashMapGet(resourcesByUri, (void *) metadataUri, strlen(metadataUri) + 1);
+        if (evicted)
+        {
+            retVal = entry != NULL && saveMetadataRecordNoLock(entry->uuid);
+        }
+        else if (locator != NULL && locator->locatorType == LOCATOR_TYPE_METADATA)
         {
+            pthread_rwlock_wrlock(&cacheLock);
             // remove the locator from our URI hashmap, but don't destory it yet
-            if (hashMapDelete(resourcesByUri, metadataUri, strlen(metadataUri) + 1, standardDoNotFreeHashMapFunc))
+            if (deleteUriLocator(metadataUri, standardDoNotFreeHashMapFunc))
             {
                 icLinkedList *metadataList = NULL;
-                DeviceCacheEntry *entry = locator->locator.metadataLocator.deviceCacheEntry;
                 // find if the metadata is endpoint metadata or device metadata
                 if (locator->locator.metadataLocator.endpoint != NULL)
                 {
@@ -2216,6 +6253,9 @@ bool jsonDatabaseRemoveMetadataByUri(const char *uri)
                 else
                 {
                     metadataList = locator->locator.metadataLocator.deviceCacheEntry->device->metadata;
+                    jsonDatabaseIndexRemove(devicesByMetadataId,
+                                            locator->locator.metadataLocator.metadata->id,
+                                            locator->locator.metadataLocator.deviceCacheEntry->device->uuid);
                 }
 
                 // Now delete the metadata from the its list
@@ -2224,13 +6264,8 @@ bool jsonDatabaseRemoveMetadataByUri(const char *uri)
                                      compareMetadata,
                                      (linkedListItemFreeFunc) metadataDestroy))
                 {
-                    // save the device
-                    entry->dirty = true;
-                    retVal = saveDevice(entry->device);
-                    if (retVal)
-                    {
-                        entry->dirty = false;
-                    }
+                    entry = locator->locator.metadataLocator.deviceCacheEntry;
+                    putMetadataEntryNoLock(entry->device);
                 }
                 else
                 {
@@ -2241,6 +6276,13 @@ bool jsonDatabaseRemoveMetadataByUri(const char *uri)
             {
                 icLogWarn(LOG_TAG, "%s: unable to delete metadata locator from URI hash map", __func__);
             }
+            pthread_rwlock_unlock(&cacheLock);
+
+            if (entry != NULL)
+            {
+                // save the device's metadata
+                retVal = saveMetadataRecordNoLock(entry->uuid);
+            }
             free(locator);
         }
         else
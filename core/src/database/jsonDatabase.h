@@ -35,9 +35,22 @@
 
 #define JSON_DATABASE_CURRENT_SCHEMA_VERSION "2"
 #define JSON_DATABASE_SCHEMA_VERSION_KEY     "schemaVersion"
+#define JSON_DATABASE_RECORDS_SEALED_KEY     "deviceRecordsSealed"
 #define JSON_DATABASE_METADATA_MARKER        "/m/"
 #define JSON_DATABASE_ENDPOINT_MARKER        "/ep/"
 
+/**
+ * Callback for reading a device in place.  The device is owned by the database and is only valid
+ * for the duration of the callback.  It must not be modified or retained, and the callback must not
+ * call back into the database.
+ */
+typedef void (*jsonDatabaseDeviceVisitor)(const icDevice *device, void *ctx);
+
+/**
+ * Callback for reading a resource in place.  Same rules as jsonDatabaseDeviceVisitor apply.
+ */
+typedef void (*jsonDatabaseResourceVisitor)(const icDeviceResource *resource, void *ctx);
+
 /**
  * Open or create our jsonDatabase.
  *
@@ -71,6 +84,190 @@ bool jsonDatabaseReload();
  */
 bool jsonDatabaseRestore(const char *tempRestoreDir);
 
+/**
+ * Write the whole database (system properties and every device) to a single archive file.  Devices are
+ * written one at a time, so the archive is never held in memory.  The file is replaced atomically.
+ *
+ * @param path the archive file to write
+ * @return true on success
+ */
+bool jsonDatabaseExportArchive(const char *path);
+
+/**
+ * Replace the contents of the database with an archive written by jsonDatabaseExportArchive.  Devices
+ * that are not in the archive are removed.  jsonDatabaseRestore uses this when the restore directory
+ * contains a "devicedb.archive" file.
+ *
+ * @param path the archive file to read
+ * @param incremental when true only devices that differ from the archive are rewritten, otherwise
+ *                    every archived device is
+ * @return true if every archived device was imported
+ */
+bool jsonDatabaseImportArchive(const char *path, bool incremental);
+
+/**
+ * Configure write-behind persistence of device changes.  When enabled, endpoint, resource and
+ * metadata updates only change the in memory cache and a background flusher writes the dirty
+ * devices to storage every flushIntervalMillis, or as soon as maxDirtyDevices devices are waiting.
+ * When disabled (the default) every non-lazy change is written to storage before the call returns.
+ * Adding devices, endpoints and resources is always written through.
+ *
+ * Write-behind is turned off by jsonDatabaseCleanup and must be enabled again after initializing.
+ *
+ * @param flushIntervalMillis the longest a change may wait before being written, or 0 to disable
+ * @param maxDirtyDevices the number of dirty devices that triggers an early flush, or 0 for no limit
+ *
+ * @see jsonDatabaseFlush
+ */
+void jsonDatabaseSetWriteBehind(uint32_t flushIntervalMillis, uint16_t maxDirtyDevices);
+
+/**
+ * Write every pending device change (including lazy saves) to storage before returning.  Use this
+ * as a durability barrier when a change must not be lost.
+ *
+ * @return true if all pending changes were written, false otherwise
+ */
+bool jsonDatabaseFlush(void);
+
+/**
+ * Write the pending changes of one device (including lazy saves) to storage before returning.  Other
+ * devices' changes are only written when the journal requires it.  Cheaper than jsonDatabaseFlush
+ * when only one device must not be lost, e.g. at the end of pairing.
+ *
+ * @param uuid the uuid of the device
+ * @return true if the device's changes were written, false otherwise
+ */
+bool jsonDatabaseFlushDevice(const char *uuid);
+
+/**
+ * Enable (or disable) journaling of resource updates.  When enabled, a resource update appends a small
+ * record to the journal instead of rewriting the whole device.  The device snapshots are brought up to
+ * date (compaction) once maxRecords records have accumulated, on jsonDatabaseFlush, and on cleanup.
+ * Records left over from a previous run are replayed when the journal is enabled and on reload.
+ *
+ * Sensitive and lazily saved resources are never journaled.  The journal is closed by jsonDatabaseCleanup
+ * and must be enabled again after initializing.
+ *
+ * @param path the journal file, or NULL to disable journaling
+ * @param maxRecords the number of records that triggers compaction, or 0 to only compact on flush/cleanup
+ * @return false if the journal could not be opened, in which case updates rewrite the device as usual
+ */
+bool jsonDatabaseSetJournal(const char *path, uint32_t maxRecords);
+
+/**
+ * Enable (or disable) the resource sync table.  When enabled, bumping a resource's last sync time
+ * (jsonDatabaseUpdateDateOfLastSyncMillis, or the synced resources of jsonDatabaseSaveResources) records
+ * the time in a compact table instead of rewriting the whole device.  The table is written to its file
+ * (checkpointed) at most every checkpointIntervalMillis, on jsonDatabaseFlush, and on cleanup, and its
+ * times are applied over the device snapshots when the table is enabled and on reload.
+ *
+ * The table is closed by jsonDatabaseCleanup and must be enabled again after initializing.
+ *
+ * @param path the table file, or NULL to disable the table
+ * @param checkpointIntervalMillis the longest a recorded time waits to be checkpointed, or 0 to only
+ *                                 checkpoint on flush/cleanup
+ * @return false if the table could not be opened, in which case sync times are saved with their device
+ */
+bool jsonDatabaseSetSyncTable(const char *path, uint32_t checkpointIntervalMillis);
+
+/**
+ * Select how device records are encoded in storage: compact records or pretty printed JSON.  The
+ * default comes from the BCORE_DEVICE_DB_COMPACT_RECORDS build option.  Compact records are a
+ * versioned binary encoding (see jsonDatabaseCompactRecord.h) that is decoded straight into the device
+ * model, which makes loading devices much cheaper than parsing JSON.  Either encoding is accepted when
+ * loading.  When set before jsonDatabaseInitialize, devices found in the other encoding while loading
+ * are rewritten, so switching back to JSON also converts compact records before an older build needs
+ * to read them; otherwise records switch over as they are next saved.  scripts/export-device-db.py
+ * prints stored records of either encoding as JSON.
+ *
+ * @param compact true to write compact records, false to write pretty printed JSON
+ */
+void jsonDatabaseSetCompactFormat(bool compact);
+
+/**
+ * Set how many threads read and parse device files when the database is initialized or reloaded.
+ * Devices are always merged into the cache by the initializing thread, in storage key order, so the
+ * result does not depend on the worker count.  The default is 1 (no extra threads).
+ *
+ * @param workers the number of loading threads, including the initializing thread.  0 is treated as 1.
+ */
+void jsonDatabaseSetLoadWorkers(uint8_t workers);
+
+/**
+ * Bound how many devices are kept fully resident in the cache.  Beyond the limit, the least recently
+ * looked up devices without unsaved changes are evicted to a compact serialized form and rehydrated
+ * when next looked up by id or uri.  Queries spanning many devices decode evicted devices without
+ * making them resident.  Devices with unsaved changes are never evicted, so the limit can be exceeded
+ * while write-behind has work pending.
+ *
+ * @param maxDevices the most devices to keep resident, or 0 (the default) for no limit, which
+ *                   rehydrates every evicted device
+ */
+void jsonDatabaseSetCacheLimit(uint32_t maxDevices);
+
+/**
+ * Enable (or disable) the cold start snapshot: a memory mapped copy of the whole device cache that
+ * jsonDatabaseInitialize serves devices from without reading or parsing any device file.  The device
+ * files stay authoritative.  A background thread replaces each device from the snapshot with its
+ * stored version, adds devices missing from the snapshot and drops those no longer stored; a device
+ * that is looked up by id or uri (or changed) before that is loaded from storage right away.
+ *
+ * The snapshot is rewritten when storage changed, at most every intervalMillis and on a persisting
+ * cleanup.  Like the load workers, the setting survives cleanup, so set it before initializing.
+ *
+ * @param path the snapshot file, or NULL to disable the snapshot
+ * @param intervalMillis how often the snapshot may be rewritten, or 0 to only write it on cleanup
+ */
+void jsonDatabaseSetSnapshot(const char *path, uint32_t intervalMillis);
+
+typedef struct
+{
+    uint32_t maxResidentDevices;
+    uint32_t residentDevices;
+    uint32_t evictedDevices;
+    uint32_t unverifiedDevices;    // from the cold start snapshot, not yet checked against storage
+    uint64_t hits;                 // lookups that found their device resident
+    uint64_t rehydrations;         // lookups that had to rehydrate their device
+    uint64_t evictions;
+    uint64_t rehydrateMillisTotal; // divide by rehydrations for the average latency
+    uint64_t rehydrateMillisMax;
+} JsonDatabaseCacheStats;
+
+/**
+ * Get the bounded cache statistics.  Hits and rehydrations are only counted while a limit is set or
+ * devices from the cold start snapshot are evicted.
+ *
+ * @param stats filled in with the current statistics
+ */
+void jsonDatabaseGetCacheStats(JsonDatabaseCacheStats *stats);
+
+/**
+ * Export a device as pretty printed JSON, exactly as it would be persisted as JSON (sensitive values
+ * remain protected).  Intended for debugging when storage holds compact records; records on disk can
+ * be exported with scripts/export-device-db.py instead.
+ *
+ * @param uuid the device to export
+ * @return the JSON document, or NULL if the device does not exist.  Caller must free.
+ */
+char *jsonDatabaseExportDeviceJSON(const char *uuid);
+
+/**
+ * Callback for system property changes.  Called after the change, without any database lock held.
+ *
+ * @param key the property that changed, or NULL after a bulk change (initialize, cleanup, reload,
+ *            restore or import) that may have changed any of them
+ * @param ctx the context given when the listener was set
+ */
+typedef void (*jsonDatabaseSystemPropertyListener)(const char *key, void *ctx);
+
+/**
+ * Set the listener for system property changes, replacing any previous one.
+ *
+ * @param listener the listener, or NULL to stop listening
+ * @param ctx context passed to the listener
+ */
+void jsonDatabaseSetSystemPropertyListener(jsonDatabaseSystemPropertyListener listener, void *ctx);
+
 /**
  * Retrieve a system property by name.
  *
@@ -165,6 +362,18 @@ icLinkedList *jsonDatabaseGetDevicesByDeviceClass(const char *deviceClass);
  */
 icLinkedList *jsonDatabaseGetDevicesByDeviceDriver(const char *deviceDriverName);
 
+/**
+ * Retrieve all devices with a device level metadata item, optionally with a particular value
+ *
+ * @param metadataId the metadata id
+ * @param value the value to match (case insensitive), or NULL to match any non-NULL value
+ * @return linked list of devices, caller is responsible for destroying
+ *
+ * @see linkedListDestroy
+ * @see deviceDestroy
+ */
+icLinkedList *jsonDatabaseGetDevicesByMetadata(const char *metadataId, const char *value);
+
 /**
  * Retrieve a device by its UUID
  *
@@ -195,6 +404,47 @@ bool jsonDatabaseIsUriAccessible(const char *uri);
  */
 icDevice *jsonDatabaseGetDeviceByUri(const char *uri);
 
+/**
+ * Run a visitor against a device without cloning it.  Prefer this (or a field accessor) over
+ * jsonDatabaseGetDeviceById when only a few fields are needed.
+ *
+ * @param uuid the uuid of the device
+ * @param visitor the callback, run while the database is read locked
+ * @param ctx context for the callback
+ * @return true if the device was found and visited
+ *
+ * @see jsonDatabaseDeviceVisitor
+ */
+bool jsonDatabaseVisitDeviceById(const char *uuid, jsonDatabaseDeviceVisitor visitor, void *ctx);
+
+/**
+ * Run a visitor against the device that owns a uri without cloning it.
+ *
+ * @param uri the uri of the device, or one of its endpoints, resources or metadata
+ * @param visitor the callback, run while the database is read locked
+ * @param ctx context for the callback
+ * @return true if the device was found and visited
+ *
+ * @see jsonDatabaseDeviceVisitor
+ */
+bool jsonDatabaseVisitDeviceByUri(const char *uri, jsonDatabaseDeviceVisitor visitor, void *ctx);
+
+/**
+ * Get the device class of a device without cloning the device
+ *
+ * @param uuid the uuid of the device
+ * @return the device class or NULL if the device is not found.  Caller frees.
+ */
+char *jsonDatabaseGetDeviceClassById(const char *uuid);
+
+/**
+ * Get the name of the driver managing the device that owns a uri without cloning the device
+ *
+ * @param uri the uri of the device, or one of its endpoints, resources or metadata
+ * @return the driver name or NULL if the device is not found.  Caller frees.
+ */
+char *jsonDatabaseGetDeviceDriverByUri(const char *uri);
+
 /**
  * Check if the provided device uuid is known to our database.
  *
@@ -264,6 +514,18 @@ bool jsonDatabaseSaveEndpoint(icDeviceEndpoint *endpoint);
  */
 icDeviceResource *jsonDatabaseGetResourceByUri(const char *uri);
 
+/**
+ * Run a visitor against a resource without cloning it.
+ *
+ * @param uri the uri of the resource
+ * @param visitor the callback, run while the database is read locked
+ * @param ctx context for the callback
+ * @return true if the resource was found and visited
+ *
+ * @see jsonDatabaseResourceVisitor
+ */
+bool jsonDatabaseVisitResourceByUri(const char *uri, jsonDatabaseResourceVisitor visitor, void *ctx);
+
 /**
  * Update a resource in the database.  The following properties can be updated:
  * value
@@ -271,6 +533,8 @@ icDeviceResource *jsonDatabaseGetResourceByUri(const char *uri);
  * mode
  * dateOfLastSyncMillis
  *
+ * When the change is written to storage follows the persistence policy the resource was created with.
+ *
  * @param resource the resource to update
  * @return true if success, false otherwise
  */
@@ -285,6 +549,17 @@ bool jsonDatabaseSaveResource(icDeviceResource *resource);
  */
 bool jsonDatabaseUpdateDateOfLastSyncMillis(icDeviceResource *resource);
 
+/**
+ * Update many resources in one transaction.  Readers see either none or all of the changes, and each
+ * affected device is persisted at most once.
+ *
+ * @param resources resources to update, as with jsonDatabaseSaveResource.  May be NULL.
+ * @param syncedResources resources whose values did not change but are now in sync, as with
+ *                        jsonDatabaseUpdateDateOfLastSyncMillis.  May be NULL.
+ * @return true if every resource was found and saved, false otherwise
+ */
+bool jsonDatabaseSaveResources(icLinkedList *resources, icLinkedList *syncedResources);
+
 // Metadata
 /**
  * Retrieve a metadata by its uri
@@ -320,6 +595,36 @@ icLinkedList *jsonDatabaseGetResourcesByUriRegex(const char *uriRegex);
  */
 icLinkedList *jsonDatabaseGetMetadataByUriRegex(const char *uriRegex);
 
+/**
+ * Get a list of resources matching the given wildcard pattern.  '*' matches any run of characters
+ * (including '/') and everything else matches itself; the pattern must match the whole URI.  Only the
+ * part of the URI space below the pattern's literal start is searched, so prefer this over
+ * jsonDatabaseGetResourcesByUriRegex when the query can be expressed with wildcards.
+ *
+ * @param uriPattern the pattern to match
+ * @return the resources that match the pattern
+ */
+icLinkedList *jsonDatabaseGetResourcesByUriPattern(const char *uriPattern);
+
+/**
+ * Get a list of metadata matching the given wildcard pattern.
+ *
+ * @param uriPattern the pattern to match
+ * @return the metadata that match the pattern
+ * @see jsonDatabaseGetResourcesByUriPattern
+ */
+icLinkedList *jsonDatabaseGetMetadataByUriPattern(const char *uriPattern);
+
+/**
+ * Build the regex that matches the same URIs as a wildcard pattern: each '*' becomes ".*" and the
+ * regex is anchored to the whole URI.  Any other regex operator in the pattern keeps its meaning.
+ *
+ * @param uriPattern the pattern
+ * @return the regex.  Caller must free.
+ * @see jsonDatabaseGetResourcesByUriPattern
+ */
+char *jsonDatabaseCreateUriPatternRegex(const char *uriPattern);
+
 /**
  * Add a new resource to an existing device/endpoint
  * @param ownerUri
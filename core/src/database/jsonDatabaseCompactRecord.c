@@ -0,0 +1,658 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "device/deviceStringIntern.h"
+#include "jsonDatabaseCompactRecord.h"
+#include <device/icDeviceEndpoint.h>
+#include <device/icDeviceMetadata.h>
+#include <device/icDeviceResource.h>
+#include <glib.h>
+#include <icConfig/simpleProtectConfig.h>
+#include <icTypes/icLinkedList.h>
+#include <icUtil/stringUtils.h>
+
+#define LOG_TAG     "jsonDatabaseCompactRecord"
+#define logFmt(fmt) "%s: " fmt, __func__
+#include <icLog/logging.h>
+
+// JSON records start with '{', so the marker tells the encodings apart
+#define COMPACT_RECORD_MARKER     "bdbdev:"
+#define COMPACT_RECORD_MARKER_LEN (sizeof(COMPACT_RECORD_MARKER) - 1)
+#define COMPACT_RECORD_VERSION    1
+
+// Resource flags
+#define COMPACT_RESOURCE_PROTECTED_VALUE 0x1 // the value is protected with the namespace
+#define COMPACT_RESOURCE_OWN_POLICY      0x2 // a persistence policy and interval follow
+
+// Version 1 layout.  Integers are unsigned LEB128 varints.  Strings are a varint of their length
+// plus one followed by their bytes, 0 standing for NULL.  A NULL uri is the one derived from the ids.
+//   device:   version byte, uuid, uri, managingDeviceDriver, deviceClass, deviceClassVersion,
+//             endpoint count, endpoints, resource count, resources, metadata count, metadata
+//   endpoint: id, uri, profile, profileVersion, enabled, resource count, resources, metadata count,
+//             metadata
+//   resource: id, uri, type, mode, cachingPolicy, dateOfLastSyncMillis, flags,
+//             [persistencePolicy, persistIntervalSecs], value
+//   metadata: id, uri, value
+
+/**
+ * A read position in a binary record.  Once malformed is set every take returns nothing.
+ */
+typedef struct
+{
+    const uint8_t *pos;
+    const uint8_t *end;
+    bool malformed;
+} Cursor;
+
+static void putVarint(GByteArray *out, uint64_t value)
+{
+    uint8_t bytes[10];
+    guint len = 0;
+
+    do
+    {
+        bytes[len] = value & 0x7F;
+        value >>= 7;
+        if (value != 0)
+        {
+            bytes[len] |= 0x80;
+        }
+        len++;
+    } while (value != 0);
+
+    g_byte_array_append(out, bytes, len);
+}
+
+static void putString(GByteArray *out, const char *str)
+{
+    if (str == NULL)
+    {
+        putVarint(out, 0);
+        return;
+    }
+
+    size_t len = strlen(str);
+    putVarint(out, (uint64_t) len + 1);
+    g_byte_array_append(out, (const guint8 *) str, len);
+}
+
+/**
+ * Put a uri, leaving it out if it is the derived one.
+ *
+ * @param derivedUri the uri made from the ids, may be NULL
+ */
+static void putUri(GByteArray *out, const char *uri, const char *derivedUri)
+{
+    putString(out, stringCompare(uri, derivedUri, false) == 0 ? NULL : uri);
+}
+
+static void putResource(GByteArray *out, const icDeviceResource *resource, const char *protectNamespace)
+{
+    scoped_generic char *protectedValue = NULL;
+    uint64_t flags = 0;
+
+    if ((resource->mode & RESOURCE_MODE_SENSITIVE) && resource->value != NULL)
+    {
+        if (protectNamespace != NULL)
+        {
+            protectedValue = simpleProtectConfigData(protectNamespace, resource->value);
+        }
+        else
+        {
+            icWarn("cannot protect resource %s: no namespace", resource->uri);
+        }
+
+        if (protectedValue != NULL)
+        {
+            flags |= COMPACT_RESOURCE_PROTECTED_VALUE;
+        }
+    }
+
+    // Like JSON records, only policies other than the default are stored
+    if (!resourceHasDefaultPersistencePolicy(resource))
+    {
+        flags |= COMPACT_RESOURCE_OWN_POLICY;
+    }
+
+    scoped_generic char *derivedUri = resourceUriCreate(resource->deviceUuid, resource->endpointId, resource->id);
+
+    putString(out, resource->id);
+    putUri(out, resource->uri, derivedUri);
+    putString(out, resource->type);
+    putVarint(out, resource->mode);
+    putVarint(out, resource->cachingPolicy);
+    putVarint(out, resource->dateOfLastSyncMillis);
+    putVarint(out, flags);
+    if (flags & COMPACT_RESOURCE_OWN_POLICY)
+    {
+        putVarint(out, resource->persistencePolicy);
+        putVarint(out, resource->persistIntervalSecs);
+    }
+    putString(out, protectedValue != NULL ? protectedValue : resource->value);
+}
+
+static void putResources(GByteArray *out, icLinkedList *resources, const char *protectNamespace)
+{
+    putVarint(out, linkedListCount(resources));
+
+    scoped_icLinkedListIterator *it = linkedListIteratorCreate(resources);
+    while (linkedListIteratorHasNext(it))
+    {
+        putResource(out, linkedListIteratorGetNext(it), protectNamespace);
+    }
+}
+
+static void putMetadatas(GByteArray *out, icLinkedList *metadatas)
+{
+    putVarint(out, linkedListCount(metadatas));
+
+    scoped_icLinkedListIterator *it = linkedListIteratorCreate(metadatas);
+    while (linkedListIteratorHasNext(it))
+    {
+        icDeviceMetadata *metadata = linkedListIteratorGetNext(it);
+        scoped_generic char *derivedUri = metadataUriCreate(metadata->deviceUuid, metadata->endpointId, metadata->id);
+
+        putString(out, metadata->id);
+        putUri(out, metadata->uri, derivedUri);
+        putString(out, metadata->value);
+    }
+}
+
+static void putEndpoints(GByteArray *out, icLinkedList *endpoints, const char *protectNamespace)
+{
+    putVarint(out, linkedListCount(endpoints));
+
+    scoped_icLinkedListIterator *it = linkedListIteratorCreate(endpoints);
+    while (linkedListIteratorHasNext(it))
+    {
+        icDeviceEndpoint *endpoint = linkedListIteratorGetNext(it);
+        scoped_generic char *derivedUri = endpointUriCreate(endpoint->deviceUuid, endpoint->id);
+
+        putString(out, endpoint->id);
+        putUri(out, endpoint->uri, derivedUri);
+        putString(out, endpoint->profile);
+        putVarint(out, endpoint->profileVersion);
+        putVarint(out, endpoint->enabled ? 1 : 0);
+        putResources(out, endpoint->resources, protectNamespace);
+        putMetadatas(out, endpoint->metadata);
+    }
+}
+
+char *jsonDatabaseCompactRecordEncode(const icDevice *device, const char *protectNamespace)
+{
+    if (device == NULL)
+    {
+        return NULL;
+    }
+
+    GByteArray *binary = g_byte_array_new();
+    const uint8_t version = COMPACT_RECORD_VERSION;
+    scoped_generic char *derivedUri = stringBuilder("/%s", device->uuid);
+
+    g_byte_array_append(binary, &version, 1);
+    putString(binary, device->uuid);
+    putUri(binary, device->uri, derivedUri);
+    putString(binary, device->managingDeviceDriver);
+    putString(binary, device->deviceClass);
+    putVarint(binary, device->deviceClassVersion);
+    putEndpoints(binary, device->endpoints, protectNamespace);
+    putResources(binary, device->resources, protectNamespace);
+    putMetadatas(binary, device->metadata);
+
+    gchar *encoded = g_base64_encode(binary->data, binary->len);
+    char *record = stringBuilder(COMPACT_RECORD_MARKER "%s", encoded);
+
+    g_free(encoded);
+    g_byte_array_free(binary, TRUE);
+
+    return record;
+}
+
+bool jsonDatabaseCompactRecordIsCompact(const char *record)
+{
+    return record != NULL && strncmp(record, COMPACT_RECORD_MARKER, COMPACT_RECORD_MARKER_LEN) == 0;
+}
+
+static uint64_t takeVarint(Cursor *cursor)
+{
+    uint64_t value = 0;
+
+    for (unsigned int shift = 0; !cursor->malformed; shift += 7)
+    {
+        if (cursor->pos == cursor->end || shift > 63)
+        {
+            cursor->malformed = true;
+            break;
+        }
+
+        uint8_t byte = *cursor->pos++;
+        value |= (uint64_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return value;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @return a copy of the string, or NULL if it was stored as NULL or the record is malformed
+ */
+static char *takeString(Cursor *cursor)
+{
+    uint64_t lenPlusOne = takeVarint(cursor);
+    if (lenPlusOne == 0)
+    {
+        return NULL;
+    }
+
+    uint64_t len = lenPlusOne - 1;
+    if (len > (uint64_t) (cursor->end - cursor->pos) || memchr(cursor->pos, '\0', len) != NULL)
+    {
+        cursor->malformed = true;
+        return NULL;
+    }
+
+    char *str = strndup((const char *) cursor->pos, len);
+    cursor->pos += len;
+
+    return str;
+}
+
+/**
+ * Take a resource, reading all of it even when it turns out to be invalid.
+ *
+ * @return the resource, or NULL if it is invalid or the record is malformed
+ */
+static icDeviceResource *
+takeResource(Cursor *cursor, const char *deviceUuid, const char *endpointId, const char *protectNamespace)
+{
+    scoped_icDeviceResource *tempResource = (icDeviceResource *) calloc(1, sizeof(icDeviceResource));
+    tempResource->deviceUuid = deviceStringInternAcquire(deviceUuid);
+    tempResource->endpointId = deviceStringInternAcquire(endpointId);
+    tempResource->id = takeString(cursor);
+    tempResource->uri = takeString(cursor);
+
+    scoped_generic char *type = takeString(cursor);
+    tempResource->type = deviceStringInternAcquire(type);
+    tempResource->mode = (uint8_t) takeVarint(cursor);
+    tempResource->cachingPolicy = (ResourceCachingPolicy) takeVarint(cursor);
+    tempResource->dateOfLastSyncMillis = takeVarint(cursor);
+
+    uint64_t flags = takeVarint(cursor);
+    uint64_t persistencePolicy = 0;
+    uint64_t persistIntervalSecs = 0;
+    if (flags & COMPACT_RESOURCE_OWN_POLICY)
+    {
+        persistencePolicy = takeVarint(cursor);
+        persistIntervalSecs = takeVarint(cursor);
+    }
+
+    scoped_generic char *storedValue = takeString(cursor);
+
+    if (cursor->malformed)
+    {
+        return NULL;
+    }
+
+    if (stringIsPrintable(tempResource->id, false) == false)
+    {
+        icError("invalid resource id '%s'", stringCoalesce(tempResource->id));
+        return NULL;
+    }
+
+    if (tempResource->uri == NULL)
+    {
+        tempResource->uri = resourceUriCreate(deviceUuid, endpointId, tempResource->id);
+    }
+    else if (resourceUriIsValid(tempResource->uri, deviceUuid, endpointId, tempResource->id) == false)
+    {
+        icError("invalid resource %s: invalid uri", tempResource->uri);
+        return NULL;
+    }
+
+    if (stringIsEmpty(tempResource->type) == true)
+    {
+        icError("invalid resource %s: no type", tempResource->uri);
+        return NULL;
+    }
+
+    if (flags & COMPACT_RESOURCE_PROTECTED_VALUE)
+    {
+        if (protectNamespace != NULL && storedValue != NULL)
+        {
+            tempResource->value = simpleUnprotectConfigData(protectNamespace, storedValue);
+        }
+        else
+        {
+            icWarn("cannot decrypt value for resource %s: no namespace", tempResource->uri);
+        }
+    }
+    else
+    {
+        tempResource->value = storedValue;
+        storedValue = NULL;
+    }
+
+    if (flags & COMPACT_RESOURCE_OWN_POLICY)
+    {
+        resourceSetPersistencePolicy(
+            tempResource, (ResourcePersistencePolicy) persistencePolicy, (uint32_t) persistIntervalSecs);
+    }
+    else
+    {
+        resourceApplyDefaultPersistencePolicy(tempResource);
+    }
+
+    icDeviceResource *resource = tempResource;
+    tempResource = NULL;
+    return resource;
+}
+
+/**
+ * Take a list of resources.
+ *
+ * @param resources the list to add them to
+ * @return false if a resource was invalid and the decode is not permissive, or the record is malformed
+ */
+static bool takeResources(Cursor *cursor,
+                          const char *deviceUuid,
+                          const char *endpointId,
+                          const char *protectNamespace,
+                          bool permissive,
+                          icLinkedList *resources)
+{
+    bool valid = true;
+    uint64_t count = takeVarint(cursor);
+
+    for (uint64_t i = 0; i < count && !cursor->malformed; i++)
+    {
+        icDeviceResource *resource = takeResource(cursor, deviceUuid, endpointId, protectNamespace);
+        if (resource != NULL)
+        {
+            linkedListAppend(resources, resource);
+        }
+        else
+        {
+            valid = valid && permissive;
+        }
+    }
+
+    return valid && !cursor->malformed;
+}
+
+/**
+ * Take a metadata item, reading all of it even when it turns out to be invalid.
+ *
+ * @return the metadata, or NULL if it is invalid or the record is malformed
+ */
+static icDeviceMetadata *takeMetadata(Cursor *cursor, const char *deviceUuid, const char *endpointId)
+{
+    scoped_icDeviceMetadata *tempMetadata = (icDeviceMetadata *) calloc(1, sizeof(icDeviceMetadata));
+    tempMetadata->deviceUuid = deviceStringInternAcquire(deviceUuid);
+    tempMetadata->endpointId = deviceStringInternAcquire(endpointId);
+    tempMetadata->id = takeString(cursor);
+    tempMetadata->uri = takeString(cursor);
+    tempMetadata->value = takeString(cursor);
+
+    if (cursor->malformed)
+    {
+        return NULL;
+    }
+
+    if (stringIsPrintable(tempMetadata->id, false) == false)
+    {
+        icError("invalid metadata id '%s'", stringCoalesce(tempMetadata->id));
+        return NULL;
+    }
+
+    if (tempMetadata->uri == NULL)
+    {
+        tempMetadata->uri = metadataUriCreate(deviceUuid, endpointId, tempMetadata->id);
+    }
+    else if (metadataUriIsValid(tempMetadata->uri, deviceUuid, endpointId, tempMetadata->id) == false)
+    {
+        icError("invalid metadata %s: invalid uri", tempMetadata->uri);
+        return NULL;
+    }
+
+    if (stringIsEmpty(tempMetadata->value) == true)
+    {
+        icError("invalid metadata %s: no value", tempMetadata->uri);
+        return NULL;
+    }
+
+    icDeviceMetadata *metadata = tempMetadata;
+    tempMetadata = NULL;
+    return metadata;
+}
+
+/**
+ * Take a list of metadata.
+ *
+ * @param metadatas the list to add them to
+ * @return false if an item was invalid and the decode is not permissive, or the record is malformed
+ */
+static bool takeMetadatas(
+    Cursor *cursor, const char *deviceUuid, const char *endpointId, bool permissive, icLinkedList *metadatas)
+{
+    bool valid = true;
+    uint64_t count = takeVarint(cursor);
+
+    for (uint64_t i = 0; i < count && !cursor->malformed; i++)
+    {
+        icDeviceMetadata *metadata = takeMetadata(cursor, deviceUuid, endpointId);
+        if (metadata != NULL)
+        {
+            linkedListAppend(metadatas, metadata);
+        }
+        else
+        {
+            valid = valid && permissive;
+        }
+    }
+
+    return valid && !cursor->malformed;
+}
+
+/**
+ * Take an endpoint, reading all of it even when it turns out to be invalid.  As with JSON records,
+ * an endpoint with an invalid resource or metadata item is invalid as a whole.
+ *
+ * @return the endpoint, or NULL if it is invalid or the record is malformed
+ */
+static icDeviceEndpoint *takeEndpoint(Cursor *cursor, const char *deviceUuid, const char *protectNamespace)
+{
+    scoped_icDeviceEndpoint *tempEndpoint = (icDeviceEndpoint *) calloc(1, sizeof(icDeviceEndpoint));
+    tempEndpoint->deviceUuid = deviceStringInternAcquire(deviceUuid);
+    tempEndpoint->id = takeString(cursor);
+    tempEndpoint->uri = takeString(cursor);
+    tempEndpoint->profile = takeString(cursor);
+    tempEndpoint->profileVersion = (uint8_t) takeVarint(cursor);
+    tempEndpoint->enabled = takeVarint(cursor) != 0;
+    tempEndpoint->resources = linkedListCreate();
+    tempEndpoint->metadata = linkedListCreate();
+
+    bool itemsValid =
+        takeResources(cursor, deviceUuid, tempEndpoint->id, protectNamespace, false, tempEndpoint->resources);
+    itemsValid = takeMetadatas(cursor, deviceUuid, tempEndpoint->id, false, tempEndpoint->metadata) && itemsValid;
+
+    if (cursor->malformed)
+    {
+        return NULL;
+    }
+
+    if (stringIsPrintable(tempEndpoint->id, false) == false)
+    {
+        icError("invalid endpoint id '%s'", stringCoalesce(tempEndpoint->id));
+        return NULL;
+    }
+
+    if (tempEndpoint->uri == NULL)
+    {
+        tempEndpoint->uri = endpointUriCreate(deviceUuid, tempEndpoint->id);
+    }
+    else if (endpointUriIsValid(tempEndpoint->uri, deviceUuid, tempEndpoint->id) == false)
+    {
+        icError("invalid endpoint %s: invalid uri", tempEndpoint->uri);
+        return NULL;
+    }
+
+    if (stringIsEmpty(tempEndpoint->profile) == true)
+    {
+        icError("invalid endpoint %s: no profile", tempEndpoint->uri);
+        return NULL;
+    }
+
+    if (!itemsValid)
+    {
+        icError("invalid endpoint %s: invalid resources or metadata", tempEndpoint->uri);
+        return NULL;
+    }
+
+    icDeviceEndpoint *endpoint = tempEndpoint;
+    tempEndpoint = NULL;
+    return endpoint;
+}
+
+/**
+ * Decode the binary record into a device.
+ *
+ * @return the device, or NULL if the record is malformed or the device is invalid
+ */
+static icDevice *takeDevice(Cursor *cursor, const char *protectNamespace, bool permissive)
+{
+    scoped_icDevice *tempDevice = (icDevice *) calloc(1, sizeof(icDevice));
+    tempDevice->uuid = takeString(cursor);
+    tempDevice->uri = takeString(cursor);
+
+    // Everything below is named after the uuid
+    if (stringIsPrintable(tempDevice->uuid, false) == false)
+    {
+        icError("invalid device: invalid uuid '%s'", stringCoalesce(tempDevice->uuid));
+        return NULL;
+    }
+
+    if (tempDevice->uri == NULL)
+    {
+        tempDevice->uri = stringBuilder("/%s", tempDevice->uuid);
+    }
+    else if (deviceUriIsValid(tempDevice->uri, tempDevice->uuid) == false)
+    {
+        icError("invalid device %s: invalid uri", tempDevice->uuid);
+        return NULL;
+    }
+
+    tempDevice->managingDeviceDriver = takeString(cursor);
+    tempDevice->deviceClass = takeString(cursor);
+    tempDevice->deviceClassVersion = (uint8_t) takeVarint(cursor);
+    tempDevice->endpoints = linkedListCreate();
+    tempDevice->resources = linkedListCreate();
+    tempDevice->metadata = linkedListCreate();
+
+    if (stringIsEmpty(tempDevice->managingDeviceDriver) == true || stringIsEmpty(tempDevice->deviceClass) == true)
+    {
+        icError("invalid device %s: no managingDeviceDriver or deviceClass", tempDevice->uri);
+        return NULL;
+    }
+
+    bool valid = true;
+    uint64_t endpointCount = takeVarint(cursor);
+    for (uint64_t i = 0; i < endpointCount && !cursor->malformed; i++)
+    {
+        icDeviceEndpoint *endpoint = takeEndpoint(cursor, tempDevice->uuid, protectNamespace);
+        if (endpoint != NULL)
+        {
+            linkedListAppend(tempDevice->endpoints, endpoint);
+        }
+        else
+        {
+            valid = valid && permissive;
+        }
+    }
+
+    valid = takeResources(cursor, tempDevice->uuid, NULL, protectNamespace, permissive, tempDevice->resources) && valid;
+    valid = takeMetadatas(cursor, tempDevice->uuid, NULL, permissive, tempDevice->metadata) && valid;
+
+    if (cursor->malformed || cursor->pos != cursor->end)
+    {
+        icError("device %s: malformed record", tempDevice->uuid);
+        return NULL;
+    }
+
+    if (!valid)
+    {
+        icError("invalid device %s: invalid endpoints, resources or metadata", tempDevice->uri);
+        return NULL;
+    }
+
+    if (linkedListCount(tempDevice->endpoints) == 0 || linkedListCount(tempDevice->resources) == 0)
+    {
+        icError("invalid device %s: no valid endpoints or resources", tempDevice->uri);
+        return NULL;
+    }
+
+    icDevice *device = tempDevice;
+    tempDevice = NULL;
+    return device;
+}
+
+icDevice *jsonDatabaseCompactRecordDecode(const char *record, const char *protectNamespace, bool permissive)
+{
+    if (!jsonDatabaseCompactRecordIsCompact(record))
+    {
+        return NULL;
+    }
+
+    // The encoded record ends at the seal, if there is one
+    const char *text = record + COMPACT_RECORD_MARKER_LEN;
+    gchar *encoded = g_strndup(text, strcspn(text, "#"));
+    gsize binaryLen = 0;
+    guchar *binary = g_base64_decode(encoded, &binaryLen);
+    icDevice *device = NULL;
+
+    g_free(encoded);
+
+    if (binary == NULL || binaryLen == 0)
+    {
+        icError("empty or undecodable record");
+    }
+    else if (binary[0] != COMPACT_RECORD_VERSION)
+    {
+        icError("unsupported record version %u, this build reads version %u", binary[0], COMPACT_RECORD_VERSION);
+    }
+    else
+    {
+        Cursor cursor = {.pos = binary + 1, .end = binary + binaryLen, .malformed = false};
+        device = takeDevice(&cursor, protectNamespace, permissive);
+    }
+
+    g_free(binary);
+
+    return device;
+}
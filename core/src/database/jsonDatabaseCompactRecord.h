@@ -0,0 +1,69 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+/*
+ * Compact device records for the device database: a versioned binary encoding of a device that is
+ * decoded straight into the device model, without building or searching a JSON tree.  Field names
+ * are implied by position, integers are variable length and URIs that can be derived from the ids
+ * they are made of are left out.  Sensitive resource values are protected exactly as they are in
+ * JSON records.
+ *
+ * Storage only carries text, so the stored form is a marker followed by the base64 of the binary
+ * record.  It can be sealed like any other record.  The first byte of the binary record is its
+ * version; records written by a newer version are rejected rather than guessed at.
+ */
+
+#pragma once
+
+#include <device/icDevice.h>
+#include <stdbool.h>
+
+/**
+ * Encode a device as a compact record.
+ *
+ * @param device the device
+ * @param protectNamespace the namespace sensitive resource values are protected with, or NULL to
+ *                         store them as is
+ * @return the record, caller must free
+ */
+char *jsonDatabaseCompactRecordEncode(const icDevice *device, const char *protectNamespace);
+
+/**
+ * Check whether a stored record is a compact record rather than a JSON document.  Only the start
+ * of the record is looked at.
+ *
+ * @param record the record, possibly sealed
+ * @return true for a compact record
+ */
+bool jsonDatabaseCompactRecordIsCompact(const char *record);
+
+/**
+ * Decode a compact record into a device, checking it the way deviceFromJSON checks JSON records.
+ *
+ * @param record the record, possibly sealed.  Its checksum is not verified here.
+ * @param protectNamespace the namespace sensitive resource values were protected with
+ * @param permissive if true, leave out invalid endpoints, resources and metadata rather than failing
+ * @return the device, or NULL if the record is damaged, from a newer version or describes an invalid
+ *         device.  Caller must destroy.
+ */
+icDevice *jsonDatabaseCompactRecordDecode(const char *record, const char *protectNamespace, bool permissive);
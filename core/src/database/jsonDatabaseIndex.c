@@ -0,0 +1,159 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "jsonDatabaseIndex.h"
+#include <icTypes/icHashMap.h>
+
+struct _JsonDatabaseIndex
+{
+    // key -> (id -> value)
+    icHashMap *keys;
+};
+
+static void freeIdEntry(void *key, void *value)
+{
+    // Only the id copy is owned
+    (void) value;
+    free(key);
+}
+
+static void freeKeyEntry(void *key, void *value)
+{
+    free(key);
+    hashMapDestroy((icHashMap *) value, freeIdEntry);
+}
+
+JsonDatabaseIndex *jsonDatabaseIndexCreate(void)
+{
+    JsonDatabaseIndex *index = calloc(1, sizeof(JsonDatabaseIndex));
+    index->keys = hashMapCreate();
+
+    return index;
+}
+
+void jsonDatabaseIndexDestroy(JsonDatabaseIndex *index)
+{
+    if (index != NULL)
+    {
+        hashMapDestroy(index->keys, freeKeyEntry);
+        free(index);
+    }
+}
+
+void jsonDatabaseIndexAdd(JsonDatabaseIndex *index, const char *key, const char *id, void *value)
+{
+    if (index == NULL || key == NULL || id == NULL)
+    {
+        return;
+    }
+
+    uint16_t keyLen = (uint16_t) (strlen(key) + 1);
+    icHashMap *members = hashMapGet(index->keys, (void *) key, keyLen);
+    if (members == NULL)
+    {
+        members = hashMapCreate();
+        hashMapPut(index->keys, strdup(key), keyLen, members);
+    }
+
+    uint16_t idLen = (uint16_t) (strlen(id) + 1);
+    if (!hashMapContains(members, (void *) id, idLen))
+    {
+        hashMapPut(members, strdup(id), idLen, value);
+    }
+}
+
+void jsonDatabaseIndexRemove(JsonDatabaseIndex *index, const char *key, const char *id)
+{
+    if (index == NULL || key == NULL || id == NULL)
+    {
+        return;
+    }
+
+    uint16_t keyLen = (uint16_t) (strlen(key) + 1);
+    icHashMap *members = hashMapGet(index->keys, (void *) key, keyLen);
+    if (members != NULL)
+    {
+        hashMapDelete(members, (void *) id, (uint16_t) (strlen(id) + 1), freeIdEntry);
+        if (hashMapCount(members) == 0)
+        {
+            hashMapDelete(index->keys, (void *) key, keyLen, freeKeyEntry);
+        }
+    }
+}
+
+void jsonDatabaseIndexRemoveId(JsonDatabaseIndex *index, const char *id)
+{
+    if (index == NULL || id == NULL)
+    {
+        return;
+    }
+
+    uint16_t idLen = (uint16_t) (strlen(id) + 1);
+    icHashMapIterator *iter = hashMapIteratorCreate(index->keys);
+    while (hashMapIteratorHasNext(iter))
+    {
+        void *key;
+        uint16_t keyLen;
+        icHashMap *members;
+        hashMapIteratorGetNext(iter, &key, &keyLen, (void **) &members);
+        if (hashMapDelete(members, (void *) id, idLen, freeIdEntry) && hashMapCount(members) == 0)
+        {
+            hashMapIteratorDeleteCurrent(iter, freeKeyEntry);
+        }
+    }
+    hashMapIteratorDestroy(iter);
+}
+
+uint32_t jsonDatabaseIndexVisit(JsonDatabaseIndex *index,
+                                const char *key,
+                                JsonDatabaseIndexVisitor visitor,
+                                void *ctx)
+{
+    uint32_t visited = 0;
+
+    if (index == NULL || key == NULL || visitor == NULL)
+    {
+        return 0;
+    }
+
+    icHashMap *members = hashMapGet(index->keys, (void *) key, (uint16_t) (strlen(key) + 1));
+    if (members != NULL)
+    {
+        icHashMapIterator *iter = hashMapIteratorCreate(members);
+        while (hashMapIteratorHasNext(iter))
+        {
+            void *id;
+            uint16_t idLen;
+            void *value;
+            hashMapIteratorGetNext(iter, &id, &idLen, &value);
+            visitor(value, ctx);
+            visited++;
+        }
+        hashMapIteratorDestroy(iter);
+    }
+
+    return visited;
+}
@@ -0,0 +1,99 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+/*
+ * A secondary index for the device database: each key (e.g. a device class) maps to the set of
+ * values (device cache entries) that currently have it, so lookups cost the size of the result
+ * instead of the number of devices.  Values are identified by a unique id (the device uuid) and are
+ * not owned by the index.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct _JsonDatabaseIndex JsonDatabaseIndex;
+
+/**
+ * Callback for each value found by jsonDatabaseIndexVisit.
+ *
+ * @param value the indexed value
+ * @param ctx the context passed to jsonDatabaseIndexVisit
+ */
+typedef void (*JsonDatabaseIndexVisitor)(void *value, void *ctx);
+
+/**
+ * @return a new, empty index.  Caller must destroy it.
+ *
+ * @see jsonDatabaseIndexDestroy
+ */
+JsonDatabaseIndex *jsonDatabaseIndexCreate(void);
+
+/**
+ * Destroy an index.  Indexed values are left alone.
+ *
+ * @param index the index to destroy
+ */
+void jsonDatabaseIndexDestroy(JsonDatabaseIndex *index);
+
+/**
+ * Record that a value has a key.  Adding the same key and id again has no effect.
+ *
+ * @param index the index
+ * @param key the key, e.g. a device class.  NULL keys are ignored.
+ * @param id the unique id of the value
+ * @param value the value
+ */
+void jsonDatabaseIndexAdd(JsonDatabaseIndex *index, const char *key, const char *id, void *value);
+
+/**
+ * Record that a value no longer has a key.
+ *
+ * @param index the index
+ * @param key the key.  NULL keys are ignored.
+ * @param id the unique id of the value
+ */
+void jsonDatabaseIndexRemove(JsonDatabaseIndex *index, const char *key, const char *id);
+
+/**
+ * Record that a value no longer has any key, e.g. when its keys are not known.  This visits every
+ * key, so prefer jsonDatabaseIndexRemove when they are known.
+ *
+ * @param index the index
+ * @param id the unique id of the value
+ */
+void jsonDatabaseIndexRemoveId(JsonDatabaseIndex *index, const char *id);
+
+/**
+ * Invoke a callback for every value that has a key.  The index must not be changed by the callback.
+ *
+ * @param index the index
+ * @param key the key
+ * @param visitor the callback
+ * @param ctx context passed to the callback
+ * @return the number of values visited
+ */
+uint32_t jsonDatabaseIndexVisit(JsonDatabaseIndex *index,
+                                const char *key,
+                                JsonDatabaseIndexVisitor visitor,
+                                void *ctx);
@@ -0,0 +1,310 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jsonDatabaseJournal.h"
+#include <cjson/cJSON.h>
+#include <glib.h>
+#include <icTypes/icLinkedList.h>
+#include <icUtil/stringUtils.h>
+#include <jsonHelper/jsonHelper.h>
+
+#define LOG_TAG     "jsonDatabaseJournal"
+#define logFmt(fmt) "%s: " fmt, __func__
+#include <icLog/logging.h>
+
+#define JOURNAL_URI_KEY            "uri"
+#define JOURNAL_VALUE_KEY          "value"
+#define JOURNAL_MODE_KEY           "mode"
+#define JOURNAL_CACHING_POLICY_KEY "cachingPolicy"
+#define JOURNAL_LAST_SYNC_KEY      "dateOfLastSyncMillis"
+
+struct _JsonDatabaseJournal
+{
+    char *path;
+    int fd;
+    uint32_t recordCount;
+};
+
+JsonDatabaseJournal *jsonDatabaseJournalOpen(const char *path)
+{
+    if (path == NULL)
+    {
+        icError("path is NULL");
+        return NULL;
+    }
+
+    errno = 0;
+    int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        g_autofree char *errMsg = strerrorSafe(errno);
+        icError("failed to open journal '%s' - %s", path, errMsg);
+        return NULL;
+    }
+
+    JsonDatabaseJournal *journal = calloc(1, sizeof(JsonDatabaseJournal));
+    journal->path = strdup(path);
+    journal->fd = fd;
+
+    return journal;
+}
+
+void jsonDatabaseJournalClose(JsonDatabaseJournal *journal)
+{
+    if (journal != NULL)
+    {
+        close(journal->fd);
+        free(journal->path);
+        free(journal);
+    }
+}
+
+/*
+ * Add a resource's record to the lines waiting to be appended.  The newline terminates the record so a
+ * torn write is detectable on replay.
+ */
+static bool addRecordLine(GString *lines, const icDeviceResource *resource)
+{
+    if (resource == NULL || resource->uri == NULL)
+    {
+        return false;
+    }
+
+    scoped_cJSON *record = cJSON_CreateObject();
+    cJSON_AddStringToObject(record, JOURNAL_URI_KEY, resource->uri);
+    if (resource->value != NULL)
+    {
+        cJSON_AddStringToObject(record, JOURNAL_VALUE_KEY, resource->value);
+    }
+    else
+    {
+        cJSON_AddNullToObject(record, JOURNAL_VALUE_KEY);
+    }
+    cJSON_AddNumberToObject(record, JOURNAL_MODE_KEY, resource->mode);
+    cJSON_AddNumberToObject(record, JOURNAL_CACHING_POLICY_KEY, resource->cachingPolicy);
+    cJSON_AddNumberToObject(record, JOURNAL_LAST_SYNC_KEY, (double) resource->dateOfLastSyncMillis);
+
+    scoped_generic char *line = cJSON_PrintUnformatted(record);
+    g_string_append(lines, line);
+    g_string_append_c(lines, '\n');
+
+    return true;
+}
+
+/*
+ * Write whole records to the end of the journal with a single sync.  If anything fails the journal is cut
+ * back to where it was, so a later append never lands behind a torn record.
+ */
+static bool writeRecordLines(JsonDatabaseJournal *journal, const GString *lines, uint32_t count)
+{
+    off_t start = lseek(journal->fd, 0, SEEK_END);
+    if (start < 0)
+    {
+        g_autofree char *errMsg = strerrorSafe(errno);
+        icError("failed to find the end of journal '%s' - %s", journal->path, errMsg);
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < lines->len)
+    {
+        ssize_t rc = write(journal->fd, lines->str + written, lines->len - written);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            g_autofree char *errMsg = strerrorSafe(errno);
+            icError("failed to append to journal '%s' - %s", journal->path, errMsg);
+            break;
+        }
+        written += (size_t) rc;
+    }
+
+    if (written == lines->len && fdatasync(journal->fd) == 0)
+    {
+        journal->recordCount += count;
+        return true;
+    }
+
+    if (written == lines->len)
+    {
+        g_autofree char *errMsg = strerrorSafe(errno);
+        icError("failed to sync journal '%s' - %s", journal->path, errMsg);
+    }
+
+    if (ftruncate(journal->fd, start) != 0)
+    {
+        g_autofree char *errMsg = strerrorSafe(errno);
+        icError("failed to cut journal '%s' back after a failed append - %s", journal->path, errMsg);
+    }
+
+    return false;
+}
+
+bool jsonDatabaseJournalAppend(JsonDatabaseJournal *journal, const icDeviceResource *resource)
+{
+    if (journal == NULL)
+    {
+        return false;
+    }
+
+    g_autoptr(GString) lines = g_string_new(NULL);
+
+    return addRecordLine(lines, resource) && writeRecordLines(journal, lines, 1);
+}
+
+bool jsonDatabaseJournalAppendAll(JsonDatabaseJournal *journal, icLinkedList *resources)
+{
+    if (journal == NULL || resources == NULL)
+    {
+        return false;
+    }
+
+    g_autoptr(GString) lines = g_string_new(NULL);
+    uint32_t count = 0;
+
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(resources);
+    while (linkedListIteratorHasNext(iter))
+    {
+        if (!addRecordLine(lines, linkedListIteratorGetNext(iter)))
+        {
+            return false;
+        }
+        count++;
+    }
+
+    return count == 0 || writeRecordLines(journal, lines, count);
+}
+
+uint32_t jsonDatabaseJournalReplay(JsonDatabaseJournal *journal, JsonDatabaseJournalReplayFunc replayFunc, void *ctx)
+{
+    uint32_t replayed = 0;
+
+    if (journal == NULL || replayFunc == NULL)
+    {
+        return 0;
+    }
+
+    FILE *f = fopen(journal->path, "r");
+    if (f == NULL)
+    {
+        g_autofree char *errMsg = strerrorSafe(errno);
+        icError("failed to open journal '%s' for replay - %s", journal->path, errMsg);
+        return 0;
+    }
+
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t lineLen;
+    uint32_t recordCount = 0;
+    off_t completeLen = 0;
+    bool torn = false;
+    while ((lineLen = getline(&line, &lineCapacity, f)) > 0)
+    {
+        if (line[lineLen - 1] != '\n')
+        {
+            // Only the last line can be missing its newline
+            icWarn("skipping incomplete record at the end of journal '%s'", journal->path);
+            torn = true;
+            break;
+        }
+
+        recordCount++;
+        completeLen += lineLen;
+
+        scoped_cJSON *record = cJSON_Parse(line);
+        const char *uri = cJSON_GetStringValue(cJSON_GetObjectItem(record, JOURNAL_URI_KEY));
+        const cJSON *value = cJSON_GetObjectItem(record, JOURNAL_VALUE_KEY);
+        int mode = 0;
+        int cachingPolicy = 0;
+        const cJSON *lastSync = cJSON_GetObjectItem(record, JOURNAL_LAST_SYNC_KEY);
+
+        if (uri == NULL || value == NULL || !cJSON_IsNumber(lastSync) ||
+            !getCJSONInt(record, JOURNAL_MODE_KEY, &mode) ||
+            !getCJSONInt(record, JOURNAL_CACHING_POLICY_KEY, &cachingPolicy))
+        {
+            icWarn("skipping invalid record %" PRIu32 " in journal '%s'", recordCount, journal->path);
+            continue;
+        }
+
+        icDeviceResource entry = {
+            .uri = (char *) uri,
+            .value = cJSON_IsString(value) ? value->valuestring : NULL,
+            .mode = (uint8_t) mode,
+            .cachingPolicy = (ResourceCachingPolicy) cachingPolicy,
+            .dateOfLastSyncMillis = (uint64_t) lastSync->valuedouble,
+        };
+
+        replayFunc(&entry, ctx);
+        replayed++;
+    }
+
+    free(line);
+    fclose(f);
+
+    // Drop the torn record, or the next append would be joined onto it and lost along with it
+    if (torn && (ftruncate(journal->fd, completeLen) != 0 || fdatasync(journal->fd) != 0))
+    {
+        g_autofree char *errMsg = strerrorSafe(errno);
+        icError("failed to drop the incomplete record from journal '%s' - %s", journal->path, errMsg);
+    }
+
+    journal->recordCount = recordCount;
+
+    return replayed;
+}
+
+bool jsonDatabaseJournalTruncate(JsonDatabaseJournal *journal)
+{
+    if (journal == NULL)
+    {
+        return false;
+    }
+
+    if (ftruncate(journal->fd, 0) != 0 || fdatasync(journal->fd) != 0)
+    {
+        g_autofree char *errMsg = strerrorSafe(errno);
+        icError("failed to truncate journal '%s' - %s", journal->path, errMsg);
+        return false;
+    }
+
+    journal->recordCount = 0;
+
+    return true;
+}
+
+uint32_t jsonDatabaseJournalGetRecordCount(const JsonDatabaseJournal *journal)
+{
+    return journal != NULL ? journal->recordCount : 0;
+}
@@ -0,0 +1,111 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+/*
+ * An append-only journal of resource updates.  Each record is one line of JSON describing the
+ * updatable properties of a single resource, so small changes don't require rewriting the whole
+ * device.  Records are applied on top of the device snapshots when the database is loaded, and the
+ * journal is truncated once those snapshots have been rewritten (compaction).
+ */
+
+#pragma once
+
+#include <device/icDeviceResource.h>
+#include <icTypes/icLinkedList.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct _JsonDatabaseJournal JsonDatabaseJournal;
+
+/**
+ * Callback for each record found while replaying a journal.
+ *
+ * @param record a temporary resource holding uri, value, mode, cachingPolicy and dateOfLastSyncMillis.
+ *               Only valid for the duration of the callback.
+ * @param ctx the context passed to jsonDatabaseJournalReplay
+ */
+typedef void (*JsonDatabaseJournalReplayFunc)(const icDeviceResource *record, void *ctx);
+
+/**
+ * Open (or create) a journal file.
+ *
+ * @param path the journal file path
+ * @return the journal, or NULL on failure.  Caller must close it.
+ *
+ * @see jsonDatabaseJournalClose
+ */
+JsonDatabaseJournal *jsonDatabaseJournalOpen(const char *path);
+
+/**
+ * Close a journal, leaving its contents on disk.
+ *
+ * @param journal the journal to close
+ */
+void jsonDatabaseJournalClose(JsonDatabaseJournal *journal);
+
+/**
+ * Append a resource update and sync it to disk before returning.  Every append pays for its own sync,
+ * which is what lets a saved resource survive a power loss the moment the save returns; use
+ * jsonDatabaseJournalAppendAll to share one sync between several updates.  If the append fails, nothing
+ * of it is left in the journal.
+ *
+ * @param journal the journal
+ * @param resource the resource whose current state should be recorded
+ * @return true if the record is durable, false otherwise
+ */
+bool jsonDatabaseJournalAppend(JsonDatabaseJournal *journal, const icDeviceResource *resource);
+
+/**
+ * Append several resource updates with a single write and sync.  Either all of them are appended or,
+ * on failure, none are left in the journal.
+ *
+ * @param journal the journal
+ * @param resources the icDeviceResources whose current state should be recorded
+ * @return true if every record is durable, false otherwise
+ */
+bool jsonDatabaseJournalAppendAll(JsonDatabaseJournal *journal, icLinkedList *resources);
+
+/**
+ * Invoke a callback for each record in the journal, oldest first.  A torn final record (e.g. from
+ * a power loss during append) is skipped and cut from the file, so later appends start on a fresh line.
+ *
+ * @param journal the journal
+ * @param replayFunc the callback
+ * @param ctx context passed to the callback
+ * @return the number of records replayed
+ */
+uint32_t jsonDatabaseJournalReplay(JsonDatabaseJournal *journal, JsonDatabaseJournalReplayFunc replayFunc, void *ctx);
+
+/**
+ * Discard all records.  Only do this after everything the journal describes is in the snapshots.
+ *
+ * @param journal the journal
+ * @return true on success
+ */
+bool jsonDatabaseJournalTruncate(JsonDatabaseJournal *journal);
+
+/**
+ * @param journal the journal
+ * @return the number of records currently in the journal
+ */
+uint32_t jsonDatabaseJournalGetRecordCount(const JsonDatabaseJournal *journal);
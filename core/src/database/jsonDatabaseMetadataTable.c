@@ -0,0 +1,385 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "jsonDatabaseMetadataTable.h"
+#include <cjson/cJSON.h>
+#include <device/icDeviceEndpoint.h>
+#include <icTypes/icHashMap.h>
+#include <icTypes/icLinkedList.h>
+
+#define LOG_TAG     "jsonDatabaseMetadataTable"
+#define logFmt(fmt) "%s: " fmt, __func__
+#include <icLog/logging.h>
+
+// Keys of an encoded record: {"device": {<id>: <metadata>}, "endpoints": {<endpoint id>: {<id>: <metadata>}}}
+#define RECORD_DEVICE_KEY    "device"
+#define RECORD_ENDPOINTS_KEY "endpoints"
+
+typedef struct
+{
+    // icDeviceMetadata, of the device and its endpoints
+    icLinkedList *metadata;
+    // endpoint id strings, so metadata is only created for endpoints the device has
+    icLinkedList *endpointIds;
+} DeviceMetadataEntry;
+
+struct _JsonDatabaseMetadataTable
+{
+    // device uuid -> DeviceMetadataEntry
+    icHashMap *devices;
+};
+
+static DeviceMetadataEntry *deviceMetadataEntryCreate(void)
+{
+    DeviceMetadataEntry *entry = calloc(1, sizeof(DeviceMetadataEntry));
+    entry->metadata = linkedListCreate();
+    entry->endpointIds = linkedListCreate();
+
+    return entry;
+}
+
+static void deviceMetadataEntryDestroy(DeviceMetadataEntry *entry)
+{
+    if (entry != NULL)
+    {
+        linkedListDestroy(entry->metadata, (linkedListItemFreeFunc) metadataDestroy);
+        linkedListDestroy(entry->endpointIds, NULL);
+        free(entry);
+    }
+}
+
+static void freeDeviceMetadataItem(void *key, void *value)
+{
+    free(key);
+    deviceMetadataEntryDestroy(value);
+}
+
+/**
+ * Put an entry in the table, replacing any previous entry for the device.
+ */
+static void putEntry(JsonDatabaseMetadataTable *table, const char *deviceUuid, DeviceMetadataEntry *entry)
+{
+    hashMapDelete(table->devices, (void *) deviceUuid, strlen(deviceUuid) + 1, freeDeviceMetadataItem);
+    hashMapPut(table->devices, strdup(deviceUuid), strlen(deviceUuid) + 1, entry);
+}
+
+/**
+ * Find the entry of the device a metadata uri belongs to.  Metadata uris are /<uuid>/m/<id> or
+ * /<uuid>/ep/<endpoint>/m/<id>.
+ */
+static DeviceMetadataEntry *getEntryByUri(const JsonDatabaseMetadataTable *table, const char *uri)
+{
+    if (uri == NULL || uri[0] != '/')
+    {
+        return NULL;
+    }
+
+    size_t uuidLen = strcspn(uri + 1, "/");
+    if (uuidLen == 0 || uuidLen >= UINT16_MAX)
+    {
+        return NULL;
+    }
+
+    char *uuid = strndup(uri + 1, uuidLen);
+    DeviceMetadataEntry *entry = hashMapGet(table->devices, uuid, (uint16_t) (uuidLen + 1));
+    free(uuid);
+
+    return entry;
+}
+
+static icDeviceMetadata *findMetadata(const DeviceMetadataEntry *entry, const char *uri)
+{
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(entry->metadata);
+    while (linkedListIteratorHasNext(iter))
+    {
+        icDeviceMetadata *metadata = linkedListIteratorGetNext(iter);
+        if (metadata->uri != NULL && strcmp(metadata->uri, uri) == 0)
+        {
+            return metadata;
+        }
+    }
+
+    return NULL;
+}
+
+static void appendMetadataClones(icLinkedList *dst, icLinkedList *src)
+{
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(src);
+    while (linkedListIteratorHasNext(iter))
+    {
+        linkedListAppend(dst, metadataClone(linkedListIteratorGetNext(iter)));
+    }
+}
+
+/**
+ * Move the metadata of one list to the end of another, destroying the emptied list.
+ */
+static void moveMetadata(icLinkedList *dst, icLinkedList *src)
+{
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(src);
+    while (linkedListIteratorHasNext(iter))
+    {
+        linkedListAppend(dst, linkedListIteratorGetNext(iter));
+    }
+    linkedListDestroy(src, standardDoNotFreeFunc);
+}
+
+/**
+ * Build a device's metadata list from its entry.
+ *
+ * @param entry the entry
+ * @param endpointId the endpoint, or NULL for the metadata of the root device
+ * @return the list of metadata clones, caller must destroy
+ */
+static icLinkedList *cloneMetadataList(const DeviceMetadataEntry *entry, const char *endpointId)
+{
+    icLinkedList *list = linkedListCreate();
+
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(entry->metadata);
+    while (linkedListIteratorHasNext(iter))
+    {
+        icDeviceMetadata *metadata = linkedListIteratorGetNext(iter);
+        if ((endpointId == NULL && metadata->endpointId == NULL) ||
+            (endpointId != NULL && metadata->endpointId != NULL && strcmp(endpointId, metadata->endpointId) == 0))
+        {
+            linkedListAppend(list, metadataClone(metadata));
+        }
+    }
+
+    return list;
+}
+
+JsonDatabaseMetadataTable *jsonDatabaseMetadataTableCreate(void)
+{
+    JsonDatabaseMetadataTable *table = calloc(1, sizeof(JsonDatabaseMetadataTable));
+    table->devices = hashMapCreate();
+
+    return table;
+}
+
+void jsonDatabaseMetadataTableDestroy(JsonDatabaseMetadataTable *table)
+{
+    if (table != NULL)
+    {
+        hashMapDestroy(table->devices, freeDeviceMetadataItem);
+        free(table);
+    }
+}
+
+bool jsonDatabaseMetadataTableContains(const JsonDatabaseMetadataTable *table, const char *deviceUuid)
+{
+    return table != NULL && deviceUuid != NULL &&
+           hashMapContains(table->devices, (void *) deviceUuid, strlen(deviceUuid) + 1);
+}
+
+void jsonDatabaseMetadataTablePutDevice(JsonDatabaseMetadataTable *table, const icDevice *device)
+{
+    if (table == NULL || device == NULL || device->uuid == NULL)
+    {
+        return;
+    }
+
+    DeviceMetadataEntry *entry = deviceMetadataEntryCreate();
+    appendMetadataClones(entry->metadata, device->metadata);
+
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(device->endpoints);
+    while (linkedListIteratorHasNext(iter))
+    {
+        icDeviceEndpoint *endpoint = linkedListIteratorGetNext(iter);
+        linkedListAppend(entry->endpointIds, strdup(endpoint->id));
+        appendMetadataClones(entry->metadata, endpoint->metadata);
+    }
+
+    putEntry(table, device->uuid, entry);
+}
+
+bool jsonDatabaseMetadataTablePutRecord(JsonDatabaseMetadataTable *table, const char *deviceUuid, const char *record)
+{
+    if (table == NULL || deviceUuid == NULL || record == NULL)
+    {
+        return false;
+    }
+
+    cJSON *body = cJSON_Parse(record);
+    cJSON *deviceJson = cJSON_GetObjectItemCaseSensitive(body, RECORD_DEVICE_KEY);
+    cJSON *endpointsJson = cJSON_GetObjectItemCaseSensitive(body, RECORD_ENDPOINTS_KEY);
+    if (!cJSON_IsObject(deviceJson) || !cJSON_IsObject(endpointsJson))
+    {
+        icWarn("invalid metadata record for device %s", deviceUuid);
+        cJSON_Delete(body);
+        return false;
+    }
+
+    // Like device records, a bad metadata is dropped rather than losing the rest
+    DeviceMetadataEntry *entry = deviceMetadataEntryCreate();
+    moveMetadata(entry->metadata, metadatasFromJSON(deviceUuid, NULL, deviceJson, true));
+
+    cJSON *endpointJson = NULL;
+    cJSON_ArrayForEach(endpointJson, endpointsJson)
+    {
+        linkedListAppend(entry->endpointIds, strdup(endpointJson->string));
+        moveMetadata(entry->metadata, metadatasFromJSON(deviceUuid, endpointJson->string, endpointJson, true));
+    }
+    cJSON_Delete(body);
+
+    putEntry(table, deviceUuid, entry);
+
+    return true;
+}
+
+char *jsonDatabaseMetadataTableEncode(const JsonDatabaseMetadataTable *table, const char *deviceUuid)
+{
+    if (!jsonDatabaseMetadataTableContains(table, deviceUuid))
+    {
+        return NULL;
+    }
+
+    DeviceMetadataEntry *entry = hashMapGet(table->devices, (void *) deviceUuid, strlen(deviceUuid) + 1);
+
+    cJSON *body = cJSON_CreateObject();
+    cJSON *deviceJson = cJSON_AddObjectToObject(body, RECORD_DEVICE_KEY);
+    cJSON *endpointsJson = cJSON_AddObjectToObject(body, RECORD_ENDPOINTS_KEY);
+
+    scoped_icLinkedListIterator *endpointIter = linkedListIteratorCreate(entry->endpointIds);
+    while (linkedListIteratorHasNext(endpointIter))
+    {
+        cJSON_AddObjectToObject(endpointsJson, linkedListIteratorGetNext(endpointIter));
+    }
+
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(entry->metadata);
+    while (linkedListIteratorHasNext(iter))
+    {
+        icDeviceMetadata *metadata = linkedListIteratorGetNext(iter);
+        cJSON *parent = metadata->endpointId == NULL
+                            ? deviceJson
+                            : cJSON_GetObjectItemCaseSensitive(endpointsJson, metadata->endpointId);
+        if (parent != NULL)
+        {
+            cJSON_AddItemToObject(parent, metadata->id, metadataToJSON(metadata, NULL));
+        }
+    }
+
+    char *record = cJSON_PrintUnformatted(body);
+    cJSON_Delete(body);
+
+    return record;
+}
+
+const icDeviceMetadata *jsonDatabaseMetadataTableGet(const JsonDatabaseMetadataTable *table, const char *uri)
+{
+    DeviceMetadataEntry *entry = table != NULL ? getEntryByUri(table, uri) : NULL;
+
+    return entry != NULL ? findMetadata(entry, uri) : NULL;
+}
+
+bool jsonDatabaseMetadataTableSet(JsonDatabaseMetadataTable *table, const icDeviceMetadata *metadata)
+{
+    if (table == NULL || metadata == NULL || metadata->uri == NULL || metadata->deviceUuid == NULL)
+    {
+        return false;
+    }
+
+    DeviceMetadataEntry *entry =
+        hashMapGet(table->devices, (void *) metadata->deviceUuid, strlen(metadata->deviceUuid) + 1);
+    if (entry == NULL)
+    {
+        return false;
+    }
+
+    icDeviceMetadata *current = findMetadata(entry, metadata->uri);
+    if (current != NULL)
+    {
+        free(current->value);
+        current->value = metadata->value != NULL ? strdup(metadata->value) : NULL;
+        return true;
+    }
+
+    if (metadata->endpointId != NULL &&
+        linkedListFind(entry->endpointIds, metadata->endpointId, linkedListCompareStringFunc) == NULL)
+    {
+        return false;
+    }
+
+    linkedListAppend(entry->metadata, metadataClone(metadata));
+
+    return true;
+}
+
+bool jsonDatabaseMetadataTableRemove(JsonDatabaseMetadataTable *table, const char *uri)
+{
+    DeviceMetadataEntry *entry = table != NULL ? getEntryByUri(table, uri) : NULL;
+    icDeviceMetadata *metadata = entry != NULL ? findMetadata(entry, uri) : NULL;
+    if (metadata == NULL)
+    {
+        return false;
+    }
+
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(entry->metadata);
+    while (linkedListIteratorHasNext(iter))
+    {
+        if (linkedListIteratorGetNext(iter) == metadata)
+        {
+            linkedListIteratorDeleteCurrent(iter, (linkedListItemFreeFunc) metadataDestroy);
+            break;
+        }
+    }
+
+    return true;
+}
+
+void jsonDatabaseMetadataTableApply(const JsonDatabaseMetadataTable *table, icDevice *device)
+{
+    if (device == NULL || !jsonDatabaseMetadataTableContains(table, device->uuid))
+    {
+        return;
+    }
+
+    DeviceMetadataEntry *entry = hashMapGet(table->devices, device->uuid, strlen(device->uuid) + 1);
+
+    linkedListDestroy(device->metadata, (linkedListItemFreeFunc) metadataDestroy);
+    device->metadata = cloneMetadataList(entry, NULL);
+
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(device->endpoints);
+    while (linkedListIteratorHasNext(iter))
+    {
+        icDeviceEndpoint *endpoint = linkedListIteratorGetNext(iter);
+        linkedListDestroy(endpoint->metadata, (linkedListItemFreeFunc) metadataDestroy);
+        endpoint->metadata = cloneMetadataList(entry, endpoint->id);
+    }
+}
+
+void jsonDatabaseMetadataTableRemoveDevice(JsonDatabaseMetadataTable *table, const char *deviceUuid)
+{
+    if (table != NULL && deviceUuid != NULL)
+    {
+        hashMapDelete(table->devices, (void *) deviceUuid, strlen(deviceUuid) + 1, freeDeviceMetadataItem);
+    }
+}
+
+uint32_t jsonDatabaseMetadataTableGetCount(const JsonDatabaseMetadataTable *table)
+{
+    return table != NULL ? hashMapCount(table->devices) : 0;
+}
@@ -0,0 +1,140 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+/*
+ * A table of device and endpoint metadata, keyed by device.  Metadata is small state that drivers and
+ * scripts change often, so the database persists a device's metadata as its own record instead of
+ * rewriting the whole device, and answers metadata lookups for evicted devices from here instead of
+ * rehydrating them.  A device's entry holds all of its metadata and is authoritative over the metadata
+ * in the device's own record.
+ *
+ * Not thread safe, the caller serializes access.
+ */
+
+#pragma once
+
+#include <device/icDevice.h>
+#include <device/icDeviceMetadata.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct _JsonDatabaseMetadataTable JsonDatabaseMetadataTable;
+
+/**
+ * Create an empty metadata table.
+ *
+ * @return the table.  Caller must destroy it.
+ *
+ * @see jsonDatabaseMetadataTableDestroy
+ */
+JsonDatabaseMetadataTable *jsonDatabaseMetadataTableCreate(void);
+
+/**
+ * Destroy a metadata table.
+ *
+ * @param table the table to destroy
+ */
+void jsonDatabaseMetadataTableDestroy(JsonDatabaseMetadataTable *table);
+
+/**
+ * @param table the table
+ * @param deviceUuid the device
+ * @return true if the table has an entry for the device
+ */
+bool jsonDatabaseMetadataTableContains(const JsonDatabaseMetadataTable *table, const char *deviceUuid);
+
+/**
+ * Replace a device's entry with the device's current metadata and endpoints.
+ *
+ * @param table the table
+ * @param device the device
+ */
+void jsonDatabaseMetadataTablePutDevice(JsonDatabaseMetadataTable *table, const icDevice *device);
+
+/**
+ * Replace a device's entry with an encoded record.
+ *
+ * @param table the table
+ * @param deviceUuid the device
+ * @param record the record, as created by jsonDatabaseMetadataTableEncode
+ * @return true if the record could be decoded, otherwise the table is unchanged
+ */
+bool jsonDatabaseMetadataTablePutRecord(JsonDatabaseMetadataTable *table, const char *deviceUuid, const char *record);
+
+/**
+ * Encode a device's entry as a record.
+ *
+ * @param table the table
+ * @param deviceUuid the device
+ * @return the JSON record, or NULL if the device has no entry.  Caller must free.
+ */
+char *jsonDatabaseMetadataTableEncode(const JsonDatabaseMetadataTable *table, const char *deviceUuid);
+
+/**
+ * Look up a metadata by its uri.
+ *
+ * @param table the table
+ * @param uri the metadata uri
+ * @return the metadata, or NULL if it is not in the table.  Owned by the table.
+ */
+const icDeviceMetadata *jsonDatabaseMetadataTableGet(const JsonDatabaseMetadataTable *table, const char *uri);
+
+/**
+ * Create or update a metadata in its device's entry.
+ *
+ * @param table the table
+ * @param metadata the metadata, which is copied
+ * @return false if its device has no entry or does not have its endpoint
+ */
+bool jsonDatabaseMetadataTableSet(JsonDatabaseMetadataTable *table, const icDeviceMetadata *metadata);
+
+/**
+ * Remove a metadata from its device's entry.
+ *
+ * @param table the table
+ * @param uri the metadata uri
+ * @return true if the metadata was in the table
+ */
+bool jsonDatabaseMetadataTableRemove(JsonDatabaseMetadataTable *table, const char *uri);
+
+/**
+ * Replace the metadata of a device and its endpoints with what its entry holds, if it has one.
+ *
+ * @param table the table
+ * @param device the device to update
+ */
+void jsonDatabaseMetadataTableApply(const JsonDatabaseMetadataTable *table, icDevice *device);
+
+/**
+ * Forget a device's entry.
+ *
+ * @param table the table
+ * @param deviceUuid the device
+ */
+void jsonDatabaseMetadataTableRemoveDevice(JsonDatabaseMetadataTable *table, const char *deviceUuid);
+
+/**
+ * @param table the table
+ * @return the number of devices in the table
+ */
+uint32_t jsonDatabaseMetadataTableGetCount(const JsonDatabaseMetadataTable *table);
@@ -0,0 +1,113 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jsonDatabaseRecord.h"
+
+// The trailer is the marker followed by 8 hex digits
+#define RECORD_CHECKSUM_MARKER     "#crc32:"
+#define RECORD_CHECKSUM_MARKER_LEN (sizeof(RECORD_CHECKSUM_MARKER) - 1)
+#define RECORD_CHECKSUM_DIGITS     8
+#define RECORD_TRAILER_LEN         (RECORD_CHECKSUM_MARKER_LEN + RECORD_CHECKSUM_DIGITS)
+
+static uint32_t crcTable[256];
+static pthread_once_t crcTableOnce = PTHREAD_ONCE_INIT;
+
+static void buildCrcTable(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+        crcTable[i] = crc;
+    }
+}
+
+uint32_t jsonDatabaseRecordChecksum(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&crcTableOnce, buildCrcTable);
+
+    const uint8_t *bytes = data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = crcTable[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+char *jsonDatabaseRecordSeal(const char *body)
+{
+    if (body == NULL)
+    {
+        return NULL;
+    }
+
+    size_t bodyLen = strlen(body);
+    char *record = malloc(bodyLen + RECORD_TRAILER_LEN + 1);
+
+    memcpy(record, body, bodyLen);
+    snprintf(record + bodyLen,
+             RECORD_TRAILER_LEN + 1,
+             RECORD_CHECKSUM_MARKER "%08" PRIx32,
+             jsonDatabaseRecordChecksum(0, body, bodyLen));
+
+    return record;
+}
+
+JsonDatabaseRecordState jsonDatabaseRecordVerify(const char *record)
+{
+    if (record == NULL)
+    {
+        return JSON_DATABASE_RECORD_CORRUPT;
+    }
+
+    size_t len = strlen(record);
+    if (len < RECORD_TRAILER_LEN ||
+        memcmp(record + len - RECORD_TRAILER_LEN, RECORD_CHECKSUM_MARKER, RECORD_CHECKSUM_MARKER_LEN) != 0)
+    {
+        return JSON_DATABASE_RECORD_UNSEALED;
+    }
+
+    size_t bodyLen = len - RECORD_TRAILER_LEN;
+    const char *digits = record + bodyLen + RECORD_CHECKSUM_MARKER_LEN;
+    char *end = NULL;
+    unsigned long stored = strtoul(digits, &end, 16);
+
+    if (end != record + len || jsonDatabaseRecordChecksum(0, record, bodyLen) != (uint32_t) stored)
+    {
+        return JSON_DATABASE_RECORD_CORRUPT;
+    }
+
+    return JSON_DATABASE_RECORD_VALID;
+}
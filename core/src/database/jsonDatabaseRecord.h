@@ -0,0 +1,68 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+/*
+ * Checksummed storage records for the device database.  A sealed record is the JSON document
+ * followed by a fixed size trailer holding the CRC-32 of the document, so a damaged file is
+ * recognized without trying to parse it.  JSON parsers stop at the end of the document, so
+ * sealed records remain readable by code that doesn't know about the trailer.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+    JSON_DATABASE_RECORD_VALID,    // the checksum matches
+    JSON_DATABASE_RECORD_UNSEALED, // no checksum, e.g. written before checksums were introduced
+    JSON_DATABASE_RECORD_CORRUPT   // the checksum does not match
+} JsonDatabaseRecordState;
+
+/**
+ * Append a checksum trailer to a record.
+ *
+ * @param body the JSON document
+ * @return the sealed record, caller must free
+ */
+char *jsonDatabaseRecordSeal(const char *body);
+
+/**
+ * Check a record read from storage against its checksum.
+ *
+ * @param record the record
+ * @return the state of the record
+ */
+JsonDatabaseRecordState jsonDatabaseRecordVerify(const char *record);
+
+/**
+ * Compute the CRC-32 (IEEE 802.3) used by record checksums.  Checksums can be computed piecewise by
+ * passing the result for the data so far as the starting value for the next piece.
+ *
+ * @param crc 0, or the checksum of the preceding data
+ * @param data the data
+ * @param len the number of bytes of data
+ * @return the checksum
+ */
+uint32_t jsonDatabaseRecordChecksum(uint32_t crc, const void *data, size_t len);
@@ -0,0 +1,428 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "jsonDatabaseRecord.h"
+#include "jsonDatabaseSnapshot.h"
+#include <device/icDeviceEndpoint.h>
+#include <device/icDeviceMetadata.h>
+#include <glib.h>
+#include <icTypes/icLinkedList.h>
+#include <icUtil/stringUtils.h>
+
+#define LOG_TAG     "jsonDatabaseSnapshot"
+#define logFmt(fmt) "%s: " fmt, __func__
+#include <icLog/logging.h>
+
+#define SNAPSHOT_MAGIC   "BDBSNAP"
+#define SNAPSHOT_VERSION 1
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t deviceCount;
+    uint64_t bodyLen;
+    uint32_t bodyChecksum;
+    uint32_t reserved;
+} SnapshotHeader;
+
+// Each device entry in the body is a uint32_t length followed by that many bytes:
+//   uuid, deviceClass, managingDeviceDriver      NUL terminated strings
+//   uint32_t endpointProfileCount, then the profiles
+//   uint32_t metadataIdCount, then the metadata ids
+//   record                                       NUL terminated string
+
+struct _JsonDatabaseSnapshot
+{
+    const char *map;
+    size_t mapLen;
+    const char *body;
+    const char *end;
+    uint32_t deviceCount;
+};
+
+struct _JsonDatabaseSnapshotWriter
+{
+    char *path;
+    char *tmpPath;
+    FILE *file;
+    SnapshotHeader header;
+    bool failed;
+};
+
+/**
+ * Take a uint32_t from a mapped snapshot, which need not be aligned.
+ *
+ * @return false if there isn't one before end
+ */
+static bool takeUInt32(const char **cursor, const char *end, uint32_t *value)
+{
+    if (end - *cursor < (ptrdiff_t) sizeof(uint32_t))
+    {
+        return false;
+    }
+
+    memcpy(value, *cursor, sizeof(uint32_t));
+    *cursor += sizeof(uint32_t);
+
+    return true;
+}
+
+/**
+ * Take count NUL terminated strings from a mapped snapshot.
+ *
+ * @return the first string, or NULL if they don't all end before end
+ */
+static const char *takeStrings(const char **cursor, const char *end, uint32_t count)
+{
+    const char *first = *cursor;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const char *nul = memchr(*cursor, '\0', end - *cursor);
+        if (nul == NULL)
+        {
+            return NULL;
+        }
+        *cursor = nul + 1;
+    }
+
+    return first;
+}
+
+/**
+ * Parse the device entry at cursor, moving the cursor past it.
+ *
+ * @return false if the entry is malformed
+ */
+static bool parseEntry(const char **cursor, const char *end, JsonDatabaseSnapshotDevice *device)
+{
+    uint32_t entryLen;
+    if (!takeUInt32(cursor, end, &entryLen) || entryLen > (uint64_t) (end - *cursor))
+    {
+        return false;
+    }
+
+    const char *entryEnd = *cursor + entryLen;
+
+    device->uuid = takeStrings(cursor, entryEnd, 1);
+    device->deviceClass = takeStrings(cursor, entryEnd, 1);
+    device->managingDeviceDriver = takeStrings(cursor, entryEnd, 1);
+    if (device->managingDeviceDriver == NULL || !takeUInt32(cursor, entryEnd, &device->endpointProfileCount))
+    {
+        return false;
+    }
+
+    device->endpointProfiles = takeStrings(cursor, entryEnd, device->endpointProfileCount);
+    if (device->endpointProfiles == NULL || !takeUInt32(cursor, entryEnd, &device->metadataIdCount))
+    {
+        return false;
+    }
+
+    device->metadataIds = takeStrings(cursor, entryEnd, device->metadataIdCount);
+    device->record = device->metadataIds != NULL ? takeStrings(cursor, entryEnd, 1) : NULL;
+
+    return device->record != NULL && *cursor == entryEnd;
+}
+
+JsonDatabaseSnapshot *jsonDatabaseSnapshotOpen(const char *path)
+{
+    if (path == NULL)
+    {
+        icError("path is NULL");
+        return NULL;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (errno != ENOENT)
+        {
+            g_autofree char *errMsg = strerrorSafe(errno);
+            icError("failed to open snapshot '%s' - %s", path, errMsg);
+        }
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(SnapshotHeader))
+    {
+        icWarn("ignoring truncated snapshot '%s'", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    // The mapping doesn't need the descriptor
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        g_autofree char *errMsg = strerrorSafe(err);
+        icError("failed to map snapshot '%s' - %s", path, errMsg);
+        return NULL;
+    }
+
+    JsonDatabaseSnapshot *snapshot = calloc(1, sizeof(JsonDatabaseSnapshot));
+    snapshot->map = map;
+    snapshot->mapLen = (size_t) st.st_size;
+    snapshot->body = snapshot->map + sizeof(SnapshotHeader);
+    snapshot->end = snapshot->map + snapshot->mapLen;
+
+    SnapshotHeader header;
+    memcpy(&header, map, sizeof(header));
+
+    bool valid = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.version == SNAPSHOT_VERSION &&
+                 header.bodyLen == (uint64_t) (snapshot->end - snapshot->body) &&
+                 jsonDatabaseRecordChecksum(0, snapshot->body, header.bodyLen) == header.bodyChecksum;
+
+    // The checksum only proves the file is what was written, the entries must also make sense
+    const char *cursor = snapshot->body;
+    uint32_t entries = 0;
+    while (valid && cursor < snapshot->end)
+    {
+        JsonDatabaseSnapshotDevice device;
+        valid = parseEntry(&cursor, snapshot->end, &device);
+        entries++;
+    }
+
+    if (!valid || entries != header.deviceCount)
+    {
+        icWarn("ignoring damaged or incompatible snapshot '%s'", path);
+        jsonDatabaseSnapshotClose(snapshot);
+        return NULL;
+    }
+
+    snapshot->deviceCount = header.deviceCount;
+
+    return snapshot;
+}
+
+void jsonDatabaseSnapshotClose(JsonDatabaseSnapshot *snapshot)
+{
+    if (snapshot != NULL)
+    {
+        munmap((void *) snapshot->map, snapshot->mapLen);
+        free(snapshot);
+    }
+}
+
+uint32_t jsonDatabaseSnapshotGetDeviceCount(const JsonDatabaseSnapshot *snapshot)
+{
+    return snapshot != NULL ? snapshot->deviceCount : 0;
+}
+
+void jsonDatabaseSnapshotVisit(const JsonDatabaseSnapshot *snapshot, JsonDatabaseSnapshotVisitor visitor, void *ctx)
+{
+    if (snapshot == NULL || visitor == NULL)
+    {
+        return;
+    }
+
+    // Entries were checked when the snapshot was opened
+    const char *cursor = snapshot->body;
+    JsonDatabaseSnapshotDevice device;
+    while (cursor < snapshot->end && parseEntry(&cursor, snapshot->end, &device))
+    {
+        visitor(&device, ctx);
+    }
+}
+
+bool jsonDatabaseSnapshotContains(const JsonDatabaseSnapshot *snapshot, const void *ptr)
+{
+    return snapshot != NULL && (const char *) ptr >= snapshot->map && (const char *) ptr < snapshot->end;
+}
+
+/**
+ * Append to the snapshot body, keeping its length and checksum up to date.
+ */
+static void writeBody(JsonDatabaseSnapshotWriter *writer, const void *data, size_t len)
+{
+    if (!writer->failed && fwrite(data, 1, len, writer->file) != len)
+    {
+        writer->failed = true;
+    }
+
+    writer->header.bodyLen += len;
+    writer->header.bodyChecksum = jsonDatabaseRecordChecksum(writer->header.bodyChecksum, data, len);
+}
+
+static void writeString(JsonDatabaseSnapshotWriter *writer, const char *str)
+{
+    const char *value = stringCoalesce(str);
+    writeBody(writer, value, strlen(value) + 1);
+}
+
+JsonDatabaseSnapshotWriter *jsonDatabaseSnapshotWriterCreate(const char *path)
+{
+    if (path == NULL)
+    {
+        icError("path is NULL");
+        return NULL;
+    }
+
+    char *tmpPath = stringBuilder("%s.tmp", path);
+    FILE *file = fopen(tmpPath, "w");
+    if (file == NULL)
+    {
+        g_autofree char *errMsg = strerrorSafe(errno);
+        icError("failed to create snapshot '%s' - %s", tmpPath, errMsg);
+        free(tmpPath);
+        return NULL;
+    }
+
+    JsonDatabaseSnapshotWriter *writer = calloc(1, sizeof(JsonDatabaseSnapshotWriter));
+    writer->path = strdup(path);
+    writer->tmpPath = tmpPath;
+    writer->file = file;
+    memcpy(writer->header.magic, SNAPSHOT_MAGIC, sizeof(writer->header.magic));
+    writer->header.version = SNAPSHOT_VERSION;
+
+    // Filled in for real on commit
+    writer->failed = fwrite(&writer->header, sizeof(writer->header), 1, file) != 1;
+
+    return writer;
+}
+
+bool jsonDatabaseSnapshotWriterAdd(JsonDatabaseSnapshotWriter *writer, const icDevice *device, const char *record)
+{
+    if (writer == NULL || device == NULL || device->uuid == NULL || record == NULL)
+    {
+        return false;
+    }
+
+    uint32_t endpointProfileCount = 0;
+    uint32_t metadataIdCount = 0;
+    size_t entryLen = strlen(device->uuid) + strlen(stringCoalesce(device->deviceClass)) +
+                      strlen(stringCoalesce(device->managingDeviceDriver)) + strlen(record) + 4 +
+                      2 * sizeof(uint32_t);
+
+    scoped_icLinkedListIterator *endpointIter = linkedListIteratorCreate(device->endpoints);
+    while (linkedListIteratorHasNext(endpointIter))
+    {
+        icDeviceEndpoint *endpoint = linkedListIteratorGetNext(endpointIter);
+        entryLen += strlen(stringCoalesce(endpoint->profile)) + 1;
+        endpointProfileCount++;
+    }
+
+    scoped_icLinkedListIterator *metadataIter = linkedListIteratorCreate(device->metadata);
+    while (linkedListIteratorHasNext(metadataIter))
+    {
+        icDeviceMetadata *metadata = linkedListIteratorGetNext(metadataIter);
+        entryLen += strlen(stringCoalesce(metadata->id)) + 1;
+        metadataIdCount++;
+    }
+
+    if (entryLen > UINT32_MAX)
+    {
+        icError("device %s is too large for a snapshot", device->uuid);
+        writer->failed = true;
+        return false;
+    }
+
+    uint32_t entryLen32 = (uint32_t) entryLen;
+    writeBody(writer, &entryLen32, sizeof(entryLen32));
+    writeString(writer, device->uuid);
+    writeString(writer, device->deviceClass);
+    writeString(writer, device->managingDeviceDriver);
+
+    writeBody(writer, &endpointProfileCount, sizeof(endpointProfileCount));
+    scoped_icLinkedListIterator *profileIter = linkedListIteratorCreate(device->endpoints);
+    while (linkedListIteratorHasNext(profileIter))
+    {
+        icDeviceEndpoint *endpoint = linkedListIteratorGetNext(profileIter);
+        writeString(writer, endpoint->profile);
+    }
+
+    writeBody(writer, &metadataIdCount, sizeof(metadataIdCount));
+    scoped_icLinkedListIterator *idIter = linkedListIteratorCreate(device->metadata);
+    while (linkedListIteratorHasNext(idIter))
+    {
+        icDeviceMetadata *metadata = linkedListIteratorGetNext(idIter);
+        writeString(writer, metadata->id);
+    }
+
+    writeString(writer, record);
+    writer->header.deviceCount++;
+
+    return !writer->failed;
+}
+
+static void destroyWriter(JsonDatabaseSnapshotWriter *writer)
+{
+    free(writer->path);
+    free(writer->tmpPath);
+    free(writer);
+}
+
+bool jsonDatabaseSnapshotWriterCommit(JsonDatabaseSnapshotWriter *writer)
+{
+    if (writer == NULL)
+    {
+        return false;
+    }
+
+    bool ok = !writer->failed;
+    ok = ok && fseek(writer->file, 0, SEEK_SET) == 0;
+    ok = ok && fwrite(&writer->header, sizeof(writer->header), 1, writer->file) == 1;
+    ok = ok && fflush(writer->file) == 0;
+    ok = ok && fdatasync(fileno(writer->file)) == 0;
+    int err = errno;
+    ok = fclose(writer->file) == 0 && ok;
+
+    if (!ok || rename(writer->tmpPath, writer->path) != 0)
+    {
+        g_autofree char *errMsg = strerrorSafe(ok ? errno : err);
+        icError("failed to write snapshot '%s' - %s", writer->path, errMsg);
+        unlink(writer->tmpPath);
+        destroyWriter(writer);
+        return false;
+    }
+
+    icDebug("wrote %" PRIu32 " devices (%" PRIu64 " bytes)", writer->header.deviceCount, writer->header.bodyLen);
+    destroyWriter(writer);
+
+    return true;
+}
+
+void jsonDatabaseSnapshotWriterAbort(JsonDatabaseSnapshotWriter *writer)
+{
+    if (writer != NULL)
+    {
+        fclose(writer->file);
+        unlink(writer->tmpPath);
+        destroyWriter(writer);
+    }
+}
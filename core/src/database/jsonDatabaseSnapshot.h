@@ -0,0 +1,145 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+/*
+ * A read-only snapshot of the whole device cache, memory mapped at startup so devices can be served
+ * before their storage files have been read.  For each device the snapshot holds its compact record
+ * and the keys of the secondary indexes it belongs to, so devices can be put into the cache without
+ * being parsed.  The snapshot is a cache of storage, not a replacement: the per-device files stay
+ * authoritative.
+ *
+ * The file is a header followed by one entry per device, in host byte order.  A CRC-32 over the
+ * entries is checked when the snapshot is opened, so a damaged or torn snapshot is never used.
+ */
+
+#pragma once
+
+#include <device/icDevice.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct _JsonDatabaseSnapshot JsonDatabaseSnapshot;
+typedef struct _JsonDatabaseSnapshotWriter JsonDatabaseSnapshotWriter;
+
+/**
+ * A device entry of an open snapshot.  All strings point into the mapped snapshot and remain valid
+ * until it is closed.
+ */
+typedef struct
+{
+    const char *uuid;
+    const char *deviceClass;
+    const char *managingDeviceDriver;
+    uint32_t endpointProfileCount;
+    const char *endpointProfiles; // endpointProfileCount NUL terminated strings, back to back
+    uint32_t metadataIdCount;
+    const char *metadataIds; // metadataIdCount NUL terminated strings, back to back
+    const char *record;      // the compact serialized device
+} JsonDatabaseSnapshotDevice;
+
+/**
+ * Callback for each device of a snapshot.
+ *
+ * @param device the device entry
+ * @param ctx the context passed to jsonDatabaseSnapshotVisit
+ */
+typedef void (*JsonDatabaseSnapshotVisitor)(const JsonDatabaseSnapshotDevice *device, void *ctx);
+
+/**
+ * Map a snapshot and verify it.
+ *
+ * @param path the snapshot file path
+ * @return the snapshot, or NULL if there is none or it can't be used.  Caller must close it.
+ *
+ * @see jsonDatabaseSnapshotClose
+ */
+JsonDatabaseSnapshot *jsonDatabaseSnapshotOpen(const char *path);
+
+/**
+ * Unmap a snapshot.  Nothing obtained from it may be used afterwards.
+ *
+ * @param snapshot the snapshot
+ */
+void jsonDatabaseSnapshotClose(JsonDatabaseSnapshot *snapshot);
+
+/**
+ * @param snapshot the snapshot
+ * @return the number of devices in the snapshot
+ */
+uint32_t jsonDatabaseSnapshotGetDeviceCount(const JsonDatabaseSnapshot *snapshot);
+
+/**
+ * Invoke a callback for each device in the snapshot.
+ *
+ * @param snapshot the snapshot
+ * @param visitor the callback
+ * @param ctx context passed to the callback
+ */
+void jsonDatabaseSnapshotVisit(const JsonDatabaseSnapshot *snapshot, JsonDatabaseSnapshotVisitor visitor, void *ctx);
+
+/**
+ * Check whether memory belongs to a snapshot, e.g. to know whether a record must be freed.
+ *
+ * @param snapshot the snapshot (may be NULL)
+ * @param ptr the memory
+ * @return true if ptr points into the mapped snapshot
+ */
+bool jsonDatabaseSnapshotContains(const JsonDatabaseSnapshot *snapshot, const void *ptr);
+
+/**
+ * Start writing a new snapshot.  It is written to a temporary file which only replaces the
+ * snapshot at path once committed.
+ *
+ * @param path the snapshot file path
+ * @return the writer, or NULL on failure.  Caller must commit or abort it.
+ *
+ * @see jsonDatabaseSnapshotWriterCommit
+ * @see jsonDatabaseSnapshotWriterAbort
+ */
+JsonDatabaseSnapshotWriter *jsonDatabaseSnapshotWriterCreate(const char *path);
+
+/**
+ * Add a device to a snapshot being written.
+ *
+ * @param writer the writer
+ * @param device the device, for its index keys
+ * @param record the compact serialized device
+ * @return false on failure, in which case the writer can only be aborted
+ */
+bool jsonDatabaseSnapshotWriterAdd(JsonDatabaseSnapshotWriter *writer, const icDevice *device, const char *record);
+
+/**
+ * Finish a snapshot, sync it to disk and atomically replace the previous one.  The writer is
+ * destroyed.
+ *
+ * @param writer the writer
+ * @return true if the snapshot was replaced
+ */
+bool jsonDatabaseSnapshotWriterCommit(JsonDatabaseSnapshotWriter *writer);
+
+/**
+ * Discard a snapshot being written, leaving the previous one in place.  The writer is destroyed.
+ *
+ * @param writer the writer (may be NULL)
+ */
+void jsonDatabaseSnapshotWriterAbort(JsonDatabaseSnapshotWriter *writer);
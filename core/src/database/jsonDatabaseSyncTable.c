@@ -0,0 +1,276 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jsonDatabaseSyncTable.h"
+#include <device/deviceStringIntern.h>
+#include <glib.h>
+#include <icTypes/icHashMap.h>
+#include <icUtil/stringUtils.h>
+
+#define LOG_TAG     "jsonDatabaseSyncTable"
+#define logFmt(fmt) "%s: " fmt, __func__
+#include <icLog/logging.h>
+
+struct _JsonDatabaseSyncTable
+{
+    char *path;
+    // interned resource uri -> uint64_t last sync time
+    icHashMap *times;
+    bool dirty;
+};
+
+static void freeSyncEntry(void *key, void *value)
+{
+    deviceStringInternRelease(key);
+    free(value);
+}
+
+/**
+ * Load a checkpoint: one "<dateOfLastSyncMillis> <uri>" line per resource.
+ */
+static void loadCheckpoint(JsonDatabaseSyncTable *table)
+{
+    FILE *f = fopen(table->path, "r");
+    if (f == NULL)
+    {
+        if (errno != ENOENT)
+        {
+            g_autofree char *errMsg = strerrorSafe(errno);
+            icError("failed to open sync table '%s' - %s", table->path, errMsg);
+        }
+        return;
+    }
+
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t lineLen;
+    uint32_t lineCount = 0;
+    while ((lineLen = getline(&line, &lineCapacity, f)) > 0)
+    {
+        lineCount++;
+
+        char *uri = NULL;
+        errno = 0;
+        uint64_t millis = strtoull(line, &uri, 10);
+        if (errno != 0 || uri == line || *uri != ' ' || line[lineLen - 1] != '\n' || lineLen - (uri - line) < 3)
+        {
+            icWarn("skipping invalid line %" PRIu32 " in sync table '%s'", lineCount, table->path);
+            continue;
+        }
+
+        line[lineLen - 1] = '\0';
+        jsonDatabaseSyncTablePut(table, uri + 1, millis);
+    }
+
+    free(line);
+    fclose(f);
+
+    // Nothing new to write yet
+    table->dirty = false;
+}
+
+JsonDatabaseSyncTable *jsonDatabaseSyncTableOpen(const char *path)
+{
+    if (path == NULL)
+    {
+        icError("path is NULL");
+        return NULL;
+    }
+
+    JsonDatabaseSyncTable *table = calloc(1, sizeof(JsonDatabaseSyncTable));
+    table->path = strdup(path);
+    table->times = hashMapCreate();
+
+    loadCheckpoint(table);
+
+    return table;
+}
+
+void jsonDatabaseSyncTableClose(JsonDatabaseSyncTable *table)
+{
+    if (table != NULL)
+    {
+        hashMapDestroy(table->times, freeSyncEntry);
+        free(table->path);
+        free(table);
+    }
+}
+
+void jsonDatabaseSyncTablePut(JsonDatabaseSyncTable *table, const char *uri, uint64_t dateOfLastSyncMillis)
+{
+    if (table == NULL || uri == NULL)
+    {
+        return;
+    }
+
+    uint64_t *millis = hashMapGet(table->times, (void *) uri, strlen(uri) + 1);
+    if (millis == NULL)
+    {
+        millis = malloc(sizeof(uint64_t));
+        char *key = deviceStringInternAcquire(uri);
+        hashMapPut(table->times, key, strlen(key) + 1, millis);
+    }
+    else if (*millis == dateOfLastSyncMillis)
+    {
+        return;
+    }
+
+    *millis = dateOfLastSyncMillis;
+    table->dirty = true;
+}
+
+bool jsonDatabaseSyncTableGet(const JsonDatabaseSyncTable *table, const char *uri, uint64_t *dateOfLastSyncMillis)
+{
+    if (table == NULL || uri == NULL)
+    {
+        return false;
+    }
+
+    uint64_t *millis = hashMapGet(table->times, (void *) uri, strlen(uri) + 1);
+    if (millis != NULL && dateOfLastSyncMillis != NULL)
+    {
+        *dateOfLastSyncMillis = *millis;
+    }
+
+    return millis != NULL;
+}
+
+void jsonDatabaseSyncTableRemoveDevice(JsonDatabaseSyncTable *table, const char *deviceUuid)
+{
+    if (table == NULL || deviceUuid == NULL)
+    {
+        return;
+    }
+
+    // Resource uris are /<uuid>/r/<id> or /<uuid>/ep/<endpoint>/r/<id>
+    size_t uuidLen = strlen(deviceUuid);
+    scoped_icHashMapIterator *iter = hashMapIteratorCreate(table->times);
+    while (hashMapIteratorHasNext(iter))
+    {
+        char *uri;
+        uint16_t keyLen;
+        void *value;
+        hashMapIteratorGetNext(iter, (void **) &uri, &keyLen, &value);
+        if (uri[0] == '/' && strncmp(uri + 1, deviceUuid, uuidLen) == 0 && uri[uuidLen + 1] == '/')
+        {
+            hashMapIteratorDeleteCurrent(iter, freeSyncEntry);
+            table->dirty = true;
+        }
+    }
+}
+
+void jsonDatabaseSyncTableClear(JsonDatabaseSyncTable *table)
+{
+    if (table != NULL && hashMapCount(table->times) > 0)
+    {
+        hashMapClear(table->times, freeSyncEntry);
+        table->dirty = true;
+    }
+}
+
+void jsonDatabaseSyncTableVisit(const JsonDatabaseSyncTable *table, JsonDatabaseSyncTableVisitor visitor, void *ctx)
+{
+    if (table == NULL || visitor == NULL)
+    {
+        return;
+    }
+
+    scoped_icHashMapIterator *iter = hashMapIteratorCreate(table->times);
+    while (hashMapIteratorHasNext(iter))
+    {
+        char *uri;
+        uint16_t keyLen;
+        uint64_t *millis;
+        hashMapIteratorGetNext(iter, (void **) &uri, &keyLen, (void **) &millis);
+        visitor(uri, *millis, ctx);
+    }
+}
+
+bool jsonDatabaseSyncTableCheckpoint(JsonDatabaseSyncTable *table)
+{
+    if (table == NULL)
+    {
+        return false;
+    }
+
+    if (!table->dirty)
+    {
+        return true;
+    }
+
+    scoped_generic char *tmpPath = stringBuilder("%s.tmp", table->path);
+    FILE *f = fopen(tmpPath, "w");
+    if (f == NULL)
+    {
+        g_autofree char *errMsg = strerrorSafe(errno);
+        icError("failed to create sync table checkpoint '%s' - %s", tmpPath, errMsg);
+        return false;
+    }
+
+    bool ok = true;
+    scoped_icHashMapIterator *iter = hashMapIteratorCreate(table->times);
+    while (ok && hashMapIteratorHasNext(iter))
+    {
+        char *uri;
+        uint16_t keyLen;
+        uint64_t *millis;
+        hashMapIteratorGetNext(iter, (void **) &uri, &keyLen, (void **) &millis);
+        ok = fprintf(f, "%" PRIu64 " %s\n", *millis, uri) > 0;
+    }
+
+    ok = fflush(f) == 0 && ok;
+    ok = fdatasync(fileno(f)) == 0 && ok;
+    int err = errno;
+    ok = fclose(f) == 0 && ok;
+
+    if (!ok || rename(tmpPath, table->path) != 0)
+    {
+        g_autofree char *errMsg = strerrorSafe(ok ? errno : err);
+        icError("failed to write sync table checkpoint '%s' - %s", table->path, errMsg);
+        unlink(tmpPath);
+        return false;
+    }
+
+    icDebug("checkpointed %" PRIu16 " resource sync times", hashMapCount(table->times));
+    table->dirty = false;
+
+    return true;
+}
+
+bool jsonDatabaseSyncTableIsDirty(const JsonDatabaseSyncTable *table)
+{
+    return table != NULL && table->dirty;
+}
+
+uint32_t jsonDatabaseSyncTableGetCount(const JsonDatabaseSyncTable *table)
+{
+    return table != NULL ? hashMapCount(table->times) : 0;
+}
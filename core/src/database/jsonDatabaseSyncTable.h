@@ -0,0 +1,128 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+/*
+ * A compact table of resource last sync times (dateOfLastSyncMillis), keyed by resource URI.  A
+ * report that only confirms a resource's current value changes nothing but this time, so keeping it
+ * here lets the database skip rewriting the device.  The table is written to its own file as a whole
+ * (checkpointed) and its times are applied on top of the device snapshots when they are loaded.
+ *
+ * Not thread safe, the caller serializes access.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct _JsonDatabaseSyncTable JsonDatabaseSyncTable;
+
+/**
+ * Callback for each entry of a sync table.
+ *
+ * @param uri the resource URI
+ * @param dateOfLastSyncMillis the last sync time of the resource
+ * @param ctx the context passed to jsonDatabaseSyncTableVisit
+ */
+typedef void (*JsonDatabaseSyncTableVisitor)(const char *uri, uint64_t dateOfLastSyncMillis, void *ctx);
+
+/**
+ * Open a sync table, loading its last checkpoint if there is one.
+ *
+ * @param path the checkpoint file path
+ * @return the table, or NULL on failure.  Caller must close it.
+ *
+ * @see jsonDatabaseSyncTableClose
+ */
+JsonDatabaseSyncTable *jsonDatabaseSyncTableOpen(const char *path);
+
+/**
+ * Close a sync table without checkpointing it.
+ *
+ * @param table the table to close
+ */
+void jsonDatabaseSyncTableClose(JsonDatabaseSyncTable *table);
+
+/**
+ * Record the last sync time of a resource.
+ *
+ * @param table the table
+ * @param uri the resource URI
+ * @param dateOfLastSyncMillis the last sync time
+ */
+void jsonDatabaseSyncTablePut(JsonDatabaseSyncTable *table, const char *uri, uint64_t dateOfLastSyncMillis);
+
+/**
+ * Look up the last sync time of a resource.
+ *
+ * @param table the table
+ * @param uri the resource URI
+ * @param dateOfLastSyncMillis receives the last sync time if found
+ * @return true if the resource is in the table
+ */
+bool jsonDatabaseSyncTableGet(const JsonDatabaseSyncTable *table, const char *uri, uint64_t *dateOfLastSyncMillis);
+
+/**
+ * Forget every resource of a device.
+ *
+ * @param table the table
+ * @param deviceUuid the device
+ */
+void jsonDatabaseSyncTableRemoveDevice(JsonDatabaseSyncTable *table, const char *deviceUuid);
+
+/**
+ * Forget every resource.
+ *
+ * @param table the table
+ */
+void jsonDatabaseSyncTableClear(JsonDatabaseSyncTable *table);
+
+/**
+ * Invoke a callback for each entry in the table.
+ *
+ * @param table the table
+ * @param visitor the callback, which must not change the table
+ * @param ctx context passed to the callback
+ */
+void jsonDatabaseSyncTableVisit(const JsonDatabaseSyncTable *table, JsonDatabaseSyncTableVisitor visitor, void *ctx);
+
+/**
+ * Write the table to its file if it changed since the last checkpoint.  The file is replaced
+ * atomically, so a failed checkpoint leaves the previous one intact.
+ *
+ * @param table the table
+ * @return true if the file is up to date
+ */
+bool jsonDatabaseSyncTableCheckpoint(JsonDatabaseSyncTable *table);
+
+/**
+ * @param table the table
+ * @return true if the table changed since the last checkpoint
+ */
+bool jsonDatabaseSyncTableIsDirty(const JsonDatabaseSyncTable *table);
+
+/**
+ * @param table the table
+ * @return the number of resources in the table
+ */
+uint32_t jsonDatabaseSyncTableGetCount(const JsonDatabaseSyncTable *table);
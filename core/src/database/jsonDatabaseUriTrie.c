@@ -0,0 +1,401 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jsonDatabaseUriTrie.h"
+#include <icTypes/icHashMap.h>
+
+typedef struct _UriTrieNode
+{
+    char *segment;
+    void *value;
+    icHashMap *children; // segment -> UriTrieNode, NULL until the first child is added
+} UriTrieNode;
+
+struct _JsonDatabaseUriTrie
+{
+    UriTrieNode root;
+    // URIs the segments can't represent, e.g. with empty segments or a trailing '/': uri -> value.
+    // NULL until the first one is added.
+    icHashMap *unsegmented;
+};
+
+typedef struct
+{
+    const char *pattern; // what is left of the pattern after its literal start
+    size_t prefixLen;    // length of the literal start, which is already in path
+    char *path;
+    size_t pathLen;
+    size_t pathCapacity;
+    JsonDatabaseUriTrieVisitor visitor;
+    void *ctx;
+} MatchContext;
+
+static UriTrieNode *createNode(const char *segment, size_t len)
+{
+    UriTrieNode *node = calloc(1, sizeof(UriTrieNode));
+    node->segment = strndup(segment, len);
+
+    return node;
+}
+
+static void destroyNode(UriTrieNode *node);
+
+static void destroyUnsegmentedEntry(void *key, void *value)
+{
+    (void) value;
+    free(key);
+}
+
+static void destroyChild(void *key, void *value)
+{
+    // The key is the segment stored within the node
+    (void) key;
+    destroyNode((UriTrieNode *) value);
+}
+
+static void destroyNode(UriTrieNode *node)
+{
+    if (node != NULL)
+    {
+        hashMapDestroy(node->children, destroyChild);
+        free(node->segment);
+        free(node);
+    }
+}
+
+static UriTrieNode *getChild(const UriTrieNode *node, const char *segment, size_t len)
+{
+    if (node->children == NULL)
+    {
+        return NULL;
+    }
+
+    return (UriTrieNode *) hashMapGet(node->children, (void *) segment, (uint16_t) len);
+}
+
+/**
+ * @return true if the URI is one the hash maps can key, i.e. not too long
+ */
+static bool isValidUri(const char *uri)
+{
+    return uri != NULL && strlen(uri) < UINT16_MAX;
+}
+
+/**
+ * @return true if the URI is absolute and has no empty segments, so it has a place in the tree
+ */
+static bool isSegmentedUri(const char *uri)
+{
+    size_t len = strlen(uri);
+
+    return len > 1 && uri[0] == '/' && uri[len - 1] != '/' && strstr(uri, "//") == NULL;
+}
+
+/**
+ * Match text against a pattern where '*' matches any run of characters.
+ */
+static bool globMatch(const char *pattern, const char *text)
+{
+    const char *star = NULL;
+    const char *resume = NULL;
+
+    while (*text != '\0')
+    {
+        if (*pattern == '*')
+        {
+            star = pattern++;
+            resume = text;
+        }
+        else if (*pattern == *text)
+        {
+            pattern++;
+            text++;
+        }
+        else if (star != NULL)
+        {
+            // Let the last star swallow one more character and try again
+            pattern = star + 1;
+            text = ++resume;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (*pattern == '*')
+    {
+        pattern++;
+    }
+
+    return *pattern == '\0';
+}
+
+bool jsonDatabaseUriPatternMatches(const char *pattern, const char *uri)
+{
+    return pattern != NULL && uri != NULL && globMatch(pattern, uri);
+}
+
+JsonDatabaseUriTrie *jsonDatabaseUriTrieCreate(void)
+{
+    return calloc(1, sizeof(JsonDatabaseUriTrie));
+}
+
+void jsonDatabaseUriTrieDestroy(JsonDatabaseUriTrie *trie)
+{
+    if (trie != NULL)
+    {
+        hashMapDestroy(trie->root.children, destroyChild);
+        hashMapDestroy(trie->unsegmented, destroyUnsegmentedEntry);
+        free(trie);
+    }
+}
+
+bool jsonDatabaseUriTriePut(JsonDatabaseUriTrie *trie, const char *uri, void *value)
+{
+    if (trie == NULL || value == NULL || !isValidUri(uri))
+    {
+        return false;
+    }
+
+    if (!isSegmentedUri(uri))
+    {
+        if (trie->unsegmented == NULL)
+        {
+            trie->unsegmented = hashMapCreate();
+        }
+
+        // The map keeps its own copy of the key, the value is not ours
+        char *key = strdup(uri);
+        if (!hashMapPut(trie->unsegmented, key, (uint16_t) (strlen(key) + 1), value))
+        {
+            free(key);
+            return false;
+        }
+
+        return true;
+    }
+
+    UriTrieNode *node = &trie->root;
+    const char *segment = uri + 1;
+
+    while (true)
+    {
+        size_t len = strcspn(segment, "/");
+        UriTrieNode *child = getChild(node, segment, len);
+        if (child == NULL)
+        {
+            if (node->children == NULL)
+            {
+                node->children = hashMapCreate();
+            }
+            child = createNode(segment, len);
+            hashMapPut(node->children, child->segment, (uint16_t) len, child);
+        }
+        node = child;
+
+        if (segment[len] == '\0')
+        {
+            break;
+        }
+        segment += len + 1;
+    }
+
+    if (node->value != NULL)
+    {
+        return false;
+    }
+    node->value = value;
+
+    return true;
+}
+
+static void *removeFromNode(UriTrieNode *node, const char *segment)
+{
+    size_t len = strcspn(segment, "/");
+    UriTrieNode *child = getChild(node, segment, len);
+    void *value = NULL;
+
+    if (child != NULL)
+    {
+        if (segment[len] == '\0')
+        {
+            value = child->value;
+            child->value = NULL;
+        }
+        else
+        {
+            value = removeFromNode(child, segment + len + 1);
+        }
+
+        if (child->value == NULL && (child->children == NULL || hashMapCount(child->children) == 0))
+        {
+            hashMapDelete(node->children, (void *) segment, (uint16_t) len, destroyChild);
+        }
+    }
+
+    return value;
+}
+
+void *jsonDatabaseUriTrieRemove(JsonDatabaseUriTrie *trie, const char *uri)
+{
+    if (trie == NULL || !isValidUri(uri))
+    {
+        return NULL;
+    }
+
+    if (!isSegmentedUri(uri))
+    {
+        uint16_t keyLen = (uint16_t) (strlen(uri) + 1);
+        void *value = trie->unsegmented != NULL ? hashMapGet(trie->unsegmented, (void *) uri, keyLen) : NULL;
+        if (value != NULL)
+        {
+            hashMapDelete(trie->unsegmented, (void *) uri, keyLen, destroyUnsegmentedEntry);
+        }
+
+        return value;
+    }
+
+    return removeFromNode(&trie->root, uri + 1);
+}
+
+static void appendToPath(MatchContext *context, const char *str, size_t len)
+{
+    if (context->pathLen + len + 1 > context->pathCapacity)
+    {
+        context->pathCapacity = (context->pathLen + len + 1) * 2;
+        context->path = realloc(context->path, context->pathCapacity);
+    }
+    memcpy(context->path + context->pathLen, str, len);
+    context->pathLen += len;
+    context->path[context->pathLen] = '\0';
+}
+
+static void matchSubtree(MatchContext *context, const UriTrieNode *node)
+{
+    if (node->value != NULL && globMatch(context->pattern, context->path + context->prefixLen))
+    {
+        context->visitor(context->path, node->value, context->ctx);
+    }
+
+    if (node->children != NULL)
+    {
+        size_t pathLen = context->pathLen;
+
+        icHashMapIterator *iter = hashMapIteratorCreate(node->children);
+        while (hashMapIteratorHasNext(iter))
+        {
+            void *key;
+            uint16_t keyLen;
+            UriTrieNode *child;
+            hashMapIteratorGetNext(iter, &key, &keyLen, (void **) &child);
+
+            appendToPath(context, "/", 1);
+            appendToPath(context, child->segment, keyLen);
+            matchSubtree(context, child);
+
+            context->pathLen = pathLen;
+            context->path[pathLen] = '\0';
+        }
+        hashMapIteratorDestroy(iter);
+    }
+}
+
+void jsonDatabaseUriTrieMatch(JsonDatabaseUriTrie *trie,
+                              const char *pattern,
+                              JsonDatabaseUriTrieVisitor visitor,
+                              void *ctx)
+{
+    if (trie == NULL || pattern == NULL || visitor == NULL)
+    {
+        return;
+    }
+
+    // The few URIs outside the tree are simply checked one by one
+    if (trie->unsegmented != NULL)
+    {
+        icHashMapIterator *iter = hashMapIteratorCreate(trie->unsegmented);
+        while (hashMapIteratorHasNext(iter))
+        {
+            void *key;
+            uint16_t keyLen;
+            void *value;
+            hashMapIteratorGetNext(iter, &key, &keyLen, &value);
+
+            if (globMatch(pattern, key))
+            {
+                visitor(key, value, ctx);
+            }
+        }
+        hashMapIteratorDestroy(iter);
+    }
+
+    // Walk straight down through the segments before the first wildcard
+    const UriTrieNode *node = &trie->root;
+    const char *remaining = pattern;
+    while (*remaining == '/')
+    {
+        size_t len = strcspn(remaining + 1, "/");
+        if (memchr(remaining + 1, '*', len) != NULL)
+        {
+            break;
+        }
+        if (len == 0)
+        {
+            // Stored URIs never have empty segments
+            return;
+        }
+
+        node = getChild(node, remaining + 1, len);
+        if (node == NULL)
+        {
+            return;
+        }
+        remaining += len + 1;
+    }
+
+    MatchContext context = {.pattern = remaining,
+                            .prefixLen = (size_t) (remaining - pattern),
+                            .visitor = visitor,
+                            .ctx = ctx};
+    appendToPath(&context, pattern, context.prefixLen);
+
+    if (*remaining == '\0')
+    {
+        // No wildcards at all
+        if (node->value != NULL)
+        {
+            visitor(context.path, node->value, ctx);
+        }
+    }
+    else
+    {
+        matchSubtree(&context, node);
+    }
+
+    free(context.path);
+}
@@ -0,0 +1,102 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+/*
+ * A segment trie over the URIs in the device database (device -> endpoint -> resource/metadata).
+ * Every '/' separated segment of a URI is a node, so wildcard queries only need to visit the part
+ * of the tree below the literal start of the pattern instead of every known URI.  URIs without a
+ * place in the tree (not absolute, with empty segments or with a trailing '/') are still accepted;
+ * they are kept aside and checked against every pattern.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+typedef struct _JsonDatabaseUriTrie JsonDatabaseUriTrie;
+
+/**
+ * Callback for each URI matched by jsonDatabaseUriTrieMatch.
+ *
+ * @param uri the matching URI.  Only valid for the duration of the callback.
+ * @param value the value stored for the URI
+ * @param ctx the context passed to jsonDatabaseUriTrieMatch
+ */
+typedef void (*JsonDatabaseUriTrieVisitor)(const char *uri, void *value, void *ctx);
+
+/**
+ * @return a new, empty trie.  Caller must destroy it.
+ *
+ * @see jsonDatabaseUriTrieDestroy
+ */
+JsonDatabaseUriTrie *jsonDatabaseUriTrieCreate(void);
+
+/**
+ * Destroy a trie.  Stored values are not owned by the trie and are left alone.
+ *
+ * @param trie the trie to destroy
+ */
+void jsonDatabaseUriTrieDestroy(JsonDatabaseUriTrie *trie);
+
+/**
+ * Store a value for a URI.
+ *
+ * @param trie the trie
+ * @param uri the URI, normally absolute, e.g. /device/ep/1/r/label
+ * @param value the value to store, must not be NULL
+ * @return false if the URI is too long to store or already has a value
+ */
+bool jsonDatabaseUriTriePut(JsonDatabaseUriTrie *trie, const char *uri, void *value);
+
+/**
+ * Remove the value stored for a URI.  Nodes left without a value or children are released.
+ *
+ * @param trie the trie
+ * @param uri the URI
+ * @return the value that was stored, or NULL if there was none
+ */
+void *jsonDatabaseUriTrieRemove(JsonDatabaseUriTrie *trie, const char *uri);
+
+/**
+ * Visit every stored URI matching a pattern.  '*' in the pattern matches any run of characters,
+ * including '/', and every other character matches itself.  The pattern must match the whole URI.
+ *
+ * @param trie the trie
+ * @param pattern the pattern, e.g. a device URI followed by "/ep/" and a wildcard to find everything on
+ *                the device's endpoints
+ * @param visitor the callback
+ * @param ctx context passed to the callback
+ */
+void jsonDatabaseUriTrieMatch(JsonDatabaseUriTrie *trie,
+                              const char *pattern,
+                              JsonDatabaseUriTrieVisitor visitor,
+                              void *ctx);
+
+/**
+ * Check a single URI against a pattern, with the same rules as jsonDatabaseUriTrieMatch.
+ *
+ * @param pattern the pattern
+ * @param uri the URI
+ * @return true if the pattern matches the whole URI
+ */
+bool jsonDatabaseUriPatternMatches(const char *pattern, const char *uri);
@@ -0,0 +1,167 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "deviceStringIntern.h"
+#include <icConcurrent/threadUtils.h>
+#include <icTypes/icHashMap.h>
+
+typedef struct
+{
+    char *str;
+    uint32_t refCount;
+} InternedString;
+
+// Resources are created and destroyed from many threads at once (device loads, clones for callers), so
+// the pool is split into stripes that each have their own lock.  A string always maps to the same stripe.
+#define POOL_STRIPE_COUNT 16
+
+typedef struct
+{
+    pthread_mutex_t mtx;
+    // string contents -> InternedString.  The key is the entry's own copy.
+    icHashMap *strings;
+} PoolStripe;
+
+static PoolStripe stripes[POOL_STRIPE_COUNT];
+static pthread_once_t stripesOnce = PTHREAD_ONCE_INIT;
+
+static void initStripes(void)
+{
+    for (int i = 0; i < POOL_STRIPE_COUNT; i++)
+    {
+        pthread_mutex_init(&stripes[i].mtx, NULL);
+        stripes[i].strings = hashMapCreate();
+    }
+}
+
+/**
+ * @param str the string
+ * @param len the length of str
+ * @return the stripe str is pooled in
+ */
+static PoolStripe *getStripe(const char *str, size_t len)
+{
+    pthread_once(&stripesOnce, initStripes);
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ (uint8_t) str[i]) * 16777619u;
+    }
+
+    return &stripes[hash % POOL_STRIPE_COUNT];
+}
+
+static void freeInternedStringEntry(void *key, void *value)
+{
+    InternedString *entry = (InternedString *) value;
+
+    // key is entry->str
+    (void) key;
+    free(entry->str);
+    free(entry);
+}
+
+char *deviceStringInternAcquire(const char *str)
+{
+    if (str == NULL)
+    {
+        return NULL;
+    }
+
+    size_t len = strlen(str);
+    if (len > UINT16_MAX)
+    {
+        // Too long to be a map key, and too unusual to be worth sharing
+        return strdup(str);
+    }
+
+    PoolStripe *stripe = getStripe(str, len);
+    LOCK_SCOPE(stripe->mtx);
+
+    InternedString *entry = hashMapGet(stripe->strings, (void *) str, (uint16_t) len);
+    if (entry == NULL)
+    {
+        entry = calloc(1, sizeof(InternedString));
+        entry->str = strdup(str);
+        hashMapPut(stripe->strings, entry->str, (uint16_t) len, entry);
+    }
+
+    entry->refCount++;
+
+    return entry->str;
+}
+
+void deviceStringInternRelease(char *str)
+{
+    if (str == NULL)
+    {
+        return;
+    }
+
+    size_t len = strlen(str);
+    bool pooled = false;
+
+    if (len <= UINT16_MAX)
+    {
+        PoolStripe *stripe = getStripe(str, len);
+        LOCK_SCOPE(stripe->mtx);
+
+        InternedString *entry = hashMapGet(stripe->strings, str, (uint16_t) len);
+
+        // An equal string that is not the pooled copy belongs to the caller
+        if (entry != NULL && entry->str == str)
+        {
+            pooled = true;
+            if (--entry->refCount == 0)
+            {
+                hashMapDelete(stripe->strings, str, (uint16_t) len, freeInternedStringEntry);
+            }
+        }
+    }
+
+    if (pooled == false)
+    {
+        free(str);
+    }
+}
+
+uint32_t deviceStringInternCount(void)
+{
+    pthread_once(&stripesOnce, initStripes);
+
+    uint32_t count = 0;
+    for (int i = 0; i < POOL_STRIPE_COUNT; i++)
+    {
+        LOCK_SCOPE(stripes[i].mtx);
+        count += hashMapCount(stripes[i].strings);
+    }
+
+    return count;
+}
@@ -0,0 +1,57 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+/*
+ * A process wide pool of shared, reference counted copies of the strings that repeat throughout the
+ * device model (device uuids, endpoint ids and resource types), so the thousands of resources that
+ * belong to one device don't each carry their own copy.
+ *
+ * Pooled strings are still plain char pointers and must be treated as read-only.  Releasing a
+ * string that did not come from the pool simply frees it, so model objects whose fields were filled
+ * in with strdup by hand can be destroyed the same way as pooled ones.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Get the pooled copy of a string, adding it to the pool if needed.
+ *
+ * @param str the string to look up.  May be NULL.
+ * @return the shared copy (or NULL if str was NULL).  Caller must release it with
+ *         deviceStringInternRelease and must not modify it.
+ */
+char *deviceStringInternAcquire(const char *str);
+
+/**
+ * Drop a reference to a pooled string.  Strings that are not from the pool are freed.
+ *
+ * @param str the string to release.  May be NULL.
+ */
+void deviceStringInternRelease(char *str);
+
+/**
+ * @return the number of distinct strings currently in the pool
+ */
+uint32_t deviceStringInternCount(void);
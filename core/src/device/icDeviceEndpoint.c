@@ -22,6 +22,7 @@
 //------------------------------ tabstop = 4 ----------------------------------
 
 #include "deviceServicePrivate.h"
+#include "device/deviceStringIntern.h"
 #include "icTypes/icLinkedList.h"
 #include <device/icDeviceEndpoint.h>
 #include <device/icDeviceMetadata.h>
@@ -56,7 +57,7 @@ void endpointDestroy(icDeviceEndpoint *endpoint)
     {
         free(endpoint->id);
         free(endpoint->profile);
-        free(endpoint->deviceUuid);
+        deviceStringInternRelease(endpoint->deviceUuid);
         free(endpoint->uri);
         linkedListDestroy(endpoint->resources, (linkedListItemFreeFunc) resourceDestroy);
         linkedListDestroy(endpoint->metadata, (linkedListItemFreeFunc) metadataDestroy);
@@ -169,10 +170,7 @@ icDeviceEndpoint *endpointClone(const icDeviceEndpoint *endpoint)
         {
             clone->profile = strdup(endpoint->profile);
         }
-        if (endpoint->deviceUuid != NULL)
-        {
-            clone->deviceUuid = strdup(endpoint->deviceUuid);
-        }
+        clone->deviceUuid = deviceStringInternAcquire(endpoint->deviceUuid);
         clone->enabled = endpoint->enabled;
         // Clone resources
         clone->resources = linkedListDeepClone(endpoint->resources, cloneResourceWithContext, NULL);
@@ -256,7 +254,7 @@ icDeviceEndpoint *endpointFromJSON(const char *deviceUUID, cJSON *endpointJSON,
         }
         else
         {
-            tempEndpoint->deviceUuid = strdup(deviceUUID);
+            tempEndpoint->deviceUuid = deviceStringInternAcquire(deviceUUID);
         }
 
         tempEndpoint->uri = getCJSONString(endpointJSON, ENDPOINT_URI_KEY);
@@ -22,6 +22,7 @@
 //------------------------------ tabstop = 4 ----------------------------------
 
 #include "deviceServicePrivate.h"
+#include "device/deviceStringIntern.h"
 #include <device/icDeviceMetadata.h>
 #include <icLog/logging.h>
 #include <icUtil/stringUtils.h>
@@ -48,9 +49,9 @@ void metadataDestroy(icDeviceMetadata *metadata)
     if (metadata != NULL)
     {
         free(metadata->id);
-        free(metadata->endpointId);
+        deviceStringInternRelease(metadata->endpointId);
         free(metadata->uri);
-        free(metadata->deviceUuid);
+        deviceStringInternRelease(metadata->deviceUuid);
         free(metadata->value);
 
         free(metadata);
@@ -84,10 +85,7 @@ icDeviceMetadata *metadataClone(const icDeviceMetadata *metadata)
     if (metadata != NULL)
     {
         clone = (icDeviceMetadata *) calloc(1, sizeof(icDeviceMetadata));
-        if (metadata->endpointId != NULL)
-        {
-            clone->endpointId = strdup(metadata->endpointId);
-        }
+        clone->endpointId = deviceStringInternAcquire(metadata->endpointId);
         if (metadata->uri != NULL)
         {
             clone->uri = strdup(metadata->uri);
@@ -96,10 +94,7 @@ icDeviceMetadata *metadataClone(const icDeviceMetadata *metadata)
         {
             clone->id = strdup(metadata->id);
         }
-        if (metadata->deviceUuid != NULL)
-        {
-            clone->deviceUuid = strdup(metadata->deviceUuid);
-        }
+        clone->deviceUuid = deviceStringInternAcquire(metadata->deviceUuid);
         if (metadata->value != NULL)
         {
             clone->value = strdup(metadata->value);
@@ -205,10 +200,10 @@ icDeviceMetadata *metadataFromJSON(const char *deviceUUID, const char *endpointI
         }
         else
         {
-            tempMetadata->deviceUuid = strdup(deviceUUID);
+            tempMetadata->deviceUuid = deviceStringInternAcquire(deviceUUID);
         }
 
-        tempMetadata->endpointId = strdupOpt(endpointId);
+        tempMetadata->endpointId = deviceStringInternAcquire(endpointId);
 
         // at this stage we have valid metadata object, create a reference of tempMetadata and make it NULL.
         // so that auto clean have no effect.
@@ -22,12 +22,15 @@
 //------------------------------ tabstop = 4 ----------------------------------
 
 #include "deviceServicePrivate.h"
+#include "device/deviceStringIntern.h"
+#include <commonDeviceDefs.h>
 #include <device-driver/device-driver.h>
 #include <device/icDeviceResource.h>
 #include <icConfig/simpleProtectConfig.h>
 #include <icLog/logging.h>
 #include <icUtil/stringUtils.h>
 #include <jsonHelper/jsonHelper.h>
+#include <resourceTypes.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
@@ -48,6 +51,11 @@
 #define RESOURCE_ENCRYPTED_VALUE_KEY          "value_enc"
 #define RESOURCE_TYPE_KEY                     "type"
 #define RESOURCE_NAMESPACE_KEY                "namespace"
+#define RESOURCE_PERSISTENCE_POLICY_KEY       "persistencePolicy"
+#define RESOURCE_PERSIST_INTERVAL_SECS_KEY    "persistIntervalSecs"
+
+// Power readings and dateLastContacted are written out at most this often
+#define TELEMETRY_PERSIST_INTERVAL_SECS       (5 * 60)
 
 
 extern inline void resourceDestroy__auto(icDeviceResource **resource);
@@ -57,10 +65,10 @@ void resourceDestroy(icDeviceResource *resource)
     if (resource != NULL)
     {
         free(resource->id);
-        free(resource->endpointId);
+        deviceStringInternRelease(resource->endpointId);
         free(resource->uri);
-        free(resource->type);
-        free(resource->deviceUuid);
+        deviceStringInternRelease(resource->type);
+        deviceStringInternRelease(resource->deviceUuid);
         free(resource->value);
 
         free(resource);
@@ -94,10 +102,7 @@ icDeviceResource *resourceClone(const icDeviceResource *resource)
     if (resource != NULL)
     {
         clone = (icDeviceResource *) calloc(1, sizeof(icDeviceResource));
-        if (resource->deviceUuid != NULL)
-        {
-            clone->deviceUuid = strdup(resource->deviceUuid);
-        }
+        clone->deviceUuid = deviceStringInternAcquire(resource->deviceUuid);
         if (resource->id != NULL)
         {
             clone->id = strdup(resource->id);
@@ -106,10 +111,7 @@ icDeviceResource *resourceClone(const icDeviceResource *resource)
         {
             clone->uri = strdup(resource->uri);
         }
-        if (resource->type != NULL)
-        {
-            clone->type = strdup(resource->type);
-        }
+        clone->type = deviceStringInternAcquire(resource->type);
         if (resource->value != NULL)
         {
             clone->value = strdup(resource->value);
@@ -117,10 +119,9 @@ icDeviceResource *resourceClone(const icDeviceResource *resource)
         clone->dateOfLastSyncMillis = resource->dateOfLastSyncMillis;
         clone->cachingPolicy = resource->cachingPolicy;
         clone->mode = resource->mode;
-        if (resource->endpointId != NULL)
-        {
-            clone->endpointId = strdup(resource->endpointId);
-        }
+        clone->persistencePolicy = resource->persistencePolicy;
+        clone->persistIntervalSecs = resource->persistIntervalSecs;
+        clone->endpointId = deviceStringInternAcquire(resource->endpointId);
     }
     else
     {
@@ -129,6 +130,72 @@ icDeviceResource *resourceClone(const icDeviceResource *resource)
     return clone;
 }
 
+void resourceSetPersistencePolicy(icDeviceResource *resource, ResourcePersistencePolicy policy, uint32_t intervalSecs)
+{
+    if (resource == NULL)
+    {
+        return;
+    }
+
+    if ((int) policy < PERSISTENCE_POLICY_ALWAYS || (int) policy > PERSISTENCE_POLICY_ON_SHUTDOWN)
+    {
+        icLogWarn(
+            LOG_TAG, "Ignoring invalid persistence policy %d for %s", (int) policy, stringCoalesce(resource->uri));
+        policy = PERSISTENCE_POLICY_ALWAYS;
+    }
+
+    resource->persistencePolicy = policy;
+    resource->persistIntervalSecs = policy == PERSISTENCE_POLICY_COALESCE ? intervalSecs : 0;
+}
+
+/**
+ * Get the persistence policy a resource has unless one is declared for it
+ *
+ * @param resource the resource
+ * @param intervalSecs set to the interval for PERSISTENCE_POLICY_COALESCE, otherwise 0
+ * @return the policy
+ */
+static ResourcePersistencePolicy getDefaultPersistencePolicy(const icDeviceResource *resource, uint32_t *intervalSecs)
+{
+    *intervalSecs = 0;
+
+    // Link telemetry changes with nearly every message, it is only stored along with other changes or on shutdown
+    if (stringCompare(resource->type, RESOURCE_TYPE_RSSI, false) == 0 ||
+        stringCompare(resource->type, RESOURCE_TYPE_LQI, false) == 0)
+    {
+        return PERSISTENCE_POLICY_ON_SHUTDOWN;
+    }
+
+    // These change often but only need to be roughly right after a restart
+    if (stringCompare(resource->type, RESOURCE_TYPE_WATTS, false) == 0 ||
+        stringCompare(resource->type, RESOURCE_TYPE_MILLIWATTS, false) == 0 ||
+        stringCompare(resource->id, COMMON_DEVICE_RESOURCE_DATE_LAST_CONTACTED, false) == 0)
+    {
+        *intervalSecs = TELEMETRY_PERSIST_INTERVAL_SECS;
+        return PERSISTENCE_POLICY_COALESCE;
+    }
+
+    return PERSISTENCE_POLICY_ALWAYS;
+}
+
+void resourceApplyDefaultPersistencePolicy(icDeviceResource *resource)
+{
+    if (resource != NULL)
+    {
+        uint32_t intervalSecs;
+        ResourcePersistencePolicy policy = getDefaultPersistencePolicy(resource, &intervalSecs);
+        resourceSetPersistencePolicy(resource, policy, intervalSecs);
+    }
+}
+
+bool resourceHasDefaultPersistencePolicy(const icDeviceResource *resource)
+{
+    uint32_t defaultIntervalSecs;
+    ResourcePersistencePolicy defaultPolicy = getDefaultPersistencePolicy(resource, &defaultIntervalSecs);
+
+    return resource->persistencePolicy == defaultPolicy && resource->persistIntervalSecs == defaultIntervalSecs;
+}
+
 cJSON *resourceToJSON(const icDeviceResource *resource, const icSerDesContext *context)
 {
     cJSON *json = cJSON_CreateObject();
@@ -159,6 +226,12 @@ cJSON *resourceToJSON(const icDeviceResource *resource, const icSerDesContext *c
     cJSON_AddNumberToObject(json, RESOURCE_MODE_KEY, resource->mode);
     cJSON_AddNumberToObject(json, RESOURCE_CACHING_POLICY_KEY, resource->cachingPolicy);
     cJSON_AddNumberToObject(json, RESOURCE_DATE_OF_LAST_SYNC_MILLIS_KEY, resource->dateOfLastSyncMillis);
+    // Most resources use their default policy, so leave it out for them
+    if (!resourceHasDefaultPersistencePolicy(resource))
+    {
+        cJSON_AddNumberToObject(json, RESOURCE_PERSISTENCE_POLICY_KEY, resource->persistencePolicy);
+        cJSON_AddNumberToObject(json, RESOURCE_PERSIST_INTERVAL_SECS_KEY, resource->persistIntervalSecs);
+    }
 
     // Whoever stores in the resource, if there is binary data they have to make sure to encode it, as a resource
     // doesn't support binary data
@@ -212,10 +285,10 @@ resourceFromJSON(const char *deviceUUID, const char *endpointId, cJSON *resource
         }
         else
         {
-            tempResource->deviceUuid = strdup(deviceUUID);
+            tempResource->deviceUuid = deviceStringInternAcquire(deviceUUID);
         }
 
-        tempResource->endpointId = strdupOpt(endpointId);
+        tempResource->endpointId = deviceStringInternAcquire(endpointId);
 
         tempResource->uri = getCJSONString(resourceJSON, RESOURCE_URI_KEY);
         tempResource->id = getCJSONString(resourceJSON, RESOURCE_ID_KEY);
@@ -275,7 +348,8 @@ resourceFromJSON(const char *deviceUUID, const char *endpointId, cJSON *resource
             tempResource->value = getCJSONString(resourceJSON, RESOURCE_VALUE_KEY);
         }
 
-        tempResource->type = getCJSONString(resourceJSON, RESOURCE_TYPE_KEY);
+        scoped_generic char *type = getCJSONString(resourceJSON, RESOURCE_TYPE_KEY);
+        tempResource->type = deviceStringInternAcquire(type);
 
         if (stringIsEmpty(tempResource->type) == true)
         {
@@ -293,6 +367,20 @@ resourceFromJSON(const char *deviceUUID, const char *endpointId, cJSON *resource
         getCJSONUInt64(resourceJSON, RESOURCE_DATE_OF_LAST_SYNC_MILLIS_KEY, &dateOfLastSyncMillis);
         tempResource->dateOfLastSyncMillis = dateOfLastSyncMillis;
 
+        // Without a stored policy the resource has its default, including one stored before defaults existed
+        int persistencePolicy = PERSISTENCE_POLICY_ALWAYS;
+        if (getCJSONInt(resourceJSON, RESOURCE_PERSISTENCE_POLICY_KEY, &persistencePolicy))
+        {
+            int persistIntervalSecs = 0;
+            getCJSONInt(resourceJSON, RESOURCE_PERSIST_INTERVAL_SECS_KEY, &persistIntervalSecs);
+            resourceSetPersistencePolicy(
+                tempResource, persistencePolicy, persistIntervalSecs > 0 ? (uint32_t) persistIntervalSecs : 0);
+        }
+        else
+        {
+            resourceApplyDefaultPersistencePolicy(tempResource);
+        }
+
         // at this stage we have valid resource, create a reference of tempResource and make it NULL.
         // so that auto clean have no effect.
         //
@@ -25,11 +25,13 @@
  */
 
 #include "device/deviceModelHelper.h"
+#include "device/deviceStringIntern.h"
 #include "device-driver/device-driver.h"
 #include "deviceServicePrivate.h"
 #include <device/icDevice.h>
 #include <device/icDeviceEndpoint.h>
 #include <device/icDeviceMetadata.h>
+#include <device/icDeviceResource.h>
 #include <icLog/logging.h>
 #include <stdio.h>
 #include <string.h>
@@ -114,7 +116,7 @@ icDeviceEndpoint *createEndpoint(icDevice *device, const char *id, const char *p
     }
 
     result->id = strdup(id);
-    result->deviceUuid = strdup(device->uuid);
+    result->deviceUuid = deviceStringInternAcquire(device->uuid);
     result->profile = strdup(profile);
     result->resources = linkedListCreate();
     result->enabled = enabled;
@@ -150,18 +152,15 @@ static icDeviceResource *createDeviceResourceOnList(icLinkedList *resourceList,
     }
 
     result->id = strdup(resourceId);
-    if (endpointId != NULL)
-    {
-        result->endpointId = strdup(endpointId);
-    }
-    result->deviceUuid = strdup(deviceUuid);
+    result->endpointId = deviceStringInternAcquire(endpointId);
+    result->deviceUuid = deviceStringInternAcquire(deviceUuid);
 
     if (value != NULL)
     {
         result->value = strdup(value);
     }
 
-    result->type = strdup(type);
+    result->type = deviceStringInternAcquire(type);
     result->mode = mode;
 
     // if a resource is created with DYNAMIC, we can go ahead and safely set the DYNAMIC_CAPABLE bit
@@ -171,6 +170,7 @@ static icDeviceResource *createDeviceResourceOnList(icLinkedList *resourceList,
     }
 
     result->cachingPolicy = cachingPolicy;
+    resourceApplyDefaultPersistencePolicy(result);
 
     linkedListAppend(resourceList, result);
 
@@ -282,11 +282,8 @@ static icDeviceMetadata *createDeviceMetadataOnList(icLinkedList *metadataList,
     }
 
     result->id = strdup(metadataId);
-    if (endpointId != NULL)
-    {
-        result->endpointId = strdup(endpointId);
-    }
-    result->deviceUuid = strdup(deviceUuid);
+    result->endpointId = deviceStringInternAcquire(endpointId);
+    result->deviceUuid = deviceStringInternAcquire(deviceUuid);
 
     if (value != NULL)
     {
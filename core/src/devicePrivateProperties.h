@@ -42,6 +42,17 @@
 #define TELEMETRY_PROPS_PREFIX                                "telemetry."
 #define FAST_COMM_FAIL_PROP                                   "zigbee.testing.fastCommFail.flag"
 #define COMM_FAIL_MONITOR_INTERVAL_SECS_PROP                  "barton.commFail.monitorIntervalSecs"
+#define DEVICE_DB_WRITE_BEHIND_INTERVAL_MILLIS_PROP           "barton.deviceDb.writeBehind.intervalMillis"
+#define DEVICE_DB_WRITE_BEHIND_MAX_DIRTY_DEVICES_PROP         "barton.deviceDb.writeBehind.maxDirtyDevices"
+#define DEVICE_DB_JOURNAL_MAX_RECORDS_PROP                    "barton.deviceDb.journal.maxRecords"
+#define DEVICE_DB_SYNC_CHECKPOINT_INTERVAL_MILLIS_PROP        "barton.deviceDb.syncTable.checkpointIntervalMillis"
+#define DEVICE_DB_LOAD_WORKERS_PROP                           "barton.deviceDb.loadWorkers"
+#define DEVICE_DB_MAX_RESIDENT_DEVICES_PROP                   "barton.deviceDb.maxResidentDevices"
+#define DEVICE_DB_SNAPSHOT_INTERVAL_MILLIS_PROP               "barton.deviceDb.snapshot.intervalMillis"
+#define DEVICE_DB_STORAGE_DURABILITY_PROP                     "barton.deviceDb.storage.durability"
+#define STORAGE_GROUP_COMMIT_WINDOW_MILLIS_PROP               "barton.storage.groupCommit.windowMillis"
+#define STORAGE_RELAXED_WINDOW_MILLIS_PROP                    "barton.storage.groupCommit.relaxedWindowMillis"
+#define MATTER_STORAGE_FLUSH_INTERVAL_MILLIS_PROP              "barton.matter.storage.flushIntervalMillis"
 #define CPE_ZIGBEE_REPORT_DEVICE_INFO_ENABLED                 "cpe.zigbee.reportDeviceInfo.enabled"
 #define CPE_DIAGNOSTIC_ZIGBEEDATA_ENABLED                     "cpe.diagnostics.zigBeeData.enabled"
 #define CPE_DIAGNOSTIC_ZIGBEEDATA_PER_CHANNEL_NUMBER_OF_SCANS "cpe.diagnostics.zigBeeData.numberOfScansPerChannel"
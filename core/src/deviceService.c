@@ -44,6 +44,8 @@
 
 #include "deviceDescriptor.h"
 #include "deviceServiceCommFail.h"
+#include "deviceServiceSystemProperties.h"
+#include "deviceStorageCommit.h"
 #include "deviceStorageMonitor.h"
 #include "event/deviceEventHandler.h"
 #include "events/barton-core-storage-changed-event.h"
@@ -97,6 +99,15 @@
 
 #define DEFAULT_COMM_FAIL_MINS                     56
 
+#define DEVICE_DB_JOURNAL_FILENAME                 "devicedb.journal"
+#define DEVICE_DB_SYNC_TABLE_FILENAME              "devicedb.synctimes"
+#define DEVICE_DB_SNAPSHOT_FILENAME                "devicedb.snapshot"
+#define DEFAULT_DEVICE_DB_LOAD_WORKERS             4
+#define DEVICE_DB_STORAGE_NAMESPACE                "devicedb"
+
+#define DEFAULT_STORAGE_GROUP_COMMIT_WINDOW_MILLIS 1000
+#define DEFAULT_STORAGE_RELAXED_WINDOW_MILLIS      30000
+
 static bool isDeviceServiceInLPM = false;
 
 static pthread_mutex_t lowPowerModeMutex = PTHREAD_MUTEX_INITIALIZER;
@@ -1183,34 +1194,14 @@ static bool isUriPattern(const char *uri)
     return strchr(uri, '*') != NULL;
 }
 
-static char *createRegexFromPattern(const char *uri)
+/*
+ * Patterns were once matched as regular expressions, with each * turned into .*, so a pattern that
+ * uses any other basic regular expression operator keeps being matched that way.  Either way the
+ * pattern must match the whole URI.
+ */
+static bool isGlobUriPattern(const char *uri)
 {
-    // Figure out how big the regex will be
-    int wildcardChars = 0;
-    int i = 0;
-    for (; uri[i]; ++i)
-    {
-        if (uri[i] == '*')
-        {
-            ++wildcardChars;
-        }
-    }
-
-    // Build the regex, essentially just replacing * with .*
-    char *regexUri = (char *) malloc(i + wildcardChars + 1);
-    int j = 0;
-    for (i = 0; uri[i]; ++i)
-    {
-        if (uri[i] == '*')
-        {
-            regexUri[j++] = '.';
-        }
-        regexUri[j++] = uri[i];
-    }
-
-    regexUri[j] = '\0';
-
-    return regexUri;
+    return strpbrk(uri, ".[]^$\\") == NULL;
 }
 
 static bool deviceServiceWriteResourceNoPattern(const char *uri, const char *value)
@@ -1822,6 +1813,30 @@ static void stopMainLoop(void)
     g_main_loop_unref(g_steal_pointer(&eventLoop));
 }
 
+/**
+ * Convert a durability property value ("immediate", "grouped" or "relaxed") to a durability class.
+ *
+ * @param value the property value, may be NULL
+ * @return the durability class, immediate if the value is not recognized
+ */
+static StorageDurability getStorageDurability(const char *value)
+{
+    if (g_strcmp0(value, "grouped") == 0)
+    {
+        return STORAGE_DURABILITY_GROUPED;
+    }
+    else if (g_strcmp0(value, "relaxed") == 0)
+    {
+        return STORAGE_DURABILITY_RELAXED;
+    }
+    else if (value != NULL && g_strcmp0(value, "immediate") != 0)
+    {
+        icLogWarn(LOG_TAG, "%s: unknown storage durability '%s', using immediate", __FUNCTION__, value);
+    }
+
+    return STORAGE_DURABILITY_IMMEDIATE;
+}
+
 bool deviceServiceInitialize(BCoreClient *service)
 {
     g_return_val_if_fail(service != NULL, false);
@@ -1845,12 +1860,85 @@ bool deviceServiceInitialize(BCoreClient *service)
     storageSetConfigPath(deviceServiceConfigDir);
 #endif
 
+    {
+        g_autoptr(BCorePropertyProvider) propertyProvider = deviceServiceConfigurationGetPropertyProvider();
+        guint16 loadWorkers = b_core_property_provider_get_property_as_uint16(
+            propertyProvider, DEVICE_DB_LOAD_WORKERS_PROP, DEFAULT_DEVICE_DB_LOAD_WORKERS);
+        jsonDatabaseSetLoadWorkers(loadWorkers > UINT8_MAX ? UINT8_MAX : (uint8_t) loadWorkers);
+        jsonDatabaseSetCacheLimit(
+            b_core_property_provider_get_property_as_uint32(propertyProvider, DEVICE_DB_MAX_RESIDENT_DEVICES_PROP, 0));
+
+        // Device database writes go straight to storage unless a grouped or relaxed durability is configured
+        deviceStorageCommitSetWindows(
+            b_core_property_provider_get_property_as_uint32(
+                propertyProvider, STORAGE_GROUP_COMMIT_WINDOW_MILLIS_PROP, DEFAULT_STORAGE_GROUP_COMMIT_WINDOW_MILLIS),
+            b_core_property_provider_get_property_as_uint32(
+                propertyProvider, STORAGE_RELAXED_WINDOW_MILLIS_PROP, DEFAULT_STORAGE_RELAXED_WINDOW_MILLIS));
+        scoped_generic char *deviceDbDurability =
+            b_core_property_provider_get_property_as_string(propertyProvider, DEVICE_DB_STORAGE_DURABILITY_PROP, NULL);
+        deviceStorageCommitSetDurability(DEVICE_DB_STORAGE_NAMESPACE, getStorageDurability(deviceDbDurability));
+
+        // Serve devices from the snapshot while their files are read in the background
+        guint32 snapshotIntervalMillis = b_core_property_provider_get_property_as_uint32(
+            propertyProvider, DEVICE_DB_SNAPSHOT_INTERVAL_MILLIS_PROP, 0);
+        if (snapshotIntervalMillis > 0 && deviceServiceConfigDir != NULL)
+        {
+            scoped_generic char *snapshotPath =
+                stringBuilder("%s/" DEVICE_DB_SNAPSHOT_FILENAME, deviceServiceConfigDir);
+            jsonDatabaseSetSnapshot(snapshotPath, snapshotIntervalMillis);
+        }
+        else
+        {
+            jsonDatabaseSetSnapshot(NULL, 0);
+        }
+    }
+
+    uint64_t dbStartMillis = getMonotonicMillis();
+
     if (!jsonDatabaseInitialize())
     {
         icLogError(LOG_TAG, "Failed to initialize database.");
         return false;
     }
 
+    icLogInfo(LOG_TAG, "Device database ready in %" PRIu64 "ms", getMonotonicMillis() - dbStartMillis);
+
+    deviceServiceSystemPropertiesInit();
+
+    // Device changes are written through to storage unless journaling, a sync table or a write-behind interval
+    // is configured
+    {
+        g_autoptr(BCorePropertyProvider) propertyProvider = deviceServiceConfigurationGetPropertyProvider();
+        guint32 journalMaxRecords =
+            b_core_property_provider_get_property_as_uint32(propertyProvider, DEVICE_DB_JOURNAL_MAX_RECORDS_PROP, 0);
+
+        if (journalMaxRecords > 0 && deviceServiceConfigDir != NULL)
+        {
+            scoped_generic char *journalPath = stringBuilder("%s/" DEVICE_DB_JOURNAL_FILENAME, deviceServiceConfigDir);
+            jsonDatabaseSetJournal(journalPath, journalMaxRecords);
+        }
+
+        guint32 syncCheckpointIntervalMillis = b_core_property_provider_get_property_as_uint32(
+            propertyProvider, DEVICE_DB_SYNC_CHECKPOINT_INTERVAL_MILLIS_PROP, 0);
+
+        if (syncCheckpointIntervalMillis > 0 && deviceServiceConfigDir != NULL)
+        {
+            scoped_generic char *syncTablePath =
+                stringBuilder("%s/" DEVICE_DB_SYNC_TABLE_FILENAME, deviceServiceConfigDir);
+            jsonDatabaseSetSyncTable(syncTablePath, syncCheckpointIntervalMillis);
+        }
+
+        guint32 writeBehindIntervalMillis = b_core_property_provider_get_property_as_uint32(
+            propertyProvider, DEVICE_DB_WRITE_BEHIND_INTERVAL_MILLIS_PROP, 0);
+
+        if (writeBehindIntervalMillis > 0)
+        {
+            guint16 maxDirtyDevices = b_core_property_provider_get_property_as_uint16(
+                propertyProvider, DEVICE_DB_WRITE_BEHIND_MAX_DIRTY_DEVICES_PROP, 0);
+            jsonDatabaseSetWriteBehind(writeBehindIntervalMillis, maxDirtyDevices);
+        }
+    }
+
     return true;
 }
 
@@ -2066,8 +2154,19 @@ void deviceServiceShutdown()
 
     deviceEventProducerShutdown();
 
+    deviceServiceSystemPropertiesShutdown();
     jsonDatabaseCleanup(true);
 
+    DeviceStorageCommitStats storageStats;
+    deviceStorageCommitShutdown();
+    deviceStorageCommitGetStats(&storageStats);
+    icLogInfo(LOG_TAG,
+              "%s: storage wrote %" PRIu64 " bytes in %" PRIu64 " syncs, %" PRIu64 " writes coalesced",
+              __FUNCTION__,
+              storageStats.bytesWritten,
+              storageStats.syncs,
+              storageStats.coalescedWrites);
+
     // FIXME: refcount shared objects to cleanly prevent use-after-free
 
     mutexLock(&discoveryControlMutex);
@@ -2206,20 +2305,8 @@ static bool addCommonResources(icDevice *device, icInitialResourceValues *initia
  */
 static bool isDeviceDescriptorBypassed()
 {
-    bool retVal = false;
-
     // get from 'system properties'
-    char *flag = NULL;
-    if (deviceServiceGetSystemProperty(DEVICE_DESCRIPTOR_BYPASS_SYSTEM_PROP, &flag) == true)
-    {
-        if (flag != NULL && strcasecmp(flag, "true") == 0)
-        {
-            retVal = true;
-        }
-        free(flag);
-    }
-
-    return retVal;
+    return deviceServiceGetSystemPropertyBool(DEVICE_DESCRIPTOR_BYPASS_SYSTEM_PROP, false);
 }
 
 /*
@@ -2698,6 +2785,9 @@ static bool finalizeNewDevice(icDevice *device, bool sendEvents, bool inRepairMo
         result &= jsonDatabaseAddDevice(device);
     }
 
+    // Don't announce the device until everything about it is in storage
+    result &= jsonDatabaseFlushDevice(device->uuid);
+
     icLogDebug(LOG_TAG, "device finalized:");
     devicePrint(device, "");
 
@@ -2836,6 +2926,43 @@ void deviceServiceUpdateEndpoint(icDevice *device, icDeviceEndpoint *endpoint)
     }
 }
 
+/*
+ * Store a new value in a cached resource.
+ *
+ * @return true if the value changed
+ */
+static bool setResourceValue(icDeviceResource *resource, const char *newValue)
+{
+    bool didChange = false;
+
+    if (resource->value != NULL)
+    {
+        if (newValue == NULL)
+        {
+            // from non-null to null
+            didChange = true;
+            free(resource->value);
+            resource->value = NULL;
+        }
+        else if (strcmp(resource->value, newValue) != 0)
+        {
+            didChange = true;
+            free(resource->value);
+            resource->value = strdup(newValue);
+        }
+    }
+    else if (newValue != NULL)
+    {
+        // changed from null to not null
+        didChange = true;
+
+        // TODO: We should only update for resources marked as READABLE
+        resource->value = strdup(newValue);
+    }
+
+    return didChange;
+}
+
 void updateResource(const char *deviceUuid,
                     const char *endpointId,
                     const char *resourceId,
@@ -2881,32 +3008,7 @@ void updateResource(const char *deviceUuid,
         }
         else
         {
-            bool didChange = false;
-
-            if (resource->value != NULL)
-            {
-                if (newValue == NULL)
-                {
-                    // from non-null to null
-                    didChange = true;
-                    free(resource->value);
-                    resource->value = NULL;
-                }
-                else if (strcmp(resource->value, newValue) != 0)
-                {
-                    didChange = true;
-                    free(resource->value);
-                    resource->value = strdup(newValue);
-                }
-            }
-            else if (newValue != NULL)
-            {
-                // changed from null to not null
-                didChange = true;
-
-                // TODO: We should only update for resources marked as READABLE
-                resource->value = strdup(newValue);
-            }
+            bool didChange = setResourceValue(resource, newValue);
 
             if (didChange)
             {
@@ -2936,6 +3038,159 @@ void updateResource(const char *deviceUuid,
     resourceDestroy(resource);
 }
 
+typedef struct
+{
+    char *deviceUuid;
+    char *endpointId;
+    char *resourceId;
+    char *newValue;
+    cJSON *metadata;
+
+    // Filled in on commit
+    icDeviceResource *resource;
+    bool sendEvent;
+    bool updateDateLastContacted;
+} StagedResourceUpdate;
+
+struct ResourceUpdateBatch
+{
+    icLinkedList *updates;
+};
+
+static void stagedResourceUpdateDestroy(StagedResourceUpdate *update)
+{
+    free(update->deviceUuid);
+    free(update->endpointId);
+    free(update->resourceId);
+    free(update->newValue);
+    cJSON_Delete(update->metadata);
+    resourceDestroy(update->resource);
+    free(update);
+}
+
+ResourceUpdateBatch *resourceUpdateBatchBegin(void)
+{
+    ResourceUpdateBatch *batch = calloc(1, sizeof(ResourceUpdateBatch));
+    batch->updates = linkedListCreate();
+
+    return batch;
+}
+
+void resourceUpdateBatchStage(ResourceUpdateBatch *batch,
+                              const char *deviceUuid,
+                              const char *endpointId,
+                              const char *resourceId,
+                              const char *newValue,
+                              cJSON *metadata)
+{
+    if (batch == NULL || deviceUuid == NULL || resourceId == NULL)
+    {
+        icLogWarn(LOG_TAG, "%s: invalid args", __func__);
+        return;
+    }
+
+    StagedResourceUpdate *update = NULL;
+
+    // Staging the same resource again replaces the earlier value
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(batch->updates);
+    while (update == NULL && linkedListIteratorHasNext(iter))
+    {
+        StagedResourceUpdate *item = linkedListIteratorGetNext(iter);
+        if (stringCompare(item->deviceUuid, deviceUuid, false) == 0 &&
+            stringCompare(item->endpointId, endpointId, false) == 0 &&
+            stringCompare(item->resourceId, resourceId, false) == 0)
+        {
+            update = item;
+        }
+    }
+
+    if (update == NULL)
+    {
+        update = calloc(1, sizeof(StagedResourceUpdate));
+        update->deviceUuid = strdup(deviceUuid);
+        update->endpointId = strdupOpt(endpointId);
+        update->resourceId = strdup(resourceId);
+        linkedListAppend(batch->updates, update);
+    }
+    else
+    {
+        free(update->newValue);
+        cJSON_Delete(update->metadata);
+    }
+
+    update->newValue = strdupOpt(newValue);
+    update->metadata = metadata != NULL ? cJSON_Duplicate(metadata, true) : NULL;
+}
+
+void resourceUpdateBatchCommit(ResourceUpdateBatch *batch)
+{
+    if (batch == NULL)
+    {
+        return;
+    }
+
+    // The database doesn't own these, the staged updates do
+    scoped_icLinkedListNofree *changed = linkedListCreate();
+    scoped_icLinkedListNofree *synced = linkedListCreate();
+    uint64_t now = getCurrentUnixTimeMillis();
+
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(batch->updates);
+    while (linkedListIteratorHasNext(iter))
+    {
+        StagedResourceUpdate *update = linkedListIteratorGetNext(iter);
+        update->resource =
+            deviceServiceGetResourceByIdInternal(update->deviceUuid, update->endpointId, update->resourceId, false);
+        icDeviceResource *resource = update->resource;
+
+        if (resource == NULL)
+        {
+            continue;
+        }
+
+        if (resource->cachingPolicy == CACHING_POLICY_NEVER && (resource->mode & RESOURCE_MODE_EMIT_EVENTS))
+        {
+            // we cannot compare previous values for non cached resources, so just send the event
+            free(resource->value);
+            resource->value = strdupOpt(update->newValue);
+            update->sendEvent = true;
+            update->updateDateLastContacted = true;
+        }
+        else if (setResourceValue(resource, update->newValue))
+        {
+            resource->dateOfLastSyncMillis = now;
+            linkedListAppend(changed, resource);
+            update->sendEvent = (resource->mode & RESOURCE_MODE_EMIT_EVENTS) != 0;
+        }
+        else
+        {
+            linkedListAppend(synced, resource);
+        }
+    }
+
+    // One database transaction for everything, so each device is saved at most once
+    jsonDatabaseSaveResources(changed, synced);
+
+    // Only tell anyone once everything is in place
+    scoped_icLinkedListIterator *eventIter = linkedListIteratorCreate(batch->updates);
+    while (linkedListIteratorHasNext(eventIter))
+    {
+        StagedResourceUpdate *update = linkedListIteratorGetNext(eventIter);
+
+        if (update->updateDateLastContacted)
+        {
+            updateDeviceDateLastContacted(update->deviceUuid);
+        }
+
+        if (update->sendEvent)
+        {
+            sendResourceUpdatedEvent(update->resource, update->metadata);
+        }
+    }
+
+    linkedListDestroy(batch->updates, (linkedListItemFreeFunc) stagedResourceUpdateDestroy);
+    free(batch);
+}
+
 void setMetadata(const char *deviceUuid, const char *endpointId, const char *name, const char *value)
 {
     icLogDebug(LOG_TAG,
@@ -3134,11 +3389,23 @@ static DeviceDriver *getDeviceDriverForUri(const char *uri)
 {
     DeviceDriver *result = NULL;
 
-    icDevice *device = deviceServiceGetDeviceByUri(uri);
-    if (device != NULL)
+    if (uri == NULL)
     {
-        result = deviceDriverManagerGetDeviceDriver(device->managingDeviceDriver);
-        deviceDestroy(device);
+        icLogError(LOG_TAG, "%s: invalid argument", __FUNCTION__);
+        return NULL;
+    }
+
+    if (deviceServiceIsUriAccessible(uri) == false)
+    {
+        icLogWarn(LOG_TAG, "%s: uri %s is not accessible", __FUNCTION__, uri);
+        return NULL;
+    }
+
+    // Only the driver name is needed, so don't clone the whole device
+    scoped_generic char *driverName = jsonDatabaseGetDeviceDriverByUri(uri);
+    if (driverName != NULL)
+    {
+        result = deviceDriverManagerGetDeviceDriver(driverName);
     }
     else
     {
@@ -4029,6 +4296,12 @@ bool deviceServiceIsDeviceKnown(const char *uuid)
     return jsonDatabaseIsDeviceKnown(uuid);
 }
 
+char *deviceServiceGetDeviceClass(const char *uuid)
+{
+    // just pass through to database
+    return jsonDatabaseGetDeviceClassById(uuid);
+}
+
 icDevice *deviceServiceGetDeviceByUri(const char *uri)
 {
     if (uri == NULL)
@@ -4288,76 +4561,24 @@ icLinkedList *deviceServiceGetDevicesByMetadata(const char *metadataId, const ch
         return NULL;
     }
 
-    // get the list of devices
-    //
-    icLinkedList *deviceList = deviceServiceGetAllDevices();
-
-    // sanity check
-    if (deviceList == NULL)
-    {
-        icLogError(LOG_TAG, "%s: unable to get list of all devices ... bailing", __FUNCTION__);
-        return NULL;
-    }
-
-    // create the found list
+    // the database keeps devices indexed by their metadata ids, so only candidates are returned
     //
-    icLinkedList *devicesFound = linkedListCreate();
+    icLinkedList *devicesFound = jsonDatabaseGetDevicesByMetadata(metadataId, valueToCompare);
 
-    // iterate though each device
+    // drop any device whose metadata isn't accessible
     //
-    icLinkedListIterator *listIter = linkedListIteratorCreate(deviceList);
+    icLinkedListIterator *listIter = linkedListIteratorCreate(devicesFound);
     while (linkedListIteratorHasNext(listIter))
     {
         icDevice *device = (icDevice *) linkedListIteratorGetNext(listIter);
+        scoped_generic char *deviceMetadataUri = createDeviceMetadataUri(device->uuid, metadataId);
 
-        // need to create the metadata deviceUri
-        //
-        char *deviceMetadataUri = createDeviceMetadataUri(device->uuid, metadataId);
-        if (deviceMetadataUri != NULL)
+        if (deviceMetadataUri == NULL || deviceServiceIsUriAccessible(deviceMetadataUri) == false)
         {
-            // now get the metadata value from device
-            //
-            char *deviceMetadataValue = NULL;
-            if (deviceServiceGetMetadata(deviceMetadataUri, &deviceMetadataValue) == true &&
-                deviceMetadataValue != NULL)
-            {
-                bool addDevice = false;
-
-                // determine if device should be added to list
-                //
-                if (valueToCompare == NULL)
-                {
-                    addDevice = true;
-                }
-                else if (strcasecmp(deviceMetadataValue, valueToCompare) == 0)
-                {
-                    addDevice = true;
-                }
-
-                // remove from device list and add to found list
-                //
-                if (addDevice)
-                {
-                    linkedListIteratorDeleteCurrent(listIter, standardDoNotFreeFunc);
-                    linkedListAppend(devicesFound, device);
-                }
-
-                // cleanup value
-                free(deviceMetadataValue);
-            }
-
-            // cleanup uri
-            free(deviceMetadataUri);
-        }
-        else
-        {
-            icLogWarn(LOG_TAG, "%s: unable to create device Metadata Uri for device %s", __FUNCTION__, device->uuid);
+            linkedListIteratorDeleteCurrent(listIter, (linkedListItemFreeFunc) deviceDestroy);
         }
     }
-
-    // cleanup
     linkedListIteratorDestroy(listIter);
-    linkedListDestroy(deviceList, (linkedListItemFreeFunc) deviceDestroy);
 
     return devicesFound;
 }
@@ -4379,9 +4600,17 @@ icLinkedList *deviceServiceGetMetadataByUriPattern(char *uriPattern)
     if (isUriPattern(uriPattern) == true)
     {
         retval = linkedListCreate();
-        scoped_generic char *regex = createRegexFromPattern(uriPattern);
 
-        icLinkedList *metadataList = jsonDatabaseGetMetadataByUriRegex(regex);
+        icLinkedList *metadataList = NULL;
+        if (isGlobUriPattern(uriPattern) == true)
+        {
+            metadataList = jsonDatabaseGetMetadataByUriPattern(uriPattern);
+        }
+        else
+        {
+            scoped_generic char *regex = jsonDatabaseCreateUriPatternRegex(uriPattern);
+            metadataList = jsonDatabaseGetMetadataByUriRegex(regex);
+        }
         icLinkedListIterator *listIter = linkedListIteratorCreate(metadataList);
         while (linkedListIteratorHasNext(listIter) == true)
         {
@@ -4427,9 +4656,13 @@ icLinkedList *deviceServiceGetResourcesByUriPatternInternal(const char *uriPatte
         return NULL;
     }
 
-    if (isUriPattern(uriPattern) == true)
+    if (isUriPattern(uriPattern) == true && isGlobUriPattern(uriPattern) == true)
+    {
+        retval = jsonDatabaseGetResourcesByUriPattern(uriPattern);
+    }
+    else if (isUriPattern(uriPattern) == true)
     {
-        scoped_generic char *regex = createRegexFromPattern(uriPattern);
+        scoped_generic char *regex = jsonDatabaseCreateUriPatternRegex(uriPattern);
         retval = jsonDatabaseGetResourcesByUriRegex(regex);
     }
     else
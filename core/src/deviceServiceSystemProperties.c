@@ -0,0 +1,434 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#define G_LOG_DOMAIN "deviceServiceSystemProperties"
+#define LOG_TAG      G_LOG_DOMAIN
+#define logFmt(fmt)  "(%s)" fmt, __func__
+
+#include "deviceServiceSystemProperties.h"
+#include "database/jsonDatabase.h"
+#include "deviceService.h"
+#include "icConcurrent/threadUtils.h"
+#include "icLog/logging.h"
+#include "icTypes/icLinkedList.h"
+#include "icUtil/stringUtils.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Properties are never forgotten once looked up, and only a handful are read on hot paths
+#define PROPERTY_SLOT_COUNT 64
+
+// The typed view of a value, packed into one word so readers get all of it with a single load.
+// The low 32 bits hold the value as an integer when it parses as one.
+#define TYPED_LOADED   (1ULL << 32)
+#define TYPED_PRESENT  (1ULL << 33)
+#define TYPED_IS_INT   (1ULL << 34)
+#define TYPED_BOOL     (1ULL << 35)
+#define TYPED_INT_MASK 0xffffffffULL
+
+typedef struct
+{
+    char *name;     // claimed once with a compare and swap, never released
+    uint64_t typed; // packed typed view, 0 until loaded
+    char *value;    // the raw value, protected by valueLock
+} PropertySlot;
+
+typedef struct
+{
+    char *name;
+    deviceServiceSystemPropertyChangedCallback callback;
+    void *ctx;
+} Subscription;
+
+static PropertySlot slots[PROPERTY_SLOT_COUNT];
+static bool started = false;
+static bool warnedFull = false;
+
+// Serializes loading values into slots, so a slower load can't overwrite a newer one
+static pthread_mutex_t loadMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t valueLock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t subscriptionMtx = PTHREAD_MUTEX_INITIALIZER;
+static icLinkedList *subscriptions = NULL;
+
+static uint32_t hashName(const char *name)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const char *c = name; *c != '\0'; c++)
+    {
+        hash = (hash ^ (uint8_t) *c) * 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * Find the slot of a property.  Lock free: slots are only ever claimed, never released.
+ *
+ * @param name the property name
+ * @param create claim a free slot if the property has none yet
+ * @return the slot, or NULL if there is none (or no room for one)
+ */
+static PropertySlot *findSlot(const char *name, bool create)
+{
+    uint32_t start = hashName(name) % PROPERTY_SLOT_COUNT;
+    for (uint32_t i = 0; i < PROPERTY_SLOT_COUNT; i++)
+    {
+        PropertySlot *slot = &slots[(start + i) % PROPERTY_SLOT_COUNT];
+        char *slotName = __atomic_load_n(&slot->name, __ATOMIC_ACQUIRE);
+        if (slotName == NULL)
+        {
+            if (!create)
+            {
+                return NULL;
+            }
+
+            char *copy = strdup(name);
+            if (__atomic_compare_exchange_n(&slot->name, &slotName, copy, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                return slot;
+            }
+            // Somebody else claimed it first, slotName now holds their name
+            free(copy);
+        }
+
+        if (strcmp(slotName, name) == 0)
+        {
+            return slot;
+        }
+    }
+
+    if (create && !__atomic_exchange_n(&warnedFull, true, __ATOMIC_RELAXED))
+    {
+        icWarn("no room to cache %s, reading through to the database", name);
+    }
+
+    return NULL;
+}
+
+static uint64_t parseTypedValue(bool present, const char *value)
+{
+    uint64_t typed = TYPED_LOADED;
+    if (present)
+    {
+        typed |= TYPED_PRESENT;
+        if (value != NULL && stringToBool(value))
+        {
+            typed |= TYPED_BOOL;
+        }
+
+        int32_t number;
+        if (value != NULL && stringToInt32(value, &number))
+        {
+            typed |= TYPED_IS_INT | ((uint64_t) (uint32_t) number & TYPED_INT_MASK);
+        }
+    }
+
+    return typed;
+}
+
+/**
+ * Load a slot's value from the database.  Caller must hold loadMtx.
+ *
+ * @param slot the slot
+ * @return true if the value differs from what the slot held before
+ */
+static bool loadSlot(PropertySlot *slot)
+{
+    char *value = NULL;
+    bool present = jsonDatabaseGetSystemProperty(slot->name, &value);
+    if (!present)
+    {
+        free(value);
+        value = NULL;
+    }
+
+    pthread_rwlock_wrlock(&valueLock);
+    char *previous = slot->value;
+    slot->value = value;
+    pthread_rwlock_unlock(&valueLock);
+
+    uint64_t previousTyped = __atomic_exchange_n(&slot->typed, parseTypedValue(present, value), __ATOMIC_ACQ_REL);
+    bool changed = (previousTyped & TYPED_PRESENT) != (present ? TYPED_PRESENT : 0) ||
+                   stringCompare(previous, value, false) != 0;
+    free(previous);
+
+    return changed;
+}
+
+/**
+ * Get the loaded slot of a property, loading it on first use.
+ *
+ * @param name the property name
+ * @return the slot, or NULL if the property can't be cached
+ */
+static PropertySlot *getLoadedSlot(const char *name)
+{
+    if (name == NULL || !__atomic_load_n(&started, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+
+    PropertySlot *slot = findSlot(name, true);
+    if (slot != NULL && (__atomic_load_n(&slot->typed, __ATOMIC_ACQUIRE) & TYPED_LOADED) == 0)
+    {
+        LOCK_SCOPE(loadMtx);
+        if ((__atomic_load_n(&slot->typed, __ATOMIC_ACQUIRE) & TYPED_LOADED) == 0)
+        {
+            loadSlot(slot);
+        }
+    }
+
+    return slot;
+}
+
+static uint64_t getTypedValue(const char *name)
+{
+    PropertySlot *slot = getLoadedSlot(name);
+    if (slot != NULL)
+    {
+        return __atomic_load_n(&slot->typed, __ATOMIC_ACQUIRE);
+    }
+
+    // Not cached, so parse it every time
+    char *value = NULL;
+    bool present = name != NULL && jsonDatabaseGetSystemProperty(name, &value);
+    uint64_t typed = parseTypedValue(present, value);
+    free(value);
+
+    return typed;
+}
+
+bool deviceServiceGetSystemPropertyBool(const char *name, bool defaultValue)
+{
+    uint64_t typed = getTypedValue(name);
+
+    return (typed & TYPED_PRESENT) != 0 ? (typed & TYPED_BOOL) != 0 : defaultValue;
+}
+
+int32_t deviceServiceGetSystemPropertyInt(const char *name, int32_t defaultValue)
+{
+    uint64_t typed = getTypedValue(name);
+
+    return (typed & TYPED_IS_INT) != 0 ? (int32_t) (uint32_t) (typed & TYPED_INT_MASK) : defaultValue;
+}
+
+char *deviceServiceGetSystemPropertyString(const char *name, const char *defaultValue)
+{
+    char *value = NULL;
+    bool present = false;
+
+    PropertySlot *slot = getLoadedSlot(name);
+    if (slot != NULL)
+    {
+        READ_LOCK_SCOPE(valueLock);
+        present = (__atomic_load_n(&slot->typed, __ATOMIC_ACQUIRE) & TYPED_PRESENT) != 0;
+        value = strdupOpt(slot->value);
+    }
+    else if (name != NULL)
+    {
+        present = jsonDatabaseGetSystemProperty(name, &value);
+    }
+
+    if (!present || value == NULL)
+    {
+        free(value);
+        value = strdupOpt(defaultValue);
+    }
+
+    return value;
+}
+
+static void destroySubscription(void *item)
+{
+    Subscription *subscription = item;
+    free(subscription->name);
+    free(subscription);
+}
+
+bool deviceServiceSubscribeSystemProperty(const char *name,
+                                          deviceServiceSystemPropertyChangedCallback callback,
+                                          void *ctx)
+{
+    if (name == NULL || callback == NULL)
+    {
+        return false;
+    }
+
+    // Changes are only noticed for cached properties
+    if (getLoadedSlot(name) == NULL)
+    {
+        icWarn("cannot watch %s", name);
+        return false;
+    }
+
+    Subscription *subscription = calloc(1, sizeof(Subscription));
+    subscription->name = strdup(name);
+    subscription->callback = callback;
+    subscription->ctx = ctx;
+
+    LOCK_SCOPE(subscriptionMtx);
+    if (subscriptions == NULL)
+    {
+        subscriptions = linkedListCreate();
+    }
+    linkedListAppend(subscriptions, subscription);
+
+    return true;
+}
+
+void deviceServiceUnsubscribeSystemProperty(const char *name,
+                                            deviceServiceSystemPropertyChangedCallback callback,
+                                            void *ctx)
+{
+    if (name == NULL)
+    {
+        return;
+    }
+
+    LOCK_SCOPE(subscriptionMtx);
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(subscriptions);
+    while (linkedListIteratorHasNext(iter))
+    {
+        Subscription *subscription = linkedListIteratorGetNext(iter);
+        if (subscription->callback == callback && subscription->ctx == ctx && strcmp(subscription->name, name) == 0)
+        {
+            linkedListIteratorDeleteCurrent(iter, destroySubscription);
+            break;
+        }
+    }
+}
+
+/**
+ * Tell the subscribers of a property about its new value.  Called without any lock held, so
+ * subscribers may use the device service, including changing properties.
+ */
+static void notifySubscribers(PropertySlot *slot)
+{
+    char *value = NULL;
+    {
+        READ_LOCK_SCOPE(valueLock);
+        value = strdupOpt(slot->value);
+    }
+
+    // Copy out whom to call, the callbacks may subscribe or unsubscribe
+    icLinkedList *matching = linkedListCreate();
+    {
+        LOCK_SCOPE(subscriptionMtx);
+        scoped_icLinkedListIterator *iter = linkedListIteratorCreate(subscriptions);
+        while (linkedListIteratorHasNext(iter))
+        {
+            Subscription *subscription = linkedListIteratorGetNext(iter);
+            if (strcmp(subscription->name, slot->name) == 0)
+            {
+                Subscription *copy = calloc(1, sizeof(Subscription));
+                copy->callback = subscription->callback;
+                copy->ctx = subscription->ctx;
+                linkedListAppend(matching, copy);
+            }
+        }
+    }
+
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(matching);
+    while (linkedListIteratorHasNext(iter))
+    {
+        Subscription *subscription = linkedListIteratorGetNext(iter);
+        subscription->callback(slot->name, value, subscription->ctx);
+    }
+
+    linkedListDestroy(matching, destroySubscription);
+    free(value);
+}
+
+/**
+ * jsonDatabase listener: reload what changed, then notify.
+ */
+static void systemPropertyChanged(const char *key, void *ctx)
+{
+    (void) ctx;
+
+    bool changed[PROPERTY_SLOT_COUNT] = {false};
+    {
+        LOCK_SCOPE(loadMtx);
+        if (key != NULL)
+        {
+            // Properties nobody has looked at are not cached, so there is nothing to do for them
+            PropertySlot *slot = findSlot(key, false);
+            if (slot != NULL)
+            {
+                changed[slot - slots] = loadSlot(slot);
+            }
+        }
+        else
+        {
+            for (uint32_t i = 0; i < PROPERTY_SLOT_COUNT; i++)
+            {
+                if (__atomic_load_n(&slots[i].name, __ATOMIC_ACQUIRE) != NULL)
+                {
+                    changed[i] = loadSlot(&slots[i]);
+                }
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < PROPERTY_SLOT_COUNT; i++)
+    {
+        if (changed[i])
+        {
+            notifySubscribers(&slots[i]);
+        }
+    }
+}
+
+/**
+ * Mark every slot as not loaded, so values are read again on next use.
+ */
+static void invalidateSlots(void)
+{
+    LOCK_SCOPE(loadMtx);
+    for (uint32_t i = 0; i < PROPERTY_SLOT_COUNT; i++)
+    {
+        __atomic_and_fetch(&slots[i].typed, ~TYPED_LOADED, __ATOMIC_ACQ_REL);
+    }
+}
+
+void deviceServiceSystemPropertiesInit(void)
+{
+    // Listen first, so nothing loaded from here on can miss a change
+    jsonDatabaseSetSystemPropertyListener(systemPropertyChanged, NULL);
+    invalidateSlots();
+    __atomic_store_n(&started, true, __ATOMIC_RELEASE);
+}
+
+void deviceServiceSystemPropertiesShutdown(void)
+{
+    __atomic_store_n(&started, false, __ATOMIC_RELEASE);
+    jsonDatabaseSetSystemPropertyListener(NULL, NULL);
+    invalidateSlots();
+
+    LOCK_SCOPE(subscriptionMtx);
+    linkedListDestroy(subscriptions, destroySubscription);
+    subscriptions = NULL;
+}
@@ -0,0 +1,41 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+/*
+ * Typed read cache of device service system properties.  Values are parsed once when they change,
+ * so readers of bool and int properties only do an atomic load.  The typed accessors and change
+ * subscriptions themselves are declared in deviceService.h.
+ */
+
+#pragma once
+
+/**
+ * Start caching.  Must be called after the device database is initialized.  Until then the typed
+ * accessors read through to the database.
+ */
+void deviceServiceSystemPropertiesInit(void);
+
+/**
+ * Stop caching and drop all subscriptions.
+ */
+void deviceServiceSystemPropertiesShutdown(void);
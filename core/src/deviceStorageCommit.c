@@ -0,0 +1,553 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "deviceStorageCommit.h"
+#include "observability/observabilityMetrics.h"
+#include <icConcurrent/delayedTask.h>
+#include <icConfig/storage.h>
+#include <icTime/timeUtils.h>
+#include <icTypes/icHashMap.h>
+#include <icTypes/icLinkedList.h>
+#include <icUtil/stringUtils.h>
+
+#define LOG_TAG     "deviceStorageCommit"
+#define logFmt(fmt) "%s: " fmt, __func__
+#include <icLog/logging.h>
+
+#define DEFAULT_GROUP_WINDOW_MILLIS   1000
+#define DEFAULT_RELAXED_WINDOW_MILLIS 30000
+#define SYNC_RATE_BUCKETS             60
+
+typedef struct
+{
+    char *id; // "<namespace>/<key>", storage keys can't contain a slash
+    char *namespace;
+    char *key;
+    char *value; // NULL to delete the key
+    uint64_t dueMillis;
+} PendingWrite;
+
+// Serializes storage operations, so a key never reaches storage out of order
+static pthread_mutex_t commitMtx = PTHREAD_MUTEX_INITIALIZER;
+
+// Guards everything below
+static pthread_mutex_t pendingMtx = PTHREAD_MUTEX_INITIALIZER;
+static icHashMap *pendingWrites = NULL; // id -> PendingWrite
+static icHashMap *durabilities = NULL;  // namespace -> StorageDurability
+static uint32_t groupWindowMillis = DEFAULT_GROUP_WINDOW_MILLIS;
+static uint32_t relaxedWindowMillis = DEFAULT_RELAXED_WINDOW_MILLIS;
+static StorageCommitTask commitTask;
+static DeviceStorageCommitStats commitStats;
+// Syncs per second over the last minute, bucketed by monotonic second
+static uint64_t syncBucketSeconds[SYNC_RATE_BUCKETS];
+static uint32_t syncBuckets[SYNC_RATE_BUCKETS];
+
+static pthread_once_t countersOnce = PTHREAD_ONCE_INIT;
+static ObservabilityCounter *bytesWrittenCounter = NULL;
+static ObservabilityCounter *syncCounter = NULL;
+
+static void commitTaskFunc(void *arg);
+
+static void createCounters(void)
+{
+    bytesWrittenCounter =
+        observabilityCounterCreate("storage.write.bytes", "Bytes written to storage, by namespace", "By");
+    syncCounter = observabilityCounterCreate("storage.sync.count", "Storage syncs, by namespace", "1");
+}
+
+static void freePendingWrite(PendingWrite *pending)
+{
+    if (pending != NULL)
+    {
+        free(pending->id);
+        free(pending->namespace);
+        free(pending->key);
+        free(pending->value);
+        free(pending);
+    }
+}
+
+static void freePendingWritesItem(void *key, void *value)
+{
+    (void) key;
+
+    freePendingWrite(value);
+}
+
+static void freeDurabilitiesItem(void *key, void *value)
+{
+    free(key);
+    free(value);
+}
+
+/**
+ * Count a storage operation.  Assumes caller owns pendingMtx.
+ *
+ * @param namespace the namespace written to
+ * @param bytes the number of bytes written, 0 for a delete
+ */
+static void countStorageOperationNoLock(const char *namespace, size_t bytes)
+{
+    commitStats.writes++;
+    commitStats.bytesWritten += bytes;
+    commitStats.syncs++;
+
+    uint64_t second = getMonotonicMillis() / 1000;
+    uint32_t bucket = (uint32_t) (second % SYNC_RATE_BUCKETS);
+    if (syncBucketSeconds[bucket] != second)
+    {
+        syncBucketSeconds[bucket] = second;
+        syncBuckets[bucket] = 0;
+    }
+    syncBuckets[bucket]++;
+
+    pthread_once(&countersOnce, createCounters);
+    if (bytes > 0)
+    {
+        observabilityCounterAddWithAttrs(bytesWrittenCounter, bytes, "namespace", namespace, NULL);
+    }
+    observabilityCounterAddWithAttrs(syncCounter, 1, "namespace", namespace, NULL);
+}
+
+/**
+ * Write a value to storage, or delete the key.  Assumes caller owns commitMtx and not pendingMtx.
+ *
+ * @param namespace the storage namespace
+ * @param key the storage key
+ * @param value the value, or NULL to delete the key
+ * @return true on success
+ */
+static bool writeToStorage(const char *namespace, const char *key, const char *value)
+{
+    bool ok = value != NULL ? storageSave(namespace, key, value) : storageDelete(namespace, key);
+
+    pthread_mutex_lock(&pendingMtx);
+    countStorageOperationNoLock(namespace, value != NULL ? strlen(value) : 0);
+    pthread_mutex_unlock(&pendingMtx);
+
+    return ok;
+}
+
+/**
+ * Get the durability class of a namespace.  Assumes caller owns pendingMtx.
+ */
+static StorageDurability getDurabilityNoLock(const char *namespace)
+{
+    StorageDurability *durability = NULL;
+
+    if (durabilities != NULL)
+    {
+        durability = hashMapGet(durabilities, (void *) namespace, (uint16_t) (strlen(namespace) + 1));
+    }
+
+    return durability != NULL ? *durability : STORAGE_DURABILITY_IMMEDIATE;
+}
+
+/**
+ * Queue a write for a group commit, replacing any pending write of the same key.  Assumes caller owns
+ * pendingMtx.
+ *
+ * @param namespace the storage namespace
+ * @param key the storage key
+ * @param value the value, or NULL to delete the key
+ * @param windowMillis how long the write may wait
+ */
+static void queueWriteNoLock(const char *namespace, const char *key, const char *value, uint32_t windowMillis)
+{
+    if (pendingWrites == NULL)
+    {
+        pendingWrites = hashMapCreate();
+    }
+
+    scoped_generic char *id = stringBuilder("%s/%s", namespace, key);
+    uint16_t idLen = (uint16_t) (strlen(id) + 1);
+
+    PendingWrite *pending = hashMapGet(pendingWrites, id, idLen);
+    if (pending != NULL)
+    {
+        // Keep the original deadline, so a key that keeps changing still reaches storage
+        free(pending->value);
+        pending->value = value != NULL ? strdup(value) : NULL;
+        commitStats.coalescedWrites++;
+        return;
+    }
+
+    pending = calloc(1, sizeof(PendingWrite));
+    pending->id = strdup(id);
+    pending->namespace = strdup(namespace);
+    pending->key = strdup(key);
+    pending->value = value != NULL ? strdup(value) : NULL;
+    pending->dueMillis = getMonotonicMillis() + windowMillis;
+    hashMapPut(pendingWrites, pending->id, idLen, pending);
+
+    deviceStorageCommitScheduleTaskNoLock(&commitTask, pending->dueMillis, commitTaskFunc);
+}
+
+/**
+ * Take the pending writes matching a namespace and, optionally, a key.  Assumes caller owns pendingMtx.
+ *
+ * @param namespace the namespace, or NULL for any
+ * @param key the key, or NULL for any
+ * @param dueOnly only take writes whose window has passed
+ * @return the writes, in no particular order.  Caller must destroy.
+ */
+static icLinkedList *takePendingNoLock(const char *namespace, const char *key, bool dueOnly)
+{
+    icLinkedList *taken = linkedListCreate();
+
+    if (pendingWrites == NULL)
+    {
+        return taken;
+    }
+
+    uint64_t now = getMonotonicMillis();
+    uint64_t nextDueMillis = UINT64_MAX;
+
+    scoped_icHashMapIterator *iter = hashMapIteratorCreate(pendingWrites);
+    while (hashMapIteratorHasNext(iter))
+    {
+        void *mapKey;
+        uint16_t mapKeyLen;
+        PendingWrite *pending;
+        hashMapIteratorGetNext(iter, &mapKey, &mapKeyLen, (void **) &pending);
+
+        bool matches = (namespace == NULL || strcmp(pending->namespace, namespace) == 0) &&
+                       (key == NULL || strcmp(pending->key, key) == 0);
+
+        if (matches && (!dueOnly || pending->dueMillis <= now))
+        {
+            hashMapIteratorDeleteCurrent(iter, standardDoNotFreeHashMapFunc);
+            linkedListAppend(taken, pending);
+        }
+        else if (pending->dueMillis < nextDueMillis)
+        {
+            nextDueMillis = pending->dueMillis;
+        }
+    }
+
+    if (nextDueMillis != UINT64_MAX)
+    {
+        deviceStorageCommitScheduleTaskNoLock(&commitTask, nextDueMillis, commitTaskFunc);
+    }
+
+    return taken;
+}
+
+/**
+ * Put a write that failed back in the queue, unless a newer write of its key was queued meanwhile.
+ * Assumes caller owns pendingMtx.
+ *
+ * @param pending the failed write, ownership is taken
+ */
+static void requeueWriteNoLock(PendingWrite *pending)
+{
+    uint16_t idLen = (uint16_t) (strlen(pending->id) + 1);
+
+    if (pendingWrites == NULL || hashMapContains(pendingWrites, pending->id, idLen))
+    {
+        freePendingWrite(pending);
+        return;
+    }
+
+    pending->dueMillis = getMonotonicMillis() + groupWindowMillis;
+    hashMapPut(pendingWrites, pending->id, idLen, pending);
+    deviceStorageCommitScheduleTaskNoLock(&commitTask, pending->dueMillis, commitTaskFunc);
+}
+
+/**
+ * Write out pending writes as one group.  Assumes caller does not own commitMtx or pendingMtx.
+ *
+ * @param namespace the namespace, or NULL for any
+ * @param key the key, or NULL for any
+ * @param dueOnly only write out writes whose window has passed
+ * @return false if any write failed.  Failed writes stay pending, failed deletes are dropped.
+ */
+static bool commitPending(const char *namespace, const char *key, bool dueOnly)
+{
+    bool ok = true;
+
+    pthread_mutex_lock(&commitMtx);
+
+    pthread_mutex_lock(&pendingMtx);
+    icLinkedList *batch = takePendingNoLock(namespace, key, dueOnly);
+    pthread_mutex_unlock(&pendingMtx);
+
+    uint16_t written = linkedListCount(batch);
+    icLinkedList *failed = linkedListCreate();
+
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(batch);
+    while (linkedListIteratorHasNext(iter))
+    {
+        PendingWrite *pending = linkedListIteratorGetNext(iter);
+        if (writeToStorage(pending->namespace, pending->key, pending->value))
+        {
+            freePendingWrite(pending);
+        }
+        else if (pending->value == NULL)
+        {
+            // Most likely the key was never written
+            icWarn("unable to delete %s", pending->id);
+            freePendingWrite(pending);
+        }
+        else
+        {
+            icError("unable to write %s, will retry", pending->id);
+            linkedListAppend(failed, pending);
+            ok = false;
+        }
+    }
+    linkedListDestroy(batch, standardDoNotFreeFunc);
+
+    pthread_mutex_lock(&pendingMtx);
+    if (written > 0)
+    {
+        commitStats.groupCommits++;
+    }
+    while (linkedListCount(failed) > 0)
+    {
+        requeueWriteNoLock(linkedListRemove(failed, 0));
+    }
+    pthread_mutex_unlock(&pendingMtx);
+    linkedListDestroy(failed, standardDoNotFreeFunc);
+
+    pthread_mutex_unlock(&commitMtx);
+
+    if (written > 0)
+    {
+        icDebug("committed %" PRIu16 " writes", written);
+    }
+
+    return ok;
+}
+
+static void commitTaskFunc(void *arg)
+{
+    (void) arg;
+
+    pthread_mutex_lock(&pendingMtx);
+    commitTask.handle = 0;
+    pthread_mutex_unlock(&pendingMtx);
+
+    commitPending(NULL, NULL, true);
+}
+
+/**
+ * Save a value or delete a key, following the durability class of the namespace.
+ *
+ * @param namespace the storage namespace
+ * @param key the storage key
+ * @param value the value, or NULL to delete the key
+ * @return true if storage was changed or the change was queued
+ */
+static bool submitWrite(const char *namespace, const char *key, const char *value)
+{
+    pthread_mutex_lock(&pendingMtx);
+    StorageDurability durability = getDurabilityNoLock(namespace);
+    if (durability != STORAGE_DURABILITY_IMMEDIATE)
+    {
+        queueWriteNoLock(namespace,
+                         key,
+                         value,
+                         durability == STORAGE_DURABILITY_RELAXED ? relaxedWindowMillis : groupWindowMillis);
+        pthread_mutex_unlock(&pendingMtx);
+        return true;
+    }
+    pthread_mutex_unlock(&pendingMtx);
+
+    pthread_mutex_lock(&commitMtx);
+
+    // A write queued before the namespace became immediate is older than this one
+    pthread_mutex_lock(&pendingMtx);
+    icLinkedList *superseded = takePendingNoLock(namespace, key, false);
+    commitStats.coalescedWrites += linkedListCount(superseded);
+    pthread_mutex_unlock(&pendingMtx);
+    linkedListDestroy(superseded, (linkedListItemFreeFunc) freePendingWrite);
+
+    bool ok = writeToStorage(namespace, key, value);
+
+    pthread_mutex_unlock(&commitMtx);
+
+    return ok;
+}
+
+void deviceStorageCommitSetWindows(uint32_t groupMillis, uint32_t relaxedMillis)
+{
+    pthread_mutex_lock(&pendingMtx);
+    groupWindowMillis = groupMillis;
+    relaxedWindowMillis = relaxedMillis < groupMillis ? groupMillis : relaxedMillis;
+    pthread_mutex_unlock(&pendingMtx);
+
+    icInfo("group window %" PRIu32 "ms, relaxed window %" PRIu32 "ms", groupMillis, relaxedWindowMillis);
+}
+
+void deviceStorageCommitSetDurability(const char *namespace, StorageDurability durability)
+{
+    if (namespace == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pendingMtx);
+    if (durabilities == NULL)
+    {
+        durabilities = hashMapCreate();
+    }
+
+    uint16_t namespaceLen = (uint16_t) (strlen(namespace) + 1);
+    hashMapDelete(durabilities, (void *) namespace, namespaceLen, freeDurabilitiesItem);
+    if (durability != STORAGE_DURABILITY_IMMEDIATE)
+    {
+        StorageDurability *value = malloc(sizeof(StorageDurability));
+        *value = durability;
+        hashMapPut(durabilities, strdup(namespace), namespaceLen, value);
+    }
+    pthread_mutex_unlock(&pendingMtx);
+
+    if (durability == STORAGE_DURABILITY_IMMEDIATE)
+    {
+        commitPending(namespace, NULL, false);
+    }
+}
+
+bool deviceStorageCommitSave(const char *namespace, const char *key, const char *value)
+{
+    if (namespace == NULL || key == NULL || value == NULL)
+    {
+        return false;
+    }
+
+    return submitWrite(namespace, key, value);
+}
+
+bool deviceStorageCommitDelete(const char *namespace, const char *key)
+{
+    if (namespace == NULL || key == NULL)
+    {
+        return false;
+    }
+
+    return submitWrite(namespace, key, NULL);
+}
+
+bool deviceStorageCommitSettle(const char *namespace, const char *key)
+{
+    if (namespace == NULL || key == NULL)
+    {
+        return false;
+    }
+
+    return commitPending(namespace, key, false);
+}
+
+bool deviceStorageCommitFlush(const char *namespace)
+{
+    return commitPending(namespace, NULL, false);
+}
+
+void deviceStorageCommitDiscard(const char *namespace)
+{
+    if (namespace == NULL)
+    {
+        return;
+    }
+
+    // Wait for a commit in progress, its writes can't be taken back either
+    pthread_mutex_lock(&commitMtx);
+    pthread_mutex_lock(&pendingMtx);
+    icLinkedList *discarded = takePendingNoLock(namespace, NULL, false);
+    pthread_mutex_unlock(&pendingMtx);
+    pthread_mutex_unlock(&commitMtx);
+
+    if (linkedListCount(discarded) > 0)
+    {
+        icInfo("discarded %" PRIu16 " pending writes to %s", linkedListCount(discarded), namespace);
+    }
+    linkedListDestroy(discarded, (linkedListItemFreeFunc) freePendingWrite);
+}
+
+void deviceStorageCommitGetStats(DeviceStorageCommitStats *stats)
+{
+    if (stats == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pendingMtx);
+    *stats = commitStats;
+    stats->pendingWrites = pendingWrites != NULL ? hashMapCount(pendingWrites) : 0;
+
+    uint64_t second = getMonotonicMillis() / 1000;
+    stats->syncsLastMinute = 0;
+    for (uint32_t i = 0; i < SYNC_RATE_BUCKETS; i++)
+    {
+        if (syncBuckets[i] > 0 && syncBucketSeconds[i] + SYNC_RATE_BUCKETS > second)
+        {
+            stats->syncsLastMinute += syncBuckets[i];
+        }
+    }
+    pthread_mutex_unlock(&pendingMtx);
+}
+
+void deviceStorageCommitScheduleTaskNoLock(StorageCommitTask *task, uint64_t deadlineMillis, taskCallbackFunc func)
+{
+    uint64_t now = getMonotonicMillis();
+    uint64_t delayMillis = deadlineMillis > now ? deadlineMillis - now : 0;
+
+    if (task->handle == 0)
+    {
+        task->handle = scheduleDelayTask(delayMillis, DELAY_MILLIS, func, NULL);
+        task->deadlineMillis = deadlineMillis;
+    }
+    else if (deadlineMillis < task->deadlineMillis)
+    {
+        // If the task already fired it is waiting for the caller's lock, and will see this work once it gets it
+        rescheduleDelayTask(task->handle, delayMillis, DELAY_MILLIS);
+        task->deadlineMillis = deadlineMillis;
+    }
+}
+
+void deviceStorageCommitShutdown(void)
+{
+    if (!commitPending(NULL, NULL, false))
+    {
+        icError("some writes could not be committed");
+    }
+
+    pthread_mutex_lock(&pendingMtx);
+    uint32_t task = commitTask.handle;
+    commitTask.handle = 0;
+    hashMapDestroy(pendingWrites, freePendingWritesItem);
+    pendingWrites = NULL;
+    pthread_mutex_unlock(&pendingMtx);
+
+    // The task takes pendingMtx, so it must not be cancelled while holding it
+    if (task != 0)
+    {
+        cancelDelayTask(task);
+    }
+}
@@ -0,0 +1,148 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+/*
+ * Group commit in front of storage.  Writes to namespaces with a grouped or relaxed durability class
+ * are held for a commit window, so a key rewritten several times in that window reaches storage (and
+ * its sync) only once, and everything that is due is written together.  Namespaces default to
+ * immediate durability, which writes through to storage before returning like storageSave does.
+ *
+ * Byte and sync counters are kept for every write so flash wear can be budgeted.  Storage syncs each
+ * file it writes or deletes, so every storage operation counts as one sync.
+ */
+
+#pragma once
+
+#include <icConcurrent/delayedTask.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum
+{
+    STORAGE_DURABILITY_IMMEDIATE, // written to storage before the call returns
+    STORAGE_DURABILITY_GROUPED,   // written with the next group commit
+    STORAGE_DURABILITY_RELAXED    // written once the relaxed window has passed, or on flush
+} StorageDurability;
+
+typedef struct
+{
+    uint64_t writes;          // storage writes and deletes performed
+    uint64_t bytesWritten;    // value bytes handed to storage
+    uint64_t syncs;           // syncs caused by the writes and deletes
+    uint32_t syncsLastMinute; // syncs in the last 60 seconds
+    uint64_t coalescedWrites; // writes replaced by a newer write before they reached storage
+    uint64_t groupCommits;    // group commits that wrote at least one key
+    uint32_t pendingWrites;   // writes waiting for a group commit
+} DeviceStorageCommitStats;
+
+typedef struct
+{
+    uint32_t handle;         // the scheduled delayed task, 0 if none
+    uint64_t deadlineMillis; // the monotonic time the task is due
+} StorageCommitTask;
+
+/**
+ * Set the commit windows.  A grouped write reaches storage at most groupWindowMillis after it was
+ * made, a relaxed one at most relaxedWindowMillis after.  Pending writes keep their deadlines.
+ *
+ * @param groupWindowMillis the grouped durability window
+ * @param relaxedWindowMillis the relaxed durability window, raised to groupWindowMillis if lower
+ */
+void deviceStorageCommitSetWindows(uint32_t groupWindowMillis, uint32_t relaxedWindowMillis);
+
+/**
+ * Set the durability class of a namespace.  Pending writes of the namespace are committed first when
+ * it becomes immediate.
+ *
+ * @param namespace the storage namespace
+ * @param durability the durability class
+ */
+void deviceStorageCommitSetDurability(const char *namespace, StorageDurability durability);
+
+/**
+ * Save a value, following the durability class of the namespace.
+ *
+ * @param namespace the storage namespace
+ * @param key the storage key
+ * @param value the value to save
+ * @return true if the value was saved or queued for the next group commit
+ */
+bool deviceStorageCommitSave(const char *namespace, const char *key, const char *value);
+
+/**
+ * Delete a key, following the durability class of the namespace.  Any pending write of the key is
+ * dropped.
+ *
+ * @param namespace the storage namespace
+ * @param key the storage key
+ * @return true if the key was deleted or the delete was queued for the next group commit
+ */
+bool deviceStorageCommitDelete(const char *namespace, const char *key);
+
+/**
+ * Write out the pending write of a key, if any, so storage can be read directly.
+ *
+ * @param namespace the storage namespace
+ * @param key the storage key
+ * @return false if the pending write failed
+ */
+bool deviceStorageCommitSettle(const char *namespace, const char *key);
+
+/**
+ * Write out every pending write of a namespace.
+ *
+ * @param namespace the storage namespace, or NULL for all of them
+ * @return false if any pending write failed.  Failed writes stay pending.
+ */
+bool deviceStorageCommitFlush(const char *namespace);
+
+/**
+ * Drop every pending write of a namespace without writing it, e.g. when the namespace is replaced.
+ *
+ * @param namespace the storage namespace
+ */
+void deviceStorageCommitDiscard(const char *namespace);
+
+/**
+ * Get the storage write counters.
+ *
+ * @param stats receives the counters
+ */
+void deviceStorageCommitGetStats(DeviceStorageCommitStats *stats);
+
+/**
+ * Make sure a commit task runs by the given time.  A task that is already scheduled is moved up
+ * rather than replaced, so there is never more than one.  The task must write out whatever is due
+ * when it runs and call this again for the rest, and must clear the handle under the same lock.
+ * Assumes caller owns the lock guarding the task.
+ *
+ * @param task the task
+ * @param deadlineMillis the monotonic time the task must run by
+ * @param func the task function
+ */
+void deviceStorageCommitScheduleTaskNoLock(StorageCommitTask *task, uint64_t deadlineMillis, taskCallbackFunc func);
+
+/**
+ * Flush every pending write and stop the commit timer.  Durability classes and counters are kept.
+ */
+void deviceStorageCommitShutdown(void);
@@ -40,6 +40,7 @@
 #include <libxml/parser.h>
 
 extern "C" {
+#include "devicePrivateProperties.h"
 #include "deviceServiceConfiguration.h"
 #include "deviceServiceProperties.h"
 #include "icUtil/fileUtils.h"
@@ -295,6 +296,11 @@ bool Matter::Init(uint64_t accountId, std::string &&attestationTrustStorePath, c
     }
     DeviceLayer::SetDeviceInstanceInfoProvider(&GetBartonDeviceInstanceInfoProvider());
 
+    // Session and subscription resumption writes are held back, if configured, so commissioning and reconnection
+    // storms don't turn into a flash write per message
+    storageDelegate.SetFlushInterval(b_core_property_provider_get_property_as_uint32(
+        propertyProvider, MATTER_STORAGE_FLUSH_INTERVAL_MILLIS_PROP, 0));
+
     // We assign new objects here just to guarantee that we're working with uninitialized objects
     opCertStore = std::make_unique<chip::Credentials::PersistentStorageOpCertStore>();
     err = opCertStore->Init(&storageDelegate);
@@ -506,6 +512,12 @@ bool Matter::Stop()
         stackThread->join();
     }
 
+    // Nothing touches storage anymore, write out what was held back
+    if (storageDelegate.Flush() != CHIP_NO_ERROR)
+    {
+        icError("Failed to flush Matter storage");
+    }
+
     // If/when Matter starts up again, we want to guarantee that this is uninitialized
     chip::Access::AccessControl &accessControl = chip::Access::GetAccessControl();
     accessControl.Finish();
@@ -32,6 +32,8 @@
 #include <libxml/parser.h>
 
 extern "C" {
+#include "deviceStorageCommit.h"
+#include <icConcurrent/delayedTask.h>
 #include <icConfig/storage.h>
 #include <icLog/logging.h>
 #include <icUtil/base64.h>
@@ -39,6 +41,9 @@ extern "C" {
 }
 
 #include "PersistentStorageDelegate.h"
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
 #include <cstring>
 #include <platform/KeyValueStoreManager.h>
 #include <system/SystemConfig.h>
@@ -52,6 +57,237 @@ namespace barton
 {
     // synchronous: get a byte buffer value
     CHIP_ERROR PersistentStorageDelegate::SyncGetKeyValue(const char *key, void *buffer, uint16_t &size)
+    {
+        if (key == nullptr)
+        {
+            return CHIP_ERROR_PERSISTED_STORAGE_VALUE_NOT_FOUND;
+        }
+
+        std::lock_guard<std::mutex> lock(dirtyMtx);
+
+        auto pending = dirty.find(key);
+        if (pending == dirty.end())
+        {
+            return LoadKeyValue(key, buffer, size);
+        }
+
+        if (!pending->second.has_value())
+        {
+            return CHIP_ERROR_PERSISTED_STORAGE_VALUE_NOT_FOUND;
+        }
+
+        // Same contract as the backing store: copy what fits, report if that wasn't everything
+        const std::vector<uint8_t> &value = pending->second.value();
+        uint16_t valueSize = static_cast<uint16_t>(value.size());
+        uint16_t copied = std::min(size, valueSize);
+        if (copied > 0)
+        {
+            memcpy(buffer, value.data(), copied);
+        }
+        size = copied;
+
+        return copied < valueSize ? CHIP_ERROR_BUFFER_TOO_SMALL : CHIP_NO_ERROR;
+    }
+
+    // synchronous: set a byte buffer value
+    CHIP_ERROR PersistentStorageDelegate::SyncSetKeyValue(const char *key, const void *value, uint16_t size)
+    {
+        if (key == nullptr || value == nullptr || size == 0)
+        {
+            return CHIP_ERROR_INVALID_ARGUMENT;
+        }
+
+        std::lock_guard<std::mutex> lock(dirtyMtx);
+
+        if (flushIntervalMillis > 0 && IsDeferrableKey(key))
+        {
+            const uint8_t *bytes = static_cast<const uint8_t *>(value);
+            dirty[key] = std::vector<uint8_t>(bytes, bytes + size);
+            ScheduleFlushLocked();
+            return CHIP_NO_ERROR;
+        }
+
+        // This change must not reach storage ahead of the ones held back, nor without them
+        CHIP_ERROR err = FlushLocked();
+        if (err != CHIP_NO_ERROR)
+        {
+            return err;
+        }
+
+        return StoreKeyValue(key, value, size);
+    }
+
+    // synchronous: delete a key
+    CHIP_ERROR PersistentStorageDelegate::SyncDeleteKeyValue(const char *key)
+    {
+        if (key == nullptr)
+        {
+            return CHIP_ERROR_PERSISTED_STORAGE_FAILED;
+        }
+
+        std::lock_guard<std::mutex> lock(dirtyMtx);
+
+        auto pending = dirty.find(key);
+        if (pending != dirty.end())
+        {
+            if (!pending->second.has_value())
+            {
+                return CHIP_ERROR_PERSISTED_STORAGE_VALUE_NOT_FOUND;
+            }
+
+            // The key exists, at least as a held back change, so the delete can be held back as well
+            pending->second.reset();
+            ScheduleFlushLocked();
+            return CHIP_NO_ERROR;
+        }
+
+        CHIP_ERROR err = FlushLocked();
+        if (err != CHIP_NO_ERROR)
+        {
+            return err;
+        }
+
+        return RemoveKeyValue(key);
+    }
+
+    void PersistentStorageDelegate::SetFlushInterval(uint32_t intervalMillis)
+    {
+        icInfo("flush interval %" PRIu32 "ms", intervalMillis);
+
+        {
+            std::lock_guard<std::mutex> lock(dirtyMtx);
+            flushIntervalMillis = intervalMillis;
+        }
+
+        if (intervalMillis == 0)
+        {
+            Flush();
+        }
+    }
+
+    CHIP_ERROR PersistentStorageDelegate::Flush()
+    {
+        CHIP_ERROR err;
+        uint32_t task = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(dirtyMtx);
+            err = FlushLocked();
+            if (dirty.empty())
+            {
+                task = flushTask;
+                flushTask = 0;
+            }
+        }
+
+        // The task takes dirtyMtx, so it must not be cancelled while holding it
+        if (task != 0)
+        {
+            cancelDelayTask(task);
+        }
+
+        return err;
+    }
+
+    CHIP_ERROR PersistentStorageDelegate::FlushLocked()
+    {
+        CHIP_ERROR firstErr = CHIP_NO_ERROR;
+
+        if (dirty.empty())
+        {
+            return CHIP_NO_ERROR;
+        }
+
+        size_t count = dirty.size();
+        for (auto it = dirty.begin(); it != dirty.end();)
+        {
+            CHIP_ERROR err;
+            if (it->second.has_value())
+            {
+                err = StoreKeyValue(
+                    it->first.c_str(), it->second.value().data(), static_cast<uint16_t>(it->second.value().size()));
+            }
+            else
+            {
+                err = RemoveKeyValue(it->first.c_str());
+                if (err == CHIP_ERROR_PERSISTED_STORAGE_VALUE_NOT_FOUND)
+                {
+                    // Only ever existed as a held back change
+                    err = CHIP_NO_ERROR;
+                }
+            }
+
+            if (err == CHIP_NO_ERROR)
+            {
+                it = dirty.erase(it);
+            }
+            else
+            {
+                icError("failed to flush key %s: %" CHIP_ERROR_FORMAT, it->first.c_str(), err.Format());
+                if (firstErr == CHIP_NO_ERROR)
+                {
+                    firstErr = err;
+                }
+                ++it;
+            }
+        }
+
+        icDebug("flushed %zu of %zu keys", count - dirty.size(), count);
+
+        return firstErr;
+    }
+
+    void PersistentStorageDelegate::ScheduleFlushLocked()
+    {
+        // The pending task flushes everything dirty by then, including this change
+        if (flushTask == 0)
+        {
+            flushTask = scheduleDelayTask(flushIntervalMillis, DELAY_MILLIS, FlushTaskFunc, this);
+        }
+    }
+
+    void PersistentStorageDelegate::FlushTaskFunc(void *arg)
+    {
+        auto *self = static_cast<PersistentStorageDelegate *>(arg);
+
+        std::lock_guard<std::mutex> lock(self->dirtyMtx);
+        self->flushTask = 0;
+        if (self->FlushLocked() != CHIP_NO_ERROR && self->flushIntervalMillis > 0)
+        {
+            // Try again later, failed changes are still dirty
+            self->ScheduleFlushLocked();
+        }
+    }
+
+    bool PersistentStorageDelegate::IsDeferrableKey(const char *key)
+    {
+        // Session resumption ("g/s/<id>", "g/sri", "f/<fabric>/s/<node>") and subscription resumption
+        // ("g/su/<index>", "g/sum") state.  Everything else, fabric tables, fail-safe markers and
+        // counters in particular, must be durable once the stack has been told it was stored.
+        static const char *const deferrablePrefixes[] = {"g/s/", "g/sri", "g/su/", "g/sum"};
+
+        for (const char *prefix : deferrablePrefixes)
+        {
+            if (strncmp(key, prefix, strlen(prefix)) == 0)
+            {
+                return true;
+            }
+        }
+
+        if (strncmp(key, "f/", 2) == 0)
+        {
+            const char *pos = key + 2;
+            while (isxdigit(static_cast<unsigned char>(*pos)))
+            {
+                pos++;
+            }
+            return pos > key + 2 && strncmp(pos, "/s/", 3) == 0;
+        }
+
+        return false;
+    }
+
+    CHIP_ERROR PersistentStorageDelegate::LoadKeyValue(const char *key, void *buffer, uint16_t &size)
     {
         CHIP_ERROR err = CHIP_ERROR_PERSISTED_STORAGE_VALUE_NOT_FOUND;
 
@@ -60,6 +296,7 @@ namespace barton
 #ifndef PASS_THROUGH
         scoped_generic char *storedVal = nullptr;
         scoped_generic char *scrubbedKey = scrubKey(key);
+        deviceStorageCommitSettle(STORAGE_NAMESPACE, scrubbedKey);
         if (storageLoad(STORAGE_NAMESPACE, scrubbedKey, &storedVal))
         {
             // base64 decode what was stored
@@ -107,8 +344,7 @@ namespace barton
         return err;
     }
 
-    // synchronous: set a byte buffer value
-    CHIP_ERROR PersistentStorageDelegate::SyncSetKeyValue(const char *key, const void *value, uint16_t size)
+    CHIP_ERROR PersistentStorageDelegate::StoreKeyValue(const char *key, const void *value, uint16_t size)
     {
         CHIP_ERROR err = CHIP_ERROR_PERSISTED_STORAGE_FAILED;
 
@@ -124,7 +360,7 @@ namespace barton
         if (encodedValue != nullptr)
         {
             scoped_generic char *scrubbedKey = scrubKey(key);
-            if (storageSave(STORAGE_NAMESPACE, scrubbedKey, encodedValue))
+            if (deviceStorageCommitSave(STORAGE_NAMESPACE, scrubbedKey, encodedValue))
             {
                 err = CHIP_NO_ERROR;
             }
@@ -139,8 +375,7 @@ namespace barton
         return err;
     }
 
-    // synchronous: delete a key
-    CHIP_ERROR PersistentStorageDelegate::SyncDeleteKeyValue(const char *key)
+    CHIP_ERROR PersistentStorageDelegate::RemoveKeyValue(const char *key)
     {
         CHIP_ERROR err = CHIP_ERROR_PERSISTED_STORAGE_FAILED;
 
@@ -150,7 +385,7 @@ namespace barton
         {
 #ifndef PASS_THROUGH
             scoped_generic char *scrubbedKey = scrubKey(key);
-            if (storageDelete(STORAGE_NAMESPACE, scrubbedKey))
+            if (deviceStorageCommitDelete(STORAGE_NAMESPACE, scrubbedKey))
             {
                 err = CHIP_NO_ERROR;
             }
@@ -31,11 +31,24 @@
 
 #include <lib/core/CHIPPersistentStorageDelegate.h>
 
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
 namespace barton
 {
 
     /**
      * Barton's implementation of CHIP's persistent storage.  Storing stuff in our dynamic config dir.
+     *
+     * With a flush interval set, the keys the stack rewrites constantly during commissioning and CASE
+     * (session and subscription resumption state) are kept in a dirty set and written out together
+     * at most one interval after they changed.  Every other key, including the fabric tables, is
+     * written through, after flushing the dirty set so storage never sees changes out of order.  If
+     * the dirty set can't be flushed, the write through fails with the flush error instead.
      */
     class PersistentStorageDelegate : public chip::PersistentStorageDelegate
     {
@@ -48,7 +61,40 @@ namespace barton
         CHIP_ERROR SyncSetKeyValue(const char *key, const void *value, uint16_t size) override;
         CHIP_ERROR SyncDeleteKeyValue(const char *key) override;
 
+        /**
+         * Set how long a change to a frequently written key may be held back.
+         *
+         * @param intervalMillis the flush interval, 0 to write every change through (the default)
+         */
+        void SetFlushInterval(uint32_t intervalMillis);
+
+        /**
+         * Write out every held back change and stop the flush timer.
+         *
+         * @return CHIP_NO_ERROR, or the first error.  Changes that failed stay dirty.
+         */
+        CHIP_ERROR Flush();
+
+    protected:
+        static bool IsDeferrableKey(const char *key);
+
+        // The backing store
+        virtual CHIP_ERROR LoadKeyValue(const char *key, void *buffer, uint16_t &size);
+        virtual CHIP_ERROR StoreKeyValue(const char *key, const void *value, uint16_t size);
+        virtual CHIP_ERROR RemoveKeyValue(const char *key);
+
     private:
         static char *scrubKey(const char *key); // caller must free
+        static void FlushTaskFunc(void *arg);
+
+        // These assume the caller holds dirtyMtx
+        CHIP_ERROR FlushLocked();
+        void ScheduleFlushLocked();
+
+        std::mutex dirtyMtx;
+        // Held back changes, std::nullopt for a delete
+        std::map<std::string, std::optional<std::vector<uint8_t>>> dirty;
+        uint32_t flushIntervalMillis = 0;
+        uint32_t flushTask = 0;
     };
 } // namespace barton
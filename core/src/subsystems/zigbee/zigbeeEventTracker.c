@@ -203,35 +203,29 @@ void zigbeeEventTrackerAddAttributeReportEvent(ReceivedAttributeReport *report)
     // need to look at the device type
     //
     bool shouldBail = false;
-    icDevice *physicalDevice = NULL;
 
     // now get the device class
-    physicalDevice = deviceServiceGetDevice(uuid);
-    if (physicalDevice != NULL && physicalDevice->deviceClass != NULL)
+    char *deviceClass = deviceServiceGetDeviceClass(uuid);
+    if (deviceClass != NULL)
     {
         // ignore sensor devices
         //
-        if (strcasecmp(physicalDevice->deviceClass, "sensor") == 0)
+        if (strcasecmp(deviceClass, "sensor") == 0)
         {
             shouldBail = true;
         }
-        else
-        {
-            // no longer needed
-            deviceDestroy(physicalDevice);
-        }
     }
     else
     {
         icLogError(LOG_TAG, "%s: got a bad device for attribute report", __FUNCTION__);
         shouldBail = true;
     }
+    free(deviceClass);
 
     // clean up and exit
     if (shouldBail)
     {
         free(uuid);
-        deviceDestroy(physicalDevice);
         return;
     }
 
@@ -372,13 +366,12 @@ void zigbeeEventTrackerAddClusterCommandEvent(ReceivedClusterCommand *command)
     }
 
     // Send the delay to telemetry only if its a sensor with an IAS Zone status change.
-    icDevice *physicalDevice = NULL;
-    physicalDevice = deviceServiceGetDevice(uuid);
-    if (physicalDevice != NULL && physicalDevice->deviceClass != NULL)
+    char *deviceClass = deviceServiceGetDeviceClass(uuid);
+    if (deviceClass != NULL)
     {
         if ((command->clusterId == IAS_ZONE_CLUSTER_ID &&
              command->commandId == IAS_ZONE_STATUS_CHANGE_NOTIFICATION_COMMAND_ID) &&
-            (strcasecmp(physicalDevice->deviceClass, SENSOR_DC) == 0))
+            (strcasecmp(deviceClass, SENSOR_DC) == 0))
         {
             IASZoneStatusChangedNotification payload;
             if ((iasZoneClusterExtract(&payload, command) == true) && (payload.delayQS > 0))
@@ -388,7 +381,7 @@ void zigbeeEventTrackerAddClusterCommandEvent(ReceivedClusterCommand *command)
         }
     }
     // cleanup
-    deviceDestroy(physicalDevice);
+    free(deviceClass);
     free(uuid);
 }
 
@@ -91,6 +91,9 @@
 #define ZIGBEE_HEALTH_CHECK_PROPS_PREFIX                   "cpe.zigbee.healthCheck"
 #define ZIGBEE_DEFENDER_PROPS_PREFIX                       "cpe.zigbee.defender"
 #define ZIGBEE_WATCHDOG_ENABLED_PROP                       "cpe.zigbee.watchdog.enabled.flag"
+#define ZIGBEE_CORE_PERSISTENT_CONNECTION_PROP             "cpe.zigbee.ipc.persistentConnection.flag"
+#define ZIGBEE_ROUTER_REQUEST_WINDOW_PROP                  "cpe.zigbee.ipc.routerRequestWindow"
+#define ZIGBEE_CORE_BINARY_EVENTS_PROP                     "cpe.zigbee.ipc.binaryEvents.flag"
 #define ZIGBEE_LINK_QUALITY_PROPS_PREFIX                   "cpe.zigbee.linkQuality"
 #define ZIGBEE_LINK_QUALITY_LQI_ENABLED_PROP               ZIGBEE_LINK_QUALITY_PROPS_PREFIX ".lqi.enabled"
 #define ZIGBEE_LINK_QUALITY_LQI_WARN_THRESHOLD_PROP        ZIGBEE_LINK_QUALITY_PROPS_PREFIX ".lqi.warnThreshold"
@@ -166,6 +169,8 @@
 
 #define COMM_FAIL_POLL_THREAD_SLEEP_TIME_SECONDS           (60 * 60)
 
+#define DEFAULT_ROUTER_REQUEST_WINDOW                      4
+
 static ZigbeeWatchdogDelegate *watchdogDelegate;
 static pthread_mutex_t watchdogDelegateMtx = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;
 
@@ -555,6 +560,10 @@ static bool zigbeeSubsystemInitialize(subsystemInitializedFunc initializedCallba
     memset(&callbacks, 0, sizeof(callbacks));
     zigbeeEventHandlerInit(&callbacks);
 
+    g_autoptr(BCorePropertyProvider) propertyProvider = deviceServiceConfigurationGetPropertyProvider();
+    zhalSetPersistentConnection(
+        b_core_property_provider_get_property_as_bool(propertyProvider, ZIGBEE_CORE_PERSISTENT_CONNECTION_PROP, false));
+
     zhalInit(ip, portNum, &callbacks, NULL, responseHandler);
 
     // wait here until ZigbeeCore is functional or we time out
@@ -804,6 +813,14 @@ static bool initializeNetwork(void)
         {
             incrementNetworkCountersIfRequired();
 
+            // ZigbeeCore forgets the event format when it restarts, so ask again after every network init
+            bool binaryEvents =
+                b_core_property_provider_get_property_as_bool(propertyProvider, ZIGBEE_CORE_BINARY_EVENTS_PROP, false);
+            if (binaryEvents == true && zhalSetBinaryEvents(true) == false)
+            {
+                icLogInfo(LOG_TAG, "ZigbeeCore did not accept binary events, they will stay JSON");
+            }
+
             zigbeeSubsystemSetReady();
 
             result = true;
@@ -992,12 +1009,37 @@ void zigbeeSubsystemHandleZhalStartupEvent(void)
     zigbeeCoreMonitorTickle();
 }
 
+/*
+ * Let mains powered routers have several requests in flight so their discovery and configuration go faster.
+ * Everything else keeps one request at a time, since end devices may only poll for their messages now and then.
+ */
+static void configureDeviceRequestWindow(uint64_t eui64, zhalDeviceType deviceType, zhalPowerSource powerSource)
+{
+    uint8_t window = 1;
+
+    if (deviceType == deviceTypeRouter && powerSource == powerSourceMains)
+    {
+        g_autoptr(BCorePropertyProvider) propertyProvider = deviceServiceConfigurationGetPropertyProvider();
+        window = b_core_property_provider_get_property_as_uint8(
+            propertyProvider, ZIGBEE_ROUTER_REQUEST_WINDOW_PROP, DEFAULT_ROUTER_REQUEST_WINDOW);
+        if (window == 0 || window > ZHAL_MAX_REQUEST_WINDOW)
+        {
+            icLogWarn(LOG_TAG, "%s: ignoring invalid router request window %" PRIu8, __func__, window);
+            window = DEFAULT_ROUTER_REQUEST_WINDOW;
+        }
+    }
+
+    zhalSetDeviceRequestWindow(eui64, window);
+}
+
 void zigbeeSubsystemDeviceDiscovered(IcDiscoveredDeviceDetails *details)
 {
     icLogDebug(LOG_TAG, "%s", __FUNCTION__);
 
     zigbeeSubsystemDumpDeviceDiscovered(details);
 
+    configureDeviceRequestWindow(details->eui64, details->deviceType, details->powerSource);
+
     // Mark this device as being in discovery, so we know not to reject commands from it
     pthread_mutex_lock(&devicesInDiscoverMtx);
     if (devicesInDiscovery == NULL)
@@ -1060,13 +1102,7 @@ static bool deviceShouldBeRejected(uint64_t eui64, bool *discovering)
     }
 
     // First check if we are rejecting these devices is enabled.  If the property isn't there we assume its enabled
-    bool rejectEnabled = true;
-    char *value;
-    if (deviceServiceGetSystemProperty(ZIGBEE_REJECT_UNKNOWN_DEVICES, &value) == true)
-    {
-        rejectEnabled = (value != NULL && stringCompare(value, "true", true) == 0);
-        free(value);
-    }
+    bool rejectEnabled = deviceServiceGetSystemPropertyBool(ZIGBEE_REJECT_UNKNOWN_DEVICES, true);
 
     if (rejectEnabled == true)
     {
@@ -4081,6 +4117,10 @@ void zigbeeSubsystemHandlePropertyChange(const char *prop, const char *value)
     {
         zigbeeLinkQualityConfigure();
     }
+    else if (stringCompare(prop, ZIGBEE_CORE_BINARY_EVENTS_PROP, false) == 0)
+    {
+        zhalSetBinaryEvents(stringToBool(value));
+    }
     else if (stringStartsWith(prop, ZIGBEE_PROPS_PREFIX, false) == true)
     {
         // pass all other properties down to the stack, chopping the prefix off.
@@ -4637,6 +4677,8 @@ bool zigbeeSubsystemRequestDeviceLeave(uint64_t eui64, bool withRejoin, bool isE
  */
 void zigbeeSubsystemDeviceAnnounced(uint64_t eui64, zhalDeviceType deviceType, zhalPowerSource powerSource)
 {
+    configureDeviceRequestWindow(eui64, deviceType, powerSource);
+
     DeviceAnnouncedContext ctx = {.eui64 = eui64, .deviceType = deviceType, .powerSource = powerSource};
     threadSafeWrapperReadItem(&deviceCallbacksWrapper, deviceCallbacksDeviceAnnounced, &ctx);
 }
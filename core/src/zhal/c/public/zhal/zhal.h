@@ -44,6 +44,8 @@ extern "C" {
 #define REPORTING_INTERVAL_MAX               0xFFFE
 #define REPORTING_INTERVAL_TWENTY_SEVEN_MINS 0x654
 
+#define ZHAL_MAX_REQUEST_WINDOW              16
+
 typedef int ZHAL_STATUS;
 
 #define PRIzHAL                              "d"
@@ -342,6 +344,27 @@ typedef void (*zhalResponseHandler)(const char *responseType, ZHAL_STATUS result
  */
 int zhalInit(const char *host, int port, zhalCallbacks *callbacks, void *callbackContext, zhalResponseHandler handler);
 
+/*
+ * Choose how requests reach the zigbee service.  When enabled, requests share one persistent connection and
+ * are matched to their acknowledgements by request id.  When disabled, the default, each request opens its own
+ * connection.  A request whose persistent connection cannot be established is sent on its own connection.
+ * Takes effect at the next zhalInit.
+ *
+ * @param enabled true to use a persistent connection
+ */
+void zhalSetPersistentConnection(bool enabled);
+
+/*
+ * Set how many requests to a device may await their responses from the zigbee service at once.  Reads, bindings
+ * and reporting configuration for the same endpoint and cluster still complete in the order they were sent, and
+ * any other request waits for everything sent to the device before it.  Devices start with a window of 1.
+ *
+ * @param eui64 the device
+ * @param window 1 to ZHAL_MAX_REQUEST_WINDOW, use 1 for sleepy end devices
+ * @return 0 on success
+ */
+int zhalSetDeviceRequestWindow(uint64_t eui64, uint8_t window);
+
 /*
  * Initialize the zigbee network using the provided EUI64 and the blob of previously stored
  * opaque network configuration data.
@@ -884,6 +907,17 @@ bool zhalDefenderConfigure(uint8_t panIdChangeThreshold,
  */
 bool zhalSetProperty(const char *key, const char *value);
 
+/**
+ * Ask the zigbee service to send attribute reports and received cluster commands in a compact binary encoding
+ * instead of JSON, or to go back to JSON.  Events in either encoding are always accepted, so a zigbee service that
+ * does not support the binary encoding simply keeps sending JSON.  The setting does not survive a restart of the
+ * zigbee service.
+ *
+ * @param enabled true for the binary encoding
+ * @return true if the zigbee service accepted the setting
+ */
+bool zhalSetBinaryEvents(bool enabled);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
@@ -25,6 +25,7 @@
  */
 
 #include "zhalAsyncReceiver.h"
+#include "zhalDispatcher.h"
 #include "zhalPrivate.h"
 #include <arpa/inet.h>
 #include <cjson/cJSON.h>
@@ -32,6 +33,7 @@
 #include <icConcurrent/timedWait.h>
 #include <icLog/logging.h>
 #include <icUtil/stringUtils.h>
+#include <inttypes.h>
 #include <netinet/in.h>
 #include <pthread.h>
 #include <string.h>
@@ -44,29 +46,41 @@
 #define ASYNC_RECVBUF_SIZE         (64 * 1024)
 #define STOP_WAIT_MILLIS           (250L)
 
+// events are handled by a fixed pool, in arrival order per device
+#define EVENT_DISPATCH_THREADS          4
+#define EVENT_DISPATCH_QUEUE_LIMIT      512
+#define EVENT_DISPATCH_FULL_WAIT_MILLIS 50
+
 static pthread_t asyncThread;
 static void *asyncReceiverThreadProc(void *);
 static bool asyncReceiverThreadRunning = false;
 
 static zhalIpcResponseHandler myIpcHandler = NULL;
 static zhalEventHandler myEventHandler = NULL;
+static zhalBinaryEventHandler myBinaryEventHandler = NULL;
 static int pipeFDs[2] = {-1, -1};
 static pthread_mutex_t STARTUP_MTX = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t STARTUP_COND = PTHREAD_COND_INITIALIZER;
 
-static void *invokeIpcHandlerCallback(void *arg);
-static void *invokeEventHandlerCallback(void *arg);
+static ZhalDispatcher *eventDispatcher = NULL;
 
 // the host name of the event producer
 static char *eventProducerHostname = NULL;
 
-int zhalAsyncReceiverStart(const char *host, zhalIpcResponseHandler ipcHandler, zhalEventHandler eventHandler)
+int zhalAsyncReceiverStart(const char *host,
+                           zhalIpcResponseHandler ipcHandler,
+                           zhalEventHandler eventHandler,
+                           zhalBinaryEventHandler binaryEventHandler)
 {
     myIpcHandler = ipcHandler;
     myEventHandler = eventHandler;
+    myBinaryEventHandler = binaryEventHandler;
 
     pipe(pipeFDs);
 
+    eventDispatcher = zhalDispatcherCreate(
+        "zhalEventWorker", EVENT_DISPATCH_THREADS, EVENT_DISPATCH_QUEUE_LIMIT, EVENT_DISPATCH_FULL_WAIT_MILLIS);
+
     initTimedWaitCond(&STARTUP_COND);
 
     pthread_mutex_lock(&STARTUP_MTX);
@@ -121,6 +135,25 @@ int zhalAsyncReceiverStop()
         pthread_join(asyncThread, NULL);
     }
 
+    pthread_mutex_lock(&STARTUP_MTX);
+    ZhalDispatcher *dispatcher = eventDispatcher;
+    eventDispatcher = NULL;
+    pthread_mutex_unlock(&STARTUP_MTX);
+
+    if (dispatcher != NULL)
+    {
+        ZhalDispatcherStats stats;
+        zhalDispatcherGetStats(dispatcher, &stats);
+        icLogInfo(LOG_TAG,
+                  "async events dispatched=%" PRIu64 ", delayed=%" PRIu64 ", dropped=%" PRIu64 ", maxQueued=%" PRIu32,
+                  stats.dispatched,
+                  stats.delayed,
+                  stats.dropped,
+                  stats.maxQueued);
+
+        zhalDispatcherDestroy(dispatcher);
+    }
+
     // Cleanup the pipe
     if (pipeFDs[0] >= 0)
     {
@@ -136,6 +169,70 @@ int zhalAsyncReceiverStop()
     return 0;
 }
 
+void zhalAsyncReceiverGetStats(ZhalDispatcherStats *stats)
+{
+    if (stats == NULL)
+    {
+        return;
+    }
+
+    memset(stats, 0, sizeof(ZhalDispatcherStats));
+
+    pthread_mutex_lock(&STARTUP_MTX);
+    if (eventDispatcher != NULL)
+    {
+        zhalDispatcherGetStats(eventDispatcher, stats);
+    }
+    pthread_mutex_unlock(&STARTUP_MTX);
+}
+
+/*
+ * Events about a device are handled in the order they arrived, anything else needs no ordering
+ */
+static uint64_t getEventOrderKey(cJSON *event)
+{
+    uint64_t eui64 = ZHAL_DISPATCH_UNORDERED;
+
+    cJSON *eui64Json = cJSON_GetObjectItem(event, "eui64");
+    if (cJSON_IsString(eui64Json) == false ||
+        stringToUnsignedNumberWithinRange(eui64Json->valuestring, &eui64, 16, 0, UINT64_MAX) == false)
+    {
+        eui64 = ZHAL_DISPATCH_UNORDERED;
+    }
+
+    return eui64;
+}
+
+static int invokeBinaryEventHandler(void *payload)
+{
+    return myBinaryEventHandler((ZhalBinaryEvent *) payload);
+}
+
+static void destroyBinaryEvent(void *payload)
+{
+    zhalBinaryEventDestroy((ZhalBinaryEvent *) payload);
+}
+
+/*
+ * Binary events are decoded straight into the report or command they carry, skipping the JSON parse and the
+ * base64 and eui64 string decoding
+ */
+static void receiveBinaryEvent(const uint8_t *buf, size_t len)
+{
+    if (myBinaryEventHandler == NULL)
+    {
+        return;
+    }
+
+    ZhalBinaryEvent *event = zhalBinaryEventDecode(buf, len);
+    if (event != NULL &&
+        zhalDispatcherSubmitPayload(
+            eventDispatcher, event->eui64, invokeBinaryEventHandler, event, destroyBinaryEvent) == false)
+    {
+        zhalBinaryEventDestroy(event);
+    }
+}
+
 static int setupAsyncSocket()
 {
     // create the UDP multicast socket
@@ -250,7 +347,12 @@ static void *asyncReceiverThreadProc(void *arg)
          * Only handle packets sent from our local loopback. Any other
          * packets might be destructive so audit log those packets.
          */
-        if (remoteAddr.sin_addr.s_addr == htonl(INADDR_LOOPBACK))
+        if (remoteAddr.sin_addr.s_addr == htonl(INADDR_LOOPBACK) &&
+            zhalBinaryEventIsFrame((const uint8_t *) recvBuf, nbytes) == true)
+        {
+            receiveBinaryEvent((const uint8_t *) recvBuf, nbytes);
+        }
+        else if (remoteAddr.sin_addr.s_addr == htonl(INADDR_LOOPBACK))
         {
             cJSON *asyncJson = cJSON_Parse(recvBuf);
             if (asyncJson == NULL)
@@ -264,18 +366,20 @@ static void *asyncReceiverThreadProc(void *arg)
             {
                 if (strcmp("ipcResponse", eventType->valuestring) == 0)
                 {
-                    if (myIpcHandler != NULL)
+                    // Handled right here rather than in the event pool, since event handlers may be blocked in
+                    // requests waiting on exactly these responses.  The handler only hands the response to its waiter.
+                    if (myIpcHandler != NULL && myIpcHandler(asyncJson) != 0)
                     {
-                        createDetachedThread(invokeIpcHandlerCallback, asyncJson, "zhalIPCWorker");
-                        asyncJson = NULL; // the thread will clean up
+                        asyncJson = NULL; // the handler will clean up
                     }
                 }
                 else
                 {
-                    if (myEventHandler != NULL)
+                    uint64_t orderKey = getEventOrderKey(asyncJson);
+                    if (myEventHandler != NULL &&
+                        zhalDispatcherSubmit(eventDispatcher, orderKey, myEventHandler, asyncJson) == true)
                     {
-                        createDetachedThread(invokeEventHandlerCallback, asyncJson, "zhalEventWorker");
-                        asyncJson = NULL; // the thread will clean up
+                        asyncJson = NULL; // the dispatcher will clean up
                     }
                 }
             }
@@ -301,25 +405,3 @@ static void *asyncReceiverThreadProc(void *arg)
     icLogInfo(LOG_TAG, "asyncReceiverThreadProc exiting");
     return NULL;
 }
-
-static void *invokeIpcHandlerCallback(void *arg)
-{
-    cJSON *json = (cJSON *) arg;
-    if (myIpcHandler(json) == 0)
-    {
-        // it was not handled, so we have to free it here
-        cJSON_Delete(json);
-    }
-    return NULL;
-}
-
-static void *invokeEventHandlerCallback(void *arg)
-{
-    cJSON *json = (cJSON *) arg;
-    if (myEventHandler(json) == 0)
-    {
-        // it was not handled, so we have to free it here
-        cJSON_Delete(json);
-    }
-    return NULL;
-}
@@ -27,13 +27,31 @@
 #ifndef FLEXCORE_ZHALASYNCRECEIVER_H
 #define FLEXCORE_ZHALASYNCRECEIVER_H
 
+#include "zhalBinaryEvent.h"
+#include "zhalDispatcher.h"
 #include <cjson/cJSON.h>
 
-// These handlers should return non-zero values to indicate that they will handle the payload argument's lifecycle
+// These handlers should return non-zero values to indicate that they will handle the payload argument's lifecycle.
+// The ipc response handler is called on the receiving thread and must not block.
 typedef int (*zhalIpcResponseHandler)(cJSON *response);
 typedef int (*zhalEventHandler)(cJSON *event);
+typedef int (*zhalBinaryEventHandler)(ZhalBinaryEvent *event);
 
-int zhalAsyncReceiverStart(const char *host, zhalIpcResponseHandler ipcHandler, zhalEventHandler eventHandler);
+/**
+ * Start receiving async events.  Events may arrive as JSON or, once ZigbeeCore has been asked for it, in the binary
+ * encoding; each goes to the matching handler.
+ */
+int zhalAsyncReceiverStart(const char *host,
+                           zhalIpcResponseHandler ipcHandler,
+                           zhalEventHandler eventHandler,
+                           zhalBinaryEventHandler binaryEventHandler);
 int zhalAsyncReceiverStop();
 
+/**
+ * Get a snapshot of the counters of the pool that hands async events to their handlers.
+ *
+ * @param stats receives the counters, all zero while the receiver is stopped
+ */
+void zhalAsyncReceiverGetStats(ZhalDispatcherStats *stats);
+
 #endif // FLEXCORE_ZHALASYNCRECEIVER_H
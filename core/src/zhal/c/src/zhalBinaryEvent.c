@@ -0,0 +1,162 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include "zhalBinaryEvent.h"
+#include "zhalPrivate.h"
+#include <icLog/logging.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint16_t readUint16(const uint8_t *buf)
+{
+    return (uint16_t) (buf[0] | (buf[1] << 8));
+}
+
+static uint64_t readUint64(const uint8_t *buf)
+{
+    uint64_t result = 0;
+
+    for (int i = 7; i >= 0; i--)
+    {
+        result = (result << 8) | buf[i];
+    }
+
+    return result;
+}
+
+/*
+ * Copy the payload into its own allocation, since reports and commands own their data.  An empty payload is left
+ * NULL, like an empty encodedBuf.
+ */
+static uint8_t *copyPayload(const uint8_t *payload, uint16_t payloadLen)
+{
+    uint8_t *result = NULL;
+
+    if (payloadLen > 0)
+    {
+        result = malloc(payloadLen);
+        memcpy(result, payload, payloadLen);
+    }
+
+    return result;
+}
+
+bool zhalBinaryEventIsFrame(const uint8_t *buf, size_t len)
+{
+    return buf != NULL && len > 0 && buf[0] == ZHAL_BINARY_EVENT_MAGIC;
+}
+
+ZhalBinaryEvent *zhalBinaryEventDecode(const uint8_t *buf, size_t len)
+{
+    if (zhalBinaryEventIsFrame(buf, len) == false || len < ZHAL_BINARY_EVENT_HEADER_SIZE)
+    {
+        icLogWarn(LOG_TAG, "%s: truncated binary event (%zu bytes)", __func__, len);
+        return NULL;
+    }
+
+    if (buf[1] != ZHAL_BINARY_EVENT_VERSION)
+    {
+        icLogWarn(LOG_TAG, "%s: unsupported binary event version %u", __func__, buf[1]);
+        return NULL;
+    }
+
+    uint16_t payloadLen = readUint16(&buf[24]);
+    if (len != ZHAL_BINARY_EVENT_HEADER_SIZE + (size_t) payloadLen)
+    {
+        icLogWarn(LOG_TAG,
+                  "%s: binary event payload length %u does not match frame length %zu",
+                  __func__,
+                  payloadLen,
+                  len);
+        return NULL;
+    }
+
+    uint8_t flags = buf[3];
+    const uint8_t *payload = &buf[ZHAL_BINARY_EVENT_HEADER_SIZE];
+    ZhalBinaryEvent *event = calloc(1, sizeof(ZhalBinaryEvent));
+    event->type = (ZhalBinaryEventType) buf[2];
+    event->eui64 = readUint64(&buf[4]);
+
+    switch (event->type)
+    {
+        case ZHAL_BINARY_EVENT_ATTRIBUTE_REPORT:
+        {
+            ReceivedAttributeReport *report = calloc(1, sizeof(ReceivedAttributeReport));
+
+            report->eui64 = event->eui64;
+            report->sourceEndpoint = buf[12];
+            report->clusterId = readUint16(&buf[15]);
+            report->rssi = (int8_t) buf[22];
+            report->lqi = buf[23];
+            if ((flags & ZHAL_BINARY_EVENT_FLAG_HAS_MFG_CODE) != 0)
+            {
+                report->mfgId = readUint16(&buf[18]);
+            }
+            report->reportData = copyPayload(payload, payloadLen);
+            report->reportDataLen = payloadLen;
+
+            event->report = report;
+            break;
+        }
+
+        case ZHAL_BINARY_EVENT_CLUSTER_COMMAND:
+        {
+            ReceivedClusterCommand *command = calloc(1, sizeof(ReceivedClusterCommand));
+
+            command->eui64 = event->eui64;
+            command->sourceEndpoint = buf[12];
+            command->profileId = readUint16(&buf[13]);
+            command->clusterId = readUint16(&buf[15]);
+            command->commandId = buf[17];
+            command->fromServer = (flags & ZHAL_BINARY_EVENT_FLAG_FROM_SERVER) != 0;
+            command->mfgSpecific = (flags & ZHAL_BINARY_EVENT_FLAG_MFG_SPECIFIC) != 0;
+            command->mfgCode = readUint16(&buf[18]);
+            command->seqNum = buf[20];
+            command->apsSeqNum = buf[21];
+            command->rssi = (int8_t) buf[22];
+            command->lqi = buf[23];
+            command->commandData = copyPayload(payload, payloadLen);
+            command->commandDataLen = payloadLen;
+
+            event->command = command;
+            break;
+        }
+
+        default:
+            icLogWarn(LOG_TAG, "%s: unsupported binary event type %u", __func__, buf[2]);
+            free(event);
+            return NULL;
+    }
+
+    return event;
+}
+
+void zhalBinaryEventDestroy(ZhalBinaryEvent *event)
+{
+    if (event != NULL)
+    {
+        freeReceivedAttributeReport(event->report);
+        freeReceivedClusterCommand(event->command);
+        free(event);
+    }
+}
@@ -0,0 +1,107 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+/*
+ * A compact binary encoding ZigbeeCore may use instead of JSON for its highest volume events, attribute reports
+ * and received cluster commands.  Each event is one datagram on the async event port: a fixed header followed by
+ * the raw ZCL payload.  Multi-byte fields are little endian.
+ *
+ *   offset  size  field
+ *   0       1     magic, ZHAL_BINARY_EVENT_MAGIC.  A JSON event never starts with this byte.
+ *   1       1     version, ZHAL_BINARY_EVENT_VERSION
+ *   2       1     event type, a ZhalBinaryEventType
+ *   3       1     flags, ZHAL_BINARY_EVENT_FLAG_*
+ *   4       8     eui64
+ *   12      1     source endpoint
+ *   13      2     profile id (cluster commands only)
+ *   15      2     cluster id
+ *   17      1     command id (cluster commands only)
+ *   18      2     manufacturer code
+ *   20      1     ZCL sequence number (cluster commands only)
+ *   21      1     APS sequence number (cluster commands only)
+ *   22      1     rssi, signed
+ *   23      1     lqi
+ *   24      2     payload length
+ *   26      n     payload, the report's attribute records or the command's payload
+ *
+ * ZigbeeCore only sends these once asked to with zhalSetBinaryEvents.  Every other event, and every event from a
+ * ZigbeeCore that does not know the encoding, stays JSON.
+ */
+
+#ifndef FLEXCORE_ZHALBINARYEVENT_H
+#define FLEXCORE_ZHALBINARYEVENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zhal/zhal.h>
+
+#define ZHAL_BINARY_EVENT_MAGIC       0xB5
+#define ZHAL_BINARY_EVENT_VERSION     1
+#define ZHAL_BINARY_EVENT_HEADER_SIZE 26
+
+#define ZHAL_BINARY_EVENT_FLAG_FROM_SERVER  0x01
+#define ZHAL_BINARY_EVENT_FLAG_MFG_SPECIFIC 0x02
+#define ZHAL_BINARY_EVENT_FLAG_HAS_MFG_CODE 0x04
+
+typedef enum
+{
+    ZHAL_BINARY_EVENT_ATTRIBUTE_REPORT = 1,
+    ZHAL_BINARY_EVENT_CLUSTER_COMMAND = 2,
+} ZhalBinaryEventType;
+
+// Free with zhalBinaryEventDestroy()
+typedef struct
+{
+    ZhalBinaryEventType type;
+    uint64_t eui64;
+    ReceivedAttributeReport *report; // set for ZHAL_BINARY_EVENT_ATTRIBUTE_REPORT
+    ReceivedClusterCommand *command; // set for ZHAL_BINARY_EVENT_CLUSTER_COMMAND
+} ZhalBinaryEvent;
+
+/**
+ * Check whether a datagram is a binary event rather than JSON.
+ *
+ * @param buf the datagram
+ * @param len its length
+ * @return true if it starts with the binary event magic
+ */
+bool zhalBinaryEventIsFrame(const uint8_t *buf, size_t len);
+
+/**
+ * Decode a binary event.
+ *
+ * @param buf the datagram
+ * @param len its length
+ * @return the event, or NULL if the frame is malformed or of a version or type this side does not know
+ */
+ZhalBinaryEvent *zhalBinaryEventDecode(const uint8_t *buf, size_t len);
+
+/**
+ * Free an event along with the report or command it carries.
+ *
+ * @param event the event, may be NULL
+ */
+void zhalBinaryEventDestroy(ZhalBinaryEvent *event);
+
+#endif // FLEXCORE_ZHALBINARYEVENT_H
@@ -0,0 +1,578 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include "zhalChannel.h"
+#include "zhalPrivate.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <icConcurrent/threadUtils.h>
+#include <icConcurrent/timedWait.h>
+#include <icLog/logging.h>
+#include <icTypes/icLinkedList.h>
+#include <icUtil/stringUtils.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define CHANNEL_SEND_TIMEOUT_SEC 10
+#define CHANNEL_SEND_ATTEMPTS    2
+
+#ifdef MSG_NOSIGNAL
+#define CHANNEL_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define CHANNEL_SEND_FLAGS 0
+#endif
+
+#ifdef POLLRDHUP
+#define CHANNEL_CLOSED_EVENTS (POLLRDHUP | POLLHUP | POLLERR)
+#else
+#define CHANNEL_CLOSED_EVENTS (POLLHUP | POLLERR)
+#endif
+
+typedef struct
+{
+    uint32_t requestId;
+    bool hasAck;
+    bool succeeded;
+    bool streamBroken; // the stream went away before the ack arrived
+    pthread_cond_t cond;
+} PendingAck;
+
+struct ZhalChannel
+{
+    char *host;
+    int port;
+    zhalIpcResponseHandler ipcHandler;
+
+    pthread_mutex_t mtx; // guards everything below and all writes to the stream
+    pthread_cond_t readerCond;
+    pthread_cond_t connectCond;
+    int sock;
+    uint32_t generation; // bumped on each connect so a stale reader never acts on a newer stream
+    int readerCount;
+    bool connecting; // a sender is connecting with the mutex released
+    bool destroying;
+    icLinkedList *pendingAcks; // PendingAck pointers in the order their requests were written
+};
+
+typedef struct
+{
+    ZhalChannel *channel;
+    int sock;
+    uint32_t generation;
+} ReaderArgs;
+
+static void *channelReaderThreadProc(void *arg);
+
+ZhalChannel *zhalChannelCreate(const char *host, int port, zhalIpcResponseHandler ipcHandler)
+{
+    ZhalChannel *channel = calloc(1, sizeof(ZhalChannel));
+
+    channel->host = strdup(host);
+    channel->port = port;
+    channel->ipcHandler = ipcHandler;
+    channel->sock = -1;
+    channel->pendingAcks = linkedListCreate();
+    mutexInitWithType(&channel->mtx, PTHREAD_MUTEX_ERRORCHECK);
+    pthread_cond_init(&channel->readerCond, NULL);
+    pthread_cond_init(&channel->connectCond, NULL);
+
+    return channel;
+}
+
+/*
+ * Fail every request waiting on the current stream and shut it down.  The stream's reader closes the socket
+ * when it exits.
+ */
+static void breakStreamNoLock(ZhalChannel *channel)
+{
+    if (channel->sock >= 0)
+    {
+        shutdown(channel->sock, SHUT_RDWR);
+        channel->sock = -1;
+    }
+
+    scoped_icLinkedListIterator *iter = linkedListIteratorCreate(channel->pendingAcks);
+    while (linkedListIteratorHasNext(iter) == true)
+    {
+        PendingAck *pending = linkedListIteratorGetNext(iter);
+        if (pending->hasAck == false)
+        {
+            pending->hasAck = true;
+            pending->streamBroken = true;
+            pthread_cond_signal(&pending->cond);
+        }
+    }
+}
+
+void zhalChannelDestroy(ZhalChannel *channel)
+{
+    if (channel == NULL)
+    {
+        return;
+    }
+
+    mutexLock(&channel->mtx);
+    channel->destroying = true;
+    breakStreamNoLock(channel);
+    while (channel->connecting == true)
+    {
+        pthread_cond_wait(&channel->connectCond, &channel->mtx);
+    }
+    while (channel->readerCount > 0)
+    {
+        pthread_cond_wait(&channel->readerCond, &channel->mtx);
+    }
+    mutexUnlock(&channel->mtx);
+
+    linkedListDestroy(channel->pendingAcks, standardDoNotFreeFunc);
+    pthread_cond_destroy(&channel->connectCond);
+    pthread_cond_destroy(&channel->readerCond);
+    pthread_mutex_destroy(&channel->mtx);
+    free(channel->host);
+    free(channel);
+}
+
+/*
+ * Open a socket and connect it to ZigbeeCore.  Called without the mutex so other senders are not held up
+ * while the connect is in progress.
+ *
+ * @return the connected socket, or -1
+ */
+static int openChannelSocket(const char *host, int port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_aton(host, &(addr.sin_addr));
+
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+    {
+        scoped_generic char *errStr = strerrorSafe(errno);
+        icLogError(LOG_TAG, "error opening channel socket: %s", errStr);
+        return -1;
+    }
+
+#ifdef SO_NOSIGPIPE
+    int enable = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable)) != 0)
+    {
+        icLogWarn(LOG_TAG, "unable to set SO_NOSIGPIPE flag on channel socket");
+    }
+#endif
+
+    // Only writes get a timeout, the reader idles on the stream between requests
+    struct timeval timeout = {CHANNEL_SEND_TIMEOUT_SEC, 0};
+    if (setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1)
+    {
+        icLogWarn(LOG_TAG, "failed setting send timeout on channel socket");
+    }
+
+    // Frames are small and each one is waited on, so don't let them sit in the send buffer
+    int noDelay = 1;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay)) == -1)
+    {
+        icLogWarn(LOG_TAG, "failed setting TCP_NODELAY on channel socket");
+    }
+
+    if (connect(sock, (const struct sockaddr *) &addr, sizeof(addr)) == -1)
+    {
+        scoped_generic char *errStr = strerrorSafe(errno);
+        icLogWarn(LOG_TAG, "error connecting channel socket: %s", errStr);
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+/*
+ * Check whether ZigbeeCore has closed the stream without the reader having noticed yet.  A request written
+ * to such a stream is lost after it left, so it is caught here while the request can still go another way.
+ */
+static bool streamClosedByPeer(int sock)
+{
+    struct pollfd pfd = {.fd = sock, .events = CHANNEL_CLOSED_EVENTS};
+
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & CHANNEL_CLOSED_EVENTS) != 0;
+}
+
+/*
+ * Make sure the stream is connected.  Called with the mutex held; it is released while connecting.  A sender
+ * that finds a connect already in progress waits for that one instead of starting its own.
+ *
+ * @return true if the stream is connected
+ */
+static bool ensureConnectedLocked(ZhalChannel *channel)
+{
+    if (channel->sock >= 0 && streamClosedByPeer(channel->sock) == true)
+    {
+        icLogInfo(LOG_TAG, "channel to %s:%d was closed, reconnecting", channel->host, channel->port);
+        breakStreamNoLock(channel);
+    }
+
+    if (channel->connecting == true)
+    {
+        while (channel->connecting == true)
+        {
+            pthread_cond_wait(&channel->connectCond, &channel->mtx);
+        }
+
+        // whatever came of that connect is the answer for this sender too
+        return channel->sock >= 0;
+    }
+
+    if (channel->sock >= 0)
+    {
+        return true;
+    }
+
+    if (channel->destroying == true)
+    {
+        return false;
+    }
+
+    channel->connecting = true;
+    mutexUnlock(&channel->mtx);
+
+    // host and port never change after create, so they are safe to read here
+    int sock = openChannelSocket(channel->host, channel->port);
+
+    mutexLock(&channel->mtx);
+    channel->connecting = false;
+    pthread_cond_broadcast(&channel->connectCond);
+
+    if (sock < 0)
+    {
+        return false;
+    }
+
+    if (channel->destroying == true)
+    {
+        close(sock);
+        return false;
+    }
+
+    ReaderArgs *args = calloc(1, sizeof(ReaderArgs));
+    args->channel = channel;
+    args->sock = sock;
+    args->generation = ++channel->generation;
+
+    if (createDetachedThread(channelReaderThreadProc, args, "zhalChannel") == false)
+    {
+        icLogError(LOG_TAG, "failed to start channel reader");
+        free(args);
+        close(sock);
+        return false;
+    }
+
+    channel->sock = sock;
+    channel->readerCount++;
+
+    icLogDebug(LOG_TAG, "channel connected to %s:%d", channel->host, channel->port);
+
+    return true;
+}
+
+/*
+ * @param written set to the number of bytes that reached the socket, even when the write fails
+ */
+static bool sendAll(int sock, const void *buf, size_t len, size_t *written)
+{
+    const char *pos = buf;
+    *written = 0;
+    while (len > 0)
+    {
+        ssize_t sent = send(sock, pos, len, CHANNEL_SEND_FLAGS);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        pos += sent;
+        len -= (size_t) sent;
+        *written += (size_t) sent;
+    }
+
+    return true;
+}
+
+static bool recvAll(int sock, void *buf, size_t len)
+{
+    char *pos = buf;
+    while (len > 0)
+    {
+        ssize_t received = recv(sock, pos, len, 0);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            return false;
+        }
+        pos += received;
+        len -= (size_t) received;
+    }
+
+    return true;
+}
+
+/*
+ * Write one frame: the payload length, in the little endian order ZigbeeCore reads, then the payload.  Both
+ * go out in a single write so a frame is never split by the frame of another request.
+ *
+ * @param written set to the number of bytes of the frame that reached the socket, even when the write fails
+ */
+static bool writeFrame(int sock, const char *payload, size_t *written)
+{
+    size_t payloadLen = strlen(payload);
+    char *frame = malloc(sizeof(uint16_t) + payloadLen);
+    frame[0] = (char) (payloadLen & 0xff);
+    frame[1] = (char) ((payloadLen >> 8) & 0xff);
+    memcpy(frame + sizeof(uint16_t), payload, payloadLen);
+
+    bool result = sendAll(sock, frame, sizeof(uint16_t) + payloadLen, written);
+    free(frame);
+
+    return result;
+}
+
+/*
+ * Read one frame, a network order length then that many bytes of JSON.
+ *
+ * @return the NUL terminated frame, or NULL when the stream is closed or broken.  Caller frees.
+ */
+static char *readFrame(int sock)
+{
+    uint16_t frameLen;
+    if (recvAll(sock, &frameLen, sizeof(frameLen)) == false)
+    {
+        return NULL;
+    }
+    frameLen = ntohs(frameLen);
+
+    char *frame = calloc(1, frameLen + 1U);
+    if (recvAll(sock, frame, frameLen) == false)
+    {
+        free(frame);
+        return NULL;
+    }
+
+    return frame;
+}
+
+static bool pendingAckRequestIdCompareFunc(void *searchVal, void *item)
+{
+    PendingAck *pending = item;
+    return pending->hasAck == false && pending->requestId == *(uint32_t *) searchVal;
+}
+
+static bool pendingAckUnackedCompareFunc(void *searchVal, void *item)
+{
+    (void) searchVal;
+    return ((PendingAck *) item)->hasAck == false;
+}
+
+static bool pendingAckCompareFunc(void *searchVal, void *item)
+{
+    return searchVal == item;
+}
+
+/*
+ * Hand an ack to the request it belongs to.  Acks that carry a requestId are matched on it, acks that don't
+ * go to the oldest unacked request since ZigbeeCore acks a stream's requests in the order they were written.
+ */
+static void completeAck(ZhalChannel *channel, uint32_t generation, cJSON *ack)
+{
+    mutexLock(&channel->mtx);
+
+    if (generation == channel->generation)
+    {
+        PendingAck *pending = NULL;
+        cJSON *requestIdJson = cJSON_GetObjectItem(ack, "requestId");
+        if (cJSON_IsNumber(requestIdJson))
+        {
+            uint32_t rid = (uint32_t) requestIdJson->valueint;
+            pending = linkedListFind(channel->pendingAcks, &rid, pendingAckRequestIdCompareFunc);
+        }
+        else
+        {
+            pending = linkedListFind(channel->pendingAcks, NULL, pendingAckUnackedCompareFunc);
+        }
+
+        if (pending != NULL)
+        {
+            cJSON *resultCode = cJSON_GetObjectItem(ack, "resultCode");
+            pending->hasAck = true;
+            pending->succeeded = cJSON_IsNumber(resultCode) && resultCode->valueint == 0;
+            pthread_cond_signal(&pending->cond);
+        }
+        else
+        {
+            icLogDebug(LOG_TAG, "dropping channel ack with no waiting request");
+        }
+    }
+
+    mutexUnlock(&channel->mtx);
+}
+
+static void *channelReaderThreadProc(void *arg)
+{
+    ReaderArgs *args = arg;
+    ZhalChannel *channel = args->channel;
+    char *frame;
+
+    while ((frame = readFrame(args->sock)) != NULL)
+    {
+        cJSON *json = cJSON_Parse(frame);
+        if (json == NULL)
+        {
+            icLogWarn(LOG_TAG, "Unable to parse channel data: %s", frame);
+            free(frame);
+            continue;
+        }
+        free(frame);
+
+        // ipc responses are handed to their waiter right here like the async receiver does, anything else is an ack
+        cJSON *eventType = cJSON_GetObjectItem(json, "eventType");
+        if (cJSON_IsString(eventType) && strcmp("ipcResponse", eventType->valuestring) == 0)
+        {
+            if (channel->ipcHandler != NULL && channel->ipcHandler(json) != 0)
+            {
+                json = NULL; // the handler will clean up
+            }
+        }
+        else
+        {
+            completeAck(channel, args->generation, json);
+        }
+
+        cJSON_Delete(json);
+    }
+
+    mutexLock(&channel->mtx);
+    if (args->generation == channel->generation && channel->sock == args->sock)
+    {
+        icLogInfo(LOG_TAG, "channel to %s:%d closed", channel->host, channel->port);
+        breakStreamNoLock(channel);
+    }
+    channel->readerCount--;
+    pthread_cond_broadcast(&channel->readerCond);
+    mutexUnlock(&channel->mtx);
+
+    close(args->sock);
+    free(args);
+
+    return NULL;
+}
+
+ZhalChannelResult zhalChannelSend(ZhalChannel *channel, uint32_t requestId, const char *payload, int timeoutSecs)
+{
+    ZhalChannelResult result = ZHAL_CHANNEL_UNAVAILABLE;
+
+    if (strlen(payload) > UINT16_MAX)
+    {
+        icLogError(LOG_TAG, "requestId %" PRIu32 " is too large to frame", requestId);
+        return ZHAL_CHANNEL_FAILED;
+    }
+
+    // Only a request that never reached the socket is tried again.  Once any of it has been written ZigbeeCore
+    // may act on it, so a broken stream from then on fails the request rather than sending it twice.
+    for (int attempt = 0; attempt < CHANNEL_SEND_ATTEMPTS && result == ZHAL_CHANNEL_UNAVAILABLE; attempt++)
+    {
+        PendingAck pending = {.requestId = requestId};
+        initTimedWaitCond(&pending.cond);
+
+        mutexLock(&channel->mtx);
+
+        if (ensureConnectedLocked(channel) == true)
+        {
+            linkedListAppend(channel->pendingAcks, &pending);
+
+            size_t written = 0;
+            if (writeFrame(channel->sock, payload, &written) == true)
+            {
+                while (pending.hasAck == false)
+                {
+                    if (incrementalCondTimedWait(&pending.cond, &channel->mtx, timeoutSecs) == ETIMEDOUT)
+                    {
+                        break;
+                    }
+                }
+
+                if (pending.hasAck == false)
+                {
+                    // Without its ack the stream can no longer pair acks in order, so start over on a new one
+                    icLogWarn(LOG_TAG, "timed out waiting for channel ack of requestId %" PRIu32, requestId);
+                    breakStreamNoLock(channel);
+                }
+                else if (pending.streamBroken == true)
+                {
+                    icLogWarn(LOG_TAG, "channel closed before the ack of requestId %" PRIu32, requestId);
+                }
+
+                result = pending.hasAck == true && pending.streamBroken == false && pending.succeeded == true
+                             ? ZHAL_CHANNEL_OK
+                             : ZHAL_CHANNEL_FAILED;
+            }
+            else
+            {
+                icLogWarn(LOG_TAG,
+                          "failed writing requestId %" PRIu32 " to the channel after %zu bytes",
+                          requestId,
+                          written);
+                breakStreamNoLock(channel);
+
+                if (written > 0)
+                {
+                    result = ZHAL_CHANNEL_FAILED;
+                }
+            }
+
+            linkedListDelete(channel->pendingAcks, &pending, pendingAckCompareFunc, standardDoNotFreeFunc);
+        }
+        else
+        {
+            // connecting failed, there is no point in trying again right away
+            attempt = CHANNEL_SEND_ATTEMPTS;
+        }
+
+        mutexUnlock(&channel->mtx);
+        pthread_cond_destroy(&pending.cond);
+    }
+
+    return result;
+}
@@ -0,0 +1,78 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+/*
+ * A persistent request channel to ZigbeeCore.  Instead of a socket per request, requests are written to one
+ * long lived stream and correlated with their acks by requestId, so several requests may be in flight on the
+ * stream at once.  Async ipc responses that arrive on the stream are handed to the same handler the async
+ * receiver uses.  The stream is connected lazily and reconnected after any error.
+ */
+
+#ifndef FLEXCORE_ZHALCHANNEL_H
+#define FLEXCORE_ZHALCHANNEL_H
+
+#include "zhalAsyncReceiver.h"
+#include <cjson/cJSON.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct ZhalChannel ZhalChannel;
+
+typedef enum
+{
+    ZHAL_CHANNEL_OK,          // the request was acked by ZigbeeCore
+    ZHAL_CHANNEL_FAILED,      // some or all of the request was written but it was not acked successfully
+    ZHAL_CHANNEL_UNAVAILABLE, // none of the request was written, the caller may send it some other way
+} ZhalChannelResult;
+
+/**
+ * Create a channel.  Nothing is connected until the first request is sent.
+ *
+ * @param host the ZigbeeCore ip address
+ * @param port the ZigbeeCore ipc port
+ * @param ipcHandler receives ipc responses that ZigbeeCore writes to the stream on the reader thread, may be NULL
+ * @return the channel, destroy with zhalChannelDestroy
+ */
+ZhalChannel *zhalChannelCreate(const char *host, int port, zhalIpcResponseHandler ipcHandler);
+
+/**
+ * Close the stream and wait for its reader to exit.  Any request waiting for an ack fails.
+ *
+ * @param channel the channel, may be NULL
+ */
+void zhalChannelDestroy(ZhalChannel *channel);
+
+/**
+ * Write a request to the stream and wait for its ack.  If the stream is found broken before any of the
+ * request was written it is reconnected and the request is tried once more.  A request is never written
+ * twice: once any of it is on the stream, losing the stream fails it.
+ *
+ * @param channel the channel
+ * @param requestId the requestId carried in the request JSON
+ * @param payload the unformatted request JSON
+ * @param timeoutSecs how long to wait for the ack
+ * @return ZHAL_CHANNEL_OK if the ack had a resultCode of 0
+ */
+ZhalChannelResult zhalChannelSend(ZhalChannel *channel, uint32_t requestId, const char *payload, int timeoutSecs);
+
+#endif // FLEXCORE_ZHALCHANNEL_H
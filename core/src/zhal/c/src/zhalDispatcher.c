@@ -0,0 +1,353 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include "zhalDispatcher.h"
+#include "zhalPrivate.h"
+#include <errno.h>
+#include <glib.h>
+#include <icConcurrent/threadUtils.h>
+#include <icConcurrent/timedWait.h>
+#include <icLog/logging.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DROP_LOG_INTERVAL 100 // after the first, log only every this many drops
+
+typedef struct
+{
+    uint64_t orderKey;
+    zhalDispatchHandler jsonHandler;           // set for JSON payloads
+    zhalDispatchPayloadHandler payloadHandler; // set for anything else
+    zhalDispatchFreeFunc freePayload;
+    void *payload;
+} DispatchItem;
+
+struct ZhalDispatcher
+{
+    char *name;
+    pthread_mutex_t mtx;
+    pthread_cond_t workCond; // a payload may have become available to a thread
+    pthread_cond_t roomCond; // the queue may have room
+    GQueue *queue;           // DispatchItems in arrival order
+    uint16_t queueLimit;
+    uint32_t fullWaitMillis;
+    uint8_t threadCount;
+    pthread_t *threads;
+    uint64_t *activeKeys; // the order key each thread is handling, ZHAL_DISPATCH_UNORDERED if none
+    bool shutdown;
+    ZhalDispatcherStats stats;
+};
+
+typedef struct
+{
+    ZhalDispatcher *dispatcher;
+    uint8_t index;
+} DispatchThreadArgs;
+
+static void *dispatchThreadProc(void *arg);
+
+static void freeItemPayload(DispatchItem *item)
+{
+    if (item->jsonHandler != NULL)
+    {
+        cJSON_Delete(item->payload);
+    }
+    else if (item->freePayload != NULL)
+    {
+        item->freePayload(item->payload);
+    }
+}
+
+static void destroyDispatchItem(gpointer data)
+{
+    DispatchItem *item = data;
+
+    freeItemPayload(item);
+    free(item);
+}
+
+ZhalDispatcher *
+zhalDispatcherCreate(const char *name, uint8_t threadCount, uint16_t queueLimit, uint32_t fullWaitMillis)
+{
+    ZhalDispatcher *dispatcher = calloc(1, sizeof(ZhalDispatcher));
+
+    dispatcher->name = strdup(name);
+    pthread_mutex_init(&dispatcher->mtx, NULL);
+    pthread_cond_init(&dispatcher->workCond, NULL);
+    initTimedWaitCond(&dispatcher->roomCond);
+    dispatcher->queue = g_queue_new();
+    dispatcher->queueLimit = queueLimit > 0 ? queueLimit : 1;
+    dispatcher->fullWaitMillis = fullWaitMillis;
+    dispatcher->threadCount = threadCount > 0 ? threadCount : 1;
+    dispatcher->threads = calloc(dispatcher->threadCount, sizeof(pthread_t));
+    dispatcher->activeKeys = calloc(dispatcher->threadCount, sizeof(uint64_t));
+
+    for (uint8_t i = 0; i < dispatcher->threadCount; i++)
+    {
+        DispatchThreadArgs *args = calloc(1, sizeof(DispatchThreadArgs));
+        args->dispatcher = dispatcher;
+        args->index = i;
+
+        if (createThread(&dispatcher->threads[i], dispatchThreadProc, args, name) == false)
+        {
+            icLogError(LOG_TAG, "%s: failed to start dispatch thread %" PRIu8, name, i);
+            free(args);
+            dispatcher->threadCount = i;
+            break;
+        }
+    }
+
+    return dispatcher;
+}
+
+void zhalDispatcherDestroy(ZhalDispatcher *dispatcher)
+{
+    if (dispatcher == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&dispatcher->mtx);
+    dispatcher->shutdown = true;
+    pthread_cond_broadcast(&dispatcher->workCond);
+    pthread_cond_broadcast(&dispatcher->roomCond);
+    pthread_mutex_unlock(&dispatcher->mtx);
+
+    for (uint8_t i = 0; i < dispatcher->threadCount; i++)
+    {
+        pthread_join(dispatcher->threads[i], NULL);
+    }
+
+    guint abandoned = g_queue_get_length(dispatcher->queue);
+    if (abandoned > 0)
+    {
+        icLogWarn(LOG_TAG, "%s: dropping %u payloads that were never handled", dispatcher->name, abandoned);
+    }
+
+    g_queue_free_full(dispatcher->queue, destroyDispatchItem);
+    free(dispatcher->threads);
+    free(dispatcher->activeKeys);
+    pthread_cond_destroy(&dispatcher->workCond);
+    pthread_cond_destroy(&dispatcher->roomCond);
+    pthread_mutex_destroy(&dispatcher->mtx);
+    free(dispatcher->name);
+    free(dispatcher);
+}
+
+/*
+ * Queue an item, waiting a while for room if the queue is full.
+ *
+ * @return false if the item was dropped, in which case the caller still owns it
+ */
+static bool submitItem(ZhalDispatcher *dispatcher, DispatchItem *item)
+{
+    pthread_mutex_lock(&dispatcher->mtx);
+
+    if (dispatcher->shutdown == false && g_queue_get_length(dispatcher->queue) >= dispatcher->queueLimit)
+    {
+        // hold off the submitter, which usually leaves the backlog in the socket's receive buffer for a moment
+        dispatcher->stats.delayed++;
+
+        bool timedOut = dispatcher->fullWaitMillis == 0;
+        while (timedOut == false && dispatcher->shutdown == false &&
+               g_queue_get_length(dispatcher->queue) >= dispatcher->queueLimit)
+        {
+            timedOut = incrementalCondTimedWaitMillis(
+                           &dispatcher->roomCond, &dispatcher->mtx, dispatcher->fullWaitMillis) == ETIMEDOUT;
+        }
+    }
+
+    if (dispatcher->shutdown == true || g_queue_get_length(dispatcher->queue) >= dispatcher->queueLimit)
+    {
+        dispatcher->stats.dropped++;
+        if (dispatcher->stats.dropped % DROP_LOG_INTERVAL == 1)
+        {
+            icLogWarn(LOG_TAG,
+                      "%s: queue is full, dropped payload (%" PRIu64 " dropped so far)",
+                      dispatcher->name,
+                      dispatcher->stats.dropped);
+        }
+
+        pthread_mutex_unlock(&dispatcher->mtx);
+        return false;
+    }
+
+    g_queue_push_tail(dispatcher->queue, item);
+
+    guint queued = g_queue_get_length(dispatcher->queue);
+    if (queued > dispatcher->stats.maxQueued)
+    {
+        dispatcher->stats.maxQueued = queued;
+    }
+
+    pthread_cond_signal(&dispatcher->workCond);
+    pthread_mutex_unlock(&dispatcher->mtx);
+
+    return true;
+}
+
+bool zhalDispatcherSubmit(ZhalDispatcher *dispatcher, uint64_t orderKey, zhalDispatchHandler handler, cJSON *payload)
+{
+    if (dispatcher == NULL || handler == NULL || payload == NULL)
+    {
+        return false;
+    }
+
+    DispatchItem *item = calloc(1, sizeof(DispatchItem));
+    item->orderKey = orderKey;
+    item->jsonHandler = handler;
+    item->payload = payload;
+
+    bool result = submitItem(dispatcher, item);
+    if (result == false)
+    {
+        free(item);
+    }
+
+    return result;
+}
+
+bool zhalDispatcherSubmitPayload(ZhalDispatcher *dispatcher,
+                                 uint64_t orderKey,
+                                 zhalDispatchPayloadHandler handler,
+                                 void *payload,
+                                 zhalDispatchFreeFunc freePayload)
+{
+    if (dispatcher == NULL || handler == NULL || payload == NULL)
+    {
+        return false;
+    }
+
+    DispatchItem *item = calloc(1, sizeof(DispatchItem));
+    item->orderKey = orderKey;
+    item->payloadHandler = handler;
+    item->freePayload = freePayload;
+    item->payload = payload;
+
+    bool result = submitItem(dispatcher, item);
+    if (result == false)
+    {
+        free(item);
+    }
+
+    return result;
+}
+
+void zhalDispatcherGetStats(ZhalDispatcher *dispatcher, ZhalDispatcherStats *stats)
+{
+    if (dispatcher == NULL || stats == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&dispatcher->mtx);
+    *stats = dispatcher->stats;
+    stats->queued = g_queue_get_length(dispatcher->queue);
+    pthread_mutex_unlock(&dispatcher->mtx);
+}
+
+static bool isOrderKeyActiveNoLock(ZhalDispatcher *dispatcher, uint64_t orderKey)
+{
+    if (orderKey == ZHAL_DISPATCH_UNORDERED)
+    {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < dispatcher->threadCount; i++)
+    {
+        if (dispatcher->activeKeys[i] == orderKey)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Take the oldest payload that is not waiting on another with the same order key.  Since every payload for a key
+ * waits while one is being handled, the one taken is always the oldest for its key.
+ */
+static DispatchItem *takeNextItemNoLock(ZhalDispatcher *dispatcher)
+{
+    for (GList *link = dispatcher->queue->head; link != NULL; link = link->next)
+    {
+        DispatchItem *item = link->data;
+        if (isOrderKeyActiveNoLock(dispatcher, item->orderKey) == false)
+        {
+            g_queue_delete_link(dispatcher->queue, link);
+            return item;
+        }
+    }
+
+    return NULL;
+}
+
+static void *dispatchThreadProc(void *arg)
+{
+    DispatchThreadArgs *args = arg;
+    ZhalDispatcher *dispatcher = args->dispatcher;
+    uint8_t index = args->index;
+    free(args);
+
+    pthread_mutex_lock(&dispatcher->mtx);
+
+    while (dispatcher->shutdown == false)
+    {
+        DispatchItem *item = takeNextItemNoLock(dispatcher);
+        if (item == NULL)
+        {
+            pthread_cond_wait(&dispatcher->workCond, &dispatcher->mtx);
+            continue;
+        }
+
+        dispatcher->activeKeys[index] = item->orderKey;
+        pthread_cond_signal(&dispatcher->roomCond);
+        pthread_mutex_unlock(&dispatcher->mtx);
+
+        int handled =
+            item->jsonHandler != NULL ? item->jsonHandler(item->payload) : item->payloadHandler(item->payload);
+        if (handled == 0)
+        {
+            // it was not handled, so we have to free it here
+            freeItemPayload(item);
+        }
+        free(item);
+
+        pthread_mutex_lock(&dispatcher->mtx);
+        dispatcher->activeKeys[index] = ZHAL_DISPATCH_UNORDERED;
+        dispatcher->stats.dispatched++;
+
+        // anything that waited on this key may be taken now
+        if (g_queue_get_length(dispatcher->queue) > 0)
+        {
+            pthread_cond_broadcast(&dispatcher->workCond);
+        }
+    }
+
+    pthread_mutex_unlock(&dispatcher->mtx);
+
+    return NULL;
+}
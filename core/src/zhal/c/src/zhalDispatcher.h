@@ -0,0 +1,115 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+/*
+ * A fixed pool of threads that hands JSON payloads from ZigbeeCore to their handlers.  Payloads wait in a bounded
+ * queue and are handled in arrival order, except that a payload whose order key matches one being handled waits
+ * for it, so everything for one device is handled in the order it arrived while different devices proceed in
+ * parallel.  When the queue is full the submitter waits a short while for room before the payload is dropped.
+ */
+
+#ifndef FLEXCORE_ZHALDISPATCHER_H
+#define FLEXCORE_ZHALDISPATCHER_H
+
+#include <cjson/cJSON.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// payloads submitted with this order key may be handled alongside anything else
+#define ZHAL_DISPATCH_UNORDERED 0
+
+// Return non-zero to indicate that the handler took over the payload's lifecycle, like zhalEventHandler
+typedef int (*zhalDispatchHandler)(cJSON *payload);
+
+// The same, for payloads that are not JSON.  Payloads the handler does not take over are freed with the free function.
+typedef int (*zhalDispatchPayloadHandler)(void *payload);
+typedef void (*zhalDispatchFreeFunc)(void *payload);
+
+typedef struct ZhalDispatcher ZhalDispatcher;
+
+typedef struct
+{
+    uint64_t dispatched; // payloads handed to their handler
+    uint64_t delayed;    // submits that found the queue full and had to wait for room
+    uint64_t dropped;    // payloads dropped because the queue stayed full
+    uint32_t queued;     // payloads waiting right now
+    uint32_t maxQueued;  // the most payloads that were ever waiting at once
+} ZhalDispatcherStats;
+
+/**
+ * Create a dispatcher and start its threads.
+ *
+ * @param name used to name the threads
+ * @param threadCount how many payloads may be handled at once
+ * @param queueLimit how many payloads may wait for a thread
+ * @param fullWaitMillis how long a submit waits for room in a full queue before the payload is dropped
+ * @return the dispatcher, destroy with zhalDispatcherDestroy
+ */
+ZhalDispatcher *
+zhalDispatcherCreate(const char *name, uint8_t threadCount, uint16_t queueLimit, uint32_t fullWaitMillis);
+
+/**
+ * Stop the threads once they finish what they are handling.  Payloads still waiting are dropped.
+ *
+ * @param dispatcher the dispatcher, may be NULL
+ */
+void zhalDispatcherDestroy(ZhalDispatcher *dispatcher);
+
+/**
+ * Queue a payload for a handler.
+ *
+ * @param dispatcher the dispatcher
+ * @param orderKey payloads with the same key are handled one at a time in the order they were submitted, typically
+ *                 the EUI64 of the device they are about.  Use ZHAL_DISPATCH_UNORDERED for payloads that need no
+ *                 ordering.
+ * @param handler the handler
+ * @param payload the payload, owned by the dispatcher if this succeeds
+ * @return false if the payload was dropped, in which case it still belongs to the caller
+ */
+bool zhalDispatcherSubmit(ZhalDispatcher *dispatcher, uint64_t orderKey, zhalDispatchHandler handler, cJSON *payload);
+
+/**
+ * Queue a payload that is not JSON for a handler.
+ *
+ * @param dispatcher the dispatcher
+ * @param orderKey as for zhalDispatcherSubmit
+ * @param handler the handler
+ * @param payload the payload, owned by the dispatcher if this succeeds
+ * @param freePayload frees the payload if the handler does not take it over or it is never handled
+ * @return false if the payload was dropped, in which case it still belongs to the caller
+ */
+bool zhalDispatcherSubmitPayload(ZhalDispatcher *dispatcher,
+                                 uint64_t orderKey,
+                                 zhalDispatchPayloadHandler handler,
+                                 void *payload,
+                                 zhalDispatchFreeFunc freePayload);
+
+/**
+ * Get a snapshot of the dispatcher's counters.
+ *
+ * @param dispatcher the dispatcher
+ * @param stats receives the counters
+ */
+void zhalDispatcherGetStats(ZhalDispatcher *dispatcher, ZhalDispatcherStats *stats);
+
+#endif // FLEXCORE_ZHALDISPATCHER_H
@@ -648,3 +648,40 @@ int zhalHandleEvent(cJSON *event)
 
     return 1; // we handled it
 }
+
+int zhalHandleBinaryEvent(ZhalBinaryEvent *event)
+{
+    void *callbackContext = getCallbackContext();
+
+    if (event->type == ZHAL_BINARY_EVENT_CLUSTER_COMMAND && getCallbacks()->clusterCommandReceived != NULL)
+    {
+        icLogDebug(LOG_TAG,
+                   "got binary clusterCommandReceived event from %016" PRIx64 " for cluster 0x%04" PRIx16,
+                   event->eui64,
+                   event->command->clusterId);
+
+        // drop this command if it has the same APS sequence number as the last one we received from this device
+        if (isDuplicateApsSequenceNumber(event->eui64, event->command->apsSeqNum) == true)
+        {
+            icLogWarn(LOG_TAG, "%s: duplicate APS sequence number detected!  Ignoring", __func__);
+        }
+        else
+        {
+            getCallbacks()->clusterCommandReceived(callbackContext, event->command);
+        }
+    }
+    else if (event->type == ZHAL_BINARY_EVENT_ATTRIBUTE_REPORT && getCallbacks()->attributeReportReceived != NULL)
+    {
+        icLogDebug(LOG_TAG,
+                   "got binary attributeReport event from %016" PRIx64 " for cluster 0x%04" PRIx16,
+                   event->eui64,
+                   event->report->clusterId);
+
+        getCallbacks()->attributeReportReceived(callbackContext, event->report);
+    }
+
+    // Cleanup since we are saying we handled it, including the report or command like the JSON handlers do
+    zhalBinaryEventDestroy(event);
+
+    return 1; // we handled it
+}
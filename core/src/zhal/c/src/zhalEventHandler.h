@@ -27,6 +27,7 @@
 
 #pragma once
 
+#include "zhalBinaryEvent.h"
 #include <cjson/cJSON.h>
 
 /**
@@ -45,3 +46,10 @@ void zhalEventHandlerTerm(void);
  * @return
  */
 int zhalHandleEvent(cJSON *event);
+
+/**
+ * Handle an event that arrived in the binary encoding
+ * @param event
+ * @return non-zero, the event is always consumed
+ */
+int zhalHandleBinaryEvent(ZhalBinaryEvent *event);
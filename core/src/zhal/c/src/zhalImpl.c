@@ -36,6 +36,7 @@
 #include <unistd.h>
 
 #include "zhalAsyncReceiver.h"
+#include "zhalChannel.h"
 #include "zhalDataScrubber.h"
 #include "zhalEventHandler.h"
 #include "zhalPrivate.h"
@@ -59,11 +60,30 @@
 #define LOG_TAG     "zhalImpl"
 #define logFmt(fmt) "%s: " fmt, __func__
 
+/*
+ * Scheduling lanes.  Workers serve devices with interactive work first, but give background work a turn after
+ * every INTERACTIVE_BURST interactive picks so polling is never starved.
+ */
+typedef enum
+{
+    REQUEST_LANE_INTERACTIVE, // commands and writes that someone is waiting on
+    REQUEST_LANE_BACKGROUND,  // reads, polling and configuration
+    REQUEST_LANE_COUNT
+} RequestLane;
+
 typedef struct
 {
     icQueue *queue; // WorkItems pending for this device
     pthread_mutex_t mutex;
-    int isBusy;
+    int pendingCount;            // WorkItems in queue
+    int pendingInteractiveCount; // WorkItems in queue on the interactive lane
+    int isBusy;                  // how many WorkItems are taken or awaiting their response
+    uint8_t window;              // how many WorkItems may be taken or await their response at once
+    uint32_t busyOrderKeys[ZHAL_MAX_REQUEST_WINDOW]; // order keys of the busy WorkItems
+
+    // guarded by workerMutex
+    bool isReady; // in one of the readyDevices lanes
+    RequestLane readyLane;
 } DeviceQueue;
 
 static void deviceQueueRelease(void *deviceQueue);
@@ -77,6 +97,8 @@ typedef struct
     cJSON *request;
     cJSON *response;
     DeviceQueue *deviceQueue; // handle to the owning device queue
+    uint32_t orderKey;        // items to the same device with conflicting order keys are never in flight together
+    RequestLane lane;
     pthread_cond_t cond;
     pthread_mutex_t mtx;
     bool timedOut;
@@ -87,6 +109,13 @@ static void workItemRelease(void *item);
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(WorkItem, workItemRelease)
 #define scoped_WorkItem            g_autoptr(WorkItem)
 
+/*
+ * Order keys.  Requests with the same key stay in order, requests with different keys may be in flight together.
+ * Reads, bindings and reporting configuration are keyed by their endpoint and cluster.
+ */
+#define ORDER_KEY_BARRIER          UINT32_MAX       // ordered against every other request to the device
+#define ORDER_KEY_INDEPENDENT      (UINT32_MAX - 1) // ordered against barriers only
+
 #define SOCKET_RECEIVE_TIMEOUT_SEC 10
 #define SOCKET_SEND_TIMEOUT_SEC    10
 
@@ -97,7 +126,10 @@ static uint32_t requestId = 0;
 
 static pthread_mutex_t requestIdMutex = PTHREAD_MUTEX_INITIALIZER;
 
-static pthread_t workerThread;
+#define WORKER_THREAD_COUNT 3
+#define INTERACTIVE_BURST   4
+
+static pthread_t workerThreads[WORKER_THREAD_COUNT];
 
 static pthread_cond_t workerCond = PTHREAD_COND_INITIALIZER;
 
@@ -105,8 +137,14 @@ static pthread_mutex_t workerMutex = PTHREAD_MUTEX_INITIALIZER;
 
 static bool workerShutdown = true;
 
+// DeviceQueues that may have work ready to send, per lane.  Guarded by workerMutex.
+static icQueue *readyDevices[REQUEST_LANE_COUNT];
+static int interactiveStreak = 0;
+
 static void *workerThreadProc(void *);
 
+static void scheduleDeviceNoLock(DeviceQueue *dq);
+
 static icHashMap *asyncRequests = NULL; // maps uint32_t (requestId) to WorkItem
 static pthread_mutex_t asyncRequestsMutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -116,6 +154,13 @@ static char *zigbeeIp = NULL;
 
 static int zigbeePort = 0;
 
+// When set, requests share one persistent connection instead of opening a socket each.  The pointer is set
+// before the workers start and cleared after they are joined, so workers read it without a lock.  All the
+// workers send on the channel at once; it serializes writes to the stream under its own mutex and pairs each
+// ack with its request, so each worker waits only for its own ack.
+static bool persistentConnectionEnabled = false;
+static ZhalChannel *requestChannel = NULL;
+
 static int handleIpcResponse(cJSON *response);
 
 static void deviceQueuesDestroy(void *key, void *value);
@@ -160,13 +205,26 @@ int zhalInit(const char *host, int port, zhalCallbacks *cbs, void *ctx, zhalResp
     pthread_mutex_unlock(&asyncRequestsMutex);
 
     zhalEventHandlerInit();
-    zhalAsyncReceiverStart(host, handleIpcResponse, zhalHandleEvent);
+    zhalAsyncReceiverStart(host, handleIpcResponse, zhalHandleEvent, zhalHandleBinaryEvent);
+
+    if (persistentConnectionEnabled == true)
+    {
+        requestChannel = zhalChannelCreate(host, port, handleIpcResponse);
+    }
 
     pthread_mutex_lock(&workerMutex);
+    for (int i = 0; i < REQUEST_LANE_COUNT; i++)
+    {
+        readyDevices[i] = queueCreate();
+    }
+    interactiveStreak = 0;
     workerShutdown = false;
     pthread_mutex_unlock(&workerMutex);
 
-    createThread(&workerThread, workerThreadProc, NULL, "zhal");
+    for (int i = 0; i < WORKER_THREAD_COUNT; i++)
+    {
+        createThread(&workerThreads[i], workerThreadProc, NULL, "zhal");
+    }
 
     mutexLock(&initializedMtx);
     initialized = true;
@@ -188,18 +246,32 @@ int zhalTerm(void)
     // Shut down the receiver socket
     zhalAsyncReceiverStop();
 
-    // Shutdown the worker
+    // Shutdown the workers
     pthread_mutex_lock(&workerMutex);
     bool workerThreadWasRunning = !workerShutdown;
     workerShutdown = true;
-    pthread_cond_signal(&workerCond);
+    pthread_cond_broadcast(&workerCond);
     pthread_mutex_unlock(&workerMutex);
 
     if (workerThreadWasRunning == true)
     {
-        pthread_join(workerThread, NULL);
+        for (int i = 0; i < WORKER_THREAD_COUNT; i++)
+        {
+            pthread_join(workerThreads[i], NULL);
+        }
     }
 
+    pthread_mutex_lock(&workerMutex);
+    for (int i = 0; i < REQUEST_LANE_COUNT; i++)
+    {
+        queueDestroy(readyDevices[i], deviceQueueRelease);
+        readyDevices[i] = NULL;
+    }
+    pthread_mutex_unlock(&workerMutex);
+
+    zhalChannelDestroy(requestChannel);
+    requestChannel = NULL;
+
     callbacks = NULL;
     free(zigbeeIp);
     zigbeeIp = NULL;
@@ -264,6 +336,11 @@ int zhalTerm(void)
     return 0;
 }
 
+void zhalSetPersistentConnection(bool enabled)
+{
+    persistentConnectionEnabled = enabled;
+}
+
 bool zhalIsInitialized(void)
 {
     mutexLock(&initializedMtx);
@@ -298,6 +375,7 @@ static DeviceQueue *createDeviceQueue(void)
     DeviceQueue *deviceQueue = g_atomic_rc_box_new0(DeviceQueue);
     deviceQueue->queue = queueCreate();
     mutexInitWithType(&deviceQueue->mutex, PTHREAD_MUTEX_ERRORCHECK);
+    deviceQueue->window = 1;
 
     return g_steal_pointer(&deviceQueue);
 }
@@ -334,6 +412,116 @@ static void deviceQueuesDestroy(void *key, void *value)
     free(key);
 }
 
+/*
+ * Work out what a request must stay ordered against.  Discovery reads depend on nothing, and reads, bindings and
+ * reporting configuration only on earlier requests to the same cluster.  Anything else, such as writes and
+ * commands, may depend on whatever was sent before it.
+ */
+static uint32_t getOrderKey(cJSON *requestJson)
+{
+    static const char *independentRequests[] = {"getEndpointIds", "getClustersInfo", "getAttributeInfos"};
+    static const char *clusterRequests[] = {
+        "attributesRead", "bindingSet", "bindingClear", "attributesSetReporting"};
+
+    cJSON *type = cJSON_GetObjectItem(requestJson, "request");
+    if (!cJSON_IsString(type))
+    {
+        return ORDER_KEY_BARRIER;
+    }
+
+    for (size_t i = 0; i < sizeof(independentRequests) / sizeof(independentRequests[0]); i++)
+    {
+        if (strcmp(type->valuestring, independentRequests[i]) == 0)
+        {
+            return ORDER_KEY_INDEPENDENT;
+        }
+    }
+
+    cJSON *endpointId = cJSON_GetObjectItem(requestJson, "endpointId");
+    cJSON *clusterId = cJSON_GetObjectItem(requestJson, "clusterId");
+    if (cJSON_IsNumber(endpointId) && cJSON_IsNumber(clusterId))
+    {
+        for (size_t i = 0; i < sizeof(clusterRequests) / sizeof(clusterRequests[0]); i++)
+        {
+            if (strcmp(type->valuestring, clusterRequests[i]) == 0)
+            {
+                return ((uint32_t) (endpointId->valueint & 0xff) << 16) | (uint32_t) (clusterId->valueint & 0xffff);
+            }
+        }
+    }
+
+    return ORDER_KEY_BARRIER;
+}
+
+/*
+ * Commands and writes act on behalf of someone waiting for the result, everything else can wait its turn
+ */
+static RequestLane getRequestLane(cJSON *requestJson)
+{
+    static const char *interactiveRequests[] = {"sendCommand", "attributesWrite", "sendViaApsAck", "requestLeave"};
+
+    cJSON *type = cJSON_GetObjectItem(requestJson, "request");
+    if (cJSON_IsString(type))
+    {
+        for (size_t i = 0; i < sizeof(interactiveRequests) / sizeof(interactiveRequests[0]); i++)
+        {
+            if (strcmp(type->valuestring, interactiveRequests[i]) == 0)
+            {
+                return REQUEST_LANE_INTERACTIVE;
+            }
+        }
+    }
+
+    return REQUEST_LANE_BACKGROUND;
+}
+
+static bool orderKeysConflict(uint32_t a, uint32_t b)
+{
+    if (a == ORDER_KEY_BARRIER || b == ORDER_KEY_BARRIER)
+    {
+        return true;
+    }
+
+    return a == b && a != ORDER_KEY_INDEPENDENT;
+}
+
+static void deviceQueueSetBusyNoLock(DeviceQueue *deviceQueue, WorkItem *item)
+{
+    if (deviceQueue->isBusy >= deviceQueue->window)
+    {
+        icLogError(LOG_TAG,
+                   "device queue for %016" PRIx64 " is already full (%d of %" PRIu8 ")!",
+                   item->eui64,
+                   deviceQueue->isBusy,
+                   deviceQueue->window);
+    }
+
+    if (deviceQueue->isBusy < ZHAL_MAX_REQUEST_WINDOW)
+    {
+        deviceQueue->busyOrderKeys[deviceQueue->isBusy] = item->orderKey;
+    }
+    deviceQueue->isBusy++;
+}
+
+static void deviceQueueClearBusyNoLock(DeviceQueue *deviceQueue, WorkItem *item)
+{
+    if (deviceQueue->isBusy <= 0)
+    {
+        return;
+    }
+
+    int tracked = deviceQueue->isBusy < ZHAL_MAX_REQUEST_WINDOW ? deviceQueue->isBusy : ZHAL_MAX_REQUEST_WINDOW;
+    for (int i = 0; i < tracked; i++)
+    {
+        if (deviceQueue->busyOrderKeys[i] == item->orderKey)
+        {
+            deviceQueue->busyOrderKeys[i] = deviceQueue->busyOrderKeys[tracked - 1];
+            break;
+        }
+    }
+    deviceQueue->isBusy--;
+}
+
 static WorkItem *createItem(uint64_t targetEui64, cJSON *requestJson, DeviceQueue *deviceQueue)
 {
     if (requestJson == NULL || deviceQueue == NULL)
@@ -348,6 +536,8 @@ static WorkItem *createItem(uint64_t targetEui64, cJSON *requestJson, DeviceQueu
     cJSON_AddNumberToObject(requestJson, "requestId", item->requestId);
     item->request = requestJson;
     item->deviceQueue = deviceQueueAcquire(deviceQueue);
+    item->orderKey = getOrderKey(requestJson);
+    item->lane = getRequestLane(requestJson);
     item->timedOut = false;
     initTimedWaitCond(&item->cond);
     mutexInitWithType(&item->mtx, PTHREAD_MUTEX_ERRORCHECK);
@@ -390,6 +580,75 @@ static void asyncRequestsFreeFunc(void *key, void *value)
     }
 }
 
+/*
+ * Get a device's queue, creating it if this is the first request for the device.  Caller holds
+ * deviceQueuesMutex and deviceQueues must exist.
+ *
+ * @return the queue, release with deviceQueueRelease
+ */
+static DeviceQueue *getDeviceQueueNoLock(uint64_t targetEui64)
+{
+    DeviceQueue *deviceQueue =
+        deviceQueueAcquire((DeviceQueue *) hashMapGet(deviceQueues, &targetEui64, sizeof(uint64_t)));
+
+    if (deviceQueue == NULL)
+    {
+        icLogDebug(LOG_TAG, "Creating device queue for %016" PRIx64, targetEui64);
+        deviceQueue = createDeviceQueue();
+
+        if (deviceQueue != NULL)
+        {
+            uint64_t *key = (uint64_t *) malloc(sizeof(targetEui64));
+            *key = targetEui64;
+
+            /* This is guaranteed as the key was not found above */
+            hashMapPut(deviceQueues, key, sizeof(uint64_t), deviceQueueAcquire(deviceQueue));
+        }
+    }
+
+    return deviceQueue;
+}
+
+int zhalSetDeviceRequestWindow(uint64_t eui64, uint8_t window)
+{
+    if (window == 0 || window > ZHAL_MAX_REQUEST_WINDOW)
+    {
+        icLogError(LOG_TAG, "%s: invalid window %" PRIu8, __func__, window);
+        return -1;
+    }
+
+    mutexLock(&deviceQueuesMutex);
+
+    if (deviceQueues == NULL)
+    {
+        mutexUnlock(&deviceQueuesMutex);
+        icWarn("Not initialized, ignoring request window");
+        return -1;
+    }
+
+    scoped_DeviceQueue deviceQueue = getDeviceQueueNoLock(eui64);
+
+    mutexUnlock(&deviceQueuesMutex);
+
+    if (deviceQueue == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&deviceQueue->mutex);
+    if (deviceQueue->window != window)
+    {
+        icLogDebug(LOG_TAG, "request window for %016" PRIx64 " is now %" PRIu8, eui64, window);
+        deviceQueue->window = window;
+    }
+
+    // a wider window may let queued items go now
+    scheduleDeviceNoLock(deviceQueue);
+    pthread_mutex_unlock(&deviceQueue->mutex);
+
+    return 0;
+}
+
 /*
  * This blocks until the full operation is complete or it times out
  * This function is not responsible for requestJson cleanup
@@ -419,23 +678,7 @@ cJSON *zhalSendRequest(uint64_t targetEui64, cJSON *requestJson, int timeoutSecs
         return NULL;
     }
 
-    scoped_DeviceQueue deviceQueue =
-        deviceQueueAcquire((DeviceQueue *) hashMapGet(deviceQueues, &targetEui64, sizeof(uint64_t)));
-
-    if (deviceQueue == NULL)
-    {
-        icLogDebug(LOG_TAG, "Creating device queue for %016" PRIx64, targetEui64);
-        deviceQueue = createDeviceQueue();
-
-        if (deviceQueue != NULL)
-        {
-            uint64_t *key = (uint64_t *) malloc(sizeof(targetEui64));
-            *key = targetEui64;
-
-            /* This is guaranteed as the key was not found above */
-            hashMapPut(deviceQueues, key, sizeof(uint64_t), deviceQueueAcquire(deviceQueue));
-        }
-    }
+    scoped_DeviceQueue deviceQueue = getDeviceQueueNoLock(targetEui64);
 
     mutexUnlock(&deviceQueuesMutex);
 
@@ -455,16 +698,23 @@ cJSON *zhalSendRequest(uint64_t targetEui64, cJSON *requestJson, int timeoutSecs
     // lock the item before the worker can get it so we wont miss its completion
     pthread_mutex_lock(&item->mtx);
 
-    // enqueue the work item
+    // enqueue the work item and put the device in line for a worker
     pthread_mutex_lock(&deviceQueue->mutex);
-    queuePush(deviceQueue->queue, workItemAcquire(item));
+    if (queuePush(deviceQueue->queue, workItemAcquire(item)) == true)
+    {
+        deviceQueue->pendingCount++;
+        if (item->lane == REQUEST_LANE_INTERACTIVE)
+        {
+            deviceQueue->pendingInteractiveCount++;
+        }
+        scheduleDeviceNoLock(deviceQueue);
+    }
+    else
+    {
+        workItemRelease(item);
+    }
     pthread_mutex_unlock(&deviceQueue->mutex);
 
-    // signal our worker that there is stuff to do
-    pthread_mutex_lock(&workerMutex);
-    pthread_cond_signal(&workerCond);
-    pthread_mutex_unlock(&workerMutex);
-
     if (ETIMEDOUT == incrementalCondTimedWait(&item->cond, &item->mtx, timeoutSecs))
     {
         icLogWarn(LOG_TAG, "requestId %" PRIu32 " timed out", item->requestId);
@@ -478,15 +728,24 @@ cJSON *zhalSendRequest(uint64_t targetEui64, cJSON *requestJson, int timeoutSecs
         // lock the device queue and remove this item if its still there
         pthread_mutex_lock(&deviceQueue->mutex);
         bool didDeleteFromQueue = queueDelete(deviceQueue->queue, item, itemQueueCompareFunc, workItemRelease);
+        if (didDeleteFromQueue)
+        {
+            deviceQueue->pendingCount--;
+            if (item->lane == REQUEST_LANE_INTERACTIVE)
+            {
+                deviceQueue->pendingInteractiveCount--;
+            }
+        }
 
         // Two cases here, could have been never removed from queue to be sent, or it could have been removed and
-        // sent, but we didn't get a reply in time.  The busy counter is only incremented in the latter case.  So if we
-        // removed it from the queue, we don't need to decrement busy.  But if we are deleting it from our pending
-        // async requests, then we should decrement busy.
+        // sent, but we didn't get a reply in time.  The busy counter is only incremented when a worker takes the
+        // item.  So if we removed it from the queue, we don't need to decrement busy.  But if we are deleting it from
+        // our pending async requests, then we should decrement busy.
 
         if (didDeleteFromAsyncRequests)
         {
-            deviceQueue->isBusy--;
+            deviceQueueClearBusyNoLock(deviceQueue, item);
+            scheduleDeviceNoLock(deviceQueue);
         }
         else
         {
@@ -502,11 +761,6 @@ cJSON *zhalSendRequest(uint64_t targetEui64, cJSON *requestJson, int timeoutSecs
             item->timedOut = true;
         }
         pthread_mutex_unlock(&deviceQueue->mutex);
-
-        // There may have been other requests queued up, so signal our worker that there might be stuff to do
-        pthread_mutex_lock(&workerMutex);
-        pthread_cond_signal(&workerCond);
-        pthread_mutex_unlock(&workerMutex);
     }
     else
     {
@@ -673,53 +927,140 @@ bool zhalEndpointHasServerCluster(zhalEndpointInfo *endpointInfo, uint16_t clust
     return result;
 }
 
+typedef struct
+{
+    GArray *blockingKeys; // order keys of items busy or passed over
+    WorkItem *readyItem;
+} ReadyItemScan;
+
+static bool scanForReadyItem(WorkItem *item, ReadyItemScan *scan)
+{
+    bool blocked = false;
+    for (guint i = 0; i < scan->blockingKeys->len && blocked == false; i++)
+    {
+        blocked = orderKeysConflict(item->orderKey, g_array_index(scan->blockingKeys, uint32_t, i));
+    }
+
+    if (blocked == false)
+    {
+        scan->readyItem = item;
+        return false; // stop iterating
+    }
+
+    // a passed over item holds back anything after it that it conflicts with, and nothing may pass a barrier
+    g_array_append_val(scan->blockingKeys, item->orderKey);
+    return item->orderKey != ORDER_KEY_BARRIER;
+}
+
 /*
- * Put any work items that are ready into the provided queue.  Return zero if there was no work to do.
+ * Take the first item of a device queue that may be sent now and mark it busy.  An item may be sent while the
+ * device's window has room, as long as its order key conflicts with nothing busy and nothing ahead of it in the
+ * queue.
+ *
+ * @return the item, with the queue's reference, or NULL if nothing is ready
  */
-static int getAvailableWork(icQueue *availableWork)
+static WorkItem *takeReadyItemNoLock(DeviceQueue *dq)
 {
-    int result = 0;
+    if (dq->isBusy >= dq->window || dq->pendingCount == 0)
+    {
+        return NULL;
+    }
 
-    pthread_mutex_lock(&deviceQueuesMutex);
-    icHashMapIterator *queuesIterator = hashMapIteratorCreate(deviceQueues);
-    while (hashMapIteratorHasNext(queuesIterator))
+    int tracked = dq->isBusy < ZHAL_MAX_REQUEST_WINDOW ? dq->isBusy : ZHAL_MAX_REQUEST_WINDOW;
+    ReadyItemScan scan = {.blockingKeys = g_array_new(FALSE, FALSE, sizeof(uint32_t)), .readyItem = NULL};
+    g_array_append_vals(scan.blockingKeys, dq->busyOrderKeys, tracked);
+
+    queueIterate(dq->queue, (queueIterateFunc) scanForReadyItem, &scan);
+    g_array_free(scan.blockingKeys, TRUE);
+
+    WorkItem *item = scan.readyItem;
+    if (item != NULL)
     {
-        uint64_t *eui64;
-        uint16_t keyLen;
-        DeviceQueue *dq;
-        if (hashMapIteratorGetNext(queuesIterator, (void **) &eui64, &keyLen, (void **) &dq) == true)
+        queueDelete(dq->queue, item, itemQueueCompareFunc, queueDoNotFreeFunc);
+        dq->pendingCount--;
+        if (item->lane == REQUEST_LANE_INTERACTIVE)
+        {
+            dq->pendingInteractiveCount--;
+        }
+        deviceQueueSetBusyNoLock(dq, item);
+    }
+
+    return item;
+}
+
+/*
+ * Put a device in line for a worker if it has queued items and room in its window.  Devices wait in the
+ * interactive lane while they have interactive items queued, and move up to it if one arrives while they wait
+ * in the background lane.  Caller holds the device queue's mutex.
+ */
+static void scheduleDeviceNoLock(DeviceQueue *dq)
+{
+    if (dq->pendingCount == 0 || dq->isBusy >= dq->window)
+    {
+        return;
+    }
+
+    RequestLane lane = dq->pendingInteractiveCount > 0 ? REQUEST_LANE_INTERACTIVE : REQUEST_LANE_BACKGROUND;
+
+    pthread_mutex_lock(&workerMutex);
+
+    if (workerShutdown == false)
+    {
+        if (dq->isReady == true && lane < dq->readyLane &&
+            queueDelete(readyDevices[dq->readyLane], dq, itemQueueCompareFunc, deviceQueueRelease) == true)
         {
-            pthread_mutex_lock(&dq->mutex);
+            dq->isReady = false;
+        }
 
-            // if a device queue is busy, dont schedule another item
-            if (dq->isBusy == 0)
+        if (dq->isReady == false)
+        {
+            if (queuePush(readyDevices[lane], deviceQueueAcquire(dq)) == true)
             {
-                WorkItem *item = (WorkItem *) queuePop(dq->queue);
-                if (item != NULL)
-                {
-                    if (queuePush(availableWork, item))
-                    {
-                        item = NULL;
-                        result++;
-                    }
-                    else
-                    {
-                        workItemRelease(item);
-                    }
-                }
+                dq->isReady = true;
+                dq->readyLane = lane;
+                pthread_cond_signal(&workerCond);
             }
+            else
+            {
+                deviceQueueRelease(dq);
+            }
+        }
+    }
 
-            pthread_mutex_unlock(&dq->mutex);
+    pthread_mutex_unlock(&workerMutex);
+}
+
+/*
+ * Take the next device in line.  Caller holds workerMutex.
+ *
+ * @return the device with the lane's reference, or NULL if no device is waiting
+ */
+static DeviceQueue *nextReadyDeviceNoLock(void)
+{
+    RequestLane order[REQUEST_LANE_COUNT] = {REQUEST_LANE_INTERACTIVE, REQUEST_LANE_BACKGROUND};
+    if (interactiveStreak >= INTERACTIVE_BURST)
+    {
+        order[0] = REQUEST_LANE_BACKGROUND;
+        order[1] = REQUEST_LANE_INTERACTIVE;
+    }
+
+    for (int i = 0; i < REQUEST_LANE_COUNT; i++)
+    {
+        DeviceQueue *dq = queuePop(readyDevices[order[i]]);
+        if (dq != NULL)
+        {
+            interactiveStreak = order[i] == REQUEST_LANE_INTERACTIVE ? interactiveStreak + 1 : 0;
+            dq->isReady = false;
+            return dq;
         }
     }
-    hashMapIteratorDestroy(queuesIterator);
-    pthread_mutex_unlock(&deviceQueuesMutex);
 
-    return result;
+    return NULL;
 }
 
-/* send over the socket and await initial synchronous response (quick).  Returns true if that was successful */
-static bool xmit(WorkItem *item)
+/* open a socket for this one request, send it and await the synchronous response.  Returns true if that was
+ * successful */
+static bool xmitOnNewSocket(const char *payload)
 {
     int sock;
     struct sockaddr_in addr;
@@ -778,7 +1119,6 @@ static bool xmit(WorkItem *item)
         return false;
     }
 
-    scoped_generic char *payload = cJSON_PrintUnformatted(item->request);
     uint16_t payloadLen = (uint16_t) strlen(payload);
 
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
@@ -853,7 +1193,37 @@ static bool xmit(WorkItem *item)
     return false;
 }
 
-static bool workOnItem(WorkItem *item, void *arg)
+/* send to ZigbeeCore and await initial synchronous response (quick).  Returns true if that was successful */
+static bool xmit(WorkItem *item)
+{
+    scoped_generic char *payload = cJSON_PrintUnformatted(item->request);
+
+    if (requestChannel != NULL)
+    {
+        ZhalChannelResult result =
+            zhalChannelSend(requestChannel, item->requestId, payload, SOCKET_RECEIVE_TIMEOUT_SEC);
+        if (result != ZHAL_CHANNEL_UNAVAILABLE)
+        {
+            return result == ZHAL_CHANNEL_OK;
+        }
+
+        icLogWarn(
+            LOG_TAG, "request channel unavailable, sending requestId %" PRIu32 " on its own socket", item->requestId);
+    }
+
+    return xmitOnNewSocket(payload);
+}
+
+/* release an item's busy slot in its device queue and let the device's next item go */
+static void finishBusyItem(WorkItem *item)
+{
+    pthread_mutex_lock(&item->deviceQueue->mutex);
+    deviceQueueClearBusyNoLock(item->deviceQueue, item);
+    scheduleDeviceNoLock(item->deviceQueue);
+    pthread_mutex_unlock(&item->deviceQueue->mutex);
+}
+
+static void workOnItem(WorkItem *item)
 {
     pthread_mutex_lock(&item->mtx);
 
@@ -862,8 +1232,8 @@ static bool workOnItem(WorkItem *item, void *arg)
     if (item->timedOut)
     {
         pthread_mutex_unlock(&item->mtx);
-        // continue to iterate
-        return true;
+        finishBusyItem(item);
+        return;
     }
 
     // This filters out any sensitive data, if present, that should not be logged
@@ -879,16 +1249,6 @@ static bool workOnItem(WorkItem *item, void *arg)
     }
     pthread_mutex_unlock(&asyncRequestsMutex);
 
-    // set device queue busy
-    pthread_mutex_lock(&item->deviceQueue->mutex);
-    if (item->deviceQueue->isBusy > 0)
-    {
-        icLogError(
-            LOG_TAG, "device queue for %016" PRIx64 " is already busy (%d)!", item->eui64, item->deviceQueue->isBusy);
-    }
-    item->deviceQueue->isBusy++;
-    pthread_mutex_unlock(&item->deviceQueue->mutex);
-
     // send to ZigbeeCore and wait for immediate/synchronous response
     //  if successful, our async receiver will find and complete it via asyncRequests hash map
     if (xmit(item) == true)
@@ -906,46 +1266,30 @@ static bool workOnItem(WorkItem *item, void *arg)
         pthread_mutex_unlock(&asyncRequestsMutex);
 
         // clear busy for this device queue
-        pthread_mutex_lock(&item->deviceQueue->mutex);
-
-        if (didDeleteFromAsyncRequests == true && item->deviceQueue->isBusy > 0)
+        if (didDeleteFromAsyncRequests == true)
         {
-            item->deviceQueue->isBusy--;
-            if (item->deviceQueue->isBusy != 0)
-            {
-                icLogError(LOG_TAG,
-                           "device queue for %016" PRIx64 " is still busy (%d)!",
-                           item->eui64,
-                           item->deviceQueue->isBusy);
-            }
+            finishBusyItem(item);
         }
 
-        pthread_mutex_unlock(&item->deviceQueue->mutex);
-
         // since it failed, unlock the item here
         pthread_cond_signal(&item->cond);
         pthread_mutex_unlock(&item->mtx);
     }
-
-    return true; // continue to iterate
 }
 
+/*
+ * Workers take devices from the ready lanes and send one item for each, then put the device back in line if it has
+ * more to send.  Taking one item per turn keeps a device with a long queue from holding up the others.
+ */
 static void *workerThreadProc(void *arg)
 {
-    icQueue *availableWork = queueCreate();
+    pthread_mutex_lock(&workerMutex);
 
     // exit conditions are if shut down via zhalTerm or if error waiting for work
-    while (true)
+    while (workerShutdown == false)
     {
-        pthread_mutex_lock(&workerMutex);
-
-        if (workerShutdown)
-        {
-            pthread_mutex_unlock(&workerMutex);
-            break;
-        }
-
-        while (!getAvailableWork(availableWork))
+        DeviceQueue *dq = nextReadyDeviceNoLock();
+        if (dq == NULL)
         {
             // no work, so we wait till we get some or are shut down
             if (pthread_cond_wait(&workerCond, &workerMutex) != 0)
@@ -953,30 +1297,33 @@ static void *workerThreadProc(void *arg)
                 icLogError(LOG_TAG, "failed to wait on workerCond, terminating workerThreadProc!");
                 break;
             }
-            else if (workerShutdown)
-            {
-                break;
-            }
+            continue;
         }
 
-        bool shuttingDown = workerShutdown;
         pthread_mutex_unlock(&workerMutex);
 
-        if (shuttingDown)
+        // A device whose queued items are all held back by busy ones goes back in line when one of those finishes
+        pthread_mutex_lock(&dq->mutex);
+        WorkItem *item = takeReadyItemNoLock(dq);
+        if (item != NULL)
         {
-            break;
+            scheduleDeviceNoLock(dq);
         }
+        pthread_mutex_unlock(&dq->mutex);
 
-        // Process any items that were ready
-        queueIterate(availableWork, (queueIterateFunc) workOnItem, NULL);
+        if (item != NULL)
+        {
+            workOnItem(item);
+            workItemRelease(item);
+        }
+        deviceQueueRelease(dq);
 
-        // All items have been processed... clear the queue
-        queueClear(availableWork, workItemRelease);
+        pthread_mutex_lock(&workerMutex);
     }
 
-    icLogInfo(LOG_TAG, "workerThreadProc exiting");
+    pthread_mutex_unlock(&workerMutex);
 
-    queueDestroy(availableWork, workItemRelease);
+    icLogInfo(LOG_TAG, "workerThreadProc exiting");
 
     return NULL;
 }
@@ -1029,21 +1376,11 @@ static int handleIpcResponse(cJSON *response)
 
         if (item != NULL)
         {
-            // clear busy for this device queue
-            pthread_mutex_lock(&item->deviceQueue->mutex);
-
-            if (didDeleteFromAsyncRequests == true && item->deviceQueue->isBusy > 0)
+            // clear busy for this device queue, which may let its next item go
+            if (didDeleteFromAsyncRequests == true)
             {
-                item->deviceQueue->isBusy--;
-                if (item->deviceQueue->isBusy != 0)
-                {
-                    icLogError(LOG_TAG,
-                               "device queue for %016" PRIx64 " is still busy (%d)!",
-                               item->eui64,
-                               item->deviceQueue->isBusy);
-                }
+                finishBusyItem(item);
             }
-            pthread_mutex_unlock(&item->deviceQueue->mutex);
 
             pthread_mutex_lock(&item->mtx);
             item->response = response;
@@ -1058,11 +1395,6 @@ static int handleIpcResponse(cJSON *response)
         result = 1; // we handled it
     }
 
-    // this might have freed up a device queue, let the worker thread take another look.
-    pthread_mutex_lock(&workerMutex);
-    pthread_cond_signal(&workerCond);
-    pthread_mutex_unlock(&workerMutex);
-
     return result;
 }
 
@@ -21,6 +21,7 @@
 //
 //------------------------------ tabstop = 4 ----------------------------------
 
+#include "zhalBinaryEvent.h"
 #include "zhalPrivate.h"
 #include <cjson/cJSON.h>
 #include <icLog/logging.h>
@@ -1864,6 +1865,25 @@ bool zhalSetProperty(const char *key, const char *value)
     return sendRequestNoResponse(0, request) == 0;
 }
 
+bool zhalSetBinaryEvents(bool enabled)
+{
+    icLogDebug(LOG_TAG, "%s: enabled=%s", __FUNCTION__, enabled ? "true" : "false");
+
+    cJSON *request = cJSON_CreateObject();
+
+    cJSON_AddStringToObject(request, "request", "eventFormatConfigure");
+    cJSON_AddNumberToObject(request, "binaryVersion", enabled ? ZHAL_BINARY_EVENT_VERSION : 0);
+
+    cJSON *binaryEventTypes = cJSON_AddArrayToObject(request, "binaryEventTypes");
+    if (enabled == true)
+    {
+        cJSON_AddItemToArray(binaryEventTypes, cJSON_CreateString("attributeReport"));
+        cJSON_AddItemToArray(binaryEventTypes, cJSON_CreateString("clusterCommandReceived"));
+    }
+
+    return sendRequestNoResponse(0, request) == 0;
+}
+
 char *zhalTest(void)
 {
     icLogDebug(LOG_TAG, "%s", __FUNCTION__);
@@ -0,0 +1,163 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+
+#include <cjson/cJSON.h>
+#include <cmocka.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <zhalAsyncReceiver.c>
+
+#define TEST_HOST          "127.0.0.1"
+#define BLOCKED_EVENTS     (EVENT_DISPATCH_THREADS * 2)
+#define RESPONSE_WAIT_SECS 5
+
+static pthread_mutex_t responsesMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t responsesCond;
+static bool responded[BLOCKED_EVENTS];
+static int eventsAnswered = 0;
+static int eventsTimedOut = 0;
+
+static int getRequestId(cJSON *json)
+{
+    cJSON *requestId = cJSON_GetObjectItem(json, "requestId");
+    assert_non_null(requestId);
+    assert_in_range(requestId->valueint, 0, BLOCKED_EVENTS - 1);
+
+    return requestId->valueint;
+}
+
+/*
+ * Record the response and wake whichever event handler waits on it, like handleIpcResponse does
+ */
+static int ipcResponseHandler(cJSON *response)
+{
+    int requestId = getRequestId(response);
+
+    pthread_mutex_lock(&responsesMtx);
+    responded[requestId] = true;
+    pthread_cond_broadcast(&responsesCond);
+    pthread_mutex_unlock(&responsesMtx);
+
+    return 0;
+}
+
+/*
+ * Block on the response to a request, the way a handler that makes a ZHAL request from its callback does
+ */
+static int blockingEventHandler(cJSON *event)
+{
+    int requestId = getRequestId(event);
+    bool timedOut = false;
+
+    pthread_mutex_lock(&responsesMtx);
+    while (responded[requestId] == false && timedOut == false)
+    {
+        timedOut = incrementalCondTimedWait(&responsesCond, &responsesMtx, RESPONSE_WAIT_SECS) == ETIMEDOUT;
+    }
+
+    if (timedOut == true)
+    {
+        eventsTimedOut++;
+    }
+    else
+    {
+        eventsAnswered++;
+    }
+    pthread_cond_broadcast(&responsesCond);
+    pthread_mutex_unlock(&responsesMtx);
+
+    return 0;
+}
+
+static void sendDatagram(int sock, const char *payload)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(ZHAL_EVENT_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert_int_equal(sendto(sock, payload, strlen(payload), 0, (struct sockaddr *) &addr, sizeof(addr)),
+                     strlen(payload));
+}
+
+static void test_ipcResponsesReachHandlersBlockedInThePool(void **state)
+{
+    (void) state;
+
+    initTimedWaitCond(&responsesCond);
+    assert_int_equal(zhalAsyncReceiverStart(TEST_HOST, ipcResponseHandler, blockingEventHandler, NULL), 0);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    assert_true(sock >= 0);
+
+    // every pool thread ends up blocked on a response, with more events queued behind them
+    char payload[128];
+    for (int i = 0; i < BLOCKED_EVENTS; i++)
+    {
+        snprintf(payload,
+                 sizeof(payload),
+                 "{\"eventType\":\"attributeReport\",\"eui64\":\"%016x\",\"requestId\":%d}",
+                 i + 1,
+                 i);
+        sendDatagram(sock, payload);
+    }
+
+    for (int i = 0; i < BLOCKED_EVENTS; i++)
+    {
+        snprintf(payload, sizeof(payload), "{\"eventType\":\"ipcResponse\",\"requestId\":%d}", i);
+        sendDatagram(sock, payload);
+    }
+
+    pthread_mutex_lock(&responsesMtx);
+    while (eventsAnswered + eventsTimedOut < BLOCKED_EVENTS)
+    {
+        assert_int_not_equal(
+            incrementalCondTimedWait(&responsesCond, &responsesMtx, RESPONSE_WAIT_SECS * BLOCKED_EVENTS), ETIMEDOUT);
+    }
+    assert_int_equal(eventsAnswered, BLOCKED_EVENTS);
+    assert_int_equal(eventsTimedOut, 0);
+    pthread_mutex_unlock(&responsesMtx);
+
+    ZhalDispatcherStats stats;
+    zhalAsyncReceiverGetStats(&stats);
+    assert_int_equal(stats.dropped, 0);
+
+    close(sock);
+    zhalAsyncReceiverStop();
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_ipcResponsesReachHandlersBlockedInThePool),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,288 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+
+#include <cjson/cJSON.h>
+#include <cmocka.h>
+#include <icUtil/base64.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <zhalBinaryEvent.h>
+
+#define TEST_TARGET_EUI64     0x000d6f0003c04a7dULL
+#define CLUSTER_ID_TEMP       0x0402
+#define CLUSTER_ID_IAS_ZONE   0x0500
+#define PROFILE_ID_HA         0x0104
+#define MFG_CODE              0x10f2
+#define BENCHMARK_EVENT_COUNT 20000
+
+static const uint8_t reportPayload[] = {0x00, 0x00, 0x29, 0x34, 0x08};
+
+static void writeUint16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = value & 0xff;
+    buf[1] = value >> 8;
+}
+
+/*
+ * Build a frame the way ZigbeeCore does
+ */
+static size_t buildFrame(uint8_t *buf,
+                         ZhalBinaryEventType type,
+                         uint8_t flags,
+                         uint16_t clusterId,
+                         const uint8_t *payload,
+                         uint16_t payloadLen)
+{
+    memset(buf, 0, ZHAL_BINARY_EVENT_HEADER_SIZE);
+    buf[0] = ZHAL_BINARY_EVENT_MAGIC;
+    buf[1] = ZHAL_BINARY_EVENT_VERSION;
+    buf[2] = type;
+    buf[3] = flags;
+    for (int i = 0; i < 8; i++)
+    {
+        buf[4 + i] = (TEST_TARGET_EUI64 >> (8 * i)) & 0xff;
+    }
+    buf[12] = 1;
+    writeUint16(&buf[13], PROFILE_ID_HA);
+    writeUint16(&buf[15], clusterId);
+    buf[17] = 0x00;
+    writeUint16(&buf[18], MFG_CODE);
+    buf[20] = 0x21;
+    buf[21] = 0x42;
+    buf[22] = (uint8_t) -60;
+    buf[23] = 200;
+    writeUint16(&buf[24], payloadLen);
+    if (payloadLen > 0)
+    {
+        memcpy(&buf[ZHAL_BINARY_EVENT_HEADER_SIZE], payload, payloadLen);
+    }
+
+    return ZHAL_BINARY_EVENT_HEADER_SIZE + payloadLen;
+}
+
+static void test_decodeAttributeReport(void **state)
+{
+    (void) state;
+
+    uint8_t frame[64];
+    size_t len = buildFrame(frame,
+                            ZHAL_BINARY_EVENT_ATTRIBUTE_REPORT,
+                            ZHAL_BINARY_EVENT_FLAG_HAS_MFG_CODE,
+                            CLUSTER_ID_TEMP,
+                            reportPayload,
+                            sizeof(reportPayload));
+
+    assert_true(zhalBinaryEventIsFrame(frame, len));
+
+    ZhalBinaryEvent *event = zhalBinaryEventDecode(frame, len);
+    assert_non_null(event);
+    assert_int_equal(event->type, ZHAL_BINARY_EVENT_ATTRIBUTE_REPORT);
+    assert_int_equal(event->eui64, TEST_TARGET_EUI64);
+    assert_null(event->command);
+
+    ReceivedAttributeReport *report = event->report;
+    assert_non_null(report);
+    assert_int_equal(report->eui64, TEST_TARGET_EUI64);
+    assert_int_equal(report->sourceEndpoint, 1);
+    assert_int_equal(report->clusterId, CLUSTER_ID_TEMP);
+    assert_int_equal(report->rssi, -60);
+    assert_int_equal(report->lqi, 200);
+    assert_int_equal(report->mfgId, MFG_CODE);
+    assert_int_equal(report->reportDataLen, sizeof(reportPayload));
+    assert_memory_equal(report->reportData, reportPayload, sizeof(reportPayload));
+
+    zhalBinaryEventDestroy(event);
+}
+
+static void test_decodeClusterCommand(void **state)
+{
+    (void) state;
+
+    const uint8_t zoneStatus[] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x00};
+    uint8_t frame[64];
+    size_t len = buildFrame(frame,
+                            ZHAL_BINARY_EVENT_CLUSTER_COMMAND,
+                            ZHAL_BINARY_EVENT_FLAG_FROM_SERVER,
+                            CLUSTER_ID_IAS_ZONE,
+                            zoneStatus,
+                            sizeof(zoneStatus));
+
+    ZhalBinaryEvent *event = zhalBinaryEventDecode(frame, len);
+    assert_non_null(event);
+    assert_int_equal(event->type, ZHAL_BINARY_EVENT_CLUSTER_COMMAND);
+    assert_null(event->report);
+
+    ReceivedClusterCommand *command = event->command;
+    assert_non_null(command);
+    assert_int_equal(command->eui64, TEST_TARGET_EUI64);
+    assert_int_equal(command->sourceEndpoint, 1);
+    assert_int_equal(command->profileId, PROFILE_ID_HA);
+    assert_int_equal(command->clusterId, CLUSTER_ID_IAS_ZONE);
+    assert_int_equal(command->commandId, 0x00);
+    assert_true(command->fromServer);
+    assert_false(command->mfgSpecific);
+    assert_int_equal(command->seqNum, 0x21);
+    assert_int_equal(command->apsSeqNum, 0x42);
+    assert_int_equal(command->rssi, -60);
+    assert_int_equal(command->lqi, 200);
+    assert_int_equal(command->commandDataLen, sizeof(zoneStatus));
+    assert_memory_equal(command->commandData, zoneStatus, sizeof(zoneStatus));
+
+    zhalBinaryEventDestroy(event);
+}
+
+static void test_decodeEmptyPayload(void **state)
+{
+    (void) state;
+
+    uint8_t frame[64];
+    size_t len = buildFrame(frame, ZHAL_BINARY_EVENT_CLUSTER_COMMAND, 0, CLUSTER_ID_IAS_ZONE, NULL, 0);
+
+    ZhalBinaryEvent *event = zhalBinaryEventDecode(frame, len);
+    assert_non_null(event);
+    assert_null(event->command->commandData);
+    assert_int_equal(event->command->commandDataLen, 0);
+
+    zhalBinaryEventDestroy(event);
+}
+
+static void test_rejectMalformedFrames(void **state)
+{
+    (void) state;
+
+    uint8_t frame[64];
+    size_t len = buildFrame(frame,
+                            ZHAL_BINARY_EVENT_ATTRIBUTE_REPORT,
+                            0,
+                            CLUSTER_ID_TEMP,
+                            reportPayload,
+                            sizeof(reportPayload));
+
+    // JSON is never mistaken for a frame
+    const char *json = "{\"eventType\":\"attributeReport\"}";
+    assert_false(zhalBinaryEventIsFrame((const uint8_t *) json, strlen(json)));
+
+    // truncated header or payload
+    assert_null(zhalBinaryEventDecode(frame, ZHAL_BINARY_EVENT_HEADER_SIZE - 1));
+    assert_null(zhalBinaryEventDecode(frame, len - 1));
+
+    // trailing bytes
+    assert_null(zhalBinaryEventDecode(frame, len + 1));
+
+    frame[1] = ZHAL_BINARY_EVENT_VERSION + 1;
+    assert_null(zhalBinaryEventDecode(frame, len));
+    frame[1] = ZHAL_BINARY_EVENT_VERSION;
+
+    frame[2] = 0x7f;
+    assert_null(zhalBinaryEventDecode(frame, len));
+}
+
+static uint64_t elapsedMicros(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) (now.tv_sec - start->tv_sec) * 1000000ULL + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/*
+ * Decode the same attribute report both ways, the JSON one the way the event handler does, and report the rates
+ */
+static void test_benchmarkDecodeRate(void **state)
+{
+    (void) state;
+
+    uint8_t frame[64];
+    size_t len = buildFrame(frame,
+                            ZHAL_BINARY_EVENT_ATTRIBUTE_REPORT,
+                            0,
+                            CLUSTER_ID_TEMP,
+                            reportPayload,
+                            sizeof(reportPayload));
+
+    char *encodedBuf = icEncodeBase64((uint8_t *) reportPayload, sizeof(reportPayload));
+    char json[256];
+    snprintf(json,
+             sizeof(json),
+             "{\"eventType\":\"attributeReport\",\"eui64\":\"%016" PRIx64 "\",\"sourceEndpoint\":1,"
+             "\"clusterId\":%d,\"encodedBuf\":\"%s\",\"rssi\":-60,\"lqi\":200}",
+             (uint64_t) TEST_TARGET_EUI64,
+             CLUSTER_ID_TEMP,
+             encodedBuf);
+    free(encodedBuf);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < BENCHMARK_EVENT_COUNT; i++)
+    {
+        cJSON *event = cJSON_Parse(json);
+        ReceivedAttributeReport *report = calloc(1, sizeof(ReceivedAttributeReport));
+        sscanf(cJSON_GetObjectItem(event, "eui64")->valuestring, "%016" PRIx64, &report->eui64);
+        report->sourceEndpoint = (uint8_t) cJSON_GetObjectItem(event, "sourceEndpoint")->valueint;
+        report->clusterId = (uint16_t) cJSON_GetObjectItem(event, "clusterId")->valueint;
+        report->rssi = (int8_t) cJSON_GetObjectItem(event, "rssi")->valueint;
+        report->lqi = (uint8_t) cJSON_GetObjectItem(event, "lqi")->valueint;
+        assert_true(icDecodeBase64(
+            cJSON_GetObjectItem(event, "encodedBuf")->valuestring, &report->reportData, &report->reportDataLen));
+        assert_int_equal(report->eui64, TEST_TARGET_EUI64);
+        freeReceivedAttributeReport(report);
+        cJSON_Delete(event);
+    }
+    uint64_t jsonMicros = elapsedMicros(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < BENCHMARK_EVENT_COUNT; i++)
+    {
+        ZhalBinaryEvent *event = zhalBinaryEventDecode(frame, len);
+        assert_int_equal(event->report->eui64, TEST_TARGET_EUI64);
+        zhalBinaryEventDestroy(event);
+    }
+    uint64_t binaryMicros = elapsedMicros(&start);
+
+    print_message("json attribute reports: %.0f events/sec, %zu bytes each\n",
+                  BENCHMARK_EVENT_COUNT * 1000000.0 / (jsonMicros > 0 ? jsonMicros : 1),
+                  strlen(json));
+    print_message("binary attribute reports: %.0f events/sec, %zu bytes each\n",
+                  BENCHMARK_EVENT_COUNT * 1000000.0 / (binaryMicros > 0 ? binaryMicros : 1),
+                  len);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_decodeAttributeReport),
+        cmocka_unit_test(test_decodeClusterCommand),
+        cmocka_unit_test(test_decodeEmptyPayload),
+        cmocka_unit_test(test_rejectMalformedFrames),
+        cmocka_unit_test(test_benchmarkDecodeRate),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,464 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+
+#include <arpa/inet.h>
+#include <cjson/cJSON.h>
+#include <cmocka.h>
+#include <icConcurrent/threadUtils.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <zhalImpl.c>
+
+#define MOCK_HOST               "127.0.0.1"
+#define ACK_TIMEOUT_SECS        5
+#define BENCHMARK_REQUEST_COUNT 500
+
+#define TEST_TARGET_EUI64       0x000d6f0003c04a7d
+
+/*
+ * A stand in for ZigbeeCore's ipc socket.  It reads length prefixed requests and acks each one on the
+ * connection it came in on.
+ */
+typedef struct
+{
+    int listenFd;
+    int port;
+    pthread_t thread;
+    bool closeAfterAck;    // take one request per connection, like ZigbeeCore without a persistent channel
+    bool closeBeforeAck;   // take one request per connection and hang up without acking it
+    bool omitRequestId;    // ack without a requestId
+    bool swapFirstTwoAcks; // hold the first ack until the second request arrives, then ack both in reverse
+    bool sendIpcResponse;  // follow each ack with its ipc response on the same connection
+    int connections;
+    int closedConnections;
+    int requests;
+} MockZigbeeCore;
+
+static pthread_mutex_t ipcResponseMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ipcResponseCond = PTHREAD_COND_INITIALIZER;
+static int ipcResponseRequestId = -1;
+
+static bool mockRead(int fd, void *buf, size_t len)
+{
+    char *pos = buf;
+    while (len > 0)
+    {
+        ssize_t received = recv(fd, pos, len, 0);
+        if (received <= 0)
+        {
+            return false;
+        }
+        pos += received;
+        len -= (size_t) received;
+    }
+
+    return true;
+}
+
+static void mockWriteFrame(int fd, const char *json)
+{
+    uint16_t len = htons((uint16_t) strlen(json));
+    send(fd, &len, sizeof(len), MSG_NOSIGNAL);
+    send(fd, json, strlen(json), MSG_NOSIGNAL);
+}
+
+static void mockAck(MockZigbeeCore *mock, int fd, int requestId)
+{
+    char json[128];
+    if (mock->omitRequestId)
+    {
+        snprintf(json, sizeof(json), "{\"resultCode\":0}");
+    }
+    else
+    {
+        snprintf(json, sizeof(json), "{\"resultCode\":0,\"requestId\":%d}", requestId);
+    }
+    mockWriteFrame(fd, json);
+
+    if (mock->sendIpcResponse)
+    {
+        snprintf(json, sizeof(json), "{\"eventType\":\"ipcResponse\",\"resultCode\":0,\"requestId\":%d}", requestId);
+        mockWriteFrame(fd, json);
+    }
+}
+
+static void mockServeConnection(MockZigbeeCore *mock, int fd)
+{
+    int heldRequestId = -1;
+    uint8_t lenBytes[2];
+
+    // requests carry their length in little endian order
+    while (mockRead(fd, lenBytes, sizeof(lenBytes)))
+    {
+        uint16_t len = (uint16_t) (lenBytes[0] | (lenBytes[1] << 8));
+        char *payload = calloc(1, len + 1U);
+        if (!mockRead(fd, payload, len))
+        {
+            free(payload);
+            break;
+        }
+
+        cJSON *request = cJSON_Parse(payload);
+        free(payload);
+        int requestId = cJSON_GetObjectItem(request, "requestId")->valueint;
+        cJSON_Delete(request);
+
+        int requestNumber = __atomic_fetch_add(&mock->requests, 1, __ATOMIC_SEQ_CST);
+
+        if (mock->closeBeforeAck)
+        {
+            break;
+        }
+
+        if (mock->swapFirstTwoAcks && requestNumber == 0)
+        {
+            heldRequestId = requestId;
+            continue;
+        }
+
+        mockAck(mock, fd, requestId);
+        if (heldRequestId >= 0)
+        {
+            mockAck(mock, fd, heldRequestId);
+            heldRequestId = -1;
+        }
+
+        if (mock->closeAfterAck)
+        {
+            break;
+        }
+    }
+}
+
+static void *mockZigbeeCoreThreadProc(void *arg)
+{
+    MockZigbeeCore *mock = arg;
+    int fd;
+
+    while ((fd = accept(mock->listenFd, NULL, NULL)) >= 0)
+    {
+        __atomic_fetch_add(&mock->connections, 1, __ATOMIC_SEQ_CST);
+        mockServeConnection(mock, fd);
+        close(fd);
+        __atomic_fetch_add(&mock->closedConnections, 1, __ATOMIC_SEQ_CST);
+    }
+
+    return NULL;
+}
+
+static void mockZigbeeCoreStart(MockZigbeeCore *mock)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    mock->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    assert_true(mock->listenFd >= 0);
+    assert_int_equal(bind(mock->listenFd, (struct sockaddr *) &addr, sizeof(addr)), 0);
+    assert_int_equal(listen(mock->listenFd, 16), 0);
+    assert_int_equal(getsockname(mock->listenFd, (struct sockaddr *) &addr, &addrLen), 0);
+    mock->port = ntohs(addr.sin_port);
+
+    assert_true(createThread(&mock->thread, mockZigbeeCoreThreadProc, mock, "mockZigbeeCore"));
+}
+
+static void mockZigbeeCoreStop(MockZigbeeCore *mock)
+{
+    shutdown(mock->listenFd, SHUT_RDWR);
+    pthread_join(mock->thread, NULL);
+    close(mock->listenFd);
+}
+
+static char *createPayload(uint32_t rid)
+{
+    cJSON *request = cJSON_CreateObject();
+    cJSON_AddNumberToObject(request, "requestId", rid);
+    char *payload = cJSON_PrintUnformatted(request);
+    cJSON_Delete(request);
+
+    return payload;
+}
+
+typedef struct
+{
+    ZhalChannel *channel;
+    uint32_t requestId;
+    ZhalChannelResult result;
+} ChannelSendArgs;
+
+static void *channelSendThreadProc(void *arg)
+{
+    ChannelSendArgs *args = arg;
+    scoped_generic char *payload = createPayload(args->requestId);
+    args->result = zhalChannelSend(args->channel, args->requestId, payload, ACK_TIMEOUT_SECS);
+
+    return NULL;
+}
+
+static int recordIpcResponse(cJSON *response)
+{
+    pthread_mutex_lock(&ipcResponseMtx);
+    ipcResponseRequestId = cJSON_GetObjectItem(response, "requestId")->valueint;
+    pthread_cond_signal(&ipcResponseCond);
+    pthread_mutex_unlock(&ipcResponseMtx);
+
+    return 0;
+}
+
+static void test_channelCorrelatesAcksByRequestId(void **state)
+{
+    (void) state;
+
+    MockZigbeeCore mock = {.swapFirstTwoAcks = true};
+    mockZigbeeCoreStart(&mock);
+    ZhalChannel *channel = zhalChannelCreate(MOCK_HOST, mock.port, NULL);
+
+    // the first request is only acked after the second is written, so both must be in flight at once
+    ChannelSendArgs first = {.channel = channel, .requestId = 10, .result = ZHAL_CHANNEL_UNAVAILABLE};
+    ChannelSendArgs second = {.channel = channel, .requestId = 11, .result = ZHAL_CHANNEL_UNAVAILABLE};
+    pthread_t firstThread;
+    assert_true(createThread(&firstThread, channelSendThreadProc, &first, "firstSend"));
+    while (__atomic_load_n(&mock.requests, __ATOMIC_SEQ_CST) == 0)
+    {
+        usleep(1000);
+    }
+    channelSendThreadProc(&second);
+    pthread_join(firstThread, NULL);
+
+    assert_int_equal(first.result, ZHAL_CHANNEL_OK);
+    assert_int_equal(second.result, ZHAL_CHANNEL_OK);
+    assert_int_equal(mock.connections, 1);
+
+    zhalChannelDestroy(channel);
+    mockZigbeeCoreStop(&mock);
+}
+
+static void test_channelPairsAcksWithoutRequestIdInOrder(void **state)
+{
+    (void) state;
+
+    MockZigbeeCore mock = {.omitRequestId = true};
+    mockZigbeeCoreStart(&mock);
+    ZhalChannel *channel = zhalChannelCreate(MOCK_HOST, mock.port, NULL);
+
+    for (uint32_t rid = 0; rid < 5; rid++)
+    {
+        scoped_generic char *payload = createPayload(rid);
+        assert_int_equal(zhalChannelSend(channel, rid, payload, ACK_TIMEOUT_SECS), ZHAL_CHANNEL_OK);
+    }
+    assert_int_equal(mock.connections, 1);
+
+    zhalChannelDestroy(channel);
+    mockZigbeeCoreStop(&mock);
+}
+
+static void test_channelReconnectsWhenClosed(void **state)
+{
+    (void) state;
+
+    MockZigbeeCore mock = {.closeAfterAck = true};
+    mockZigbeeCoreStart(&mock);
+    ZhalChannel *channel = zhalChannelCreate(MOCK_HOST, mock.port, NULL);
+
+    for (uint32_t rid = 0; rid < 3; rid++)
+    {
+        scoped_generic char *payload = createPayload(rid);
+        assert_int_equal(zhalChannelSend(channel, rid, payload, ACK_TIMEOUT_SECS), ZHAL_CHANNEL_OK);
+
+        // the next request has to find the stream closed, not race the hang up
+        while (__atomic_load_n(&mock.closedConnections, __ATOMIC_SEQ_CST) <= (int) rid)
+        {
+            usleep(1000);
+        }
+    }
+    assert_int_equal(mock.requests, 3);
+    assert_int_equal(mock.connections, 3);
+
+    zhalChannelDestroy(channel);
+    mockZigbeeCoreStop(&mock);
+}
+
+static void test_channelDoesNotResendAfterWrite(void **state)
+{
+    (void) state;
+
+    MockZigbeeCore mock = {.closeBeforeAck = true};
+    mockZigbeeCoreStart(&mock);
+    zigbeeIp = strdup(MOCK_HOST);
+    zigbeePort = mock.port;
+    requestChannel = zhalChannelCreate(MOCK_HOST, mock.port, NULL);
+
+    // ZigbeeCore may have acted on a request it read before hanging up, so it must not be sent again on the
+    // channel or on a socket of its own
+    DeviceQueue *deviceQueue = createDeviceQueue();
+    cJSON *request = cJSON_CreateObject();
+    WorkItem *item = createItem(TEST_TARGET_EUI64, request, deviceQueue);
+    assert_false(xmit(item));
+    workItemRelease(item);
+    cJSON_Delete(request);
+    deviceQueueRelease(deviceQueue);
+
+    zhalChannelDestroy(requestChannel);
+    requestChannel = NULL;
+    free(zigbeeIp);
+    zigbeeIp = NULL;
+    mockZigbeeCoreStop(&mock);
+
+    assert_int_equal(mock.requests, 1);
+    assert_int_equal(mock.connections, 1);
+}
+
+static void test_channelUnavailableWithoutZigbeeCore(void **state)
+{
+    (void) state;
+
+    // take a free port, then stop listening on it
+    MockZigbeeCore mock = {0};
+    mockZigbeeCoreStart(&mock);
+    mockZigbeeCoreStop(&mock);
+
+    ZhalChannel *channel = zhalChannelCreate(MOCK_HOST, mock.port, NULL);
+    scoped_generic char *payload = createPayload(0);
+    assert_int_equal(zhalChannelSend(channel, 0, payload, ACK_TIMEOUT_SECS), ZHAL_CHANNEL_UNAVAILABLE);
+    zhalChannelDestroy(channel);
+}
+
+static void test_channelDeliversIpcResponses(void **state)
+{
+    (void) state;
+
+    MockZigbeeCore mock = {.sendIpcResponse = true};
+    mockZigbeeCoreStart(&mock);
+    ZhalChannel *channel = zhalChannelCreate(MOCK_HOST, mock.port, recordIpcResponse);
+
+    initTimedWaitCond(&ipcResponseCond);
+    ipcResponseRequestId = -1;
+
+    scoped_generic char *payload = createPayload(42);
+    assert_int_equal(zhalChannelSend(channel, 42, payload, ACK_TIMEOUT_SECS), ZHAL_CHANNEL_OK);
+
+    pthread_mutex_lock(&ipcResponseMtx);
+    while (ipcResponseRequestId == -1)
+    {
+        assert_int_not_equal(incrementalCondTimedWait(&ipcResponseCond, &ipcResponseMtx, ACK_TIMEOUT_SECS),
+                             ETIMEDOUT);
+    }
+    assert_int_equal(ipcResponseRequestId, 42);
+    pthread_mutex_unlock(&ipcResponseMtx);
+
+    zhalChannelDestroy(channel);
+    mockZigbeeCoreStop(&mock);
+}
+
+static uint64_t elapsedMicros(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) (now.tv_sec - start->tv_sec) * 1000000ULL + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/*
+ * Send requests through xmit the way the worker does and report the rate
+ */
+static double measureRequestRate(void)
+{
+    DeviceQueue *deviceQueue = createDeviceQueue();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < BENCHMARK_REQUEST_COUNT; i++)
+    {
+        cJSON *request = cJSON_CreateObject();
+        WorkItem *item = createItem(TEST_TARGET_EUI64, request, deviceQueue);
+        assert_true(xmit(item));
+        workItemRelease(item);
+        cJSON_Delete(request);
+    }
+
+    uint64_t micros = elapsedMicros(&start);
+    deviceQueueRelease(deviceQueue);
+
+    return BENCHMARK_REQUEST_COUNT * 1000000.0 / (micros > 0 ? micros : 1);
+}
+
+static void test_benchmarkRequestRate(void **state)
+{
+    (void) state;
+
+    MockZigbeeCore mock = {0};
+    mockZigbeeCoreStart(&mock);
+    zigbeeIp = strdup(MOCK_HOST);
+    zigbeePort = mock.port;
+
+    requestChannel = NULL;
+    double socketPerRequestRate = measureRequestRate();
+    int socketPerRequestConnections = mock.connections;
+
+    requestChannel = zhalChannelCreate(MOCK_HOST, mock.port, NULL);
+    double persistentRate = measureRequestRate();
+    zhalChannelDestroy(requestChannel);
+    requestChannel = NULL;
+
+    print_message("socket per request: %.0f requests/sec over %d connections\n",
+                  socketPerRequestRate,
+                  socketPerRequestConnections);
+    print_message("persistent channel: %.0f requests/sec over %d connections\n",
+                  persistentRate,
+                  mock.connections - socketPerRequestConnections);
+
+    assert_int_equal(socketPerRequestConnections, BENCHMARK_REQUEST_COUNT);
+    assert_int_equal(mock.connections - socketPerRequestConnections, 1);
+
+    free(zigbeeIp);
+    zigbeeIp = NULL;
+    mockZigbeeCoreStop(&mock);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_channelCorrelatesAcksByRequestId),
+        cmocka_unit_test(test_channelPairsAcksWithoutRequestIdInOrder),
+        cmocka_unit_test(test_channelReconnectsWhenClosed),
+        cmocka_unit_test(test_channelDoesNotResendAfterWrite),
+        cmocka_unit_test(test_channelUnavailableWithoutZigbeeCore),
+        cmocka_unit_test(test_channelDeliversIpcResponses),
+        cmocka_unit_test(test_benchmarkRequestRate),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,338 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+
+#include <cjson/cJSON.h>
+#include <cmocka.h>
+#include <errno.h>
+#include <icConcurrent/threadUtils.h>
+#include <icConcurrent/timedWait.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <zhalDispatcher.h>
+
+#define STRESS_PRODUCERS          4
+#define STRESS_DEVICES_PER_THREAD 8
+#define STRESS_EVENTS_PER_DEVICE  250
+#define STRESS_DEVICES            (STRESS_PRODUCERS * STRESS_DEVICES_PER_THREAD)
+#define STRESS_QUEUE_LIMIT        32
+#define WAIT_TIMEOUT_SECS         10
+
+static pthread_mutex_t handlerMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t handlerCond;
+static int lastSequence[STRESS_DEVICES + 1];
+static int outOfOrder = 0;
+static int started = 0;
+static bool gateOpen = true;
+
+static cJSON *createEvent(uint64_t eui64, int sequence)
+{
+    cJSON *event = cJSON_CreateObject();
+    cJSON_AddNumberToObject(event, "device", (double) eui64);
+    cJSON_AddNumberToObject(event, "sequence", sequence);
+
+    return event;
+}
+
+/*
+ * Record that an event for a device arrived, noting any that arrive out of order
+ */
+static int recordingHandler(cJSON *event)
+{
+    int device = cJSON_GetObjectItem(event, "device")->valueint;
+    int sequence = cJSON_GetObjectItem(event, "sequence")->valueint;
+
+    pthread_mutex_lock(&handlerMtx);
+    if (sequence != lastSequence[device] + 1)
+    {
+        outOfOrder++;
+    }
+    lastSequence[device] = sequence;
+    pthread_mutex_unlock(&handlerMtx);
+
+    // give the other threads a chance to jump ahead if ordering were broken
+    if (sequence % 16 == 0)
+    {
+        usleep(100);
+    }
+
+    return 0;
+}
+
+/*
+ * Block until the test opens the gate
+ */
+static int gatedHandler(cJSON *event)
+{
+    pthread_mutex_lock(&handlerMtx);
+    started++;
+    pthread_cond_broadcast(&handlerCond);
+    while (gateOpen == false)
+    {
+        pthread_cond_wait(&handlerCond, &handlerMtx);
+    }
+    pthread_mutex_unlock(&handlerMtx);
+
+    cJSON_Delete(event);
+
+    return 1;
+}
+
+static void waitForStarted(int count)
+{
+    pthread_mutex_lock(&handlerMtx);
+    while (started < count)
+    {
+        assert_int_not_equal(incrementalCondTimedWait(&handlerCond, &handlerMtx, WAIT_TIMEOUT_SECS), ETIMEDOUT);
+    }
+    pthread_mutex_unlock(&handlerMtx);
+}
+
+static void openGate(void)
+{
+    pthread_mutex_lock(&handlerMtx);
+    gateOpen = true;
+    pthread_cond_broadcast(&handlerCond);
+    pthread_mutex_unlock(&handlerMtx);
+}
+
+static void waitForDispatched(ZhalDispatcher *dispatcher, uint64_t count)
+{
+    ZhalDispatcherStats stats;
+
+    for (int i = 0; i < WAIT_TIMEOUT_SECS * 100; i++)
+    {
+        zhalDispatcherGetStats(dispatcher, &stats);
+        if (stats.dispatched >= count)
+        {
+            return;
+        }
+        usleep(10000);
+    }
+
+    fail_msg("only %llu of %llu payloads were dispatched",
+             (unsigned long long) stats.dispatched,
+             (unsigned long long) count);
+}
+
+static int setupHandlers(void **state)
+{
+    (void) state;
+
+    initTimedWaitCond(&handlerCond);
+    memset(lastSequence, 0, sizeof(lastSequence));
+    outOfOrder = 0;
+    started = 0;
+    gateOpen = true;
+
+    return 0;
+}
+
+typedef struct
+{
+    ZhalDispatcher *dispatcher;
+    int firstDevice;
+    int failedSubmits;
+} ProducerArgs;
+
+static void *producerThreadProc(void *arg)
+{
+    ProducerArgs *args = arg;
+
+    for (int sequence = 1; sequence <= STRESS_EVENTS_PER_DEVICE; sequence++)
+    {
+        for (int i = 0; i < STRESS_DEVICES_PER_THREAD; i++)
+        {
+            uint64_t device = args->firstDevice + i;
+            cJSON *event = createEvent(device, sequence);
+            if (zhalDispatcherSubmit(args->dispatcher, device, recordingHandler, event) == false)
+            {
+                cJSON_Delete(event);
+                args->failedSubmits++;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void test_stormKeepsPerDeviceOrder(void **state)
+{
+    (void) state;
+
+    // a small queue and a long wait for room, so every producer is held back instead of dropping
+    ZhalDispatcher *dispatcher = zhalDispatcherCreate("testDispatch", 4, STRESS_QUEUE_LIMIT, WAIT_TIMEOUT_SECS * 1000);
+    pthread_t producers[STRESS_PRODUCERS];
+    ProducerArgs args[STRESS_PRODUCERS];
+
+    for (int i = 0; i < STRESS_PRODUCERS; i++)
+    {
+        args[i].dispatcher = dispatcher;
+        args[i].firstDevice = 1 + i * STRESS_DEVICES_PER_THREAD;
+        args[i].failedSubmits = 0;
+        assert_true(createThread(&producers[i], producerThreadProc, &args[i], "testProducer"));
+    }
+
+    for (int i = 0; i < STRESS_PRODUCERS; i++)
+    {
+        pthread_join(producers[i], NULL);
+        assert_int_equal(args[i].failedSubmits, 0);
+    }
+
+    waitForDispatched(dispatcher, STRESS_DEVICES * STRESS_EVENTS_PER_DEVICE);
+
+    ZhalDispatcherStats stats;
+    zhalDispatcherGetStats(dispatcher, &stats);
+    assert_int_equal(stats.dispatched, STRESS_DEVICES * STRESS_EVENTS_PER_DEVICE);
+    assert_int_equal(stats.dropped, 0);
+    assert_int_equal(stats.queued, 0);
+    assert_true(stats.maxQueued <= STRESS_QUEUE_LIMIT);
+
+    assert_int_equal(outOfOrder, 0);
+    for (int device = 1; device <= STRESS_DEVICES; device++)
+    {
+        assert_int_equal(lastSequence[device], STRESS_EVENTS_PER_DEVICE);
+    }
+
+    print_message("storm: %d events, %llu submits waited for room\n",
+                  STRESS_DEVICES * STRESS_EVENTS_PER_DEVICE,
+                  (unsigned long long) stats.delayed);
+
+    zhalDispatcherDestroy(dispatcher);
+}
+
+static void test_sameDeviceWaitsOtherDevicesDoNot(void **state)
+{
+    (void) state;
+
+    ZhalDispatcher *dispatcher = zhalDispatcherCreate("testDispatch", 3, 8, 0);
+    gateOpen = false;
+
+    assert_true(zhalDispatcherSubmit(dispatcher, 1, gatedHandler, createEvent(1, 1)));
+    assert_true(zhalDispatcherSubmit(dispatcher, 1, gatedHandler, createEvent(1, 2)));
+    assert_true(zhalDispatcherSubmit(dispatcher, 2, gatedHandler, createEvent(2, 1)));
+
+    // the second event for device 1 waits for the first even though a thread is free
+    waitForStarted(2);
+    usleep(50000);
+    pthread_mutex_lock(&handlerMtx);
+    assert_int_equal(started, 2);
+    pthread_mutex_unlock(&handlerMtx);
+
+    ZhalDispatcherStats stats;
+    zhalDispatcherGetStats(dispatcher, &stats);
+    assert_int_equal(stats.queued, 1);
+
+    openGate();
+    waitForDispatched(dispatcher, 3);
+
+    zhalDispatcherDestroy(dispatcher);
+}
+
+static void test_unorderedPayloadsRunTogether(void **state)
+{
+    (void) state;
+
+    ZhalDispatcher *dispatcher = zhalDispatcherCreate("testDispatch", 3, 8, 0);
+    gateOpen = false;
+
+    for (int i = 0; i < 3; i++)
+    {
+        assert_true(zhalDispatcherSubmit(dispatcher, ZHAL_DISPATCH_UNORDERED, gatedHandler, createEvent(0, i)));
+    }
+
+    waitForStarted(3);
+
+    openGate();
+    waitForDispatched(dispatcher, 3);
+
+    zhalDispatcherDestroy(dispatcher);
+}
+
+static void test_fullQueueDrops(void **state)
+{
+    (void) state;
+
+    ZhalDispatcher *dispatcher = zhalDispatcherCreate("testDispatch", 1, 2, 10);
+    gateOpen = false;
+
+    assert_true(zhalDispatcherSubmit(dispatcher, 1, gatedHandler, createEvent(1, 1)));
+    waitForStarted(1);
+
+    assert_true(zhalDispatcherSubmit(dispatcher, 1, gatedHandler, createEvent(1, 2)));
+    assert_true(zhalDispatcherSubmit(dispatcher, 1, gatedHandler, createEvent(1, 3)));
+
+    cJSON *dropped = createEvent(1, 4);
+    assert_false(zhalDispatcherSubmit(dispatcher, 1, gatedHandler, dropped));
+    cJSON_Delete(dropped);
+
+    ZhalDispatcherStats stats;
+    zhalDispatcherGetStats(dispatcher, &stats);
+    assert_int_equal(stats.delayed, 1);
+    assert_int_equal(stats.dropped, 1);
+    assert_int_equal(stats.queued, 2);
+    assert_int_equal(stats.maxQueued, 2);
+
+    openGate();
+    waitForDispatched(dispatcher, 3);
+
+    zhalDispatcherDestroy(dispatcher);
+}
+
+static void test_destroyDropsWaitingPayloads(void **state)
+{
+    (void) state;
+
+    ZhalDispatcher *dispatcher = zhalDispatcherCreate("testDispatch", 1, 8, 0);
+    gateOpen = false;
+
+    assert_true(zhalDispatcherSubmit(dispatcher, 1, gatedHandler, createEvent(1, 1)));
+    waitForStarted(1);
+    assert_true(zhalDispatcherSubmit(dispatcher, 1, gatedHandler, createEvent(1, 2)));
+
+    // the handler in progress finishes, the one still waiting is freed without being handled
+    openGate();
+    zhalDispatcherDestroy(dispatcher);
+
+    pthread_mutex_lock(&handlerMtx);
+    assert_true(started <= 2);
+    pthread_mutex_unlock(&handlerMtx);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_stormKeepsPerDeviceOrder, setupHandlers, NULL),
+        cmocka_unit_test_setup_teardown(test_sameDeviceWaitsOtherDevicesDoNot, setupHandlers, NULL),
+        cmocka_unit_test_setup_teardown(test_unorderedPayloadsRunTogether, setupHandlers, NULL),
+        cmocka_unit_test_setup_teardown(test_fullQueueDrops, setupHandlers, NULL),
+        cmocka_unit_test_setup_teardown(test_destroyDropsWaitingPayloads, setupHandlers, NULL),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
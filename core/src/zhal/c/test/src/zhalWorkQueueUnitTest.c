@@ -0,0 +1,459 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+
+#include <cjson/cJSON.h>
+#include <cmocka.h>
+#include <stdint.h>
+#include <string.h>
+#include <zhalImpl.c>
+
+#define TEST_TARGET_EUI64 0x000d6f0003c04a7d
+#define ENDPOINT_ID       1
+#define CLUSTER_ID_ONOFF  0x0006
+#define CLUSTER_ID_LEVEL  0x0008
+#define CLUSTER_ID_TEMP   0x0402
+
+static icLinkedList *heldItems = NULL; // keeps the items tests compare against alive until teardown
+
+static cJSON *createRequest(const char *type, int clusterId)
+{
+    cJSON *request = cJSON_CreateObject();
+    cJSON_AddStringToObject(request, "request", type);
+    cJSON_AddNumberToObject(request, "endpointId", ENDPOINT_ID);
+    cJSON_AddNumberToObject(request, "clusterId", clusterId);
+
+    return request;
+}
+
+/*
+ * Queue a request for the device the way zhalSendRequest does.  The returned item stays valid until the test's
+ * teardown.
+ */
+static WorkItem *enqueue(DeviceQueue *deviceQueue, cJSON *request)
+{
+    WorkItem *item = createItem(TEST_TARGET_EUI64, request, deviceQueue);
+    assert_true(linkedListAppend(heldItems, workItemAcquire(item)));
+    assert_true(queuePush(deviceQueue->queue, item));
+    deviceQueue->pendingCount++;
+    if (item->lane == REQUEST_LANE_INTERACTIVE)
+    {
+        deviceQueue->pendingInteractiveCount++;
+    }
+
+    return item;
+}
+
+/*
+ * Take the next ready item, dropping the queue's reference the way the worker does once it is done with it
+ */
+static WorkItem *takeNext(DeviceQueue *deviceQueue)
+{
+    WorkItem *item = takeReadyItemNoLock(deviceQueue);
+    if (item != NULL)
+    {
+        workItemRelease(item);
+    }
+
+    return item;
+}
+
+static int setupHeldItems(void **state)
+{
+    (void) state;
+
+    heldItems = linkedListCreate();
+
+    return 0;
+}
+
+static int teardownHeldItems(void **state)
+{
+    (void) state;
+
+    linkedListDestroy(heldItems, workItemRelease);
+    heldItems = NULL;
+
+    return 0;
+}
+
+static int setupScheduler(void **state)
+{
+    for (int i = 0; i < REQUEST_LANE_COUNT; i++)
+    {
+        readyDevices[i] = queueCreate();
+    }
+    interactiveStreak = 0;
+    workerShutdown = false;
+
+    return setupHeldItems(state);
+}
+
+static int teardownScheduler(void **state)
+{
+    workerShutdown = true;
+    for (int i = 0; i < REQUEST_LANE_COUNT; i++)
+    {
+        queueDestroy(readyDevices[i], deviceQueueRelease);
+        readyDevices[i] = NULL;
+    }
+
+    return teardownHeldItems(state);
+}
+
+static void test_orderKeys(void **state)
+{
+    (void) state;
+
+    cJSON *read = createRequest("attributesRead", CLUSTER_ID_ONOFF);
+    cJSON *bind = createRequest("bindingSet", CLUSTER_ID_ONOFF);
+    cJSON *write = createRequest("attributesWrite", CLUSTER_ID_ONOFF);
+    cJSON *endpoints = cJSON_CreateObject();
+    cJSON_AddStringToObject(endpoints, "request", "getEndpointIds");
+
+    assert_int_equal(getOrderKey(read), getOrderKey(bind));
+    assert_int_equal(getOrderKey(write), ORDER_KEY_BARRIER);
+    assert_int_equal(getOrderKey(endpoints), ORDER_KEY_INDEPENDENT);
+
+    assert_true(orderKeysConflict(getOrderKey(read), ORDER_KEY_BARRIER));
+    assert_true(orderKeysConflict(ORDER_KEY_INDEPENDENT, ORDER_KEY_BARRIER));
+    assert_false(orderKeysConflict(ORDER_KEY_INDEPENDENT, ORDER_KEY_INDEPENDENT));
+    assert_false(orderKeysConflict(getOrderKey(read), ORDER_KEY_INDEPENDENT));
+
+    cJSON_Delete(read);
+    cJSON_Delete(bind);
+    cJSON_Delete(write);
+    cJSON_Delete(endpoints);
+}
+
+static void test_defaultWindowSendsOneAtATime(void **state)
+{
+    (void) state;
+
+    DeviceQueue *deviceQueue = createDeviceQueue();
+    cJSON *onOff = createRequest("attributesRead", CLUSTER_ID_ONOFF);
+    cJSON *level = createRequest("attributesRead", CLUSTER_ID_LEVEL);
+
+    WorkItem *first = enqueue(deviceQueue, onOff);
+    WorkItem *second = enqueue(deviceQueue, level);
+
+    assert_ptr_equal(takeNext(deviceQueue), first);
+    assert_null(takeNext(deviceQueue));
+
+    deviceQueueClearBusyNoLock(deviceQueue, first);
+    assert_ptr_equal(takeNext(deviceQueue), second);
+    assert_null(takeNext(deviceQueue));
+    assert_int_equal(deviceQueue->pendingCount, 0);
+
+    deviceQueueRelease(deviceQueue);
+    cJSON_Delete(onOff);
+    cJSON_Delete(level);
+}
+
+static void test_windowKeepsSameClusterInOrder(void **state)
+{
+    (void) state;
+
+    DeviceQueue *deviceQueue = createDeviceQueue();
+    deviceQueue->window = 4;
+    cJSON *bind = createRequest("bindingSet", CLUSTER_ID_ONOFF);
+    cJSON *report = createRequest("attributesSetReporting", CLUSTER_ID_ONOFF);
+    cJSON *level = createRequest("attributesRead", CLUSTER_ID_LEVEL);
+    cJSON *temp = createRequest("attributesRead", CLUSTER_ID_TEMP);
+
+    WorkItem *bindItem = enqueue(deviceQueue, bind);
+    WorkItem *reportItem = enqueue(deviceQueue, report);
+    WorkItem *levelItem = enqueue(deviceQueue, level);
+    WorkItem *tempItem = enqueue(deviceQueue, temp);
+
+    // reporting for on/off waits for its binding, the other clusters go along with the binding
+    assert_ptr_equal(takeNext(deviceQueue), bindItem);
+    assert_ptr_equal(takeNext(deviceQueue), levelItem);
+    assert_ptr_equal(takeNext(deviceQueue), tempItem);
+    assert_null(takeNext(deviceQueue));
+
+    deviceQueueClearBusyNoLock(deviceQueue, levelItem);
+    assert_null(takeNext(deviceQueue));
+
+    deviceQueueClearBusyNoLock(deviceQueue, bindItem);
+    assert_ptr_equal(takeNext(deviceQueue), reportItem);
+    assert_int_equal(deviceQueue->isBusy, 2);
+
+    deviceQueueRelease(deviceQueue);
+    cJSON_Delete(bind);
+    cJSON_Delete(report);
+    cJSON_Delete(level);
+    cJSON_Delete(temp);
+}
+
+static void test_windowHoldsBarriers(void **state)
+{
+    (void) state;
+
+    DeviceQueue *deviceQueue = createDeviceQueue();
+    deviceQueue->window = 4;
+    cJSON *onOff = createRequest("attributesRead", CLUSTER_ID_ONOFF);
+    cJSON *command = createRequest("sendCommand", CLUSTER_ID_LEVEL);
+    cJSON *temp = createRequest("attributesRead", CLUSTER_ID_TEMP);
+
+    WorkItem *onOffItem = enqueue(deviceQueue, onOff);
+    WorkItem *commandItem = enqueue(deviceQueue, command);
+    WorkItem *tempItem = enqueue(deviceQueue, temp);
+
+    // the command waits for the read before it, and the read after it may not pass it
+    assert_ptr_equal(takeNext(deviceQueue), onOffItem);
+    assert_null(takeNext(deviceQueue));
+
+    deviceQueueClearBusyNoLock(deviceQueue, onOffItem);
+    assert_ptr_equal(takeNext(deviceQueue), commandItem);
+    assert_null(takeNext(deviceQueue));
+
+    deviceQueueClearBusyNoLock(deviceQueue, commandItem);
+    assert_ptr_equal(takeNext(deviceQueue), tempItem);
+
+    deviceQueueRelease(deviceQueue);
+    cJSON_Delete(onOff);
+    cJSON_Delete(command);
+    cJSON_Delete(temp);
+}
+
+static void test_windowIsFilledButNotExceeded(void **state)
+{
+    (void) state;
+
+    DeviceQueue *deviceQueue = createDeviceQueue();
+    deviceQueue->window = 2;
+    cJSON *requests[4];
+
+    for (int i = 0; i < 4; i++)
+    {
+        requests[i] = cJSON_CreateObject();
+        cJSON_AddStringToObject(requests[i], "request", "getClustersInfo");
+        enqueue(deviceQueue, requests[i]);
+    }
+
+    WorkItem *first = takeNext(deviceQueue);
+    assert_non_null(first);
+    assert_non_null(takeNext(deviceQueue));
+    assert_null(takeNext(deviceQueue));
+
+    deviceQueueClearBusyNoLock(deviceQueue, first);
+    assert_non_null(takeNext(deviceQueue));
+    assert_null(takeNext(deviceQueue));
+    assert_int_equal(deviceQueue->isBusy, 2);
+    assert_int_equal(deviceQueue->pendingCount, 1);
+
+    deviceQueueRelease(deviceQueue);
+    for (int i = 0; i < 4; i++)
+    {
+        cJSON_Delete(requests[i]);
+    }
+}
+
+static void test_requestLanes(void **state)
+{
+    (void) state;
+
+    cJSON *command = createRequest("sendCommand", CLUSTER_ID_ONOFF);
+    cJSON *write = createRequest("attributesWrite", CLUSTER_ID_ONOFF);
+    cJSON *read = createRequest("attributesRead", CLUSTER_ID_ONOFF);
+    cJSON *bind = createRequest("bindingSet", CLUSTER_ID_ONOFF);
+
+    assert_int_equal(getRequestLane(command), REQUEST_LANE_INTERACTIVE);
+    assert_int_equal(getRequestLane(write), REQUEST_LANE_INTERACTIVE);
+    assert_int_equal(getRequestLane(read), REQUEST_LANE_BACKGROUND);
+    assert_int_equal(getRequestLane(bind), REQUEST_LANE_BACKGROUND);
+
+    cJSON_Delete(command);
+    cJSON_Delete(write);
+    cJSON_Delete(read);
+    cJSON_Delete(bind);
+}
+
+static void test_devicesTakeTurns(void **state)
+{
+    (void) state;
+
+    DeviceQueue *busyDevice = createDeviceQueue();
+    DeviceQueue *quietDevice = createDeviceQueue();
+    busyDevice->window = 4;
+    cJSON *requests[3];
+
+    for (int i = 0; i < 3; i++)
+    {
+        requests[i] = cJSON_CreateObject();
+        cJSON_AddStringToObject(requests[i], "request", "getClustersInfo");
+        enqueue(busyDevice, requests[i]);
+    }
+    scheduleDeviceNoLock(busyDevice);
+    WorkItem *quietItem = enqueue(quietDevice, requests[0]);
+    scheduleDeviceNoLock(quietDevice);
+
+    // a device is in line once no matter how much it has queued
+    scheduleDeviceNoLock(busyDevice);
+    assert_int_equal(queueCount(readyDevices[REQUEST_LANE_BACKGROUND]), 2);
+
+    // after one item the busy device goes to the back of the line, behind the quiet one
+    DeviceQueue *next = nextReadyDeviceNoLock();
+    assert_ptr_equal(next, busyDevice);
+    assert_non_null(takeNext(next));
+    scheduleDeviceNoLock(next);
+    deviceQueueRelease(next);
+
+    next = nextReadyDeviceNoLock();
+    assert_ptr_equal(next, quietDevice);
+    assert_ptr_equal(takeNext(next), quietItem);
+    scheduleDeviceNoLock(next);
+    deviceQueueRelease(next);
+
+    next = nextReadyDeviceNoLock();
+    assert_ptr_equal(next, busyDevice);
+    deviceQueueRelease(next);
+    assert_null(nextReadyDeviceNoLock());
+
+    deviceQueueRelease(busyDevice);
+    deviceQueueRelease(quietDevice);
+    for (int i = 0; i < 3; i++)
+    {
+        cJSON_Delete(requests[i]);
+    }
+}
+
+static void test_interactiveLaneGoesFirst(void **state)
+{
+    (void) state;
+
+    DeviceQueue *pollingDevice = createDeviceQueue();
+    DeviceQueue *commandedDevice = createDeviceQueue();
+    cJSON *read = createRequest("attributesRead", CLUSTER_ID_TEMP);
+    cJSON *command = createRequest("sendCommand", CLUSTER_ID_ONOFF);
+
+    enqueue(pollingDevice, read);
+    scheduleDeviceNoLock(pollingDevice);
+    enqueue(commandedDevice, read);
+    scheduleDeviceNoLock(commandedDevice);
+    assert_int_equal(queueCount(readyDevices[REQUEST_LANE_BACKGROUND]), 2);
+
+    // a command moves its device up to the interactive lane, ahead of the device that was waiting before it
+    enqueue(commandedDevice, command);
+    scheduleDeviceNoLock(commandedDevice);
+    assert_int_equal(queueCount(readyDevices[REQUEST_LANE_BACKGROUND]), 1);
+    assert_int_equal(queueCount(readyDevices[REQUEST_LANE_INTERACTIVE]), 1);
+
+    DeviceQueue *next = nextReadyDeviceNoLock();
+    assert_ptr_equal(next, commandedDevice);
+    deviceQueueRelease(next);
+
+    next = nextReadyDeviceNoLock();
+    assert_ptr_equal(next, pollingDevice);
+    deviceQueueRelease(next);
+
+    deviceQueueRelease(pollingDevice);
+    deviceQueueRelease(commandedDevice);
+    cJSON_Delete(read);
+    cJSON_Delete(command);
+}
+
+static void test_backgroundLaneIsNotStarved(void **state)
+{
+    (void) state;
+
+    DeviceQueue *pollingDevice = createDeviceQueue();
+    DeviceQueue *commandedDevice = createDeviceQueue();
+    commandedDevice->window = ZHAL_MAX_REQUEST_WINDOW;
+    cJSON *read = createRequest("attributesRead", CLUSTER_ID_TEMP);
+    cJSON *command = createRequest("sendCommand", CLUSTER_ID_ONOFF);
+
+    enqueue(pollingDevice, read);
+    scheduleDeviceNoLock(pollingDevice);
+    for (int i = 0; i < INTERACTIVE_BURST + 1; i++)
+    {
+        enqueue(commandedDevice, command);
+    }
+    scheduleDeviceNoLock(commandedDevice);
+
+    for (int i = 0; i < INTERACTIVE_BURST; i++)
+    {
+        DeviceQueue *next = nextReadyDeviceNoLock();
+        assert_ptr_equal(next, commandedDevice);
+        WorkItem *item = takeNext(next);
+        assert_non_null(item);
+        deviceQueueClearBusyNoLock(next, item);
+        scheduleDeviceNoLock(next);
+        deviceQueueRelease(next);
+    }
+
+    // a burst of commands is followed by a turn for the background lane
+    DeviceQueue *next = nextReadyDeviceNoLock();
+    assert_ptr_equal(next, pollingDevice);
+    deviceQueueRelease(next);
+
+    next = nextReadyDeviceNoLock();
+    assert_ptr_equal(next, commandedDevice);
+    deviceQueueRelease(next);
+
+    deviceQueueRelease(pollingDevice);
+    deviceQueueRelease(commandedDevice);
+    cJSON_Delete(read);
+    cJSON_Delete(command);
+}
+
+static void test_setDeviceRequestWindowRejectsInvalidWindows(void **state)
+{
+    (void) state;
+
+    assert_int_equal(zhalSetDeviceRequestWindow(TEST_TARGET_EUI64, 0), -1);
+    assert_int_equal(zhalSetDeviceRequestWindow(TEST_TARGET_EUI64, ZHAL_MAX_REQUEST_WINDOW + 1), -1);
+
+    deviceQueues = hashMapCreate();
+    assert_int_equal(zhalSetDeviceRequestWindow(TEST_TARGET_EUI64, ZHAL_MAX_REQUEST_WINDOW), 0);
+
+    uint64_t eui64 = TEST_TARGET_EUI64;
+    DeviceQueue *deviceQueue = hashMapGet(deviceQueues, &eui64, sizeof(eui64));
+    assert_non_null(deviceQueue);
+    assert_int_equal(deviceQueue->window, ZHAL_MAX_REQUEST_WINDOW);
+
+    hashMapDestroy(deviceQueues, deviceQueuesDestroy);
+    deviceQueues = NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_orderKeys),
+        cmocka_unit_test_setup_teardown(test_defaultWindowSendsOneAtATime, setupHeldItems, teardownHeldItems),
+        cmocka_unit_test_setup_teardown(test_windowKeepsSameClusterInOrder, setupHeldItems, teardownHeldItems),
+        cmocka_unit_test_setup_teardown(test_windowHoldsBarriers, setupHeldItems, teardownHeldItems),
+        cmocka_unit_test_setup_teardown(test_windowIsFilledButNotExceeded, setupHeldItems, teardownHeldItems),
+        cmocka_unit_test(test_requestLanes),
+        cmocka_unit_test_setup_teardown(test_devicesTakeTurns, setupScheduler, teardownScheduler),
+        cmocka_unit_test_setup_teardown(test_interactiveLaneGoesFirst, setupScheduler, teardownScheduler),
+        cmocka_unit_test_setup_teardown(test_backgroundLaneIsNotStarved, setupScheduler, teardownScheduler),
+        cmocka_unit_test(test_setDeviceRequestWindowRejectsInvalidWindows),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
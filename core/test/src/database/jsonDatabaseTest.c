@@ -29,13 +29,21 @@
 #include <stddef.h>
 
 #include "database/jsonDatabase.h"
+#include "database/jsonDatabaseCompactRecord.h"
+#include "database/jsonDatabaseRecord.h"
+#include "device/deviceStringIntern.h"
 #include <cjson/cJSON.h>
 #include <cmocka.h>
 #include <device/icDevice.h>
 #include <icLog/logging.h>
+#include <inttypes.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <commonDeviceDefs.h>
 #include <device-driver/device-driver.h>
@@ -44,19 +52,21 @@
 #include <device/icDeviceResource.h>
 #include <deviceHelper.h>
 #include <icConfig/storage.h>
+#include <icTime/timeUtils.h>
 #include <icUtil/fileUtils.h>
 #include <icUtil/stringUtils.h>
 #include <jsonHelper/jsonHelper.h>
 #include <resourceTypes.h>
 
 
-#define LOG_TAG              "jsonDatabaseTest"
+#define LOG_TAG               "jsonDatabaseTest"
 
-#define USE_DUMMY_STORAGE    "___USE_DUMMY_STORAGE___"
+#define USE_DUMMY_STORAGE     "___USE_DUMMY_STORAGE___"
 
-#define STORAGE_NAMESPACE    "devicedb"
-#define DEVICE_ENDPOINTS_KEY "deviceEndpoints"
-#define DEVICE_RESOURCES_KEY "deviceResources"
+#define STORAGE_NAMESPACE     "devicedb"
+#define SYSTEM_PROPERTIES_KEY "systemProperties"
+#define DEVICE_ENDPOINTS_KEY  "deviceEndpoints"
+#define DEVICE_RESOURCES_KEY  "deviceResources"
 
 #ifndef FIXTURES_DIR
 #error Please define FIXTURES_DIR
@@ -66,6 +76,17 @@ static int counter = 0;
 
 static cJSON *dummyMemoryStorage;
 
+// When the gate is closed, __wrap_storageSave and __wrap_storageGetKeys park their caller until the gate is
+// opened again so tests can observe what other threads may do while storage is busy
+static pthread_mutex_t storageGateMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t storageGateCond = PTHREAD_COND_INITIALIZER;
+static bool storageGateClosed = false;
+static bool storageGateEntered = false;
+
+// When set, __wrap_storageLoad reads dummy storage without consuming a mock so it can be called from
+// other threads, e.g. the device load workers
+static bool storageLoadFromDummyStorage = false;
+
 bool __wrap_storageLoad(const char *namespace, const char *key, char **value);
 cJSON *__wrap_storageLoadJSON(const char *namespace, const char *key);
 bool __wrap_storageParse(const char *namespace, const char *key, const StorageCallbacks *cb);
@@ -76,6 +97,7 @@ char *__wrap_simpleProtectConfigData(const char *namespace, const char *dataToPr
 char *__wrap_simpleUnprotectConfigData(const char *namespace, const char *protectedData);
 static icDevice *createDummyDevice();
 static icDevice *createCorruptedDummyDevice();
+static char *dummyStorageGet(const char *namespace, const char *key);
 static void dummyStoragePut(const char *namespace, const char *key, const char *value);
 
 static void assertDevicesEqual(icDevice *device1, icDevice *device2);
@@ -720,6 +742,65 @@ static void test_jsonDatabaseGetDeviceById(void **state)
     (void) state;
 }
 
+static void countEndpoints(const icDevice *device, void *ctx)
+{
+    *(uint16_t *) ctx = linkedListCount(device->endpoints);
+}
+
+static void copyResourceValue(const icDeviceResource *resource, void *ctx)
+{
+    *(char **) ctx = strdup(resource->value);
+}
+
+static void test_jsonDatabaseVisitorsAndFieldAccessors(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+
+    // Mock saving the device
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+
+    scoped_generic char *deviceClass = jsonDatabaseGetDeviceClassById(device->uuid);
+    assert_non_null(deviceClass);
+    assert_string_equal(deviceClass, device->deviceClass);
+
+    // Any uri under the device resolves to its driver
+    scoped_generic char *driverName = jsonDatabaseGetDeviceDriverByUri(resource->uri);
+    assert_non_null(driverName);
+    assert_string_equal(driverName, device->managingDeviceDriver);
+
+    uint16_t endpointCount = UINT16_MAX;
+    assert_true(jsonDatabaseVisitDeviceByUri(device->uri, countEndpoints, &endpointCount));
+    assert_int_equal(endpointCount, linkedListCount(device->endpoints));
+
+    scoped_generic char *value = NULL;
+    assert_true(jsonDatabaseVisitResourceByUri(resource->uri, copyResourceValue, &value));
+    assert_string_equal(value, resource->value);
+
+    // Unknown things are not visited
+    assert_null(jsonDatabaseGetDeviceClassById("notadevice"));
+    assert_null(jsonDatabaseGetDeviceDriverByUri("/notadevice"));
+    assert_false(jsonDatabaseVisitDeviceById("notadevice", countEndpoints, &endpointCount));
+    assert_false(jsonDatabaseVisitResourceByUri(device->uri, copyResourceValue, &value));
+
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+
+    deviceDestroy(device);
+
+    (void) state;
+}
+
 static void test_jsonDatabaseGetDeviceByUri(void **state)
 {
     // mock so no systemProperties database which equals no database
@@ -1781,8 +1862,11 @@ static void test_jsonDatabaseLoadDeviceWithBadEndpoint(void **state)
     scoped_generic char *corruptedDevicePtr = readFileContents(deviceFilePath);
     assert_non_null(corruptedDevicePtr);
 
+    // Seal it like the database would, so it is the bad endpoint that fails the strict load
+    scoped_generic char *sealedDevicePtr = jsonDatabaseRecordSeal(corruptedDevicePtr);
+
     // Add the corrupted device data on dummy storage
-    dummyStoragePut(STORAGE_NAMESPACE, corruptedDeviceUuid, corruptedDevicePtr);
+    dummyStoragePut(STORAGE_NAMESPACE, corruptedDeviceUuid, sealedDevicePtr);
 
     will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
 
@@ -1868,162 +1952,2131 @@ static void test_restore(void **state)
     assert_false(jsonDatabaseRestore("fake"));
 }
 
-// ******************************
-// Setup/Teardown
-// ******************************
-
-static int dummyStorageSetup(void **state)
+static void *saveResourceThreadProc(void *arg)
 {
-    dummyMemoryStorage = cJSON_CreateObject();
-
-    (void) state;
-
-    return 0;
+    jsonDatabaseSaveResource((icDeviceResource *) arg);
+    return NULL;
 }
 
-static int dummyStorageTeardown(void **state)
+static void test_jsonDatabaseReadsDoNotWaitOnStorage(void **state)
 {
-    if (dummyMemoryStorage != NULL)
-    {
-        cJSON_Delete(dummyMemoryStorage);
-        dummyMemoryStorage = NULL;
-    }
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
 
-    (void) state;
+    assert_true(jsonDatabaseInitialize());
 
-    return 0;
-}
+    icDevice *device = createDummyDevice();
 
-// ******************************
-// Helpers
-// ******************************
+    // Mock saving the device
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
 
-static bool compareMetadata(void *searchVal, void *item)
-{
-    icDeviceMetadata *metadata1 = (icDeviceMetadata *) searchVal;
-    icDeviceMetadata *metadata2 = (icDeviceMetadata *) item;
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+    free(resource->value);
+    resource->value = strdup("written");
 
-    if (metadata1 == NULL || metadata2 == NULL)
-    {
-        return false;
-    }
+    // Park the next write inside storage
+    pthread_mutex_lock(&storageGateMtx);
+    storageGateClosed = true;
+    storageGateEntered = false;
+    pthread_mutex_unlock(&storageGateMtx);
 
-    if (strcmp(metadata1->id, metadata2->id) != 0)
-    {
-        return false;
-    }
+    pthread_t writer;
+    assert_int_equal(pthread_create(&writer, NULL, saveResourceThreadProc, resource), 0);
 
-    if (strcmp(metadata1->deviceUuid, metadata2->deviceUuid) != 0)
+    pthread_mutex_lock(&storageGateMtx);
+    while (!storageGateEntered)
     {
-        return false;
+        pthread_cond_wait(&storageGateCond, &storageGateMtx);
     }
+    pthread_mutex_unlock(&storageGateMtx);
 
-    if (strcmp(metadata1->uri, metadata2->uri) != 0)
+    // The writer is now stuck in storage. Lookups must still be served, and must already see the
+    // new value. Before reader/writer locking, this would deadlock.
+    uint64_t start = getMonotonicMillis();
+    for (int i = 0; i < 1000; i++)
     {
-        return false;
-    }
+        icDeviceResource *found = jsonDatabaseGetResourceByUri(resource->uri);
+        assert_non_null(found);
+        assert_string_equal(found->value, "written");
+        resourceDestroy(found);
 
-    if (strcmp(metadata1->endpointId, metadata2->endpointId) != 0)
-    {
-        return false;
+        assert_true(jsonDatabaseIsDeviceKnown(device->uuid));
     }
+    icLogInfo(LOG_TAG, "1000 lookups during a stalled write took %" PRIu64 "ms", getMonotonicMillis() - start);
 
-    if (strcmp(metadata1->value, metadata2->value) != 0)
-    {
-        return false;
-    }
+    pthread_mutex_lock(&storageGateMtx);
+    storageGateClosed = false;
+    pthread_cond_broadcast(&storageGateCond);
+    pthread_mutex_unlock(&storageGateMtx);
 
-    return true;
-}
+    pthread_join(writer, NULL);
 
-static char *dummyStorageGet(const char *namespace, const char *key)
-{
-    char *retval = NULL;
-    cJSON *namespaceJson = cJSON_GetObjectItem(dummyMemoryStorage, namespace);
-    if (namespaceJson != NULL)
-    {
-        cJSON *keyJson = cJSON_GetObjectItem(namespaceJson, key);
-        if (keyJson != NULL)
-        {
-            retval = strdup(keyJson->valuestring);
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    // Device should not be dirty, so device will not get written
+    jsonDatabaseCleanup(true);
 
-            icLogDebug(LOG_TAG, "Read from dummy storage namespace=%s, key=%s, value=%s", namespace, key, retval);
-        }
-        else
-        {
-            icLogDebug(LOG_TAG, "Failed to ready from dummy storage namespace=%s, key=%s", namespace, key);
-        }
-    }
-    else
-    {
-        icLogDebug(LOG_TAG, "Did not find namespace %s in dummy storage", namespace);
-    }
+    deviceDestroy(device);
 
-    return retval;
+    (void) state;
 }
 
-static void dummyStoragePut(const char *namespace, const char *key, const char *value)
+static void test_jsonDatabaseWriteBehindDefersUntilFlush(void **state)
 {
-    cJSON *namespaceJson = cJSON_GetObjectItem(dummyMemoryStorage, namespace);
-    if (namespaceJson == NULL)
-    {
-        icLogDebug(LOG_TAG, "Creating dummy storage namespace %s", namespace);
-        namespaceJson = cJSON_CreateObject();
-        cJSON_AddItemToObject(dummyMemoryStorage, namespace, namespaceJson);
-    }
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
 
-    if (cJSON_HasObjectItem(namespaceJson, key))
-    {
-        cJSON_DeleteItemFromObject(namespaceJson, key);
-    }
-    cJSON_AddStringToObject(namespaceJson, key, value);
+    assert_true(jsonDatabaseInitialize());
 
-    icLogDebug(LOG_TAG, "Saving to dummy storage namespace=%s, key=%s, value=%s", namespace, key, value);
+    icDevice *device = createDummyDevice();
+
+    // Mock saving the device, adds are always written through
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+
+    // Long enough that the flusher never runs on its own during this test
+    jsonDatabaseSetWriteBehind(60000, 0);
+
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+    free(resource->value);
+    resource->value = strdup("deferred");
+
+    // No storageSave is mocked, so any write here would fail the test
+    assert_true(jsonDatabaseSaveResource(resource));
+    assert_true(jsonDatabaseSaveResource(resource));
+
+    icDeviceResource *found = jsonDatabaseGetResourceByUri(resource->uri);
+    assert_non_null(found);
+    assert_string_equal(found->value, "deferred");
+    resourceDestroy(found);
+
+    // The barrier writes the device once
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseFlush());
+
+    scoped_generic char *stored = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_non_null(stored);
+    assert_non_null(strstr(stored, "deferred"));
+
+    // Nothing left to write
+    assert_true(jsonDatabaseFlush());
+    jsonDatabaseSetWriteBehind(0, 0);
+
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    // Device should not be dirty, so device will not get written
+    jsonDatabaseCleanup(true);
+
+    deviceDestroy(device);
+
+    (void) state;
 }
 
-static icLinkedList *dummyStorageGetKeys(const char *namespace)
+static void test_jsonDatabaseFlushDeviceWritesOnlyThatDevice(void **state)
 {
-    icLinkedList *keys = linkedListCreate();
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
 
-    cJSON *keysJson = cJSON_GetObjectItem(dummyMemoryStorage, namespace);
-    if (keysJson != NULL)
-    {
-        int count = cJSON_GetArraySize(keysJson);
-        for (int i = 0; i < count; ++i)
-        {
-            cJSON *item = cJSON_GetArrayItem(keysJson, i);
-            icLogDebug(LOG_TAG, "Found key %s for namespace %s", item->string, namespace);
-            linkedListAppend(keys, strdup(item->string));
-        }
-    }
+    assert_true(jsonDatabaseInitialize());
 
+    icDevice *device = createDummyDevice();
+    icDevice *otherDevice = createDummyDevice();
 
-    return keys;
+    // Mock saving the devices, adds are always written through
+    will_return_count(__wrap_storageSave, true, 2);
+    assert_true(jsonDatabaseAddDevice(device));
+    assert_true(jsonDatabaseAddDevice(otherDevice));
+
+    // Long enough that the flusher never runs on its own during this test
+    jsonDatabaseSetWriteBehind(60000, 0);
+
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+    free(resource->value);
+    resource->value = strdup("deferred");
+    icDeviceResource *otherResource = linkedListGetElementAt(otherDevice->resources, 0);
+    free(otherResource->value);
+    otherResource->value = strdup("otherDeferred");
+
+    // No storageSave is mocked, so any write here would fail the test
+    assert_true(jsonDatabaseSaveResource(resource));
+    assert_true(jsonDatabaseSaveResource(otherResource));
+
+    // Only the flushed device is written
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseFlushDevice(device->uuid));
+
+    scoped_generic char *stored = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_non_null(strstr(stored, "deferred"));
+    scoped_generic char *otherStored = dummyStorageGet(STORAGE_NAMESPACE, otherDevice->uuid);
+    assert_null(strstr(otherStored, "otherDeferred"));
+
+    // Nothing left to write for it, and unknown devices are not flushed
+    assert_true(jsonDatabaseFlushDevice(device->uuid));
+    assert_false(jsonDatabaseFlushDevice("unknown"));
+
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseFlush());
+    jsonDatabaseSetWriteBehind(0, 0);
+
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+
+    deviceDestroy(device);
+    deviceDestroy(otherDevice);
+
+    (void) state;
 }
 
-static bool dummyStorageDelete(const char *namespace, const char *key)
+static void test_jsonDatabaseWriteBehindFlushesAtThreshold(void **state)
 {
-    bool retval = false;
-    cJSON *keysJson = cJSON_GetObjectItem(dummyMemoryStorage, namespace);
-    if (keysJson != NULL)
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+
+    // Mock saving the device
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+
+    // A single dirty device is enough to wake the flusher
+    jsonDatabaseSetWriteBehind(60000, 1);
+
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+    free(resource->value);
+    resource->value = strdup("threshold");
+
+    // The flusher writes from its own thread, so catch it at the gate instead of using the mock queue
+    pthread_mutex_lock(&storageGateMtx);
+    storageGateClosed = true;
+    storageGateEntered = false;
+    pthread_mutex_unlock(&storageGateMtx);
+
+    assert_true(jsonDatabaseSaveResource(resource));
+
+    pthread_mutex_lock(&storageGateMtx);
+    while (!storageGateEntered)
     {
-        if (cJSON_HasObjectItem(keysJson, key))
-        {
-            icLogDebug(LOG_TAG, "Deleting key %s for namespace %s", key, namespace);
-            cJSON_DeleteItemFromObject(keysJson, key);
-            retval = true;
-        }
+        pthread_cond_wait(&storageGateCond, &storageGateMtx);
     }
+    storageGateClosed = false;
+    pthread_cond_broadcast(&storageGateCond);
+    pthread_mutex_unlock(&storageGateMtx);
 
-    return retval;
+    // Stopping the flusher waits for its write to finish; the device is clean so nothing else is written
+    jsonDatabaseSetWriteBehind(0, 0);
+
+    scoped_generic char *stored = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_non_null(stored);
+    assert_non_null(strstr(stored, "threshold"));
+
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+
+    deviceDestroy(device);
+
+    (void) state;
 }
 
-static icDevice *createDummyDevice()
+static void test_jsonDatabaseJournalReplaysResourceUpdates(void **state)
 {
-    ++counter;
-    char uuid[64];
-    sprintf(uuid, "device%d", counter++);
-    char class[64];
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+
+    // Mock saving the device
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+
+    char journalDir[] = "/tmp/jsonDatabaseJournalXXXXXX";
+    assert_non_null(mkdtemp(journalDir));
+    scoped_generic char *journalPath = stringBuilder("%s/devicedb.journal", journalDir);
+
+    assert_true(jsonDatabaseSetJournal(journalPath, 0));
+
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+    free(resource->value);
+    resource->value = strdup("journaled");
+
+    // No storageSave is mocked, the update must only go to the journal
+    assert_true(jsonDatabaseSaveResource(resource));
+
+    // Simulate a crash by dropping everything without persisting
+    jsonDatabaseCleanup(false);
+
+    // Read system properties
+    will_return(__wrap_storageLoad, USE_DUMMY_STORAGE);
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    // Read device
+    will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseInitialize());
+
+    // The snapshot alone doesn't have the update
+    icDeviceResource *found = jsonDatabaseGetResourceByUri(resource->uri);
+    assert_non_null(found);
+    assert_string_not_equal(found->value, "journaled");
+    resourceDestroy(found);
+
+    // Enabling the journal replays it, then compacts it into the snapshot
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseSetJournal(journalPath, 0));
+
+    found = jsonDatabaseGetResourceByUri(resource->uri);
+    assert_non_null(found);
+    assert_string_equal(found->value, "journaled");
+    resourceDestroy(found);
+
+    scoped_generic char *stored = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_non_null(stored);
+    assert_non_null(strstr(stored, "journaled"));
+
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+
+    deviceDestroy(device);
+    unlink(journalPath);
+    rmdir(journalDir);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseJournalCompactsAtMaxRecords(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+
+    // Mock saving the device
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+
+    char journalDir[] = "/tmp/jsonDatabaseJournalXXXXXX";
+    assert_non_null(mkdtemp(journalDir));
+    scoped_generic char *journalPath = stringBuilder("%s/devicedb.journal", journalDir);
+
+    assert_true(jsonDatabaseSetJournal(journalPath, 2));
+
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+    free(resource->value);
+    resource->value = strdup("first");
+    assert_true(jsonDatabaseSaveResource(resource));
+
+    struct stat journalStat;
+    assert_int_equal(stat(journalPath, &journalStat), 0);
+    assert_true(journalStat.st_size > 0);
+
+    // The second record reaches the limit, so the device is rewritten once and the journal emptied
+    free(resource->value);
+    resource->value = strdup("second");
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseSaveResource(resource));
+
+    assert_int_equal(stat(journalPath, &journalStat), 0);
+    assert_int_equal(journalStat.st_size, 0);
+
+    scoped_generic char *stored = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_non_null(stored);
+    assert_non_null(strstr(stored, "second"));
+
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    // Device should not be dirty, so device will not get written
+    jsonDatabaseCleanup(true);
+
+    deviceDestroy(device);
+    unlink(journalPath);
+    rmdir(journalDir);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseJournalDropsTornRecord(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+
+    // Mock saving the device
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+
+    char journalDir[] = "/tmp/jsonDatabaseJournalXXXXXX";
+    assert_non_null(mkdtemp(journalDir));
+    scoped_generic char *journalPath = stringBuilder("%s/devicedb.journal", journalDir);
+
+    // A power loss in the middle of an append leaves a record without its newline
+    FILE *tornJournal = fopen(journalPath, "w");
+    assert_non_null(tornJournal);
+    fputs("{\"uri\":\"/torn", tornJournal);
+    fclose(tornJournal);
+
+    // Nothing to replay, so nothing is compacted and no storageSave is mocked
+    assert_true(jsonDatabaseSetJournal(journalPath, 0));
+
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+    free(resource->value);
+    resource->value = strdup("afterTorn");
+    assert_true(jsonDatabaseSaveResource(resource));
+
+    // Simulate a crash by dropping everything without persisting
+    jsonDatabaseCleanup(false);
+
+    // Read system properties
+    will_return(__wrap_storageLoad, USE_DUMMY_STORAGE);
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    // Read device
+    will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseInitialize());
+
+    // The record appended after the torn one must not have been joined onto it
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseSetJournal(journalPath, 0));
+
+    icDeviceResource *found = jsonDatabaseGetResourceByUri(resource->uri);
+    assert_non_null(found);
+    assert_string_equal(found->value, "afterTorn");
+    resourceDestroy(found);
+
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+
+    deviceDestroy(device);
+    unlink(journalPath);
+    rmdir(journalDir);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseCompactFormatMigratesAndExports(void **state)
+{
+    jsonDatabaseSetCompactFormat(false);
+
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+    // Policies other than the default are stored too
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+    resourceSetPersistencePolicy(resource, PERSISTENCE_POLICY_COALESCE, 30);
+
+    // Mock saving the device
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+
+    char *stored = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_non_null(stored);
+    assert_int_equal(stored[0], '{');
+    scoped_cJSON *storedJSON = cJSON_Parse(stored);
+    scoped_generic char *unformatted = cJSON_PrintUnformatted(storedJSON);
+    free(stored);
+
+    jsonDatabaseCleanup(false);
+
+    jsonDatabaseSetCompactFormat(true);
+
+    // Read system properties
+    will_return(__wrap_storageLoad, USE_DUMMY_STORAGE);
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    // Read device
+    will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
+    // The pretty printed system properties and device are rewritten compactly
+    will_return_count(__wrap_storageSave, true, 2);
+    assert_true(jsonDatabaseInitialize());
+
+    stored = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_non_null(stored);
+    assert_true(jsonDatabaseCompactRecordIsCompact(stored));
+    assert_int_equal(jsonDatabaseRecordVerify(stored), JSON_DATABASE_RECORD_VALID);
+    assert_true(strlen(stored) < strlen(unformatted));
+    // Sensitive values are protected in compact records too
+    icDeviceEndpoint *endpoint = linkedListGetElementAt(device->endpoints, 0);
+    icDeviceResource *sensitive = linkedListGetElementAt(endpoint->resources, 0);
+    scoped_icDevice *decoded = jsonDatabaseCompactRecordDecode(stored, NULL, false);
+    assert_non_null(decoded);
+    icDeviceEndpoint *decodedEndpoint = linkedListGetElementAt(decoded->endpoints, 0);
+    icDeviceResource *decodedSensitive = linkedListGetElementAt(decodedEndpoint->resources, 0);
+    assert_null(decodedSensitive->value);
+    free(stored);
+
+    stored = dummyStorageGet(STORAGE_NAMESPACE, SYSTEM_PROPERTIES_KEY);
+    assert_non_null(stored);
+    assert_null(strchr(stored, '\n'));
+    free(stored);
+
+    jsonDatabaseCleanup(false);
+
+    // Compact records load as is, nothing to migrate
+    will_return(__wrap_storageLoad, USE_DUMMY_STORAGE);
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseInitialize());
+
+    scoped_icDevice *loaded = jsonDatabaseGetDeviceById(device->uuid);
+    assertDevicesEqual(device, loaded);
+    icDeviceResource *loadedResource = linkedListGetElementAt(loaded->resources, 0);
+    assert_int_equal(loadedResource->persistencePolicy, PERSISTENCE_POLICY_COALESCE);
+    assert_int_equal(loadedResource->persistIntervalSecs, 30);
+    icDeviceEndpoint *loadedEndpoint = linkedListGetElementAt(loaded->endpoints, 0);
+    icDeviceResource *loadedSensitive = linkedListGetElementAt(loadedEndpoint->resources, 0);
+    assert_string_equal(loadedSensitive->value, sensitive->value);
+
+    scoped_generic char *exported = jsonDatabaseExportDeviceJSON(device->uuid);
+    assert_non_null(exported);
+    assert_non_null(strchr(exported, '\n'));
+    assert_non_null(strstr(exported, device->uuid));
+    assert_null(jsonDatabaseExportDeviceJSON("notADevice"));
+
+    jsonDatabaseCleanup(false);
+
+    // Switching back converts compact records to JSON
+    jsonDatabaseSetCompactFormat(false);
+
+    will_return(__wrap_storageLoad, USE_DUMMY_STORAGE);
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
+    will_return_count(__wrap_storageSave, true, 2);
+    assert_true(jsonDatabaseInitialize());
+
+    stored = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_non_null(stored);
+    assert_int_equal(stored[0], '{');
+    free(stored);
+
+    scoped_icDevice *reverted = jsonDatabaseGetDeviceById(device->uuid);
+    assertDevicesEqual(device, reverted);
+
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+
+    deviceDestroy(device);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseCompactRecordRejectsDamage(void **state)
+{
+    icDevice *device = createDummyDevice();
+    scoped_generic char *record = jsonDatabaseCompactRecordEncode(device, NULL);
+    assert_non_null(record);
+
+    // Without a namespace the sensitive value is stored as is
+    scoped_icDevice *decoded = jsonDatabaseCompactRecordDecode(record, NULL, false);
+    assertDevicesEqual(device, decoded);
+
+    // Sealed records decode the same
+    scoped_generic char *sealed = jsonDatabaseRecordSeal(record);
+    scoped_icDevice *decodedSealed = jsonDatabaseCompactRecordDecode(sealed, NULL, false);
+    assertDevicesEqual(device, decodedSealed);
+
+    // Truncated anywhere, the record no longer decodes
+    size_t prefixLen = strlen("bdbdev:");
+    for (size_t len = prefixLen; len < strlen(record); len += 4)
+    {
+        scoped_generic char *truncated = strndup(record, len);
+        assert_null(jsonDatabaseCompactRecordDecode(truncated, NULL, false));
+    }
+
+    // Records from a newer version are not guessed at
+    gsize binaryLen = 0;
+    guchar *binary = g_base64_decode(record + prefixLen, &binaryLen);
+    binary[0]++;
+    gchar *newerBody = g_base64_encode(binary, binaryLen);
+    scoped_generic char *newer = stringBuilder("bdbdev:%s", newerBody);
+    assert_null(jsonDatabaseCompactRecordDecode(newer, NULL, false));
+    g_free(newerBody);
+    g_free(binary);
+
+    // JSON records are not compact records
+    assert_false(jsonDatabaseCompactRecordIsCompact("{\"uuid\":\"x\"}"));
+    assert_null(jsonDatabaseCompactRecordDecode("{\"uuid\":\"x\"}", NULL, false));
+
+    deviceDestroy(device);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseParallelDeviceLoad(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *added[12];
+    for (size_t i = 0; i < ARRAY_LENGTH(added); i++)
+    {
+        added[i] = createDummyDevice();
+        // Mock saving the device
+        will_return(__wrap_storageSave, true);
+        assert_true(jsonDatabaseAddDevice(added[i]));
+    }
+
+    jsonDatabaseCleanup(false);
+
+    jsonDatabaseSetLoadWorkers(4);
+    storageLoadFromDummyStorage = true;
+
+    // Read system properties
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    // Read devices
+    will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseInitialize());
+
+    storageLoadFromDummyStorage = false;
+    jsonDatabaseSetLoadWorkers(1);
+
+    icLinkedList *loaded = jsonDatabaseGetDevices();
+    assert_int_equal(linkedListCount(loaded), ARRAY_LENGTH(added));
+    linkedListDestroy(loaded, (linkedListItemFreeFunc) deviceDestroy);
+
+    for (size_t i = 0; i < ARRAY_LENGTH(added); i++)
+    {
+        icDevice *found = jsonDatabaseGetDeviceById(added[i]->uuid);
+        assert_non_null(found);
+        assertDevicesEqual(added[i], found);
+        deviceDestroy(found);
+
+        icDeviceResource *resource = linkedListGetElementAt(added[i]->resources, 0);
+        found = jsonDatabaseGetDeviceByUri(resource->uri);
+        assert_non_null(found);
+        assert_string_equal(found->uuid, added[i]->uuid);
+        deviceDestroy(found);
+        deviceDestroy(added[i]);
+    }
+
+    jsonDatabaseCleanup(false);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseGetItemsByUriPattern(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+    icDevice *otherDevice = createDummyDevice();
+
+    // Mock saving the devices
+    will_return_count(__wrap_storageSave, true, 2);
+    assert_true(jsonDatabaseAddDevice(device));
+    assert_true(jsonDatabaseAddDevice(otherDevice));
+
+    // Everything on one device: its own resource and its endpoint's resource
+    scoped_generic char *devicePattern = stringBuilder("%s/*", device->uri);
+    icLinkedList *found = jsonDatabaseGetResourcesByUriPattern(devicePattern);
+    assert_int_equal(linkedListCount(found), 2);
+    linkedListDestroy(found, (linkedListItemFreeFunc) resourceDestroy);
+
+    found = jsonDatabaseGetMetadataByUriPattern(devicePattern);
+    assert_int_equal(linkedListCount(found), 3);
+    linkedListDestroy(found, (linkedListItemFreeFunc) metadataDestroy);
+
+    // Wildcards can span segments and devices
+    found = jsonDatabaseGetResourcesByUriPattern("/*/ep/*/r/*");
+    assert_int_equal(linkedListCount(found), 2);
+    linkedListDestroy(found, (linkedListItemFreeFunc) resourceDestroy);
+
+    found = jsonDatabaseGetResourcesByUriPattern("*");
+    assert_int_equal(linkedListCount(found), 4);
+    linkedListDestroy(found, (linkedListItemFreeFunc) resourceDestroy);
+
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+    scoped_generic char *resourcePattern = stringBuilder("/*%s", strrchr(resource->uri, '/'));
+    found = jsonDatabaseGetResourcesByUriPattern(resourcePattern);
+    assert_int_equal(linkedListCount(found), 1);
+    assert_string_equal(((icDeviceResource *) linkedListGetElementAt(found, 0))->uri, resource->uri);
+    linkedListDestroy(found, (linkedListItemFreeFunc) resourceDestroy);
+
+    // The whole URI has to match
+    resourcePattern[strlen(resourcePattern) - 1] = '\0';
+    found = jsonDatabaseGetResourcesByUriPattern(resourcePattern);
+    assert_int_equal(linkedListCount(found), 0);
+    linkedListDestroy(found, (linkedListItemFreeFunc) resourceDestroy);
+
+    found = jsonDatabaseGetResourcesByUriPattern("/notADevice/*");
+    assert_int_equal(linkedListCount(found), 0);
+    linkedListDestroy(found, (linkedListItemFreeFunc) resourceDestroy);
+
+    // A URI without a place in the trie, such as one with a trailing '/', is still stored and matched
+    icDeviceResource *irregular = createDeviceResource(device,
+                                                       "irregular",
+                                                       "irregularValue",
+                                                       RESOURCE_TYPE_STRING,
+                                                       RESOURCE_MODE_READABLE,
+                                                       CACHING_POLICY_ALWAYS);
+    free(irregular->uri);
+    irregular->uri = stringBuilder("%s/r/irregular/", device->uri);
+    // Mock saving the device
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddResource(device->uri, irregular));
+
+    icDeviceResource *loaded = jsonDatabaseGetResourceByUri(irregular->uri);
+    assert_non_null(loaded);
+    resourceDestroy(loaded);
+
+    found = jsonDatabaseGetResourcesByUriPattern(devicePattern);
+    assert_int_equal(linkedListCount(found), 3);
+    linkedListDestroy(found, (linkedListItemFreeFunc) resourceDestroy);
+
+    // Removed devices are gone from pattern queries too
+    will_return(__wrap_storageDelete, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseRemoveDeviceById(device->uuid));
+    found = jsonDatabaseGetResourcesByUriPattern("*");
+    assert_int_equal(linkedListCount(found), 2);
+    linkedListDestroy(found, (linkedListItemFreeFunc) resourceDestroy);
+
+    jsonDatabaseCleanup(false);
+
+    deviceDestroy(device);
+    deviceDestroy(otherDevice);
+
+    (void) state;
+}
+
+static bool resourceUriEquals(void *searchVal, void *item)
+{
+    return strcmp(((icDeviceResource *) searchVal)->uri, ((icDeviceResource *) item)->uri) == 0;
+}
+
+static void test_jsonDatabaseUriPatternAndRegexAgree(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+    // Mock saving the device
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+
+    // Resource ids that prefix each other, which an unanchored match would confuse
+    const char *ids[] = {"temp", "temperature"};
+    for (size_t i = 0; i < ARRAY_LENGTH(ids); i++)
+    {
+        icDeviceResource *resource = createDeviceResource(device,
+                                                          ids[i],
+                                                          "20",
+                                                          RESOURCE_TYPE_STRING,
+                                                          RESOURCE_MODE_READABLE,
+                                                          CACHING_POLICY_ALWAYS);
+        // Mock saving the device
+        will_return(__wrap_storageSave, true);
+        assert_true(jsonDatabaseAddResource(device->uri, resource));
+    }
+
+    const char *patterns[] = {"/*/r/temp", "*/temp", "*/r/temp*", "/*/ep/*"};
+    for (size_t i = 0; i < ARRAY_LENGTH(patterns); i++)
+    {
+        scoped_generic char *regex = jsonDatabaseCreateUriPatternRegex(patterns[i]);
+        icLinkedList *byPattern = jsonDatabaseGetResourcesByUriPattern(patterns[i]);
+        icLinkedList *byRegex = jsonDatabaseGetResourcesByUriRegex(regex);
+
+        assert_int_equal(linkedListCount(byPattern), linkedListCount(byRegex));
+        icLinkedListIterator *iter = linkedListIteratorCreate(byPattern);
+        while (linkedListIteratorHasNext(iter))
+        {
+            assert_non_null(linkedListFind(byRegex, linkedListIteratorGetNext(iter), resourceUriEquals));
+        }
+        linkedListIteratorDestroy(iter);
+
+        linkedListDestroy(byPattern, (linkedListItemFreeFunc) resourceDestroy);
+        linkedListDestroy(byRegex, (linkedListItemFreeFunc) resourceDestroy);
+    }
+
+    // Only the whole uri counts
+    icLinkedList *found = jsonDatabaseGetResourcesByUriPattern("/*/r/temp");
+    assert_int_equal(linkedListCount(found), 1);
+    linkedListDestroy(found, (linkedListItemFreeFunc) resourceDestroy);
+
+    jsonDatabaseCleanup(false);
+
+    deviceDestroy(device);
+
+    (void) state;
+}
+
+/*
+ * Not a pass/fail benchmark, but logs how pattern queries compare to regex queries over 10k+ URIs
+ * while checking they agree.
+ */
+static void test_jsonDatabaseUriPatternVersusRegexBenchmark(void **state)
+{
+    // 7 URIs per dummy device
+    const int deviceCount = 1500;
+    const int iterations = 20;
+
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    // Mock saving the devices
+    will_return_count(__wrap_storageSave, true, deviceCount);
+    icDevice *middleDevice = NULL;
+    for (int i = 0; i < deviceCount; i++)
+    {
+        icDevice *device = createDummyDevice();
+        assert_true(jsonDatabaseAddDevice(device));
+        if (i == deviceCount / 2)
+        {
+            middleDevice = device;
+        }
+        else
+        {
+            deviceDestroy(device);
+        }
+    }
+
+    scoped_generic char *devicePattern = stringBuilder("%s/*", middleDevice->uri);
+    scoped_generic char *deviceRegex = stringBuilder("^%s/.*$", middleDevice->uri);
+    const char *patterns[] = {devicePattern, "/*/ep/*/r/*", "*"};
+    const char *regexes[] = {deviceRegex, "^/.*/ep/.*/r/.*$", "^.*$"};
+    const int expected[] = {2, deviceCount, deviceCount * 2};
+
+    for (size_t i = 0; i < ARRAY_LENGTH(patterns); i++)
+    {
+        uint64_t patternMillis = 0;
+        uint64_t regexMillis = 0;
+
+        for (int j = 0; j < iterations; j++)
+        {
+            uint64_t start = getMonotonicMillis();
+            icLinkedList *byPattern = jsonDatabaseGetResourcesByUriPattern(patterns[i]);
+            patternMillis += getMonotonicMillis() - start;
+
+            start = getMonotonicMillis();
+            icLinkedList *byRegex = jsonDatabaseGetResourcesByUriRegex(regexes[i]);
+            regexMillis += getMonotonicMillis() - start;
+
+            assert_int_equal(linkedListCount(byPattern), expected[i]);
+            assert_int_equal(linkedListCount(byRegex), expected[i]);
+
+            linkedListDestroy(byPattern, (linkedListItemFreeFunc) resourceDestroy);
+            linkedListDestroy(byRegex, (linkedListItemFreeFunc) resourceDestroy);
+        }
+
+        icLogInfo(LOG_TAG,
+                  "%s: %d queries for %s took %" PRIu64 "ms by pattern, %" PRIu64 "ms by regex",
+                  __FUNCTION__,
+                  iterations,
+                  patterns[i],
+                  patternMillis,
+                  regexMillis);
+    }
+
+    jsonDatabaseCleanup(false);
+
+    deviceDestroy(middleDevice);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseSecondaryIndexes(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+    icDevice *otherDevice = createDummyDevice();
+
+    // Mock saving the devices
+    will_return_count(__wrap_storageSave, true, 2);
+    assert_true(jsonDatabaseAddDevice(device));
+    assert_true(jsonDatabaseAddDevice(otherDevice));
+
+    // New device metadata is indexed
+    icDeviceMetadata *metadata = createDeviceMetadata(device, "role", "hub");
+    icDeviceMetadata *otherMetadata = createDeviceMetadata(otherDevice, "role", "HUB");
+    will_return_count(__wrap_storageSave, true, 2);
+    assert_true(jsonDatabaseSaveMetadata(metadata));
+    assert_true(jsonDatabaseSaveMetadata(otherMetadata));
+
+    // Endpoint metadata with the same id is not device metadata
+    icDeviceEndpoint *endpoint = linkedListGetElementAt(otherDevice->endpoints, 0);
+    icDeviceMetadata *endpointMetadata = createEndpointMetadata(endpoint, "role", "hub");
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseSaveMetadata(endpointMetadata));
+
+    icLinkedList *found = jsonDatabaseGetDevicesByMetadata("role", "hub");
+    assert_int_equal(linkedListCount(found), 2);
+    linkedListDestroy(found, (linkedListItemFreeFunc) deviceDestroy);
+
+    found = jsonDatabaseGetDevicesByMetadata("role", NULL);
+    assert_int_equal(linkedListCount(found), 2);
+    linkedListDestroy(found, (linkedListItemFreeFunc) deviceDestroy);
+
+    found = jsonDatabaseGetDevicesByMetadata("role", "camera");
+    assert_int_equal(linkedListCount(found), 0);
+    linkedListDestroy(found, (linkedListItemFreeFunc) deviceDestroy);
+
+    // Removed metadata is no longer indexed
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseRemoveMetadataByUri(metadata->uri));
+
+    found = jsonDatabaseGetDevicesByMetadata("role", "hub");
+    assert_int_equal(linkedListCount(found), 1);
+    assert_string_equal(((icDevice *) linkedListGetElementAt(found, 0))->uuid, otherDevice->uuid);
+    linkedListDestroy(found, (linkedListItemFreeFunc) deviceDestroy);
+
+    // Removed devices are no longer indexed
+    found = jsonDatabaseGetEndpointsByProfile(endpoint->profile);
+    assert_int_equal(linkedListCount(found), 1);
+    linkedListDestroy(found, (linkedListItemFreeFunc) endpointDestroy);
+
+    will_return(__wrap_storageDelete, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseRemoveDeviceById(otherDevice->uuid));
+
+    found = jsonDatabaseGetDevicesByMetadata("role", NULL);
+    assert_int_equal(linkedListCount(found), 0);
+    linkedListDestroy(found, (linkedListItemFreeFunc) deviceDestroy);
+
+    found = jsonDatabaseGetDevicesByDeviceClass(otherDevice->deviceClass);
+    assert_int_equal(linkedListCount(found), 0);
+    linkedListDestroy(found, (linkedListItemFreeFunc) deviceDestroy);
+
+    found = jsonDatabaseGetDevicesByDeviceDriver(otherDevice->managingDeviceDriver);
+    assert_int_equal(linkedListCount(found), 0);
+    linkedListDestroy(found, (linkedListItemFreeFunc) deviceDestroy);
+
+    found = jsonDatabaseGetEndpointsByProfile(endpoint->profile);
+    assert_int_equal(linkedListCount(found), 0);
+    linkedListDestroy(found, (linkedListItemFreeFunc) endpointDestroy);
+
+    found = jsonDatabaseGetDevicesByDeviceClass(device->deviceClass);
+    assert_int_equal(linkedListCount(found), 1);
+    linkedListDestroy(found, (linkedListItemFreeFunc) deviceDestroy);
+
+    jsonDatabaseCleanup(false);
+
+    deviceDestroy(device);
+    deviceDestroy(otherDevice);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseInternsDeviceModelStrings(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    uint32_t pooledBefore = deviceStringInternCount();
+
+    icDevice *device = createDummyDevice();
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+    icDeviceEndpoint *endpoint = linkedListGetElementAt(device->endpoints, 0);
+    icDeviceResource *endpointResource = linkedListGetElementAt(endpoint->resources, 0);
+
+    // Every part of the device shares one copy of its uuid
+    assert_ptr_equal(resource->deviceUuid, endpoint->deviceUuid);
+    assert_ptr_equal(resource->deviceUuid, endpointResource->deviceUuid);
+    assert_ptr_not_equal(resource->deviceUuid, device->uuid);
+    assert_true(deviceStringInternCount() > pooledBefore);
+
+    // Mock saving the device
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+
+    // Clones handed out by the database share storage with the cached model
+    icDeviceResource *clone = jsonDatabaseGetResourceByUri(endpointResource->uri);
+    assert_non_null(clone);
+    assert_ptr_equal(clone->type, endpointResource->type);
+    assert_ptr_equal(clone->endpointId, endpointResource->endpointId);
+    assert_ptr_equal(clone->deviceUuid, endpointResource->deviceUuid);
+    assert_ptr_not_equal(clone->uri, endpointResource->uri);
+    resourceDestroy(clone);
+
+    // Strings filled in by hand are still freed normally
+    icDeviceResource *handMade = resourceClone(resource);
+    deviceStringInternRelease(handMade->type);
+    handMade->type = strdup(resource->type);
+    resourceDestroy(handMade);
+
+    jsonDatabaseCleanup(false);
+
+    deviceDestroy(device);
+
+    // Nothing refers to the pooled strings any more
+    assert_int_equal(deviceStringInternCount(), pooledBefore);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseSaveResourcesPersistsEachDeviceOnce(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+
+    // Mock saving the device
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+
+    icDeviceResource *deviceResource = linkedListGetElementAt(device->resources, 0);
+    icDeviceEndpoint *endpoint = linkedListGetElementAt(device->endpoints, 0);
+    icDeviceResource *endpointResource = linkedListGetElementAt(endpoint->resources, 0);
+
+    icDeviceResource *first = resourceClone(deviceResource);
+    free(first->value);
+    first->value = strdup("batched1");
+    icDeviceResource *second = resourceClone(endpointResource);
+    free(second->value);
+    second->value = strdup("batched2");
+
+    icLinkedList *changed = linkedListCreate();
+    linkedListAppend(changed, first);
+    linkedListAppend(changed, second);
+
+    // Two resources on one device are a single write
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseSaveResources(changed, NULL));
+
+    icDeviceResource *saved = jsonDatabaseGetResourceByUri(first->uri);
+    assert_string_equal(saved->value, "batched1");
+    resourceDestroy(saved);
+    saved = jsonDatabaseGetResourceByUri(second->uri);
+    assert_string_equal(saved->value, "batched2");
+    resourceDestroy(saved);
+
+    // Resources that are only in sync are not written right away
+    uint64_t lastSync = second->dateOfLastSyncMillis;
+    icLinkedList *synced = linkedListCreate();
+    linkedListAppend(synced, second);
+    assert_true(jsonDatabaseSaveResources(NULL, synced));
+
+    saved = jsonDatabaseGetResourceByUri(second->uri);
+    assert_true(saved->dateOfLastSyncMillis >= lastSync);
+    resourceDestroy(saved);
+
+    // Unknown resources are reported, but don't stop the rest of the batch
+    icDeviceResource *missing = resourceClone(deviceResource);
+    free(missing->uri);
+    missing->uri = strdup("/notADevice/r/notAResource");
+    free(first->value);
+    first->value = strdup("batched3");
+    icLinkedList *withMissing = linkedListCreate();
+    linkedListAppend(withMissing, missing);
+    linkedListAppend(withMissing, first);
+
+    will_return(__wrap_storageSave, true);
+    assert_false(jsonDatabaseSaveResources(withMissing, NULL));
+
+    saved = jsonDatabaseGetResourceByUri(first->uri);
+    assert_string_equal(saved->value, "batched3");
+    resourceDestroy(saved);
+
+    linkedListDestroy(withMissing, standardDoNotFreeFunc);
+    linkedListDestroy(synced, standardDoNotFreeFunc);
+    linkedListDestroy(changed, standardDoNotFreeFunc);
+    resourceDestroy(missing);
+    resourceDestroy(first);
+    resourceDestroy(second);
+
+    jsonDatabaseCleanup(false);
+
+    deviceDestroy(device);
+
+    (void) state;
+}
+
+
+static void test_jsonDatabaseSaveResourcesJournalsEachResource(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+
+    // Mock saving the device
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+
+    char journalDir[] = "/tmp/jsonDatabaseJournalXXXXXX";
+    assert_non_null(mkdtemp(journalDir));
+    scoped_generic char *journalPath = stringBuilder("%s/devicedb.journal", journalDir);
+
+    assert_true(jsonDatabaseSetJournal(journalPath, 0));
+
+    icDeviceEndpoint *endpoint = linkedListGetElementAt(device->endpoints, 0);
+    icDeviceResource *first = resourceClone(linkedListGetElementAt(device->resources, 0));
+    free(first->value);
+    first->value = strdup("journaled1");
+    icDeviceResource *second = resourceClone(linkedListGetElementAt(endpoint->resources, 0));
+    free(second->value);
+    second->value = strdup("journaled2");
+
+    icLinkedList *changed = linkedListCreate();
+    linkedListAppend(changed, first);
+    linkedListAppend(changed, second);
+
+    // No storageSave is mocked, both updates must only go to the journal
+    assert_true(jsonDatabaseSaveResources(changed, NULL));
+
+    scoped_generic char *journalContents = readFileContents(journalPath);
+    assert_non_null(journalContents);
+    assert_non_null(strstr(journalContents, "journaled1"));
+    assert_non_null(strstr(journalContents, "journaled2"));
+
+    // Simulate a crash by dropping everything without persisting
+    jsonDatabaseCleanup(false);
+
+    // Read system properties
+    will_return(__wrap_storageLoad, USE_DUMMY_STORAGE);
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    // Read device
+    will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseInitialize());
+
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseSetJournal(journalPath, 0));
+
+    icDeviceResource *found = jsonDatabaseGetResourceByUri(first->uri);
+    assert_non_null(found);
+    assert_string_equal(found->value, "journaled1");
+    resourceDestroy(found);
+    found = jsonDatabaseGetResourceByUri(second->uri);
+    assert_non_null(found);
+    assert_string_equal(found->value, "journaled2");
+    resourceDestroy(found);
+
+    linkedListDestroy(changed, standardDoNotFreeFunc);
+    resourceDestroy(first);
+    resourceDestroy(second);
+
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+
+    deviceDestroy(device);
+    unlink(journalPath);
+    rmdir(journalDir);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseDeviceRecordChecksums(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    // A new database has no records from before checksums
+    scoped_generic char *recordsSealed = NULL;
+    assert_true(jsonDatabaseGetSystemProperty(JSON_DATABASE_RECORDS_SEALED_KEY, &recordsSealed));
+    assert_string_equal(recordsSealed, "true");
+
+    icDevice *device = createDummyDevice();
+
+    // Mock saving the device
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+
+    jsonDatabaseCleanup(false);
+
+    // Saved devices are sealed, and still plain JSON to anything that doesn't check
+    scoped_generic char *stored = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_non_null(stored);
+    assert_int_equal(jsonDatabaseRecordVerify(stored), JSON_DATABASE_RECORD_VALID);
+    scoped_cJSON *storedJSON = cJSON_Parse(stored);
+    assert_non_null(storedJSON);
+
+    // Sealed records load normally
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
+    will_return(__wrap_storageLoad, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseInitialize());
+
+    scoped_icDevice *loaded = jsonDatabaseGetDeviceById(device->uuid);
+    assert_non_null(loaded);
+    assertDevicesEqual(loaded, device);
+
+    jsonDatabaseCleanup(false);
+
+    // A write cut short loses the checksum trailer along with whatever else didn't make it
+    scoped_generic char *body = strdup(stored);
+    char *trailer = strstr(body, "#crc32:");
+    assert_non_null(trailer);
+    *trailer = '\0';
+    assert_int_equal(jsonDatabaseRecordVerify(body), JSON_DATABASE_RECORD_UNSEALED);
+    scoped_generic char *truncated = strdup(body);
+    truncated[strlen(truncated) / 2] = '\0';
+    assert_int_equal(jsonDatabaseRecordVerify(truncated), JSON_DATABASE_RECORD_UNSEALED);
+
+    // Once the database is sealed that is damage, not an old record
+    dummyStoragePut(STORAGE_NAMESPACE, device->uuid, truncated);
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
+    // Rejected by the strict load, and too short for the permissive one to salvage
+    will_return_count(__wrap_storageLoad, USE_DUMMY_STORAGE, 2);
+    assert_true(jsonDatabaseInitialize());
+
+    scoped_icDevice *cutShort = jsonDatabaseGetDeviceById(device->uuid);
+    assert_null(cutShort);
+
+    jsonDatabaseCleanup(false);
+
+    // A database from before checksums takes records without one, then seals them and itself
+    dummyStoragePut(STORAGE_NAMESPACE, device->uuid, body);
+    scoped_generic char *properties = dummyStorageGet(STORAGE_NAMESPACE, SYSTEM_PROPERTIES_KEY);
+    assert_non_null(properties);
+    scoped_cJSON *propertiesJSON = cJSON_Parse(properties);
+    cJSON_DeleteItemFromObject(propertiesJSON, JSON_DATABASE_RECORDS_SEALED_KEY);
+    scoped_generic char *legacyProperties = cJSON_PrintUnformatted(propertiesJSON);
+    dummyStoragePut(STORAGE_NAMESPACE, SYSTEM_PROPERTIES_KEY, legacyProperties);
+
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
+    will_return(__wrap_storageLoad, USE_DUMMY_STORAGE);
+    // The system properties and device are rewritten, then the database is marked sealed
+    will_return_count(__wrap_storageSave, true, 3);
+    assert_true(jsonDatabaseInitialize());
+
+    scoped_icDevice *resealed = jsonDatabaseGetDeviceById(device->uuid);
+    assert_non_null(resealed);
+    assertDevicesEqual(resealed, device);
+
+    scoped_generic char *rewritten = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_int_equal(jsonDatabaseRecordVerify(rewritten), JSON_DATABASE_RECORD_VALID);
+    scoped_generic char *nowSealed = NULL;
+    assert_true(jsonDatabaseGetSystemProperty(JSON_DATABASE_RECORDS_SEALED_KEY, &nowSealed));
+    assert_string_equal(nowSealed, "true");
+
+    jsonDatabaseCleanup(false);
+
+    // Damage that still parses as JSON is caught by the checksum
+    char *value = strstr(stored, "\"device");
+    assert_non_null(value);
+    value[1] = 'D';
+    assert_int_equal(jsonDatabaseRecordVerify(stored), JSON_DATABASE_RECORD_CORRUPT);
+
+    // Records from before checksums have none
+    scoped_generic char *unsealed = cJSON_PrintUnformatted(storedJSON);
+    assert_int_equal(jsonDatabaseRecordVerify(unsealed), JSON_DATABASE_RECORD_UNSEALED);
+
+    scoped_generic char *sealed = jsonDatabaseRecordSeal(unsealed);
+    assert_int_equal(jsonDatabaseRecordVerify(sealed), JSON_DATABASE_RECORD_VALID);
+
+    deviceDestroy(device);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseArchiveExportAndImport(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+    icDevice *otherDevice = createDummyDevice();
+    icDevice *newDevice = createDummyDevice();
+
+    // Mock saving the devices
+    will_return_count(__wrap_storageSave, true, 2);
+    assert_true(jsonDatabaseAddDevice(device));
+    assert_true(jsonDatabaseAddDevice(otherDevice));
+
+    char archiveDir[] = "/tmp/jsonDatabaseArchiveXXXXXX";
+    assert_non_null(mkdtemp(archiveDir));
+    scoped_generic char *archivePath = stringBuilder("%s/devicedb.archive", archiveDir);
+
+    assert_true(jsonDatabaseExportArchive(archivePath));
+
+    // Diverge from the archive: change one device and add another
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+    icDeviceResource *changed = resourceClone(resource);
+    free(changed->value);
+    changed->value = strdup("notArchived");
+    will_return_count(__wrap_storageSave, true, 2);
+    assert_true(jsonDatabaseSaveResource(changed));
+    assert_true(jsonDatabaseAddDevice(newDevice));
+
+    // Restoring from the archive only rewrites the changed device and removes the new one
+    will_return(__wrap_storageSave, true);
+    will_return(__wrap_storageDelete, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseRestore(archiveDir));
+
+    icDeviceResource *found = jsonDatabaseGetResourceByUri(resource->uri);
+    assert_non_null(found);
+    assert_string_equal(found->value, resource->value);
+    resourceDestroy(found);
+
+    assert_false(jsonDatabaseIsDeviceKnown(newDevice->uuid));
+    scoped_icDevice *restored = jsonDatabaseGetDeviceById(otherDevice->uuid);
+    assert_non_null(restored);
+    assertDevicesEqual(restored, otherDevice);
+
+    // A full import rewrites every device and the system properties
+    will_return_count(__wrap_storageSave, true, 3);
+    assert_true(jsonDatabaseImportArchive(archivePath, false));
+
+    // Nothing differs now
+    assert_true(jsonDatabaseImportArchive(archivePath, true));
+
+    // Not an archive
+    scoped_generic char *badPath = stringBuilder("%s/bad.archive", archiveDir);
+    FILE *bad = fopen(badPath, "w");
+    assert_non_null(bad);
+    fputs("{\"devices\":[]}\n", bad);
+    fclose(bad);
+    assert_false(jsonDatabaseImportArchive(badPath, true));
+    assert_true(jsonDatabaseIsDeviceKnown(device->uuid));
+
+    jsonDatabaseCleanup(false);
+
+    resourceDestroy(changed);
+    deviceDestroy(device);
+    deviceDestroy(otherDevice);
+    deviceDestroy(newDevice);
+    unlink(badPath);
+    unlink(archivePath);
+    rmdir(archiveDir);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseCacheLimitEvictsAndRehydrates(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+    jsonDatabaseSetCacheLimit(2);
+
+    icDevice *devices[3] = {createDummyDevice(), createDummyDevice(), createDummyDevice()};
+
+    // Mock saving the devices
+    will_return_count(__wrap_storageSave, true, 3);
+    for (int i = 0; i < 3; i++)
+    {
+        assert_true(jsonDatabaseAddDevice(devices[i]));
+    }
+
+    JsonDatabaseCacheStats stats;
+    jsonDatabaseGetCacheStats(&stats);
+    assert_int_equal(stats.residentDevices, 2);
+    assert_int_equal(stats.evictedDevices, 1);
+    assert_int_equal(stats.evictions, 1);
+
+    // Queries across devices see the evicted one without rehydrating it
+    icLinkedList *found = jsonDatabaseGetResourcesByUriPattern("*");
+    assert_int_equal(linkedListCount(found), 6);
+    linkedListDestroy(found, (linkedListItemFreeFunc) resourceDestroy);
+
+    found = jsonDatabaseGetResourcesByUriRegex(".*");
+    assert_int_equal(linkedListCount(found), 6);
+    linkedListDestroy(found, (linkedListItemFreeFunc) resourceDestroy);
+
+    found = jsonDatabaseGetDevices();
+    assert_int_equal(linkedListCount(found), 3);
+    linkedListDestroy(found, (linkedListItemFreeFunc) deviceDestroy);
+
+    for (int i = 0; i < 3; i++)
+    {
+        found = jsonDatabaseGetDevicesByDeviceClass(devices[i]->deviceClass);
+        assert_int_equal(linkedListCount(found), 1);
+        linkedListDestroy(found, (linkedListItemFreeFunc) deviceDestroy);
+    }
+
+    jsonDatabaseGetCacheStats(&stats);
+    assert_int_equal(stats.evictedDevices, 1);
+    assert_int_equal(stats.rehydrations, 0);
+
+    // Looking devices up makes them resident, evicting another
+    for (int i = 0; i < 3; i++)
+    {
+        scoped_icDevice *device = jsonDatabaseGetDeviceById(devices[i]->uuid);
+        assert_non_null(device);
+        assertDevicesEqual(device, devices[i]);
+
+        icDeviceEndpoint *endpoint = linkedListGetElementAt(devices[i]->endpoints, 0);
+        icDeviceResource *resource = linkedListGetElementAt(endpoint->resources, 0);
+        icDeviceResource *cached = jsonDatabaseGetResourceByUri(resource->uri);
+        assert_non_null(cached);
+        assert_string_equal(cached->value, resource->value);
+        resourceDestroy(cached);
+    }
+
+    jsonDatabaseGetCacheStats(&stats);
+    assert_int_equal(stats.residentDevices, 2);
+    assert_int_equal(stats.evictedDevices, 1);
+    assert_true(stats.rehydrations > 0);
+    assert_true(stats.hits > 0);
+
+    // Without a limit everything comes back
+    jsonDatabaseSetCacheLimit(0);
+    jsonDatabaseGetCacheStats(&stats);
+    assert_int_equal(stats.residentDevices, 3);
+    assert_int_equal(stats.evictedDevices, 0);
+
+    jsonDatabaseCleanup(false);
+
+    for (int i = 0; i < 3; i++)
+    {
+        deviceDestroy(devices[i]);
+    }
+
+    (void) state;
+}
+
+static void test_jsonDatabaseResourcePersistencePolicies(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+    icDeviceResource *onShutdown = linkedListGetElementAt(device->resources, 0);
+    resourceSetPersistencePolicy(onShutdown, PERSISTENCE_POLICY_ON_SHUTDOWN, 0);
+    icDeviceEndpoint *endpoint = linkedListGetElementAt(device->endpoints, 0);
+    icDeviceResource *memoryOnly = linkedListGetElementAt(endpoint->resources, 0);
+    resourceSetPersistencePolicy(memoryOnly, PERSISTENCE_POLICY_MEMORY_ONLY, 0);
+    icDeviceResource *coalesced = createDeviceResource(
+        device, "coalesced", "0", RESOURCE_TYPE_STRING, RESOURCE_MODE_READABLE, CACHING_POLICY_ALWAYS);
+    coalesced->uri = createDeviceResourceUri(device->uuid, coalesced->id);
+    // Long enough that the deadline never passes during this test
+    resourceSetPersistencePolicy(coalesced, PERSISTENCE_POLICY_COALESCE, 3600);
+
+    // Mock saving the device, adds are always written through
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+
+    // The policies are part of the stored device
+    scoped_generic char *stored = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_non_null(strstr(stored, "persistencePolicy"));
+
+    // No storageSave is mocked, so any write here would fail the test
+    free(onShutdown->value);
+    onShutdown->value = strdup("shutdownValue");
+    assert_true(jsonDatabaseSaveResource(onShutdown));
+    free(memoryOnly->value);
+    memoryOnly->value = strdup("memoryValue");
+    assert_true(jsonDatabaseSaveResource(memoryOnly));
+    free(coalesced->value);
+    coalesced->value = strdup("coalescedValue");
+    assert_true(jsonDatabaseSaveResource(coalesced));
+    assert_true(jsonDatabaseUpdateDateOfLastSyncMillis(coalesced));
+
+    icDeviceResource *found = jsonDatabaseGetResourceByUri(coalesced->uri);
+    assert_non_null(found);
+    assert_string_equal(found->value, "coalescedValue");
+    assert_int_equal(found->persistencePolicy, PERSISTENCE_POLICY_COALESCE);
+    assert_int_equal(found->persistIntervalSecs, 3600);
+    resourceDestroy(found);
+
+    // The barrier writes the deferred changes, in one device write
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseFlush());
+
+    free(stored);
+    stored = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_non_null(strstr(stored, "shutdownValue"));
+    assert_non_null(strstr(stored, "coalescedValue"));
+
+    // Memory only changes are never written on their own
+    free(memoryOnly->value);
+    memoryOnly->value = strdup("memoryValue2");
+    assert_true(jsonDatabaseSaveResource(memoryOnly));
+    assert_true(jsonDatabaseFlush());
+
+    // A held back change is written on shutdown
+    free(onShutdown->value);
+    onShutdown->value = strdup("shutdownValue2");
+    assert_true(jsonDatabaseSaveResource(onShutdown));
+
+    // Mock writing system properties and the device
+    will_return(__wrap_storageSave, true);
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+
+    free(stored);
+    stored = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_non_null(strstr(stored, "shutdownValue2"));
+
+    deviceDestroy(device);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseTelemetryDefaultPersistencePolicies(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+    icDeviceResource *rssi = createDeviceResource(
+        device, "rssi", "-50", RESOURCE_TYPE_RSSI, RESOURCE_MODE_READABLE, CACHING_POLICY_ALWAYS);
+    rssi->uri = createDeviceResourceUri(device->uuid, rssi->id);
+    icDeviceResource *power = createDeviceResource(
+        device, "power", "10", RESOURCE_TYPE_WATTS, RESOURCE_MODE_READABLE, CACHING_POLICY_ALWAYS);
+    power->uri = createDeviceResourceUri(device->uuid, power->id);
+
+    // Telemetry gets its default when created
+    assert_int_equal(rssi->persistencePolicy, PERSISTENCE_POLICY_ON_SHUTDOWN);
+    assert_int_equal(power->persistencePolicy, PERSISTENCE_POLICY_COALESCE);
+    assert_true(power->persistIntervalSecs > 0);
+
+    // Mock saving the device, adds are always written through
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+
+    // Defaults are not stored, so the record looks like one written before they existed
+    scoped_generic char *stored = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_null(strstr(stored, "persistencePolicy"));
+
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+
+    storageLoadFromDummyStorage = true;
+    // Read system properties
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    // Read devices
+    will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseInitialize());
+    storageLoadFromDummyStorage = false;
+
+    // Loading applies the defaults
+    scoped_icDeviceResource *loadedRssi = jsonDatabaseGetResourceByUri(rssi->uri);
+    assert_non_null(loadedRssi);
+    assert_int_equal(loadedRssi->persistencePolicy, PERSISTENCE_POLICY_ON_SHUTDOWN);
+    scoped_icDeviceResource *loadedPower = jsonDatabaseGetResourceByUri(power->uri);
+    assert_non_null(loadedPower);
+    assert_int_equal(loadedPower->persistencePolicy, PERSISTENCE_POLICY_COALESCE);
+    assert_int_equal(loadedPower->persistIntervalSecs, power->persistIntervalSecs);
+
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+
+    deviceDestroy(device);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseSyncTableKeepsLastSyncTimes(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *device = createDummyDevice();
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+    resource->dateOfLastSyncMillis = 0;
+
+    // Mock saving the device
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(device));
+    scoped_generic char *storedBefore = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_non_null(storedBefore);
+
+    char syncTableDir[] = "/tmp/jsonDatabaseSyncTableXXXXXX";
+    assert_non_null(mkdtemp(syncTableDir));
+    scoped_generic char *syncTablePath = stringBuilder("%s/devicedb.synctimes", syncTableDir);
+
+    assert_true(jsonDatabaseSetSyncTable(syncTablePath, 0));
+
+    // No storageSave is mocked, the sync time must only go to the sync table
+    assert_true(jsonDatabaseUpdateDateOfLastSyncMillis(resource));
+
+    icDeviceResource *found = jsonDatabaseGetResourceByUri(resource->uri);
+    assert_non_null(found);
+    uint64_t syncedMillis = found->dateOfLastSyncMillis;
+    assert_true(syncedMillis > 0);
+    resourceDestroy(found);
+
+    // Flushing checkpoints the table without rewriting the device
+    assert_true(jsonDatabaseFlush());
+    assert_true(doesFileExist(syncTablePath));
+
+    scoped_generic char *storedAfter = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_string_equal(storedBefore, storedAfter);
+
+    // Drop everything without persisting, the checkpoint has the sync time
+    jsonDatabaseCleanup(false);
+
+    // Read system properties
+    will_return(__wrap_storageLoad, USE_DUMMY_STORAGE);
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    // Read device
+    will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseInitialize());
+
+    // The snapshot alone doesn't have the sync time
+    found = jsonDatabaseGetResourceByUri(resource->uri);
+    assert_non_null(found);
+    assert_int_equal(found->dateOfLastSyncMillis, 0);
+    resourceDestroy(found);
+
+    // Enabling the table applies it over the snapshot
+    assert_true(jsonDatabaseSetSyncTable(syncTablePath, 0));
+
+    found = jsonDatabaseGetResourceByUri(resource->uri);
+    assert_non_null(found);
+    assert_int_equal(found->dateOfLastSyncMillis, syncedMillis);
+    resourceDestroy(found);
+
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+
+    deviceDestroy(device);
+    unlink(syncTablePath);
+    rmdir(syncTableDir);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseSnapshotColdStart(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+
+    icDevice *keptDevice = createDummyDevice();
+    icDevice *removedDevice = createDummyDevice();
+
+    // Mock saving the devices
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(keptDevice));
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseAddDevice(removedDevice));
+
+    char snapshotDir[] = "/tmp/jsonDatabaseSnapshotXXXXXX";
+    assert_non_null(mkdtemp(snapshotDir));
+    scoped_generic char *snapshotPath = stringBuilder("%s/devicedb.snapshot", snapshotDir);
+
+    // A persisting cleanup writes the snapshot
+    jsonDatabaseSetSnapshot(snapshotPath, 0);
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+    assert_true(doesFileExist(snapshotPath));
+
+    // Change storage without the snapshot knowing about it
+    jsonDatabaseSetSnapshot(NULL, 0);
+    storageLoadFromDummyStorage = true;
+    // Read system properties
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    // Read devices
+    will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseInitialize());
+
+    icDeviceResource *resource = linkedListGetElementAt(keptDevice->resources, 0);
+    free(resource->value);
+    resource->value = strdup("stored");
+    // Mock saving the resource
+    will_return(__wrap_storageSave, true);
+    assert_true(jsonDatabaseSaveResource(resource));
+    will_return(__wrap_storageDelete, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseRemoveDeviceById(removedDevice->uuid));
+
+    jsonDatabaseCleanup(false);
+
+    // Keep the reconciler away from storage until the snapshot has been checked
+    pthread_mutex_lock(&storageGateMtx);
+    storageGateClosed = true;
+    storageGateEntered = false;
+    pthread_mutex_unlock(&storageGateMtx);
+
+    jsonDatabaseSetSnapshot(snapshotPath, 0);
+    // Read system properties
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseInitialize());
+
+    // Both devices come from the snapshot, nothing has been read from storage yet
+    JsonDatabaseCacheStats stats;
+    jsonDatabaseGetCacheStats(&stats);
+    assert_int_equal(stats.unverifiedDevices, 2);
+
+    icLinkedList *devices = jsonDatabaseGetDevices();
+    assert_int_equal(linkedListCount(devices), 2);
+    linkedListDestroy(devices, (linkedListItemFreeFunc) deviceDestroy);
+
+    // Looking up a device loads it from storage right away
+    icDeviceResource *found = jsonDatabaseGetResourceByUri(resource->uri);
+    assert_non_null(found);
+    assert_string_equal(found->value, "stored");
+    resourceDestroy(found);
+
+    jsonDatabaseGetCacheStats(&stats);
+    assert_int_equal(stats.unverifiedDevices, 1);
+
+    // Let the reconciler catch up with storage
+    pthread_mutex_lock(&storageGateMtx);
+    storageGateClosed = false;
+    pthread_cond_broadcast(&storageGateCond);
+    pthread_mutex_unlock(&storageGateMtx);
+
+    uint64_t deadline = getMonotonicMillis() + 5000;
+    do
+    {
+        jsonDatabaseGetCacheStats(&stats);
+        if (stats.unverifiedDevices == 0)
+        {
+            break;
+        }
+        usleep(1000);
+    } while (getMonotonicMillis() < deadline);
+    assert_int_equal(stats.unverifiedDevices, 0);
+
+    devices = jsonDatabaseGetDevices();
+    assert_int_equal(linkedListCount(devices), 1);
+    linkedListDestroy(devices, (linkedListItemFreeFunc) deviceDestroy);
+    assert_false(jsonDatabaseIsDeviceKnown(removedDevice->uuid));
+
+    storageLoadFromDummyStorage = false;
+
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+    jsonDatabaseSetSnapshot(NULL, 0);
+
+    deviceDestroy(keptDevice);
+    deviceDestroy(removedDevice);
+    unlink(snapshotPath);
+    rmdir(snapshotDir);
+
+    (void) state;
+}
+
+static void test_jsonDatabaseMetadataRecordsAreSeparate(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+    jsonDatabaseSetCacheLimit(1);
+
+    icDevice *device = createDummyDevice();
+    icDevice *residentDevice = createDummyDevice();
+
+    // Mock saving the devices, the first one is evicted when the second is added
+    will_return_count(__wrap_storageSave, true, 2);
+    assert_true(jsonDatabaseAddDevice(device));
+    assert_true(jsonDatabaseAddDevice(residentDevice));
+
+    JsonDatabaseCacheStats stats;
+    jsonDatabaseGetCacheStats(&stats);
+    assert_int_equal(stats.evictedDevices, 1);
+
+    scoped_generic char *deviceRecord = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    scoped_generic char *metadataKey = stringBuilder("%s.metadata", device->uuid);
+
+    icDeviceEndpoint *endpoint = linkedListGetElementAt(device->endpoints, 0);
+    icDeviceMetadata *metadata = linkedListGetElementAt(endpoint->metadata, 0);
+    free(metadata->value);
+    metadata->value = strdup("abc123");
+    icDeviceMetadata *newMetadata = createDeviceMetadata(device, "newMetadata", "newMetadataValue");
+
+    // Mock writing the metadata record, once per save
+    will_return_count(__wrap_storageSave, true, 2);
+    assert_true(jsonDatabaseSaveMetadata(metadata));
+    assert_true(jsonDatabaseSaveMetadata(newMetadata));
+
+    // Only the metadata record was written, and the device stayed evicted
+    scoped_generic char *storedDevice = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_string_equal(storedDevice, deviceRecord);
+    scoped_generic char *storedMetadata = dummyStorageGet(STORAGE_NAMESPACE, metadataKey);
+    assert_non_null(storedMetadata);
+    assert_non_null(strstr(storedMetadata, "abc123"));
+
+    scoped_icDeviceMetadata *found = jsonDatabaseGetMetadataByUri(metadata->uri);
+    assert_non_null(found);
+    assert_string_equal(found->value, "abc123");
+
+    icLinkedList *byMetadata = jsonDatabaseGetDevicesByMetadata("newMetadata", "newMetadataValue");
+    assert_int_equal(linkedListCount(byMetadata), 1);
+    linkedListDestroy(byMetadata, (linkedListItemFreeFunc) deviceDestroy);
+
+    // Exports carry the metadata saved since the device was evicted
+    scoped_generic char *exported = jsonDatabaseExportDeviceJSON(device->uuid);
+    assert_non_null(exported);
+    assert_non_null(strstr(exported, "abc123"));
+    assert_non_null(strstr(exported, "newMetadataValue"));
+
+    char archiveDir[] = "/tmp/jsonDatabaseArchiveXXXXXX";
+    assert_non_null(mkdtemp(archiveDir));
+    scoped_generic char *archivePath = stringBuilder("%s/devicedb.archive", archiveDir);
+    assert_true(jsonDatabaseExportArchive(archivePath));
+    scoped_generic char *archive = readFileContents(archivePath);
+    assert_non_null(archive);
+    assert_non_null(strstr(archive, "abc123"));
+    assert_non_null(strstr(archive, "newMetadataValue"));
+    unlink(archivePath);
+    rmdir(archiveDir);
+
+    jsonDatabaseGetCacheStats(&stats);
+    assert_int_equal(stats.evictedDevices, 1);
+    assert_int_equal(stats.rehydrations, 0);
+
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    // Nothing is dirty, so no device gets written
+    jsonDatabaseCleanup(true);
+
+    // The metadata record is applied to the device as it is loaded
+    storageLoadFromDummyStorage = true;
+    // Read system properties
+    will_return(__wrap_storageLoadJSON, USE_DUMMY_STORAGE);
+    // Read devices
+    will_return(__wrap_storageGetKeys, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseInitialize());
+    storageLoadFromDummyStorage = false;
+
+    scoped_icDevice *loaded = jsonDatabaseGetDeviceById(device->uuid);
+    assert_non_null(loaded);
+    assertDevicesEqual(loaded, device);
+
+    // Writing the device in full takes its metadata along, so the metadata record goes
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+    free(resource->value);
+    resource->value = strdup("changed");
+    will_return(__wrap_storageSave, true);
+    will_return(__wrap_storageDelete, USE_DUMMY_STORAGE);
+    assert_true(jsonDatabaseSaveResource(resource));
+
+    scoped_generic char *droppedMetadata = dummyStorageGet(STORAGE_NAMESPACE, metadataKey);
+    assert_null(droppedMetadata);
+    scoped_generic char *rewrittenDevice = dummyStorageGet(STORAGE_NAMESPACE, device->uuid);
+    assert_non_null(strstr(rewrittenDevice, "abc123"));
+
+    jsonDatabaseSetCacheLimit(0);
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+
+    deviceDestroy(device);
+    deviceDestroy(residentDevice);
+
+    (void) state;
+}
+
+static void countVisit(const icDeviceResource *resource, void *ctx)
+{
+    (void) resource;
+    (*(int *) ctx)++;
+}
+
+static void countDeviceVisit(const icDevice *device, void *ctx)
+{
+    (void) device;
+    (*(int *) ctx)++;
+}
+
+static void *lookupByUriThreadProc(void *arg)
+{
+    icDevice *device = arg;
+    icDeviceEndpoint *endpoint = linkedListGetElementAt(device->endpoints, 0);
+    icDeviceResource *resource = linkedListGetElementAt(device->resources, 0);
+    icDeviceMetadata *metadata = linkedListGetElementAt(endpoint->metadata, 0);
+
+    intptr_t misses = 0;
+    for (int i = 0; i < 2000; i++)
+    {
+        // Each lookup makes this device resident, which evicts the other thread's device
+        scoped_icDevice *foundDevice = jsonDatabaseGetDeviceByUri(endpoint->uri);
+        scoped_icDeviceResource *foundResource = jsonDatabaseGetResourceByUri(resource->uri);
+        scoped_icDeviceMetadata *foundMetadata = jsonDatabaseGetMetadataByUri(metadata->uri);
+        scoped_icDeviceEndpoint *foundEndpoint = jsonDatabaseGetEndpointByUri(metadata->uri);
+        bool accessible = jsonDatabaseIsUriAccessible(metadata->uri);
+        int visits = 0;
+        jsonDatabaseVisitResourceByUri(resource->uri, countVisit, &visits);
+        jsonDatabaseVisitDeviceByUri(endpoint->uri, countDeviceVisit, &visits);
+
+        if (foundDevice == NULL || foundResource == NULL || foundMetadata == NULL || foundEndpoint == NULL ||
+            !accessible || visits != 2)
+        {
+            misses++;
+        }
+    }
+
+    return (void *) misses;
+}
+
+static void test_jsonDatabaseUriLookupsSurviveEviction(void **state)
+{
+    // mock so no systemProperties database which equals no database
+    will_return(__wrap_storageLoadJSON, NULL);
+    /// mock initialization of systemProperties database
+    will_return(__wrap_storageSave, true);
+
+    assert_true(jsonDatabaseInitialize());
+    jsonDatabaseSetCacheLimit(1);
+
+    icDevice *first = createDummyDevice();
+    icDevice *second = createDummyDevice();
+
+    // Mock saving the devices
+    will_return_count(__wrap_storageSave, true, 2);
+    assert_true(jsonDatabaseAddDevice(first));
+    assert_true(jsonDatabaseAddDevice(second));
+
+    // Each thread keeps evicting the other's device, often between its residency check and its lookup
+    pthread_t firstThread;
+    pthread_t secondThread;
+    assert_int_equal(pthread_create(&firstThread, NULL, lookupByUriThreadProc, first), 0);
+    assert_int_equal(pthread_create(&secondThread, NULL, lookupByUriThreadProc, second), 0);
+
+    void *firstMisses;
+    void *secondMisses;
+    pthread_join(firstThread, &firstMisses);
+    pthread_join(secondThread, &secondMisses);
+    assert_int_equal((intptr_t) firstMisses, 0);
+    assert_int_equal((intptr_t) secondMisses, 0);
+
+    jsonDatabaseSetCacheLimit(0);
+    // Mock writing system properties
+    will_return(__wrap_storageSave, true);
+    jsonDatabaseCleanup(true);
+
+    deviceDestroy(first);
+    deviceDestroy(second);
+
+    (void) state;
+}
+
+// ******************************
+// Setup/Teardown
+// ******************************
+
+static int dummyStorageSetup(void **state)
+{
+    dummyMemoryStorage = cJSON_CreateObject();
+
+    (void) state;
+
+    return 0;
+}
+
+static int dummyStorageTeardown(void **state)
+{
+    if (dummyMemoryStorage != NULL)
+    {
+        cJSON_Delete(dummyMemoryStorage);
+        dummyMemoryStorage = NULL;
+    }
+
+    (void) state;
+
+    return 0;
+}
+
+// ******************************
+// Helpers
+// ******************************
+
+static bool compareMetadata(void *searchVal, void *item)
+{
+    icDeviceMetadata *metadata1 = (icDeviceMetadata *) searchVal;
+    icDeviceMetadata *metadata2 = (icDeviceMetadata *) item;
+
+    if (metadata1 == NULL || metadata2 == NULL)
+    {
+        return false;
+    }
+
+    if (strcmp(metadata1->id, metadata2->id) != 0)
+    {
+        return false;
+    }
+
+    if (strcmp(metadata1->deviceUuid, metadata2->deviceUuid) != 0)
+    {
+        return false;
+    }
+
+    if (strcmp(metadata1->uri, metadata2->uri) != 0)
+    {
+        return false;
+    }
+
+    if (strcmp(metadata1->endpointId, metadata2->endpointId) != 0)
+    {
+        return false;
+    }
+
+    if (strcmp(metadata1->value, metadata2->value) != 0)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+static char *dummyStorageGet(const char *namespace, const char *key)
+{
+    char *retval = NULL;
+    cJSON *namespaceJson = cJSON_GetObjectItem(dummyMemoryStorage, namespace);
+    if (namespaceJson != NULL)
+    {
+        cJSON *keyJson = cJSON_GetObjectItem(namespaceJson, key);
+        if (keyJson != NULL)
+        {
+            retval = strdup(keyJson->valuestring);
+
+            icLogDebug(LOG_TAG, "Read from dummy storage namespace=%s, key=%s, value=%s", namespace, key, retval);
+        }
+        else
+        {
+            icLogDebug(LOG_TAG, "Failed to ready from dummy storage namespace=%s, key=%s", namespace, key);
+        }
+    }
+    else
+    {
+        icLogDebug(LOG_TAG, "Did not find namespace %s in dummy storage", namespace);
+    }
+
+    return retval;
+}
+
+static void dummyStoragePut(const char *namespace, const char *key, const char *value)
+{
+    cJSON *namespaceJson = cJSON_GetObjectItem(dummyMemoryStorage, namespace);
+    if (namespaceJson == NULL)
+    {
+        icLogDebug(LOG_TAG, "Creating dummy storage namespace %s", namespace);
+        namespaceJson = cJSON_CreateObject();
+        cJSON_AddItemToObject(dummyMemoryStorage, namespace, namespaceJson);
+    }
+
+    if (cJSON_HasObjectItem(namespaceJson, key))
+    {
+        cJSON_DeleteItemFromObject(namespaceJson, key);
+    }
+    cJSON_AddStringToObject(namespaceJson, key, value);
+
+    icLogDebug(LOG_TAG, "Saving to dummy storage namespace=%s, key=%s, value=%s", namespace, key, value);
+}
+
+static icLinkedList *dummyStorageGetKeys(const char *namespace)
+{
+    icLinkedList *keys = linkedListCreate();
+
+    cJSON *keysJson = cJSON_GetObjectItem(dummyMemoryStorage, namespace);
+    if (keysJson != NULL)
+    {
+        int count = cJSON_GetArraySize(keysJson);
+        for (int i = 0; i < count; ++i)
+        {
+            cJSON *item = cJSON_GetArrayItem(keysJson, i);
+            icLogDebug(LOG_TAG, "Found key %s for namespace %s", item->string, namespace);
+            linkedListAppend(keys, strdup(item->string));
+        }
+    }
+
+
+    return keys;
+}
+
+static bool dummyStorageDelete(const char *namespace, const char *key)
+{
+    bool retval = false;
+    cJSON *keysJson = cJSON_GetObjectItem(dummyMemoryStorage, namespace);
+    if (keysJson != NULL)
+    {
+        if (cJSON_HasObjectItem(keysJson, key))
+        {
+            icLogDebug(LOG_TAG, "Deleting key %s for namespace %s", key, namespace);
+            cJSON_DeleteItemFromObject(keysJson, key);
+            retval = true;
+        }
+    }
+
+    return retval;
+}
+
+static icDevice *createDummyDevice()
+{
+    ++counter;
+    char uuid[64];
+    sprintf(uuid, "device%d", counter++);
+    char class[64];
     sprintf(class, "dummyClass%d", counter++);
     char driver[64];
     sprintf(driver, "dummyDriver%d", counter++);
@@ -2265,6 +4318,12 @@ bool __wrap_storageLoad(const char *namespace, const char *key, char **value)
 {
     icLogDebug(LOG_TAG, "%s: namespace=%s, key=%s", __FUNCTION__, namespace, key);
 
+    if (storageLoadFromDummyStorage)
+    {
+        *value = dummyStorageGet(namespace, key);
+        return *value != NULL;
+    }
+
     *value = mock_type(char *);
     if (*value == NULL)
     {
@@ -2366,6 +4425,24 @@ bool __wrap_storageSave(const char *namespace, const char *key, const char *valu
 {
     icLogDebug(LOG_TAG, "%s: namespace=%s, key=%s, value=%s", __FUNCTION__, namespace, key, value);
 
+    pthread_mutex_lock(&storageGateMtx);
+    if (storageGateClosed)
+    {
+        // Don't touch the mock queue here, we are likely not on the test thread
+        storageGateEntered = true;
+        pthread_cond_broadcast(&storageGateCond);
+        while (storageGateClosed)
+        {
+            pthread_cond_wait(&storageGateCond, &storageGateMtx);
+        }
+        pthread_mutex_unlock(&storageGateMtx);
+
+        dummyStoragePut(namespace, key, value);
+
+        return true;
+    }
+    pthread_mutex_unlock(&storageGateMtx);
+
     bool retval = mock_type(bool);
 
     if (retval)
@@ -2380,6 +4457,22 @@ icLinkedList *__wrap_storageGetKeys(const char *namespace)
 {
     icLogDebug(LOG_TAG, "%s: namespace=%s", __FUNCTION__, namespace);
 
+    pthread_mutex_lock(&storageGateMtx);
+    if (storageGateClosed)
+    {
+        // Don't touch the mock queue here, we are likely not on the test thread
+        storageGateEntered = true;
+        pthread_cond_broadcast(&storageGateCond);
+        while (storageGateClosed)
+        {
+            pthread_cond_wait(&storageGateCond, &storageGateMtx);
+        }
+        pthread_mutex_unlock(&storageGateMtx);
+
+        return dummyStorageGetKeys(namespace);
+    }
+    pthread_mutex_unlock(&storageGateMtx);
+
     void *mockReturn = mock_type(void *);
     if (mockReturn != NULL && strcmp(mockReturn, USE_DUMMY_STORAGE) == 0)
     {
@@ -2447,6 +4540,8 @@ int main(int argc, const char **argv)
             test_jsonDatabaseGetDevicesByDeviceDriver, dummyStorageSetup, dummyStorageTeardown),
         cmocka_unit_test_setup_teardown(test_jsonDatabaseGetDeviceById, dummyStorageSetup, dummyStorageTeardown),
         cmocka_unit_test_setup_teardown(test_jsonDatabaseGetDeviceByUri, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseVisitorsAndFieldAccessors, dummyStorageSetup, dummyStorageTeardown),
         cmocka_unit_test_setup_teardown(test_jsonDatabaseRemoveDeviceById, dummyStorageSetup, dummyStorageTeardown),
         cmocka_unit_test_setup_teardown(
             test_jsonDatabaseGetEndpointsByEndpointProfile, dummyStorageSetup, dummyStorageTeardown),
@@ -2477,7 +4572,56 @@ int main(int argc, const char **argv)
             test_jsonDatabaseLoadDeviceWithBadEndpoint, dummyStorageSetup, dummyStorageTeardown),
         cmocka_unit_test_setup_teardown(test_jsonDatabaseAddDuplicateEndpoint, dummyStorageSetup, dummyStorageTeardown),
         cmocka_unit_test(test_deviceModelLoadPermissive),
-        cmocka_unit_test_setup_teardown(test_restore, dummyStorageSetup, dummyStorageTeardown)};
+        cmocka_unit_test_setup_teardown(test_restore, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseReadsDoNotWaitOnStorage, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseWriteBehindDefersUntilFlush, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseFlushDeviceWritesOnlyThatDevice, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseWriteBehindFlushesAtThreshold, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseJournalReplaysResourceUpdates, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseJournalCompactsAtMaxRecords, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseJournalDropsTornRecord, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseCompactFormatMigratesAndExports, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test(test_jsonDatabaseCompactRecordRejectsDamage),
+        cmocka_unit_test_setup_teardown(test_jsonDatabaseParallelDeviceLoad, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseGetItemsByUriPattern, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseUriPatternAndRegexAgree, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseUriPatternVersusRegexBenchmark, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(test_jsonDatabaseSecondaryIndexes, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseInternsDeviceModelStrings, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseSaveResourcesPersistsEachDeviceOnce, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseSaveResourcesJournalsEachResource, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseDeviceRecordChecksums, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseArchiveExportAndImport, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseCacheLimitEvictsAndRehydrates, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseResourcePersistencePolicies, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseTelemetryDefaultPersistencePolicies, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseSyncTableKeepsLastSyncTimes, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseSnapshotColdStart, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseMetadataRecordsAreSeparate, dummyStorageSetup, dummyStorageTeardown),
+        cmocka_unit_test_setup_teardown(
+            test_jsonDatabaseUriLookupsSurviveEviction, dummyStorageSetup, dummyStorageTeardown)};
 
     int retval = cmocka_run_group_tests(tests, NULL, NULL);
 
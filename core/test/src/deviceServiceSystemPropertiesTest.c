@@ -0,0 +1,247 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include "database/jsonDatabase.h"
+#include "deviceService.h"
+#include "deviceServiceSystemProperties.h"
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#define MAX_FAKE_PROPERTIES 4
+
+/* Fake database */
+
+static char *names[MAX_FAKE_PROPERTIES];
+static char *values[MAX_FAKE_PROPERTIES];
+static int databaseReads;
+static jsonDatabaseSystemPropertyListener listener;
+static void *listenerCtx;
+
+bool jsonDatabaseGetSystemProperty(const char *key, char **value)
+{
+    databaseReads++;
+    for (int i = 0; i < MAX_FAKE_PROPERTIES; i++)
+    {
+        if (names[i] != NULL && strcmp(names[i], key) == 0)
+        {
+            *value = values[i] != NULL ? strdup(values[i]) : NULL;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void jsonDatabaseSetSystemPropertyListener(jsonDatabaseSystemPropertyListener newListener, void *ctx)
+{
+    listener = newListener;
+    listenerCtx = ctx;
+}
+
+static void setFakeProperty(const char *name, const char *value)
+{
+    int freeSlot = -1;
+    for (int i = 0; i < MAX_FAKE_PROPERTIES; i++)
+    {
+        if (names[i] != NULL && strcmp(names[i], name) == 0)
+        {
+            free(values[i]);
+            values[i] = value != NULL ? strdup(value) : NULL;
+            return;
+        }
+
+        if (names[i] == NULL && freeSlot < 0)
+        {
+            freeSlot = i;
+        }
+    }
+
+    assert_true(freeSlot >= 0);
+    names[freeSlot] = strdup(name);
+    values[freeSlot] = value != NULL ? strdup(value) : NULL;
+}
+
+/* Fixture */
+
+static int setup(void **state)
+{
+    (void) state;
+
+    deviceServiceSystemPropertiesInit();
+    databaseReads = 0;
+
+    return 0;
+}
+
+static int teardown(void **state)
+{
+    (void) state;
+
+    deviceServiceSystemPropertiesShutdown();
+    for (int i = 0; i < MAX_FAKE_PROPERTIES; i++)
+    {
+        free(names[i]);
+        free(values[i]);
+        names[i] = NULL;
+        values[i] = NULL;
+    }
+
+    return 0;
+}
+
+/* Subscriber */
+
+static int changeCount;
+static char *lastChangedValue;
+
+static void propertyChanged(const char *name, const char *value, void *ctx)
+{
+    (void) name;
+
+    assert_ptr_equal(ctx, &changeCount);
+    changeCount++;
+    free(lastChangedValue);
+    lastChangedValue = value != NULL ? strdup(value) : NULL;
+}
+
+/* Tests */
+
+static void test_typed_values_are_parsed(void **state)
+{
+    (void) state;
+
+    setFakeProperty("flag", "true");
+    setFakeProperty("number", "-42");
+    setFakeProperty("word", "hello");
+
+    assert_true(deviceServiceGetSystemPropertyBool("flag", false));
+    assert_int_equal(deviceServiceGetSystemPropertyInt("number", 7), -42);
+    assert_int_equal(deviceServiceGetSystemPropertyInt("word", 7), 7);
+    assert_false(deviceServiceGetSystemPropertyBool("word", true));
+
+    char *word = deviceServiceGetSystemPropertyString("word", NULL);
+    assert_string_equal(word, "hello");
+    free(word);
+}
+
+static void test_missing_values_use_defaults(void **state)
+{
+    (void) state;
+
+    assert_true(deviceServiceGetSystemPropertyBool("missingFlag", true));
+    assert_false(deviceServiceGetSystemPropertyBool("missingFlag", false));
+    assert_int_equal(deviceServiceGetSystemPropertyInt("missingNumber", 12), 12);
+
+    char *missing = deviceServiceGetSystemPropertyString("missingWord", "fallback");
+    assert_string_equal(missing, "fallback");
+    free(missing);
+    assert_null(deviceServiceGetSystemPropertyString("missingWord", NULL));
+}
+
+static void test_reads_are_cached(void **state)
+{
+    (void) state;
+
+    setFakeProperty("cached", "true");
+
+    for (int i = 0; i < 10; i++)
+    {
+        assert_true(deviceServiceGetSystemPropertyBool("cached", false));
+    }
+
+    assert_int_equal(databaseReads, 1);
+
+    // A change behind the cache's back is not seen until the database says so
+    setFakeProperty("cached", "false");
+    assert_true(deviceServiceGetSystemPropertyBool("cached", false));
+
+    assert_non_null(listener);
+    listener("cached", listenerCtx);
+    assert_false(deviceServiceGetSystemPropertyBool("cached", true));
+}
+
+static void test_subscribers_are_notified_of_changes(void **state)
+{
+    (void) state;
+
+    changeCount = 0;
+    setFakeProperty("watched", "1");
+    assert_true(deviceServiceSubscribeSystemProperty("watched", propertyChanged, &changeCount));
+
+    setFakeProperty("watched", "2");
+    listener("watched", listenerCtx);
+    assert_int_equal(changeCount, 1);
+    assert_string_equal(lastChangedValue, "2");
+    assert_int_equal(deviceServiceGetSystemPropertyInt("watched", 0), 2);
+
+    // Writing the same value again is not a change
+    listener("watched", listenerCtx);
+    assert_int_equal(changeCount, 1);
+
+    // A reload refreshes everything
+    setFakeProperty("watched", "3");
+    listener(NULL, listenerCtx);
+    assert_int_equal(changeCount, 2);
+    assert_string_equal(lastChangedValue, "3");
+
+    deviceServiceUnsubscribeSystemProperty("watched", propertyChanged, &changeCount);
+    setFakeProperty("watched", "4");
+    listener("watched", listenerCtx);
+    assert_int_equal(changeCount, 2);
+    assert_int_equal(deviceServiceGetSystemPropertyInt("watched", 0), 4);
+
+    free(lastChangedValue);
+    lastChangedValue = NULL;
+}
+
+static void test_reads_go_to_database_when_stopped(void **state)
+{
+    (void) state;
+
+    setFakeProperty("uncached", "true");
+    deviceServiceSystemPropertiesShutdown();
+    databaseReads = 0;
+
+    assert_true(deviceServiceGetSystemPropertyBool("uncached", false));
+    assert_true(deviceServiceGetSystemPropertyBool("uncached", false));
+    assert_int_equal(databaseReads, 2);
+    assert_null(listener);
+    assert_false(deviceServiceSubscribeSystemProperty("uncached", propertyChanged, &changeCount));
+}
+
+int main(int argc, const char **argv)
+{
+    const struct CMUnitTest test[] = {
+        cmocka_unit_test_setup_teardown(test_typed_values_are_parsed, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_missing_values_use_defaults, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_reads_are_cached, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_subscribers_are_notified_of_changes, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_reads_go_to_database_when_stopped, setup, teardown)};
+
+    return cmocka_run_group_tests(test, NULL, NULL);
+}
@@ -0,0 +1,283 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "deviceStorageCommit.h"
+#include <icConcurrent/delayedTask.h>
+#include <icTypes/icLinkedList.h>
+#include <icUtil/stringUtils.h>
+
+#define TEST_NAMESPACE "storageCommitTest"
+
+// "<key>=<value>" for each storage write, "<key>" for each delete
+static icLinkedList *storageOperations = NULL;
+
+// Delayed task calls made through the wrappers below, which pass them on
+static uint32_t scheduledTasks = 0;
+static uint32_t rescheduledTasks = 0;
+
+bool __wrap_storageSave(const char *namespace, const char *key, const char *value);
+bool __wrap_storageDelete(const char *namespace, const char *key);
+uint32_t __real_scheduleDelayTask(uint64_t delayAmount, delayUnits units, taskCallbackFunc func, void *arg);
+uint32_t __wrap_scheduleDelayTask(uint64_t delayAmount, delayUnits units, taskCallbackFunc func, void *arg);
+void __real_rescheduleDelayTask(uint32_t delayedTaskHandle, uint64_t delayAmount, delayUnits units);
+void __wrap_rescheduleDelayTask(uint32_t delayedTaskHandle, uint64_t delayAmount, delayUnits units);
+
+bool __wrap_storageSave(const char *namespace, const char *key, const char *value)
+{
+    assert_string_equal(namespace, TEST_NAMESPACE);
+    linkedListAppend(storageOperations, stringBuilder("%s=%s", key, value));
+
+    return mock_type(bool);
+}
+
+bool __wrap_storageDelete(const char *namespace, const char *key)
+{
+    assert_string_equal(namespace, TEST_NAMESPACE);
+    linkedListAppend(storageOperations, strdup(key));
+
+    return mock_type(bool);
+}
+
+uint32_t __wrap_scheduleDelayTask(uint64_t delayAmount, delayUnits units, taskCallbackFunc func, void *arg)
+{
+    scheduledTasks++;
+
+    return __real_scheduleDelayTask(delayAmount, units, func, arg);
+}
+
+void __wrap_rescheduleDelayTask(uint32_t delayedTaskHandle, uint64_t delayAmount, delayUnits units)
+{
+    rescheduledTasks++;
+    __real_rescheduleDelayTask(delayedTaskHandle, delayAmount, units);
+}
+
+static bool stringEquals(void *searchVal, void *item)
+{
+    return strcmp(searchVal, item) == 0;
+}
+
+static bool storageOperationPerformed(const char *operation)
+{
+    return linkedListFind(storageOperations, (void *) operation, stringEquals) != NULL;
+}
+
+static int setup(void **state)
+{
+    (void) state;
+
+    storageOperations = linkedListCreate();
+    scheduledTasks = 0;
+    rescheduledTasks = 0;
+    // Long enough that the commit task never gets to run during a test
+    deviceStorageCommitSetWindows(60000, 120000);
+
+    return 0;
+}
+
+static int teardown(void **state)
+{
+    (void) state;
+
+    deviceStorageCommitSetDurability(TEST_NAMESPACE, STORAGE_DURABILITY_IMMEDIATE);
+    deviceStorageCommitShutdown();
+    linkedListDestroy(storageOperations, NULL);
+    storageOperations = NULL;
+
+    return 0;
+}
+
+static void test_immediateWritesGoStraightToStorage(void **state)
+{
+    (void) state;
+
+    DeviceStorageCommitStats before;
+    DeviceStorageCommitStats after;
+    deviceStorageCommitGetStats(&before);
+
+    will_return(__wrap_storageSave, true);
+    assert_true(deviceStorageCommitSave(TEST_NAMESPACE, "key", "value"));
+    assert_int_equal(linkedListCount(storageOperations), 1);
+    assert_true(storageOperationPerformed("key=value"));
+
+    deviceStorageCommitGetStats(&after);
+    assert_int_equal(after.writes - before.writes, 1);
+    assert_int_equal(after.bytesWritten - before.bytesWritten, strlen("value"));
+    assert_int_equal(after.syncs - before.syncs, 1);
+    assert_true(after.syncsLastMinute >= 1);
+    assert_int_equal(after.pendingWrites, 0);
+}
+
+static void test_groupedWritesAreCoalesced(void **state)
+{
+    (void) state;
+
+    DeviceStorageCommitStats before;
+    DeviceStorageCommitStats after;
+    deviceStorageCommitGetStats(&before);
+
+    deviceStorageCommitSetDurability(TEST_NAMESPACE, STORAGE_DURABILITY_GROUPED);
+
+    // Nothing is mocked, storage must not be touched yet
+    assert_true(deviceStorageCommitSave(TEST_NAMESPACE, "first", "a"));
+    assert_true(deviceStorageCommitSave(TEST_NAMESPACE, "first", "b"));
+    assert_true(deviceStorageCommitSave(TEST_NAMESPACE, "second", "c"));
+    assert_int_equal(linkedListCount(storageOperations), 0);
+
+    deviceStorageCommitGetStats(&after);
+    assert_int_equal(after.pendingWrites, 2);
+    assert_int_equal(after.coalescedWrites - before.coalescedWrites, 1);
+
+    will_return_count(__wrap_storageSave, true, 2);
+    assert_true(deviceStorageCommitFlush(TEST_NAMESPACE));
+    assert_int_equal(linkedListCount(storageOperations), 2);
+    assert_true(storageOperationPerformed("first=b"));
+    assert_true(storageOperationPerformed("second=c"));
+
+    deviceStorageCommitGetStats(&after);
+    assert_int_equal(after.pendingWrites, 0);
+    assert_int_equal(after.writes - before.writes, 2);
+    assert_int_equal(after.groupCommits - before.groupCommits, 1);
+}
+
+static void test_settleWritesOnlyItsKey(void **state)
+{
+    (void) state;
+
+    deviceStorageCommitSetDurability(TEST_NAMESPACE, STORAGE_DURABILITY_RELAXED);
+
+    assert_true(deviceStorageCommitSave(TEST_NAMESPACE, "settled", "a"));
+    assert_true(deviceStorageCommitSave(TEST_NAMESPACE, "waiting", "b"));
+
+    will_return(__wrap_storageSave, true);
+    assert_true(deviceStorageCommitSettle(TEST_NAMESPACE, "settled"));
+    assert_int_equal(linkedListCount(storageOperations), 1);
+    assert_true(storageOperationPerformed("settled=a"));
+
+    DeviceStorageCommitStats stats;
+    deviceStorageCommitGetStats(&stats);
+    assert_int_equal(stats.pendingWrites, 1);
+
+    // Going back to immediate commits what is pending
+    will_return(__wrap_storageSave, true);
+    deviceStorageCommitSetDurability(TEST_NAMESPACE, STORAGE_DURABILITY_IMMEDIATE);
+    assert_true(storageOperationPerformed("waiting=b"));
+}
+
+static void test_deleteReplacesPendingWrite(void **state)
+{
+    (void) state;
+
+    deviceStorageCommitSetDurability(TEST_NAMESPACE, STORAGE_DURABILITY_GROUPED);
+
+    assert_true(deviceStorageCommitSave(TEST_NAMESPACE, "key", "value"));
+    assert_true(deviceStorageCommitDelete(TEST_NAMESPACE, "key"));
+
+    will_return(__wrap_storageDelete, true);
+    assert_true(deviceStorageCommitFlush(NULL));
+    assert_int_equal(linkedListCount(storageOperations), 1);
+    assert_true(storageOperationPerformed("key"));
+}
+
+static void test_failedWriteStaysPending(void **state)
+{
+    (void) state;
+
+    deviceStorageCommitSetDurability(TEST_NAMESPACE, STORAGE_DURABILITY_GROUPED);
+
+    assert_true(deviceStorageCommitSave(TEST_NAMESPACE, "key", "value"));
+
+    will_return(__wrap_storageSave, false);
+    assert_false(deviceStorageCommitFlush(TEST_NAMESPACE));
+
+    DeviceStorageCommitStats stats;
+    deviceStorageCommitGetStats(&stats);
+    assert_int_equal(stats.pendingWrites, 1);
+
+    will_return(__wrap_storageSave, true);
+    assert_true(deviceStorageCommitFlush(TEST_NAMESPACE));
+
+    deviceStorageCommitGetStats(&stats);
+    assert_int_equal(stats.pendingWrites, 0);
+    assert_int_equal(linkedListCount(storageOperations), 2);
+}
+
+static void test_discardDropsPendingWrites(void **state)
+{
+    (void) state;
+
+    deviceStorageCommitSetDurability(TEST_NAMESPACE, STORAGE_DURABILITY_GROUPED);
+
+    assert_true(deviceStorageCommitSave(TEST_NAMESPACE, "key", "value"));
+    deviceStorageCommitDiscard(TEST_NAMESPACE);
+
+    // Nothing is mocked, storage must not be touched
+    assert_true(deviceStorageCommitFlush(TEST_NAMESPACE));
+    assert_int_equal(linkedListCount(storageOperations), 0);
+}
+
+static void test_soonerDeadlineMovesCommitTaskUp(void **state)
+{
+    (void) state;
+
+    deviceStorageCommitSetDurability(TEST_NAMESPACE, STORAGE_DURABILITY_RELAXED);
+    assert_true(deviceStorageCommitSave(TEST_NAMESPACE, "relaxed", "a"));
+    assert_int_equal(scheduledTasks, 1);
+
+    // Due sooner, the pending task must be moved up rather than joined by a second one
+    deviceStorageCommitSetDurability(TEST_NAMESPACE, STORAGE_DURABILITY_GROUPED);
+    assert_true(deviceStorageCommitSave(TEST_NAMESPACE, "grouped", "b"));
+    assert_int_equal(scheduledTasks, 1);
+    assert_int_equal(rescheduledTasks, 1);
+
+    // Due later, the pending task already covers it
+    deviceStorageCommitSetDurability(TEST_NAMESPACE, STORAGE_DURABILITY_RELAXED);
+    assert_true(deviceStorageCommitSave(TEST_NAMESPACE, "relaxed2", "c"));
+    assert_int_equal(scheduledTasks, 1);
+    assert_int_equal(rescheduledTasks, 1);
+
+    deviceStorageCommitDiscard(TEST_NAMESPACE);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_immediateWritesGoStraightToStorage, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_groupedWritesAreCoalesced, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_settleWritesOnlyItsKey, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_deleteReplacesPendingWrite, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_failedWriteStaysPending, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_discardDropsPendingWrites, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_soonerDeadlineMovesCommitTaskUp, setup, teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
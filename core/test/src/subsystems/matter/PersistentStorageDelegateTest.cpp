@@ -0,0 +1,196 @@
+//------------------------------ tabstop = 4 ----------------------------------
+//
+// If not stated otherwise in this file or this component's LICENSE file the
+// following copyright and licenses apply:
+//
+// Copyright 2024 Comcast Cable Communications Management, LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+//------------------------------ tabstop = 4 ----------------------------------
+
+#include "subsystems/matter/PersistentStorageDelegate.h"
+#include <cstring>
+#include <gtest/gtest.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace barton;
+
+namespace
+{
+    // Long enough that the flush task never runs during a test
+    constexpr uint32_t kFlushIntervalMillis = 60000;
+
+    /**
+     * Keeps the backing store in memory and records the order keys reach it in
+     */
+    class RecordingStorageDelegate : public PersistentStorageDelegate
+    {
+    public:
+        using PersistentStorageDelegate::IsDeferrableKey;
+
+        std::map<std::string, std::vector<uint8_t>> stored;
+        std::vector<std::string> writes;
+        std::set<std::string> failingKeys;
+
+    protected:
+        CHIP_ERROR LoadKeyValue(const char *key, void *buffer, uint16_t &size) override
+        {
+            auto it = stored.find(key);
+            if (it == stored.end())
+            {
+                return CHIP_ERROR_PERSISTED_STORAGE_VALUE_NOT_FOUND;
+            }
+
+            uint16_t valueSize = static_cast<uint16_t>(it->second.size());
+            if (valueSize > size)
+            {
+                return CHIP_ERROR_BUFFER_TOO_SMALL;
+            }
+            memcpy(buffer, it->second.data(), valueSize);
+            size = valueSize;
+
+            return CHIP_NO_ERROR;
+        }
+
+        CHIP_ERROR StoreKeyValue(const char *key, const void *value, uint16_t size) override
+        {
+            if (failingKeys.count(key) > 0)
+            {
+                return CHIP_ERROR_PERSISTED_STORAGE_FAILED;
+            }
+
+            const uint8_t *bytes = static_cast<const uint8_t *>(value);
+            stored[key] = std::vector<uint8_t>(bytes, bytes + size);
+            writes.emplace_back(key);
+
+            return CHIP_NO_ERROR;
+        }
+
+        CHIP_ERROR RemoveKeyValue(const char *key) override
+        {
+            if (failingKeys.count(key) > 0)
+            {
+                return CHIP_ERROR_PERSISTED_STORAGE_FAILED;
+            }
+
+            if (stored.erase(key) == 0)
+            {
+                return CHIP_ERROR_PERSISTED_STORAGE_VALUE_NOT_FOUND;
+            }
+            writes.emplace_back(std::string("-") + key);
+
+            return CHIP_NO_ERROR;
+        }
+    };
+
+    class PersistentStorageDelegateTest : public ::testing::Test
+    {
+    protected:
+        void SetUp() override { storage.SetFlushInterval(kFlushIntervalMillis); }
+
+        void TearDown() override
+        {
+            // Nothing may be left for the flush task once the delegate is gone
+            storage.failingKeys.clear();
+            storage.SetFlushInterval(0);
+        }
+
+        CHIP_ERROR Set(const char *key, uint8_t value) { return storage.SyncSetKeyValue(key, &value, sizeof(value)); }
+
+        RecordingStorageDelegate storage;
+    };
+
+    TEST(PersistentStorageDelegateKeys, SessionAndSubscriptionResumptionKeysAreDeferrable)
+    {
+        EXPECT_TRUE(RecordingStorageDelegate::IsDeferrableKey("g/s/AbCd=="));
+        EXPECT_TRUE(RecordingStorageDelegate::IsDeferrableKey("g/sri"));
+        EXPECT_TRUE(RecordingStorageDelegate::IsDeferrableKey("g/su/3"));
+        EXPECT_TRUE(RecordingStorageDelegate::IsDeferrableKey("g/sum"));
+        EXPECT_TRUE(RecordingStorageDelegate::IsDeferrableKey("f/1/s/0000000000000002"));
+        EXPECT_TRUE(RecordingStorageDelegate::IsDeferrableKey("f/a0/s/0000000000000002"));
+    }
+
+    TEST(PersistentStorageDelegateKeys, OtherKeysAreNotDeferrable)
+    {
+        // Fabric tables, fail-safe markers and counters
+        EXPECT_FALSE(RecordingStorageDelegate::IsDeferrableKey("g/fidx"));
+        EXPECT_FALSE(RecordingStorageDelegate::IsDeferrableKey("g/fs/c"));
+        EXPECT_FALSE(RecordingStorageDelegate::IsDeferrableKey("g/gcc"));
+        EXPECT_FALSE(RecordingStorageDelegate::IsDeferrableKey("f/1/n"));
+        EXPECT_FALSE(RecordingStorageDelegate::IsDeferrableKey("f/1/o"));
+
+        // Near misses of the deferrable prefixes
+        EXPECT_FALSE(RecordingStorageDelegate::IsDeferrableKey("g/s"));
+        EXPECT_FALSE(RecordingStorageDelegate::IsDeferrableKey("g/su"));
+        EXPECT_FALSE(RecordingStorageDelegate::IsDeferrableKey("f//s/1"));
+        EXPECT_FALSE(RecordingStorageDelegate::IsDeferrableKey("f/xyz/s/1"));
+        EXPECT_FALSE(RecordingStorageDelegate::IsDeferrableKey("f/1/s"));
+        EXPECT_FALSE(RecordingStorageDelegate::IsDeferrableKey("s/1"));
+    }
+
+    TEST_F(PersistentStorageDelegateTest, DeferrableKeysAreHeldBack)
+    {
+        ASSERT_EQ(Set("g/s/1", 7), CHIP_NO_ERROR);
+        EXPECT_TRUE(storage.writes.empty());
+
+        // The held back value is what the stack reads
+        uint8_t value = 0;
+        uint16_t size = sizeof(value);
+        ASSERT_EQ(storage.SyncGetKeyValue("g/s/1", &value, size), CHIP_NO_ERROR);
+        EXPECT_EQ(value, 7);
+
+        ASSERT_EQ(storage.Flush(), CHIP_NO_ERROR);
+        EXPECT_EQ(storage.writes, std::vector<std::string>({"g/s/1"}));
+    }
+
+    TEST_F(PersistentStorageDelegateTest, HeldBackChangesAreFlushedBeforeCriticalWrites)
+    {
+        ASSERT_EQ(Set("g/s/1", 1), CHIP_NO_ERROR);
+        ASSERT_EQ(Set("g/sri", 2), CHIP_NO_ERROR);
+        ASSERT_EQ(Set("f/1/n", 3), CHIP_NO_ERROR);
+
+        ASSERT_EQ(storage.writes.size(), 3u);
+        EXPECT_EQ(storage.writes.back(), "f/1/n");
+    }
+
+    TEST_F(PersistentStorageDelegateTest, HeldBackChangesAreFlushedBeforeCriticalDeletes)
+    {
+        ASSERT_EQ(Set("f/1/n", 1), CHIP_NO_ERROR);
+        ASSERT_EQ(Set("g/s/1", 2), CHIP_NO_ERROR);
+        ASSERT_EQ(storage.SyncDeleteKeyValue("f/1/n"), CHIP_NO_ERROR);
+
+        EXPECT_EQ(storage.writes, std::vector<std::string>({"f/1/n", "g/s/1", "-f/1/n"}));
+    }
+
+    TEST_F(PersistentStorageDelegateTest, CriticalWriteFailsWhenFlushFails)
+    {
+        ASSERT_EQ(Set("g/s/1", 1), CHIP_NO_ERROR);
+        storage.failingKeys.insert("g/s/1");
+
+        // The critical key must not reach storage without the change before it
+        EXPECT_NE(Set("g/fidx", 2), CHIP_NO_ERROR);
+        EXPECT_EQ(storage.stored.count("g/fidx"), 0u);
+        EXPECT_NE(storage.SyncDeleteKeyValue("g/fidx"), CHIP_NO_ERROR);
+
+        // The failed change is kept and goes out once storage works again
+        storage.failingKeys.clear();
+        ASSERT_EQ(Set("g/fidx", 2), CHIP_NO_ERROR);
+        EXPECT_EQ(storage.writes, std::vector<std::string>({"g/s/1", "g/fidx"}));
+    }
+} // namespace
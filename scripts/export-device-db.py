@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+
+# ------------------------------ tabstop = 4 ----------------------------------
+#
+# If not stated otherwise in this file or this component's LICENSE file the
+# following copyright and licenses apply:
+#
+# Copyright 2026 Comcast Cable Communications Management, LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# ------------------------------ tabstop = 4 ----------------------------------
+
+"""
+Export device database records as JSON.
+
+Reads device records copied out of the device database storage, in either
+encoding (JSON or compact records, see core/src/database/jsonDatabaseCompactRecord.h),
+checks their checksums and prints each device as the JSON document it would be
+stored as with compact records disabled. Sensitive resource values stay protected,
+so no keys are needed.
+
+Usage:
+    python3 export-device-db.py <record file>...
+"""
+
+import argparse
+import base64
+import json
+import sys
+import zlib
+
+CHECKSUM_MARKER = "#crc32:"
+CHECKSUM_DIGITS = 8
+COMPACT_RECORD_MARKER = "bdbdev:"
+COMPACT_RECORD_VERSION = 1
+
+RESOURCE_PROTECTED_VALUE = 0x1
+RESOURCE_OWN_POLICY = 0x2
+
+
+class MalformedRecord(Exception):
+    pass
+
+
+class Cursor:
+    """A read position in a binary compact record."""
+
+    def __init__(self, data: bytes):
+        self.data = data
+        self.pos = 0
+
+    def at_end(self) -> bool:
+        return self.pos == len(self.data)
+
+    def take_varint(self) -> int:
+        value = 0
+        shift = 0
+        while True:
+            if self.pos == len(self.data) or shift > 63:
+                raise MalformedRecord("truncated or oversized integer")
+            byte = self.data[self.pos]
+            self.pos += 1
+            value |= (byte & 0x7F) << shift
+            if byte & 0x80 == 0:
+                return value
+            shift += 7
+
+    def take_string(self):
+        length_plus_one = self.take_varint()
+        if length_plus_one == 0:
+            return None
+        end = self.pos + length_plus_one - 1
+        if end > len(self.data):
+            raise MalformedRecord("truncated string")
+        value = self.data[self.pos:end].decode("utf-8")
+        self.pos = end
+        return value
+
+
+def endpoint_uri(device_uuid: str, endpoint_id: str) -> str:
+    return f"/{device_uuid}/ep/{endpoint_id}"
+
+
+def resource_uri(device_uuid: str, endpoint_id, resource_id: str) -> str:
+    if not endpoint_id:
+        return f"/{device_uuid}/r/{resource_id}"
+    return f"{endpoint_uri(device_uuid, endpoint_id)}/r/{resource_id}"
+
+
+def metadata_uri(device_uuid: str, endpoint_id, name: str) -> str:
+    if endpoint_id is None:
+        return f"/{device_uuid}/m/{name}"
+    return f"{endpoint_uri(device_uuid, endpoint_id)}/m/{name}"
+
+
+def take_resources(cursor: Cursor, device_uuid: str, endpoint_id) -> dict:
+    resources = {}
+    for _ in range(cursor.take_varint()):
+        resource_id = cursor.take_string()
+        uri = cursor.take_string() or resource_uri(device_uuid, endpoint_id, resource_id)
+        resource = {
+            "id": resource_id,
+            "uri": uri,
+            "type": cursor.take_string(),
+            "mode": cursor.take_varint(),
+            "cachingPolicy": cursor.take_varint(),
+            "dateOfLastSyncMillis": cursor.take_varint(),
+        }
+        flags = cursor.take_varint()
+        if flags & RESOURCE_OWN_POLICY:
+            resource["persistencePolicy"] = cursor.take_varint()
+            resource["persistIntervalSecs"] = cursor.take_varint()
+        value = cursor.take_string()
+        resource["value_enc" if flags & RESOURCE_PROTECTED_VALUE else "value"] = value
+        resources[resource_id] = resource
+    return resources
+
+
+def take_metadatas(cursor: Cursor, device_uuid: str, endpoint_id) -> dict:
+    metadatas = {}
+    for _ in range(cursor.take_varint()):
+        name = cursor.take_string()
+        uri = cursor.take_string() or metadata_uri(device_uuid, endpoint_id, name)
+        value = cursor.take_string()
+        # JSON records keep object values as objects
+        try:
+            parsed = json.loads(value)
+            if isinstance(parsed, dict):
+                value = parsed
+        except (TypeError, ValueError):
+            pass
+        metadatas[name] = {"id": name, "uri": uri, "value": value}
+    return metadatas
+
+
+def decode_compact_record(text: str) -> dict:
+    data = base64.b64decode(text[len(COMPACT_RECORD_MARKER):], validate=True)
+    if len(data) == 0:
+        raise MalformedRecord("empty record")
+    if data[0] != COMPACT_RECORD_VERSION:
+        raise MalformedRecord(f"unsupported record version {data[0]}")
+
+    cursor = Cursor(data[1:])
+    uuid = cursor.take_string()
+    device = {"uuid": uuid, "uri": cursor.take_string() or f"/{uuid}"}
+    device["deviceDriver"] = cursor.take_string()
+    device["deviceClass"] = cursor.take_string()
+    device["deviceClassVersion"] = cursor.take_varint()
+
+    endpoints = {}
+    for _ in range(cursor.take_varint()):
+        endpoint_id = cursor.take_string()
+        endpoint = {
+            "id": endpoint_id,
+            "uri": cursor.take_string() or endpoint_uri(uuid, endpoint_id),
+            "profile": cursor.take_string(),
+            "profileVersion": cursor.take_varint(),
+            "enabled": cursor.take_varint() != 0,
+        }
+        endpoint["resources"] = take_resources(cursor, uuid, endpoint_id)
+        endpoint["metadatas"] = take_metadatas(cursor, uuid, endpoint_id)
+        endpoints[endpoint_id] = endpoint
+
+    device["deviceEndpoints"] = endpoints
+    device["deviceResources"] = take_resources(cursor, uuid, None)
+    device["metadatas"] = take_metadatas(cursor, uuid, None)
+
+    if not cursor.at_end():
+        raise MalformedRecord("trailing data")
+
+    return device
+
+
+def export_record(record: str) -> dict:
+    """
+    Decode a stored record, verifying its checksum if it is sealed.
+    """
+    trailer_len = len(CHECKSUM_MARKER) + CHECKSUM_DIGITS
+    if len(record) >= trailer_len and record[-trailer_len:].startswith(CHECKSUM_MARKER):
+        body = record[:-trailer_len]
+        stored = int(record[-CHECKSUM_DIGITS:], 16)
+        if zlib.crc32(body.encode("utf-8")) != stored:
+            raise MalformedRecord("checksum mismatch")
+        record = body
+
+    if record.startswith(COMPACT_RECORD_MARKER):
+        return decode_compact_record(record)
+
+    return json.loads(record)
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description="Export device database records as JSON")
+    parser.add_argument("records", nargs="+", help="device record files read from storage")
+    args = parser.parse_args()
+
+    failed = False
+    for path in args.records:
+        try:
+            with open(path, "r", encoding="utf-8") as f:
+                device = export_record(f.read())
+        except (OSError, ValueError, MalformedRecord) as e:
+            print(f"{path}: {e}", file=sys.stderr)
+            failed = True
+            continue
+
+        print(json.dumps(device, indent=4))
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())